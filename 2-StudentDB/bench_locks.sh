@@ -0,0 +1,53 @@
+#! /bin/bash
+#multi-process contention benchmark for the record locks, see sdb_lock.c.
+#Every writer process adds and then deletes its own ids, one sdbsc run per
+#operation.  The ids of the writers interleave (writer w of W uses w+1,
+#w+1+W, ...) so they keep sharing filesystem blocks and pages.  After each
+#round the db has to be empty again and agree with a full rescan.
+#
+#usage:  [SDB_OPTS=global options] ./bench_locks.sh [ops per writer] [writer counts...]
+#example:  SDB_OPTS=--durability=sync ./bench_locks.sh 200 1 2 4 8
+OPS=${1:-200}
+shift
+COUNTS=${@:-1 2 4 8}
+
+now_ns() {
+    date +%s%N
+}
+
+writer() {
+    local w=$1 n=$2 i id
+    for ((i = 0; i < OPS; i++)); do
+        id=$((w + 1 + i * n))
+        ./sdbsc $SDB_OPTS -a $id bench writer$w 300 >/dev/null || echo "add $id failed"
+    done
+    for ((i = 0; i < OPS; i++)); do
+        id=$((w + 1 + i * n))
+        ./sdbsc $SDB_OPTS -d $id >/dev/null || echo "delete $id failed"
+    done
+}
+
+rm -f student.db student.db.*
+./sdbsc -a 1 seed seed 100 >/dev/null
+./sdbsc -d 1 >/dev/null
+
+printf "%8s %10s %12s %12s\n" writers ops seconds ops/sec
+for n in $COUNTS; do
+    start=$(now_ns)
+    for ((w = 0; w < n; w++)); do
+        writer $w $n &
+    done
+    wait
+    end=$(now_ns)
+
+    ops=$((2 * OPS * n))
+    awk -v n=$n -v ops=$ops -v ns=$((end - start)) \
+        'BEGIN { printf "%8d %10d %12.3f %12.0f\n", n, ops, ns / 1e9, ops / (ns / 1e9) }'
+
+    count=$(./sdbsc -c | tr -cd '0-9')
+    rebuilt=$(./sdbsc --rebuild-stats | tr -cd '0-9')
+    if [ -n "$count" ] || [ "$rebuilt" != "0" ]; then
+        echo "db not consistent after $n writers: count '$count', rescan '$rebuilt'"
+        exit 1
+    fi
+done
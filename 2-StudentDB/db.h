@@ -1,6 +1,8 @@
 #ifndef __DB_H__
 #define __DB_H__
 
+#include <stdint.h>
+
 // Basic student database record.  Note:
 //  1. id must be > 0.  A student id==0 means the record has been deleted
 //  2. gpa is an int, should be between 0<=gpa<=500, real gpa is gpa/100.0 this
@@ -31,5 +33,253 @@ static const int DELETED_STUDENT_ID = 0;
 
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
+#define SNAP_DB_PREFIX ".snap_"             //snapshot copies, followed by the
+                                            //pid and the name of the db file
+#define DB_INDEX_EXT ".idx"                 //id->slot index of a compacted db,
+                                            //named after the db file
+#define DB_NAME_EXT  ".lname"               //last name index, named after the
+                                            //db file
+#define DB_GPA_EXT   ".gpa"                 //gpa index, named after the db file
+#define DB_WAL_EXT   ".wal"                 //write-ahead log, named after the
+                                            //db file
+#define DB_SOCK_EXT  ".sock"                //socket of sdbsc --serve, named
+                                            //after the db file
+#define DB_HOT_EXT   ".hot"                 //id and gpa column of a db with
+                                            //the split layout
+#define DB_DIR_EXT   ".dir"                 //bucket directory of a db with
+                                            //the hash layout
+#define DB_PACK_EXT  ".off"                 //id->offset directory of a db
+                                            //with the packed layout
+#define DB_CRC_EXT   ".crc"                 //record checksums, named after
+                                            //the db file
+
+//Database header.  Slot 0 of the file can never hold a student because ids
+//start at MIN_STD_ID, so it is used for a header the same size as a
+//student record.  A file whose slot 0 is all zeros has no header and uses
+//the original direct addressed layout.
+//
+//Layouts:
+//  DB_LAYOUT_DIRECT   student id lives in slot id (the original format)
+//  DB_LAYOUT_COMPACT  live records are packed into slots 1..n, a sidecar
+//                     index file maps id -> slot.  Written by compress_db()
+//  DB_LAYOUT_PAGED    4 KiB pages with a live record bitmap each, see below.
+//                     Written by --migrate
+//  DB_LAYOUT_SPLIT    ids and gpas in a column file of their own, the names
+//                     in the db file, see below.  Written by --migrate=split
+//  DB_LAYOUT_HASH     records in hash buckets found through a directory
+//                     file, for ids above MAX_STD_ID, see below.  Written
+//                     by --migrate=hash
+//  DB_LAYOUT_PACKED   variable length records without the padding of the
+//                     names, found through an id -> offset directory, see
+//                     below.  Written by --migrate=packed
+//
+//Since version 2 the header is also a superblock:  it carries running
+//statistics that every add and delete keeps up to date, so counting the
+//records does not need a scan.  Version 1 headers, and files without a
+//header, have no statistics until --rebuild-stats is run on them.
+//Version 3 added the paged layout, version 4 the split layout, version 5
+//the hash layout, version 6 the packed layout.
+#define DB_MAGIC            0x48424453      //"SDBH" in little endian
+#define DB_VERSION          6
+#define DB_STATS_VERSION    2               //first version with statistics
+#define DB_LAYOUT_DIRECT    0
+#define DB_LAYOUT_COMPACT   1
+#define DB_LAYOUT_PAGED     2
+#define DB_LAYOUT_SPLIT     3
+#define DB_LAYOUT_HASH      4
+#define DB_LAYOUT_PACKED    5
+
+//the gpa histogram has buckets 0.50 wide, a 5.00 gpa goes in the last one
+#define DB_GPA_BUCKETS      10
+#define DB_GPA_BUCKET_WIDTH 50
+
+typedef struct db_header{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t layout;
+	uint32_t count;                         //live records
+	uint32_t min_id;                        //lowest live id, 0 if empty
+	uint32_t max_id;                        //highest live id, 0 if empty
+	uint32_t gpa_sum;                       //sum of the integer gpas
+	uint32_t gpa_hist[DB_GPA_BUCKETS];      //records per gpa bucket
+} db_header_t;
+
+//Paged layout.  The file is an array of DB_PAGE_SIZE pages.  Page 0 only
+//holds the header (in its first 64 bytes), page p >= 1 holds the ids
+//(p-1)*63+1 .. p*63:  a db_page_hdr_t in its first 64 bytes and the
+//record of the i-th of those ids in the 64 bytes after that, i from 0.
+//A record is live only while its bit is set in the page header, which
+//makes scans and compaction walk the bitmaps instead of testing every
+//slot, and lets a page whose count drops to 0 be punched out of the
+//file.  A page that is a hole reads as an empty page header.
+#define DB_PAGE_SIZE        4096
+#define DB_PAGE_SLOTS       (DB_PAGE_SIZE / 64)         //64 byte slots
+#define DB_PAGE_RECORDS     (DB_PAGE_SLOTS - 1)         //63, after the header
+#define DB_PAGE_OF(id)      (1 + ((id) - 1) / DB_PAGE_RECORDS)
+#define DB_PAGE_INDEX(id)   (((id) - 1) % DB_PAGE_RECORDS)
+#define DB_PAGE_FIRST_ID(p) (((p) - 1) * DB_PAGE_RECORDS + 1)
+
+typedef struct db_page_hdr{
+	uint32_t count;                         //live records on the page
+	uint32_t reserved;
+	uint64_t live;                          //bit i set:  record i is live
+	uint8_t  unused[48];                    //pads the header to 64 bytes
+} db_page_hdr_t;
+
+//Split layout.  The columns that counts, gpa queries and statistics read
+//are kept apart from the names.  The hot file (DB_HOT_EXT) is an array of
+//db_hot_t indexed by id, an entry with id 0 means the student is not in
+//the db.  The db file holds the header in its first 64 bytes and after
+//that the names of id at DB_COLD_OFF(id).  A full db has an 800 KB hot
+//column against 6.4 MB of records, so a scan that needs no names reads
+//an eighth of the data.
+typedef struct db_hot{
+	int32_t id;
+	int32_t gpa;
+} db_hot_t;
+
+#define DB_COLD_SIZE        56              //fname and lname, as in student_t
+#define DB_COLD_OFF(id)     (64 + ((int64_t)(id) - 1) * DB_COLD_SIZE)
+
+//Hash layout.  The other layouts find a record from its id alone, which
+//limits ids to MAX_STD_ID.  This one takes any id from MIN_STD_ID up to
+//DB_HASH_MAX_ID with extendible hashing.  The db file is an array of
+//DB_PAGE_SIZE pages, page 0 holds the header and every other page is a
+//bucket:  a db_bucket_hdr_t in its first 64 bytes and 63 record slots
+//after it, a slot is live while its bit is set, as in the paged layout.
+//The directory file (DB_DIR_EXT) is a db_dir_hdr_t and 2^depth bucket
+//page numbers.  The bucket of an id is entry db_hash_id(id) & (2^depth-1),
+//a lookup reads that entry and one page.  The ids of a bucket share the
+//low bucket depth bits of their hash (its prefix).  A full bucket is split
+//on the next bit when a record is added, the directory is doubled first
+//when the bucket already uses all of its bits.  Buckets are not merged
+//again, compress_db() rebuilds the file.
+#define DB_HASH_MAX_ID      0x7fffffff      //largest int
+#define DB_HASH_MAX_DEPTH   24              //at most 16M directory entries
+#define DB_DIR_MAGIC        0x52494453      //"SDIR" in little endian
+
+//murmur3 finalizer, a bijection so that distinct ids never collide
+static inline uint32_t db_hash_id(uint32_t h){
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+typedef struct db_bucket_hdr{
+	uint32_t count;                         //live records in the bucket
+	uint32_t depth;                         //hash bits the ids share
+	uint64_t live;                          //bit i set:  record i is live
+	uint32_t prefix;                        //those bits
+	uint8_t  unused[44];                    //pads the header to 64 bytes
+} db_bucket_hdr_t;
+
+typedef struct db_dir_hdr{
+	uint32_t magic;
+	uint32_t depth;                         //the directory has 2^depth entries
+	uint32_t nbuckets;                      //bucket pages 1..nbuckets
+	uint8_t  unused[52];                    //pads the header to 64 bytes
+} db_dir_hdr_t;
+
+//Packed layout.  Most of a student_t is the zero padding of its names.
+//Here a record is a db_packed_t followed by the bytes of the two names
+//and padded to DB_PACK_ALIGN, for typical names under half of 64 bytes.
+//The db file holds the header in its first 64 bytes and after that the
+//records, appended at the end of the file as they are added, so a
+//record never moves until compress_db() rewrites the file in id order.
+//The directory file (DB_PACK_EXT) is an array of uint32_t by id like the
+//index of a compacted db, holding the offset of the record of the id in
+//DB_PACK_ALIGN units, 0 if the student is not in the db.  A delete zeroes
+//the record and its directory entry, the space is reclaimed by -x.
+#define DB_PACK_ALIGN       4
+#define DB_PACK_MAX         64              //largest record, names full
+#define DB_PACK_LEN(f, l)   ((sizeof(db_packed_t) + (f) + (l) + DB_PACK_ALIGN - 1) \
+                             & ~(size_t)(DB_PACK_ALIGN - 1))
+
+typedef struct db_packed{
+	int32_t  id;
+	int16_t  gpa;                           //MAX_STD_GPA fits in 16 bits
+	uint8_t  flen;                          //bytes of fname, at most 24
+	uint8_t  llen;                          //bytes of lname, at most 32
+} db_packed_t;
+
+//Last name index.  Students with the same last name are kept on a doubly
+//linked list through two arrays indexed by id (next and prev, 0 ends a
+//list), so adding or deleting a student is O(1) however common the name.
+//The heads of the lists are found through an open addressing hash table
+//with linear probing, one bucket per distinct hash of lname.  Names whose
+//hashes collide share a list, a lookup checks the records themselves.
+//The bucket table is a power of two in size and is rebuilt at twice the
+//size when it gets three quarters full.  Removing a bucket shifts the
+//following buckets back instead of leaving a tombstone.
+//
+//File layout:  name_index_hdr_t | next[MAX_STD_ID+1] | prev[MAX_STD_ID+1]
+//              | name_bucket_t[capacity]  (the link arrays are uint32_t)
+#define DB_NAME_MAGIC       0x4e424453      //"SDBN" in little endian
+#define DB_NAME_VERSION     1
+#define DB_NAME_MIN_CAP     1024            //buckets in a new table
+
+typedef struct name_index_hdr{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;                      //buckets, a power of two
+	uint32_t count;                         //buckets in use
+} name_index_hdr_t;
+
+typedef struct name_bucket{
+	uint32_t head;                          //first id on the list, 0 if free
+	uint32_t hash;
+} name_bucket_t;
+
+//GPA index.  The same linked lists as the last name index, one per
+//integer gpa, so the heads are a plain array over MIN_STD_GPA..MAX_STD_GPA
+//and the file never grows.  Walking the lists from either end returns the
+//students in gpa order.
+//
+//File layout:  gpa_index_hdr_t | next[MAX_STD_ID+1] | prev[MAX_STD_ID+1]
+//              | head[MAX_STD_GPA+1]  (all uint32_t)
+#define DB_GPA_MAGIC        0x47424453      //"SDBG" in little endian
+#define DB_GPA_VERSION      1
+
+typedef struct gpa_index_hdr{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;                         //students on the lists
+	uint32_t reserved;
+} gpa_index_hdr_t;
+
+//Record checksums.  The CRC32C of the 64 bytes of every live record, an
+//array by id like the gpa index links, 0 for an empty slot.  A record is
+//checked against it when it is read by id and by -V.  Created by --crc,
+//from then on kept current by every add and delete.
+//
+//File layout:  crc_index_hdr_t | crc[MAX_STD_ID+1]  (uint32_t)
+#define DB_CRC_MAGIC        0x43424453      //"SDBC" in little endian
+#define DB_CRC_VERSION      1
+
+typedef struct crc_index_hdr{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t reserved[2];
+} crc_index_hdr_t;
+
+//Write-ahead log.  In --wal mode every change is appended to the log, as
+//the full image of the slot of one id (all zeros for a delete), before it
+//is written to the db file.  Only the log is flushed when an operation
+//commits, the db file catches up at the next checkpoint.  Records are
+//numbered from 1 after each checkpoint empties the log, a record whose
+//magic, sequence number or check value is wrong marks the torn end of
+//the log.
+#define DB_WAL_MAGIC        0x57424453      //"SDBW" in little endian
+
+typedef struct wal_record{
+	uint32_t magic;
+	uint32_t seq;                           //1, 2, 3 ... since the checkpoint
+	int32_t  id;                            //student id the image belongs to
+	uint32_t check;                         //FNV-1a of seq, id and rec
+	student_t rec;                          //new contents of the slot
+} wal_record_t;
 
 #endif
\ No newline at end of file
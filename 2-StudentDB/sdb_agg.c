@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AGG_HAVE_X86 1
+#endif
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Aggregate kernels.  Each one folds n integer gpas into a gpa_agg_t:
+ *  the count, the sum, the sum of the squares, the smallest and largest
+ *  gpa and the histogram over the DB_GPA_BUCKETS buckets of db.h.  No
+ *  value is converted to floating point, print_db_aggregates() does that
+ *  once for the averages.
+ */
+static void agg_gpa_scalar(gpa_agg_t *a, const int32_t *gpa, int n){
+    for (int i = 0; i < n; i++) {
+        int32_t g = gpa[i];
+
+        a->sum += g;
+        a->sum_sq += (int64_t)g * g;
+        if (g < a->min)
+            a->min = g;
+        if (g > a->max)
+            a->max = g;
+        a->hist[gpa_bucket(g)]++;
+    }
+    a->count += n;
+}
+
+#ifdef AGG_HAVE_X86
+/*
+ *  The AVX2 kernel works on 8 gpas at a time.  Sums and squares are kept
+ *  in 32 bit lanes and added to the 64 bit totals every AGG_CHUNK values,
+ *  before a lane of squares (at most 500*500 each) can overflow.  The
+ *  histogram is counted with compares:  for every bucket but the first,
+ *  how many gpas are at or above its lower bound, the buckets are the
+ *  differences.
+ */
+#define AGG_CHUNK   8192
+
+__attribute__((target("avx2")))
+static void agg_gpa_avx2(gpa_agg_t *a, const int32_t *gpa, int n){
+    __m256i vmin = _mm256_set1_epi32(a->min);
+    __m256i vmax = _mm256_set1_epi32(a->max);
+    __m256i bound[DB_GPA_BUCKETS - 1];
+    int i = 0;
+
+    for (int b = 1; b < DB_GPA_BUCKETS; b++)
+        bound[b - 1] = _mm256_set1_epi32(b * DB_GPA_BUCKET_WIDTH - 1);
+
+    while (n - i >= 8) {
+        int stop = i + ((n - i) / 8) * 8;
+        if (stop - i > AGG_CHUNK)
+            stop = i + AGG_CHUNK;
+        int done = stop - i;
+
+        __m256i vsum = _mm256_setzero_si256();
+        __m256i vsq = _mm256_setzero_si256();
+        __m256i vge[DB_GPA_BUCKETS - 1];
+        for (int b = 0; b < DB_GPA_BUCKETS - 1; b++)
+            vge[b] = _mm256_setzero_si256();
+
+        for (; i < stop; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(gpa + i));
+            vsum = _mm256_add_epi32(vsum, v);
+            vsq = _mm256_add_epi32(vsq, _mm256_mullo_epi32(v, v));
+            vmin = _mm256_min_epi32(vmin, v);
+            vmax = _mm256_max_epi32(vmax, v);
+            //a true compare is -1 in the lane, subtracting it counts one
+            for (int b = 0; b < DB_GPA_BUCKETS - 1; b++)
+                vge[b] = _mm256_sub_epi32(vge[b], _mm256_cmpgt_epi32(v, bound[b]));
+        }
+
+        int32_t lanes[8];
+        uint32_t ge[DB_GPA_BUCKETS - 1];
+        _mm256_storeu_si256((__m256i *)lanes, vsum);
+        for (int l = 0; l < 8; l++)
+            a->sum += lanes[l];
+        _mm256_storeu_si256((__m256i *)lanes, vsq);
+        for (int l = 0; l < 8; l++)
+            a->sum_sq += lanes[l];
+        for (int b = 0; b < DB_GPA_BUCKETS - 1; b++) {
+            _mm256_storeu_si256((__m256i *)lanes, vge[b]);
+            ge[b] = 0;
+            for (int l = 0; l < 8; l++)
+                ge[b] += lanes[l];
+        }
+
+        a->hist[0] += done - ge[0];
+        for (int b = 1; b < DB_GPA_BUCKETS - 1; b++)
+            a->hist[b] += ge[b - 1] - ge[b];
+        a->hist[DB_GPA_BUCKETS - 1] += ge[DB_GPA_BUCKETS - 2];
+        a->count += done;
+    }
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, vmin);
+    for (int l = 0; l < 8; l++)
+        if (lanes[l] < a->min)
+            a->min = lanes[l];
+    _mm256_storeu_si256((__m256i *)lanes, vmax);
+    for (int l = 0; l < 8; l++)
+        if (lanes[l] > a->max)
+            a->max = lanes[l];
+
+    agg_gpa_scalar(a, gpa + i, n - i);
+}
+#endif
+
+static void (*agg_gpa)(gpa_agg_t *a, const int32_t *gpa, int n);
+
+/*
+ *  pick_agg_gpa
+ *
+ *  Selects the fastest aggregate kernel the cpu supports, once.
+ */
+static void pick_agg_gpa(void){
+    if (agg_gpa != NULL)
+        return;
+
+    agg_gpa = agg_gpa_scalar;
+#ifdef AGG_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        agg_gpa = agg_gpa_avx2;
+#endif
+}
+
+/*
+ *  aggregate_db
+ *      fd:  linux file descriptor
+ *      a:   set to the aggregates of every gpa in the db
+ *
+ *  One pass over the ids and gpas (open_db_hot_scan(), so a split db only
+ *  has its hot column read).  The gpas are collected AGG_BATCH at a time
+ *  and handed to the kernel.  An empty db has a count of 0, min and max
+ *  are then 0 as well.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int aggregate_db(int fd, gpa_agg_t *a){
+    int32_t batch[AGG_BATCH];
+    db_scan_t scan;
+    student_t *s;
+    int n = 0;
+    int rc;
+
+    memset(a, 0, sizeof(*a));
+    a->min = INT32_MAX;
+    a->max = INT32_MIN;
+    pick_agg_gpa();
+
+    if (open_db_hot_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID) != NO_ERROR) {
+        close_db_scan(&scan);
+        return ERR_DB_FILE;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0) {
+        batch[n++] = s->gpa;
+        if (n == AGG_BATCH) {
+            agg_gpa(a, batch, n);
+            n = 0;
+        }
+    }
+    close_db_scan(&scan);
+    if (rc < 0)
+        return ERR_DB_FILE;
+
+    agg_gpa(a, batch, n);
+    if (a->count == 0)
+        a->min = a->max = 0;
+    return NO_ERROR;
+}
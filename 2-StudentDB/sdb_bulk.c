@@ -0,0 +1,505 @@
+#define _GNU_SOURCE     //fallocate(), getline()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <time.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+//one parsed input row.  line keeps the input order so that the first of
+//several rows with the same id is the one that is loaded
+typedef struct bulk_row{
+    student_t student;
+    int       line;
+} bulk_row_t;
+
+/*
+ *  parse_bulk_gpa
+ *      str:  gpa field from the input
+ *      gpa:  where to store the gpa as an integer
+ *
+ *  A gpa with a decimal point is a real gpa (3.45) and is scaled by 100,
+ *  which lets the output of -p be loaded back.  Without a decimal point it
+ *  is the 3 digit integer form used by -a (345).
+ *
+ *  returns:  NO_ERROR if the field is a number, ERR_DB_OP otherwise
+ */
+static int parse_bulk_gpa(char *str, int *gpa){
+    char *end;
+
+    if (strchr(str, '.') != NULL) {
+        double real = strtod(str, &end);
+        if (end == str || *end != '\0')
+            return ERR_DB_OP;
+        *gpa = (int)(real * 100.0 + 0.5);
+        return NO_ERROR;
+    }
+
+    long val = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || val < INT_MIN || val > INT_MAX)
+        return ERR_DB_OP;
+    *gpa = (int)val;
+    return NO_ERROR;
+}
+
+/*
+ *  split_csv_line
+ *      line:    one CSV line without its line end, modified in place
+ *      fields:  receives the fields
+ *      max:     size of fields
+ *
+ *  Cuts the line into its fields as RFC 4180 has them:  a field in double
+ *  quotes may hold commas, and "" inside it stands for one quote, which
+ *  is how -q and -r --format=csv print such names.  The spaces around a
+ *  field are trimmed.
+ *
+ *  returns:  the number of fields, or -1 if there are more than max or a
+ *            quote is out of place
+ */
+static int split_csv_line(char *line, char *fields[], int max){
+    char *p = line;
+    int n = 0;
+
+    for (;;) {
+        while (isspace((unsigned char)*p))
+            p++;
+        char *field = p;
+        char *out;
+
+        if (*p == '"') {
+            //copy the quoted text down over its quotes
+            out = field;
+            for (p++; *p != '"' || p[1] == '"'; p++) {
+                if (*p == '\0')
+                    return -1;
+                if (*p == '"')
+                    p++;
+                *out++ = *p;
+            }
+            p++;
+            while (isspace((unsigned char)*p))
+                p++;
+            if (*p != ',' && *p != '\0')
+                return -1;
+        } else {
+            p += strcspn(p, ",\"");
+            if (*p == '"')
+                return -1;
+            out = p;
+            while (out > field && isspace((unsigned char)out[-1]))
+                out--;
+        }
+
+        if (n == max)
+            return -1;
+        fields[n++] = field;
+        char sep = *p;
+        *out = '\0';
+        if (sep == '\0')
+            return n;
+        p++;
+    }
+}
+
+/*
+ *  parse_bulk_line
+ *      line:  one line of input, modified in place
+ *      row:   where to store the parsed student
+ *
+ *  Accepts either CSV (id,first,last,gpa, see split_csv_line()) or
+ *  whitespace separated columns (id first last gpa).  The whitespace form
+ *  also covers the fixed width table printed by -p.
+ *
+ *  returns:  NO_ERROR    row parsed
+ *            WARN_BULK_SKIP  blank line, comment or the -p header
+ *            ERR_DB_OP   the line is malformed
+ */
+static int parse_bulk_line(char *line, bulk_row_t *row){
+    char *fields[4];
+    int nfields = 0;
+    char *save = NULL;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (isspace((unsigned char)*line))
+        line++;
+
+    if (*line == '\0' || *line == '#' || strncmp(line, "ID ", 3) == 0)
+        return WARN_BULK_SKIP;
+
+    if (strchr(line, ',') != NULL) {
+        nfields = split_csv_line(line, fields, 4);
+    } else {
+        for (char *tok = strtok_r(line, " \t", &save); tok != NULL;
+                tok = strtok_r(NULL, " \t", &save)) {
+            if (nfields == 4)
+                return ERR_DB_OP;
+            fields[nfields++] = tok;
+        }
+    }
+
+    if (nfields != 4 || *fields[1] == '\0' || *fields[2] == '\0')
+        return ERR_DB_OP;
+
+    char *end;
+    long id = strtol(fields[0], &end, 10);
+    if (end == fields[0] || *end != '\0' || id < INT_MIN || id > INT_MAX)
+        return ERR_DB_OP;
+
+    memset(&row->student, 0, sizeof(row->student));
+    row->student.id = (int)id;
+    strncpy(row->student.fname, fields[1], sizeof(row->student.fname) - 1);
+    strncpy(row->student.lname, fields[2], sizeof(row->student.lname) - 1);
+
+    if (parse_bulk_gpa(fields[3], &row->student.gpa) != NO_ERROR)
+        return ERR_DB_OP;
+
+    return NO_ERROR;
+}
+
+static int cmp_bulk_row(const void *a, const void *b){
+    const bulk_row_t *ra = a;
+    const bulk_row_t *rb = b;
+
+    if (ra->student.id != rb->student.id)
+        return ra->student.id < rb->student.id ? -1 : 1;
+    return ra->line - rb->line;
+}
+
+/*
+ *  write_bulk_run
+ *      fd:     linux file descriptor
+ *      rows:   rows with adjacent ids, rows[i].student.id == first id + i
+ *      n:      number of rows
+ *
+ *  Writes a run of adjacent records with pwritev(), one iovec per record
+ *  and as few calls as IOV_MAX allows.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_bulk_run(int fd, bulk_row_t *rows, int n){
+    struct iovec iov[BULK_MAX_IOV];
+
+    for (int done = 0; done < n; ) {
+        int cnt = n - done < BULK_MAX_IOV ? n - done : BULK_MAX_IOV;
+        off_t offset = (off_t)rows[done].student.id * STUDENT_RECORD_SIZE;
+        ssize_t want = (ssize_t)cnt * STUDENT_RECORD_SIZE;
+
+        for (int i = 0; i < cnt; i++) {
+            iov[i].iov_base = &rows[done + i].student;
+            iov[i].iov_len = STUDENT_RECORD_SIZE;
+        }
+
+        if (pwritev(fd, iov, cnt, offset) != want)
+            return ERR_DB_FILE;
+        done += cnt;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  log_bulk_rows
+ *      fd:    linux file descriptor
+ *      rows:  new rows of a batch, about to be written by write_bulk_run()
+ *      n:     number of rows
+ *
+ *  In --wal mode logs the whole batch and commits it with one flush, the
+ *  group commit for a bulk load.  The log lock stays held until the caller
+ *  has written the rows and calls wal_end().  Does nothing otherwise.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int log_bulk_rows(int fd, const bulk_row_t *rows, int n){
+    if (wal_begin(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int i = 0; i < n; i++) {
+        if (wal_append(fd, rows[i].student.id, &rows[i].student) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return wal_commit(fd);
+}
+
+/*
+ *  store_bulk_rows
+ *      fd:     linux file descriptor
+ *      rows:   validated rows in ascending id order, unique within the batch
+ *      kept:   number of rows
+ *      stats:  running totals, updated
+ *
+ *  Second half of load_bulk_batch(), run with the id span of the batch
+ *  locked.  The indexes and statistics are updated and saved once per
+ *  batch under the superblock lock.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on an I/O error
+ */
+static int store_bulk_rows(int fd, bulk_row_t *rows, int kept,
+                           bulk_stats_t *stats){
+    student_t *existing = NULL;
+
+    //only the direct layout has a slot per id that runs can be written to,
+    //anything else goes through the storage engine a row at a time.  The
+    //new rows are logged and committed together before any is applied
+    db_handle_t *h = db_handle(fd);
+    if (h != NULL && h->layout != DB_LAYOUT_DIRECT) {
+        int fresh = 0;
+        int rc = wal_begin(fd);
+        for (int i = 0; i < kept && rc == NO_ERROR; i++) {
+            student_t cur;
+            if (read_db_slot(fd, rows[i].student.id, &cur) != NO_ERROR) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            if (!is_empty_record(&cur)) {
+                stats->duplicates++;
+                continue;
+            }
+            rows[fresh++] = rows[i];
+            rc = wal_append(fd, rows[i].student.id, &rows[i].student);
+        }
+        if (rc == NO_ERROR)
+            rc = wal_commit(fd);
+        if (rc == NO_ERROR)
+            rc = lock_db_meta(fd, F_WRLCK);
+        else
+            fresh = 0;
+        for (int i = 0; i < fresh && rc == NO_ERROR; i++) {
+            if (apply_db_slot(fd, rows[i].student.id, &rows[i].student) != NO_ERROR ||
+                    update_db_indexes(fd, &rows[i].student, 1) != NO_ERROR)
+                rc = ERR_DB_FILE;
+            else
+                stats->added++;
+        }
+        if (rc == NO_ERROR)
+            rc = save_db_indexes(fd);
+        unlock_db_meta(fd);
+        wal_end(fd);
+        return rc;
+    }
+
+    int first = rows[0].student.id;
+    int last = rows[kept - 1].student.id;
+    off_t span = ((off_t)last - first + 1) * STUDENT_RECORD_SIZE;
+    if ((off_t)kept * 2 >= last - first + 1)
+        fallocate(fd, 0, (off_t)first * STUDENT_RECORD_SIZE, span);
+
+    existing = malloc((size_t)kept * sizeof(student_t));
+    if (existing == NULL)
+        return ERR_DB_FILE;
+
+    //read the slots of each run of adjacent ids with one pread() and drop
+    //the rows whose id is already taken
+    int fresh = 0;
+    int rc = NO_ERROR;
+    for (int i = 0; i < kept; ) {
+        int j = i + 1;
+        while (j < kept && rows[j].student.id == rows[j - 1].student.id + 1)
+            j++;
+
+        off_t offset = (off_t)rows[i].student.id * STUDENT_RECORD_SIZE;
+        ssize_t want = (ssize_t)(j - i) * STUDENT_RECORD_SIZE;
+        ssize_t got = pread(fd, &existing[i], want, offset);
+        if (got == -1) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (got < want)
+            memset((char *)&existing[i] + got, 0, want - got);
+        i = j;
+    }
+    for (int k = 0; k < kept && rc == NO_ERROR; k++) {
+        if (memcmp(&existing[k], &EMPTY_STUDENT_RECORD,
+                   STUDENT_RECORD_SIZE) != 0) {
+            stats->duplicates++;
+            continue;
+        }
+        rows[fresh++] = rows[k];
+    }
+    free(existing);
+
+    //log the whole batch with one commit, then write it run by run
+    if (rc == NO_ERROR)
+        rc = log_bulk_rows(fd, rows, fresh);
+    if (rc == NO_ERROR)
+        rc = lock_db_meta(fd, F_WRLCK);
+    else
+        fresh = 0;
+    for (int i = 0; i < fresh && rc == NO_ERROR; ) {
+        int j = i + 1;
+        while (j < fresh && rows[j].student.id == rows[j - 1].student.id + 1)
+            j++;
+
+        rc = write_bulk_run(fd, &rows[i], j - i);
+        for (int r = i; r < j && rc == NO_ERROR; r++)
+            rc = update_db_indexes(fd, &rows[r].student, 1);
+        if (rc == NO_ERROR)
+            stats->added += j - i;
+        i = j;
+    }
+    if (rc == NO_ERROR)
+        rc = save_db_indexes(fd);
+    unlock_db_meta(fd);
+    wal_end(fd);
+    return rc;
+}
+
+/*
+ *  load_bulk_batch
+ *      fd:     linux file descriptor
+ *      rows:   parsed rows, sorted in place
+ *      n:      number of rows
+ *      stats:  running totals, updated
+ *
+ *  Validates a batch of rows and writes the new ones.  Rows are sorted by
+ *  id so that duplicates inside the batch sit next to each other and so
+ *  that adjacent ids can be written with one pwritev().  The existing
+ *  slots of each run are read with a single pread() for the duplicate
+ *  check.  When a batch is dense its whole id span is preallocated with one
+ *  fallocate() call, sparse batches keep their holes.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on an I/O error
+ */
+static int load_bulk_batch(int fd, bulk_row_t *rows, int n,
+                           bulk_stats_t *stats){
+    int kept = 0;
+
+    qsort(rows, n, sizeof(bulk_row_t), cmp_bulk_row);
+
+    //drop rows that fail validation or repeat an id within the batch
+    for (int i = 0; i < n; i++) {
+        if (validate_db_range(fd, rows[i].student.id,
+                              rows[i].student.gpa) != NO_ERROR) {
+            stats->rejected++;
+            continue;
+        }
+        if (kept > 0 && rows[kept - 1].student.id == rows[i].student.id) {
+            stats->duplicates++;
+            continue;
+        }
+        rows[kept++] = rows[i];
+    }
+
+    if (kept == 0)
+        return NO_ERROR;
+
+    //the id span of the batch stays locked from the duplicate check until
+    //the indexes are updated
+    int first = rows[0].student.id;
+    int nids = rows[kept - 1].student.id - first + 1;
+    if (lock_db_slots(fd, first, nids, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    int rc = store_bulk_rows(fd, rows, kept, stats);
+    unlock_db_slots(fd, first, nids);
+    return rc;
+}
+
+/*
+ *  bulk_load
+ *      fd:    linux file descriptor
+ *      path:  file to load, "-" reads standard input
+ *
+ *  Loads a whole file of students in one process.  Rows are read and
+ *  validated in batches of BULK_BATCH_ROWS, see load_bulk_batch().  Rather
+ *  than one M_STD_ADDED line per student a single summary is printed.
+ *
+ *  returns:  NO_ERROR       all rows processed (some may have been rejected)
+ *            ERR_DB_FILE    the input or the database could not be accessed
+ *
+ *  console:  M_BULK_SUMMARY  on success
+ *            M_ERR_BULK_OPEN input file can not be opened
+ *            M_ERR_DB_WRITE  error writing to the db file
+ */
+int bulk_load(int fd, char *path){
+    FILE *in = stdin;
+    bulk_stats_t stats = {0};
+    bulk_row_t *rows;
+    char *line = NULL;
+    size_t line_cap = 0;
+    int nrows = 0;
+    int lineno = 0;
+    int rc = NO_ERROR;
+    struct timespec start, end;
+
+    if (strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            printf(M_ERR_BULK_OPEN, path);
+            return ERR_DB_FILE;
+        }
+    }
+
+    rows = malloc(BULK_BATCH_ROWS * sizeof(bulk_row_t));
+    if (rows == NULL) {
+        if (in != stdin)
+            fclose(in);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (rc == NO_ERROR && getline(&line, &line_cap, in) != -1) {
+        lineno++;
+        switch (parse_bulk_line(line, &rows[nrows])) {
+            case NO_ERROR:
+                rows[nrows++].line = lineno;
+                break;
+            case WARN_BULK_SKIP:
+                break;
+            default:
+                stats.rejected++;
+                break;
+        }
+
+        if (nrows == BULK_BATCH_ROWS) {
+            rc = load_bulk_batch(fd, rows, nrows, &stats);
+            nrows = 0;
+        }
+    }
+
+    if (rc == NO_ERROR && nrows > 0)
+        rc = load_bulk_batch(fd, rows, nrows, &stats);
+
+    //one superblock write per batch (see store_bulk_rows()) and one flush
+    //for the whole load instead of one per record
+    if (rc == NO_ERROR && stats.added > 0) {
+        db_handle_t *h = db_handle(fd);
+        if (h != NULL) {
+            h->dirty = true;
+            //pick up the size the pwritev() calls grew the file to
+            if (h->map != NULL)
+                rc = grow_db_map(h, 0);
+        }
+        if (rc == NO_ERROR && DB_DATA_DURABILITY == DB_DURABILITY_SYNC &&
+                fdatasync(fd) == -1)
+            rc = ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    free(line);
+    free(rows);
+    if (in != stdin)
+        fclose(in);
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return rc;
+    }
+
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    int total = stats.added + stats.duplicates + stats.rejected;
+    printf(M_BULK_SUMMARY, stats.added, stats.duplicates, stats.rejected,
+           secs, secs > 0 ? total / secs : 0.0);
+
+    return NO_ERROR;
+}
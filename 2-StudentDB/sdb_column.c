@@ -0,0 +1,373 @@
+#define _GNU_SOURCE     //fallocate()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  The split layout (see db.h).  A record is split in two:  its id and gpa
+ *  go in the hot column, an array indexed by id in a file of its own, and
+ *  its names go in the db file after the header.  The hot entry is what
+ *  makes a record live, so an add writes the names and then the hot
+ *  entry, a delete clears the hot entry and then the names.  Scans that
+ *  only need ids and gpas (counts, statistics, the gpa index) read the hot
+ *  column alone, see open_db_hot_scan().
+ */
+
+//the names of a record are the DB_COLD_SIZE bytes between id and gpa
+#define COLD_PART(s)    ((char *)(s) + offsetof(student_t, fname))
+
+/*
+ *  hot_column_path
+ *      db_path:  name of the database file
+ *      buff:     where to build the name of its hot column file
+ *      len:      size of buff
+ */
+void hot_column_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_HOT_EXT, buff, len);
+}
+
+/*
+ *  open_hot_column
+ *      h:  handle of a database with the split layout
+ *
+ *  Opens and maps the hot column next to the db file, the same way the
+ *  index of a compacted db is.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_hot_column(db_handle_t *h){
+    char path[DB_PATH_MAX];
+
+    hot_column_path(h->path, path, sizeof(path));
+    h->hot_fd = open(path, O_RDWR);
+    if (h->hot_fd == -1)
+        return ERR_DB_FILE;
+
+    if (sdb_config.use_mmap) {
+        void *map = mmap(NULL, DB_HOT_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, h->hot_fd, 0);
+        if (map != MAP_FAILED)
+            h->hot_map = map;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_hot_column
+ *      h:  handle being closed
+ *
+ *  Unmaps and closes the hot column, flushing it unless the durability
+ *  policy is relaxed.
+ */
+void close_hot_column(db_handle_t *h){
+    if (h->hot_map != NULL) {
+        if (h->dirty && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            msync(h->hot_map, DB_HOT_SIZE, MS_SYNC);
+        munmap(h->hot_map, DB_HOT_SIZE);
+        h->hot_map = NULL;
+    }
+    if (h->hot_fd != -1) {
+        if (h->dirty && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            fdatasync(h->hot_fd);
+        close(h->hot_fd);
+        h->hot_fd = -1;
+    }
+}
+
+/*
+ *  read_hot_entry / write_hot_entry
+ *      h:   handle of a database with the split layout
+ *      id:  student id
+ *      e:   entry to read into or write
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int read_hot_entry(db_handle_t *h, int id, db_hot_t *e){
+    if (id > MAX_STD_ID) {
+        memset(e, 0, sizeof(*e));
+        return NO_ERROR;
+    }
+
+    if (h->hot_map != NULL) {
+        *e = h->hot_map[id];
+        return NO_ERROR;
+    }
+
+    ssize_t got = pread(h->hot_fd, e, sizeof(*e), (off_t)id * sizeof(*e));
+    if (got == -1)
+        return ERR_DB_FILE;
+    if (got < (ssize_t)sizeof(*e))
+        memset(e, 0, sizeof(*e));
+    return NO_ERROR;
+}
+
+static int write_hot_entry(db_handle_t *h, int id, const db_hot_t *e){
+    if (id > MAX_STD_ID)
+        return ERR_DB_FILE;
+
+    if (h->hot_map != NULL) {
+        h->hot_map[id] = *e;
+        if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC) {
+            long page = sysconf(_SC_PAGESIZE);
+            uintptr_t start = (uintptr_t)&h->hot_map[id] & ~((uintptr_t)page - 1);
+            if (msync((void *)start, page, MS_SYNC) == -1)
+                return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    if (pwrite(h->hot_fd, e, sizeof(*e), (off_t)id * sizeof(*e)) !=
+            (ssize_t)sizeof(*e))
+        return ERR_DB_FILE;
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(h->hot_fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  write_cold_part
+ *      h:   handle of a database with the split layout
+ *      id:  student id, the names go at DB_COLD_OFF(id)
+ *      s:   record whose names are written
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_cold_part(db_handle_t *h, int id, const student_t *s){
+    if (pwrite(h->fd, COLD_PART((student_t *)s), DB_COLD_SIZE, DB_COLD_OFF(id)) !=
+            DB_COLD_SIZE)
+        return ERR_DB_FILE;
+    h->dirty = true;
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(h->fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  read_split_slot
+ *      h:   handle of a database with the split layout
+ *      id:  student id to read
+ *      *s:  where to assemble the record
+ *
+ *  read_db_slot() for the split layout.  The names are only read when the
+ *  hot entry says the student is there.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_split_slot(db_handle_t *h, int id, student_t *s){
+    db_hot_t e;
+
+    *s = EMPTY_STUDENT_RECORD;
+    if (read_hot_entry(h, id, &e) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (e.id == DELETED_STUDENT_ID)
+        return NO_ERROR;
+
+    ssize_t got = pread(h->fd, COLD_PART(s), DB_COLD_SIZE, DB_COLD_OFF(id));
+    if (got == -1)
+        return ERR_DB_FILE;
+    s->id = e.id;
+    s->gpa = e.gpa;
+    return NO_ERROR;
+}
+
+/*
+ *  apply_split_slot
+ *      h:   handle of a database with the split layout
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  apply_db_slot() for the split layout.  Deleted names are zeroed, the
+ *  blocks they leave empty are given back by -x and -X (see
+ *  punch_split_range()), which can lock all the ids sharing a block.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int apply_split_slot(db_handle_t *h, int id, const student_t *s){
+    db_hot_t e = { .id = s->id, .gpa = s->gpa };
+
+    if (!is_empty_record(s)) {
+        if (write_cold_part(h, id, s) != NO_ERROR)
+            return ERR_DB_FILE;
+        return write_hot_entry(h, id, &e);
+    }
+
+    if (write_hot_entry(h, id, &e) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_cold_part(h, id, s);
+}
+
+/*
+ *  read_hot_block
+ *      h:      handle of a database with the split layout
+ *      first:  first id
+ *      n:      number of entries
+ *      buf:    room for n entries
+ *
+ *  Used by the scan iterator.  Entries past the end of the column read
+ *  as empty.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_hot_block(db_handle_t *h, int first, int n, db_hot_t *buf){
+    size_t want = (size_t)n * sizeof(db_hot_t);
+
+    ssize_t got = pread(h->hot_fd, buf, want, (off_t)first * sizeof(db_hot_t));
+    if (got == -1)
+        return ERR_DB_FILE;
+    if ((size_t)got < want)
+        memset((char *)buf + got, 0, want - got);
+    return NO_ERROR;
+}
+
+/*
+ *  punch_inside
+ *      fd:     linux file descriptor
+ *      start:  first byte of the range
+ *      end:    end of the range (exclusive)
+ *
+ *  punch_empty_blocks() for the blocks that lie entirely inside the
+ *  range, the ones at its edges hold ids that are not locked.
+ *
+ *  returns:  bytes deallocated, or ERR_DB_FILE on an I/O error
+ */
+static long long punch_inside(int fd, off_t start, off_t end){
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    off_t blk = st.st_blksize > 0 ? st.st_blksize : 4096;
+
+    start = (start + blk - 1) / blk * blk;
+    end -= end % blk;
+    if (start >= end)
+        return 0;
+    return punch_empty_blocks(fd, start, end);
+}
+
+/*
+ *  punch_split_range
+ *      fd:     linux file descriptor of a db with the split layout
+ *      first:  first id of the range
+ *      last:   last id of the range
+ *
+ *  Gives back the disk space of the hot entries and names of deleted
+ *  students in first..last, every block of either file that lies inside
+ *  the range and holds nothing but zeros is punched.  The caller holds
+ *  the write locks of the ids in the range.
+ *
+ *  returns:  bytes deallocated, or ERR_DB_FILE on an I/O error
+ */
+long long punch_split_range(int fd, int first, int last){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->layout != DB_LAYOUT_SPLIT)
+        return ERR_DB_FILE;
+    if (first < MIN_STD_ID)
+        first = MIN_STD_ID;
+    if (last > MAX_STD_ID)
+        last = MAX_STD_ID;
+
+    long long hot = punch_inside(h->hot_fd, (off_t)first * sizeof(db_hot_t),
+                                 ((off_t)last + 1) * sizeof(db_hot_t));
+    long long cold = punch_inside(fd, DB_COLD_OFF(first), DB_COLD_OFF(last + 1));
+    if (hot < 0 || cold < 0)
+        return ERR_DB_FILE;
+    return hot + cold;
+}
+
+/*
+ *  write_sparse
+ *      fd:   file to write
+ *      img:  image of the file
+ *      len:  length of the image
+ *
+ *  Writes img over the file a 4 KiB page at a time, from the last page
+ *  down so that the header at the start goes last.  Pages of zeros are
+ *  punched out instead of written, the file is cut to len.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_sparse(int fd, const char *img, size_t len){
+    const size_t page = 4096;
+
+    if (len == 0)
+        return truncate_db_file(fd, 0);
+
+    for (size_t off = (len - 1) / page * page; ; off -= page) {
+        size_t n = len - off < page ? len - off : page;
+        const char *p = img + off;
+
+        bool zero = p[0] == 0 && memcmp(p, p + 1, n - 1) == 0;
+        if (!(zero && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                off, n) == 0) &&
+                pwrite(fd, p, n, off) != (ssize_t)n)
+            return ERR_DB_FILE;
+        if (off == 0)
+            break;
+    }
+    return truncate_db_file(fd, len);
+}
+
+/*
+ *  write_split_db
+ *      fd:    linux file descriptor of the db, locked by the caller
+ *      recs:  MAX_STD_ID+1 records indexed by id, id 0 means no record
+ *      hdr:   the header for the db file, layout DB_LAYOUT_SPLIT
+ *
+ *  Writes the split image of recs, used by migrate_db().  The hot column
+ *  is written first, it is ignored until the header says the db is split,
+ *  then the names and the header are written over the db file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int write_split_db(int fd, const student_t *recs, const db_header_t *hdr){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+    int last = hdr->count > 0 ? (int)hdr->max_id : 0;
+    size_t cold_len = DB_COLD_OFF(last + 1);
+    int rc = ERR_DB_FILE;
+
+    if (h == NULL)
+        return ERR_DB_FILE;
+    hot_column_path(h->path, path, sizeof(path));
+
+    db_hot_t *hot = calloc(MAX_STD_ID + 1, sizeof(db_hot_t));
+    char *cold = calloc(1, cold_len);
+    int hot_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, DB_FILE_MODE);
+    if (hot == NULL || cold == NULL || hot_fd == -1)
+        goto out;
+
+    memcpy(cold, hdr, sizeof(*hdr));
+    for (int id = MIN_STD_ID; id <= last; id++) {
+        if (recs[id].id == DELETED_STUDENT_ID)
+            continue;
+        hot[id].id = recs[id].id;
+        hot[id].gpa = recs[id].gpa;
+        memcpy(cold + DB_COLD_OFF(id), COLD_PART((student_t *)&recs[id]),
+               DB_COLD_SIZE);
+    }
+
+    if (ftruncate(hot_fd, DB_HOT_SIZE) == -1 ||
+            write_sparse(hot_fd, (const char *)hot, DB_HOT_SIZE) != NO_ERROR ||
+            fdatasync(hot_fd) == -1)
+        goto out;
+    rc = write_sparse(fd, cold, cold_len);
+
+out:
+    if (hot_fd != -1)
+        close(hot_fd);
+    free(hot);
+    free(cold);
+    return rc;
+}
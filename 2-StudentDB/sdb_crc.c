@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_HAVE_X86 1
+#endif
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+//offsets into the checksum file, see db.h
+#define CRC_OFF(id)     ((off_t)(sizeof(crc_index_hdr_t) + (size_t)(id) * sizeof(uint32_t)))
+#define CRC_FILE_SIZE   CRC_OFF(MAX_STD_ID + 1)
+#define CRC32C_POLY     0x82f63b78      //Castagnoli, bit reflected
+
+/*
+ *  CRC32C of a buffer.  The table version works on 8 bytes per step with
+ *  eight 256 entry tables (slicing by 8), the SSE4.2 version uses the
+ *  crc32 instruction, which computes the same polynomial 8 bytes at a
+ *  time.  Both take and return the inverted crc, crc32c() does the
+ *  inversions.
+ */
+static uint32_t crc_table[8][256];
+
+static void init_crc_table(void){
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^
+                              crc_table[0][crc_table[t - 1][i] & 0xff];
+}
+
+static uint32_t crc32c_table(uint32_t crc, const void *buf, size_t len){
+    const unsigned char *p = buf;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+        crc = crc_table[7][w & 0xff] ^ crc_table[6][(w >> 8) & 0xff] ^
+              crc_table[5][(w >> 16) & 0xff] ^ crc_table[4][(w >> 24) & 0xff] ^
+              crc_table[3][(w >> 32) & 0xff] ^ crc_table[2][(w >> 40) & 0xff] ^
+              crc_table[1][(w >> 48) & 0xff] ^ crc_table[0][w >> 56];
+    }
+    for (; len > 0; p++, len--)
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p) & 0xff];
+    return crc;
+}
+
+#ifdef CRC_HAVE_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *buf, size_t len){
+    const unsigned char *p = buf;
+
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        c = _mm_crc32_u64(c, w);
+    }
+    crc = (uint32_t)c;
+#endif
+    for (; len >= 4; p += 4, len -= 4) {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        crc = _mm_crc32_u32(crc, w);
+    }
+    for (; len > 0; p++, len--)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_update)(uint32_t crc, const void *buf, size_t len);
+
+/*
+ *  pick_crc32c
+ *
+ *  Selects the crc32 instruction if the cpu has it, or builds the tables,
+ *  once.
+ */
+static void pick_crc32c(void){
+    if (crc32c_update != NULL)
+        return;
+
+#ifdef CRC_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_update = crc32c_sse42;
+        return;
+    }
+#endif
+    init_crc_table();
+    crc32c_update = crc32c_table;
+}
+
+/*
+ *  crc32c
+ *      buf:  bytes to check
+ *      len:  number of bytes
+ *
+ *  returns:  the CRC32C (Castagnoli) of buf
+ */
+uint32_t crc32c(const void *buf, size_t len){
+    pick_crc32c();
+    return ~crc32c_update(~0u, buf, len);
+}
+
+/*
+ *  record_crc
+ *      s:  contents of a slot
+ *
+ *  returns:  the checksum kept for the slot, 0 for an empty one
+ */
+uint32_t record_crc(const student_t *s){
+    if (is_empty_record(s))
+        return 0;
+    return crc32c(s, sizeof(*s));
+}
+
+/*
+ *  crc_index_path
+ *      db_path:  name of the database file
+ *      buff:     receives the name of its checksum file
+ *      len:      size of buff
+ */
+void crc_index_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_CRC_EXT, buff, len);
+}
+
+/*
+ *  crc_read / crc_write
+ *      h:    handle with an open checksum file
+ *      id:   student id
+ *      v:    value to fill in / to store
+ *
+ *  Access the checksum of one id, through the mapping when it is mapped.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int crc_read(db_handle_t *h, int id, uint32_t *v){
+    if (h->crc_map != NULL) {
+        *v = h->crc_map[id];
+        return NO_ERROR;
+    }
+    if (pread(h->crc_fd, v, sizeof(*v), CRC_OFF(id)) != (ssize_t)sizeof(*v))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int crc_write(db_handle_t *h, int id, uint32_t v){
+    if (h->crc_map != NULL) {
+        h->crc_map[id] = v;
+        return NO_ERROR;
+    }
+    if (pwrite(h->crc_fd, &v, sizeof(v), CRC_OFF(id)) != (ssize_t)sizeof(v))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  open_crc_index
+ *      h:  handle of a database that is being opened
+ *
+ *  Opens the checksum file of the database if it has one.  Unlike the
+ *  name and gpa indexes it is never built on demand, only by --crc, a
+ *  database without one simply is not checked (h->crc_fd == -1).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_crc_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    crc_index_hdr_t hdr;
+    struct stat st;
+
+    h->crc_fd = -1;
+    h->crc_map = NULL;
+    h->crc_dirty = false;
+
+    crc_index_path(h->path, path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+        return NO_ERROR;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+            hdr.magic != DB_CRC_MAGIC || hdr.version != DB_CRC_VERSION ||
+            fstat(fd, &st) == -1 || st.st_size < CRC_FILE_SIZE) {
+        close(fd);
+        return NO_ERROR;
+    }
+
+    h->crc_fd = fd;
+    if (sdb_config.use_mmap) {
+        char *map = mmap(NULL, CRC_FILE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            h->crc_map = (uint32_t *)(map + sizeof(crc_index_hdr_t));
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_crc_index
+ *      h:  handle of a database that is being closed
+ *
+ *  Unmaps and closes the checksum file, flushing it with batch or sync
+ *  durability if it was written to.
+ */
+void close_crc_index(db_handle_t *h){
+    if (h->crc_fd == -1)
+        return;
+
+    if (h->crc_map != NULL)
+        munmap((char *)h->crc_map - sizeof(crc_index_hdr_t), CRC_FILE_SIZE);
+    if (h->crc_dirty && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+        fdatasync(h->crc_fd);
+    close(h->crc_fd);
+
+    h->crc_fd = -1;
+    h->crc_map = NULL;
+    h->crc_dirty = false;
+}
+
+/*
+ *  refresh_crc_index
+ *      h:  handle of an open database, its superblock lock is held
+ *
+ *  Opens a checksum file another process created, or reopens one that
+ *  was built again, like refresh_name_index().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int refresh_crc_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    struct stat path_st, fd_st;
+
+    crc_index_path(h->path, path, sizeof(path));
+    bool exists = stat(path, &path_st) == 0;
+    if (h->crc_fd == -1 && !exists)
+        return NO_ERROR;
+
+    if (h->crc_fd == -1 || !exists || fstat(h->crc_fd, &fd_st) == -1 ||
+            fd_st.st_ino != path_st.st_ino || fd_st.st_dev != path_st.st_dev) {
+        close_crc_index(h);
+        return open_crc_index(h);
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  update_crc_index
+ *      fd:     linux file descriptor
+ *      s:      record that was just added or deleted
+ *      delta:  1 for an add, -1 for a delete
+ *
+ *  Stores the checksum of an added record, or clears that of a deleted
+ *  one.  The writer still holds the record lock of the id, so a reader
+ *  that takes it sees the record and its checksum agree.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int update_crc_index(int fd, const student_t *s, int delta){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->crc_fd == -1)
+        return NO_ERROR;
+    if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+        return NO_ERROR;
+
+    h->crc_dirty = true;
+    return crc_write(h, s->id, delta > 0 ? record_crc(s) : 0);
+}
+
+/*
+ *  save_crc_index
+ *      fd:  linux file descriptor
+ *
+ *  With sync durability, flushes the checksum file if it changed.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_crc_index(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->crc_fd == -1 || !h->crc_dirty ||
+            DB_DATA_DURABILITY != DB_DURABILITY_SYNC)
+        return NO_ERROR;
+    if (h->crc_map != NULL &&
+            msync((char *)h->crc_map - sizeof(crc_index_hdr_t), CRC_FILE_SIZE,
+                  MS_SYNC) == -1)
+        return ERR_DB_FILE;
+    if (fdatasync(h->crc_fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  build_crc_index
+ *      fd:  linux file descriptor
+ *
+ *  Creates the checksum file of a database from one scan of its records,
+ *  writes it next to the database and renames it into place.  The scan
+ *  runs under lock_db_all(), writers change a record and its checksum
+ *  under the same record lock, so none of them is half way through.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int build_crc_index(int fd){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+    char tmp_path[DB_PATH_MAX + 4];
+    db_scan_t scan;
+    student_t *s;
+    int rc;
+
+    if (h == NULL || h->layout == DB_LAYOUT_HASH)
+        return ERR_DB_FILE;
+
+    //the whole file is built in memory, it is 400 KB
+    char *img = calloc(1, CRC_FILE_SIZE);
+    if (img == NULL)
+        return ERR_DB_FILE;
+    crc_index_hdr_t *hdr = (crc_index_hdr_t *)img;
+    uint32_t *crcs = (uint32_t *)(img + sizeof(*hdr));
+
+    hdr->magic = DB_CRC_MAGIC;
+    hdr->version = DB_CRC_VERSION;
+
+    if (lock_db_all(fd, F_RDLCK) != NO_ERROR) {
+        free(img);
+        return ERR_DB_FILE;
+    }
+    if (open_db_scan(&scan, fd, MIN_STD_ID, MAX_STD_ID) != NO_ERROR) {
+        close_db_scan(&scan);
+        unlock_db_all(fd);
+        free(img);
+        return ERR_DB_FILE;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0)
+        crcs[s->id] = record_crc(s);
+    close_db_scan(&scan);
+
+    crc_index_path(h->path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    bool ok = rc == 0;
+    int tmp_fd = ok ? open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, DB_FILE_MODE)
+                    : -1;
+    if (tmp_fd != -1) {
+        ok = pwrite(tmp_fd, img, CRC_FILE_SIZE, 0) == (ssize_t)CRC_FILE_SIZE;
+        if (ok && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            ok = fdatasync(tmp_fd) == 0;
+        close(tmp_fd);
+        if (!ok || rename(tmp_path, path) != 0) {
+            unlink(tmp_path);
+            ok = false;
+        }
+    } else {
+        ok = false;
+    }
+    free(img);
+
+    if (ok) {
+        close_crc_index(h);
+        ok = open_crc_index(h) == NO_ERROR && h->crc_fd != -1;
+    }
+    unlock_db_all(fd);
+    return ok ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  check_record_crc
+ *      fd:  linux file descriptor
+ *      id:  student id s was read for
+ *      s:   the slot as read, read again if the first check fails
+ *
+ *  Verifies a record read without locks against its checksum.  A writer
+ *  stores the record first and the checksum after it, so a mismatch may
+ *  just be a change in progress:  the record is read again under its
+ *  record lock before it is reported.  A caller that holds locks already
+ *  is not racing any writer for this id.
+ *
+ *  returns:  NO_ERROR if the record is intact or the db keeps no
+ *            checksums, ERR_DB_OP if it is damaged, ERR_DB_FILE on failure
+ */
+int check_record_crc(int fd, int id, student_t *s){
+    db_handle_t *h = db_handle(fd);
+    uint32_t stored;
+
+    if (h == NULL || h->crc_fd == -1 || id < MIN_STD_ID || id > MAX_STD_ID)
+        return NO_ERROR;
+
+    if (crc_read(h, id, &stored) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (stored == record_crc(s))
+        return NO_ERROR;
+    if (holds_db_locks(h))
+        return ERR_DB_OP;
+
+    if (lock_db_slots(fd, id, 1, F_RDLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    int rc = read_db_slot(fd, id, s);
+    if (rc == NO_ERROR)
+        rc = crc_read(h, id, &stored);
+    unlock_db_slots(fd, id, 1);
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+    return stored == record_crc(s) ? NO_ERROR : ERR_DB_OP;
+}
+
+/*
+ *  verify_db
+ *      fd:  linux file descriptor
+ *
+ *  -V.  Checks every slot against its checksum in one scan under
+ *  lock_db_all(F_RDLCK):  a live record must match, an id with a checksum
+ *  but no record lost it.  The checksums are read in one go, the records
+ *  a scan block at a time, so it runs at the speed of the scan.
+ *
+ *  returns:  NO_ERROR if every record is intact, ERR_DB_OP if any is not
+ *            or the db keeps no checksums, ERR_DB_FILE on failure
+ *
+ *  console:  M_DB_CRC_BAD     for each damaged or lost record
+ *            M_DB_VERIFIED    summary
+ *            M_ERR_DB_NO_CRC  the db has no checksum file
+ *            M_ERR_DB_READ    error reading the database
+ */
+int verify_db(int fd){
+    db_handle_t *h = db_handle(fd);
+    struct timespec start, end;
+    db_scan_t scan;
+    student_t *s;
+    int checked = 0, bad = 0;
+    int next_id = MIN_STD_ID;
+    int rc;
+
+    if (h == NULL || h->crc_fd == -1) {
+        printf(M_ERR_DB_NO_CRC);
+        return ERR_DB_OP;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t *crcs = malloc(CRC_FILE_SIZE - sizeof(crc_index_hdr_t));
+    if (crcs == NULL || lock_db_all(fd, F_RDLCK) != NO_ERROR) {
+        free(crcs);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //the file may have been built again while the lock was awaited
+    size_t len = CRC_FILE_SIZE - sizeof(crc_index_hdr_t);
+    if (h->crc_fd == -1 ||
+            pread(h->crc_fd, crcs, len, sizeof(crc_index_hdr_t)) != (ssize_t)len ||
+            open_db_scan(&scan, fd, MIN_STD_ID, MAX_STD_ID) != NO_ERROR) {
+        unlock_db_all(fd);
+        free(crcs);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    while ((rc = next_db_record(&scan, &s)) > 0) {
+        for (; next_id < s->id; next_id++) {
+            if (crcs[next_id] != 0) {
+                printf(M_DB_CRC_BAD, next_id);
+                bad++;
+            }
+        }
+        if (crcs[s->id] != record_crc(s)) {
+            printf(M_DB_CRC_BAD, s->id);
+            bad++;
+        }
+        checked++;
+        next_id = s->id + 1;
+    }
+    close_db_scan(&scan);
+    for (; rc == 0 && next_id <= MAX_STD_ID; next_id++) {
+        if (crcs[next_id] != 0) {
+            printf(M_DB_CRC_BAD, next_id);
+            bad++;
+        }
+    }
+    unlock_db_all(fd);
+    free(crcs);
+
+    if (rc < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    double mb = (double)checked * STUDENT_RECORD_SIZE / (1024 * 1024);
+    printf(M_DB_VERIFIED, checked, secs, secs > 0 ? mb / secs : 0.0, bad);
+    return bad > 0 ? ERR_DB_OP : NO_ERROR;
+}
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+//offsets into the gpa index file, see db.h
+#define GPA_LINKS       ((off_t)((MAX_STD_ID + 1) * sizeof(uint32_t)))
+#define GPA_NEXT_OFF    ((off_t)sizeof(gpa_index_hdr_t))
+#define GPA_PREV_OFF    (GPA_NEXT_OFF + GPA_LINKS)
+#define GPA_HEAD_OFF    (GPA_PREV_OFF + GPA_LINKS)
+#define GPA_FILE_SIZE   (GPA_HEAD_OFF + (off_t)((MAX_STD_GPA + 1) * sizeof(uint32_t)))
+
+/*
+ *  gpa_index_path
+ *      db_path:  name of the database file
+ *      buff:     receives the name of its gpa index
+ *      len:      size of buff
+ */
+void gpa_index_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_GPA_EXT, buff, len);
+}
+
+/*
+ *  gpa_read / gpa_write
+ *      h:    handle with an open gpa index
+ *      off:  offset of a uint32_t in the index file
+ *      v:    value to fill in / to store
+ *
+ *  Access one list link or head, through the mapping when it is mapped.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int gpa_read(db_handle_t *h, off_t off, uint32_t *v){
+    if (h->gpa_map != NULL) {
+        memcpy(v, h->gpa_map + off, sizeof(*v));
+        return NO_ERROR;
+    }
+    if (pread(h->gpa_fd, v, sizeof(*v), off) != (ssize_t)sizeof(*v))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int gpa_write(db_handle_t *h, off_t off, uint32_t v){
+    if (h->gpa_map != NULL) {
+        memcpy(h->gpa_map + off, &v, sizeof(v));
+        return NO_ERROR;
+    }
+    if (pwrite(h->gpa_fd, &v, sizeof(v), off) != (ssize_t)sizeof(v))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+#define NEXT(id)    (GPA_NEXT_OFF + (off_t)(id) * sizeof(uint32_t))
+#define PREV(id)    (GPA_PREV_OFF + (off_t)(id) * sizeof(uint32_t))
+#define HEAD(gpa)   (GPA_HEAD_OFF + (off_t)(gpa) * sizeof(uint32_t))
+
+/*
+ *  open_gpa_index
+ *      h:  handle of a database that is being opened
+ *
+ *  Opens the gpa index of the database if it has one.  A database without
+ *  one has h->gpa_fd == -1, read_gpa_bucket() builds it the first time it
+ *  is needed.  An index that does not look right is ignored (and will be
+ *  rebuilt) rather than failing the open.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_gpa_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    gpa_index_hdr_t hdr;
+    struct stat st;
+
+    h->gpa_fd = -1;
+    h->gpa_map = NULL;
+    h->gpa_dirty = false;
+
+    gpa_index_path(h->path, path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+        return NO_ERROR;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+            hdr.magic != DB_GPA_MAGIC || hdr.version != DB_GPA_VERSION ||
+            fstat(fd, &st) == -1 || st.st_size < GPA_FILE_SIZE) {
+        close(fd);
+        return NO_ERROR;
+    }
+
+    h->gpa_fd = fd;
+    h->gpa_hdr = hdr;
+
+    if (sdb_config.use_mmap) {
+        char *map = mmap(NULL, GPA_FILE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            h->gpa_map = map;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_gpa_index
+ *      h:  handle of a database that is being closed
+ *
+ *  Unmaps and closes the gpa index.  If it was written to the header is
+ *  written back and, with batch or sync durability, the index flushed.
+ */
+void close_gpa_index(db_handle_t *h){
+    if (h->gpa_fd == -1)
+        return;
+
+    if (h->gpa_map != NULL)
+        munmap(h->gpa_map, GPA_FILE_SIZE);
+    if (h->gpa_dirty) {
+        pwrite(h->gpa_fd, &h->gpa_hdr, sizeof(h->gpa_hdr), 0);
+        if (DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            fdatasync(h->gpa_fd);
+    }
+    close(h->gpa_fd);
+
+    h->gpa_fd = -1;
+    h->gpa_map = NULL;
+    h->gpa_dirty = false;
+}
+
+/*
+ *  refresh_gpa_index
+ *      h:  handle of an open database, its superblock lock is held
+ *
+ *  Picks up changes other processes made to the index, like
+ *  refresh_name_index().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int refresh_gpa_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    struct stat path_st, fd_st;
+
+    gpa_index_path(h->path, path, sizeof(path));
+    bool exists = stat(path, &path_st) == 0;
+    if (h->gpa_fd == -1 && !exists)
+        return NO_ERROR;
+
+    if (h->gpa_fd == -1 || !exists || fstat(h->gpa_fd, &fd_st) == -1 ||
+            fd_st.st_ino != path_st.st_ino || fd_st.st_dev != path_st.st_dev) {
+        h->gpa_dirty = false;
+        close_gpa_index(h);
+        return open_gpa_index(h);
+    }
+
+    if (pread(h->gpa_fd, &h->gpa_hdr, sizeof(h->gpa_hdr), 0) !=
+            (ssize_t)sizeof(h->gpa_hdr))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  update_gpa_index
+ *      fd:     linux file descriptor
+ *      s:      record that was just added or deleted
+ *      delta:  1 for an add, -1 for a delete
+ *
+ *  Keeps the gpa index in step with a change that has already been
+ *  written.  An add pushes the id on the front of the list for its gpa, a
+ *  delete unlinks it.  Like the name index the header is only cached until
+ *  save_gpa_index(), and a database without a gpa index is left alone.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int update_gpa_index(int fd, const student_t *s, int delta){
+    db_handle_t *h = db_handle(fd);
+    uint32_t id = s->id;
+    uint32_t head, prev, next;
+
+    if (h == NULL || h->gpa_fd == -1)
+        return NO_ERROR;
+    if (s->id < MIN_STD_ID || s->id > MAX_STD_ID ||
+            s->gpa < MIN_STD_GPA || s->gpa > MAX_STD_GPA)
+        return NO_ERROR;
+
+    if (gpa_read(h, HEAD(s->gpa), &head) != NO_ERROR)
+        return ERR_DB_FILE;
+    h->gpa_dirty = true;
+
+    if (delta > 0) {
+        if (head == id)
+            return NO_ERROR;    //already indexed
+        if (gpa_write(h, NEXT(id), head) != NO_ERROR ||
+                gpa_write(h, PREV(id), 0) != NO_ERROR ||
+                (head != 0 && gpa_write(h, PREV(head), id) != NO_ERROR) ||
+                gpa_write(h, HEAD(s->gpa), id) != NO_ERROR)
+            return ERR_DB_FILE;
+        h->gpa_hdr.count++;
+        return NO_ERROR;
+    }
+
+    if (gpa_read(h, PREV(id), &prev) != NO_ERROR ||
+            gpa_read(h, NEXT(id), &next) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (prev == 0 && head != id)
+        return NO_ERROR;        //was not indexed
+
+    if (gpa_write(h, prev != 0 ? NEXT(prev) : HEAD(s->gpa), next) != NO_ERROR ||
+            (next != 0 && gpa_write(h, PREV(next), prev) != NO_ERROR) ||
+            gpa_write(h, NEXT(id), 0) != NO_ERROR ||
+            gpa_write(h, PREV(id), 0) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->gpa_hdr.count > 0)
+        h->gpa_hdr.count--;
+    return NO_ERROR;
+}
+
+/*
+ *  save_gpa_index
+ *      fd:  linux file descriptor
+ *
+ *  Writes back the cached header of the gpa index if the index changed
+ *  and, with sync durability, flushes the index.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_gpa_index(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->gpa_fd == -1 || !h->gpa_dirty)
+        return NO_ERROR;
+
+    if (pwrite(h->gpa_fd, &h->gpa_hdr, sizeof(h->gpa_hdr), 0) !=
+            (ssize_t)sizeof(h->gpa_hdr))
+        return ERR_DB_FILE;
+
+    if (DB_DATA_DURABILITY != DB_DURABILITY_SYNC)
+        return NO_ERROR;
+    if (h->gpa_map != NULL && msync(h->gpa_map, GPA_FILE_SIZE, MS_SYNC) == -1)
+        return ERR_DB_FILE;
+    if (fdatasync(h->gpa_fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  build_gpa_index
+ *      fd:  linux file descriptor
+ *
+ *  Creates the gpa index of a database from one scan of its records,
+ *  writes it next to the database and renames it into place.  Only needed
+ *  once per database, from then on add and delete keep it current.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int build_gpa_index(int fd){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+    char tmp_path[DB_PATH_MAX + 4];
+    db_scan_t scan;
+    student_t *s;
+    int rc;
+
+    if (h == NULL)
+        return ERR_DB_FILE;
+
+    //the whole file is built in memory, it is 800 KB at most
+    char *img = calloc(1, GPA_FILE_SIZE);
+    if (img == NULL)
+        return ERR_DB_FILE;
+    gpa_index_hdr_t *hdr = (gpa_index_hdr_t *)img;
+    uint32_t *next = (uint32_t *)(img + GPA_NEXT_OFF);
+    uint32_t *prev = (uint32_t *)(img + GPA_PREV_OFF);
+    uint32_t *head = (uint32_t *)(img + GPA_HEAD_OFF);
+
+    hdr->magic = DB_GPA_MAGIC;
+    hdr->version = DB_GPA_VERSION;
+
+    if (open_db_hot_scan(&scan, fd, MIN_STD_ID, MAX_STD_ID) != NO_ERROR) {
+        close_db_scan(&scan);
+        free(img);
+        return ERR_DB_FILE;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0) {
+        if (s->gpa < MIN_STD_GPA || s->gpa > MAX_STD_GPA)
+            continue;
+        if (head[s->gpa] != 0)
+            prev[head[s->gpa]] = s->id;
+        next[s->id] = head[s->gpa];
+        head[s->gpa] = s->id;
+        hdr->count++;
+    }
+    close_db_scan(&scan);
+
+    if (rc < 0) {
+        free(img);
+        return ERR_DB_FILE;
+    }
+
+    gpa_index_path(h->path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, DB_FILE_MODE);
+    if (tmp_fd == -1) {
+        free(img);
+        return ERR_DB_FILE;
+    }
+
+    //only the pages that are not all zero are written, most ids are on no
+    //list in a sparse db
+    static const char zero_page[4096];
+    bool ok = ftruncate(tmp_fd, GPA_FILE_SIZE) == 0;
+    for (off_t off = 0; ok && off < GPA_FILE_SIZE; off += sizeof(zero_page)) {
+        size_t n = sizeof(zero_page);
+        if ((off_t)n > GPA_FILE_SIZE - off)
+            n = GPA_FILE_SIZE - off;
+        if (memcmp(img + off, zero_page, n) != 0)
+            ok = pwrite(tmp_fd, img + off, n, off) == (ssize_t)n;
+    }
+    if (ok && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+        ok = fdatasync(tmp_fd) == 0;
+    close(tmp_fd);
+    free(img);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return ERR_DB_FILE;
+    }
+
+    close_gpa_index(h);
+    return open_gpa_index(h);
+}
+
+static int cmp_ids(const void *a, const void *b){
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+//read_gpa_bucket() without the locking
+static int read_gpa_list(int fd, int gpa, int **ids){
+    db_handle_t *h = db_handle(fd);
+    uint32_t id;
+    int n = 0;
+    int cap = 0;
+    int *out = NULL;
+
+    *ids = NULL;
+    if (h == NULL || gpa < MIN_STD_GPA || gpa > MAX_STD_GPA)
+        return ERR_DB_FILE;
+    if (h->gpa_fd == -1 && (build_gpa_index(fd) != NO_ERROR || h->gpa_fd == -1))
+        return ERR_DB_FILE;
+
+    if (gpa_read(h, HEAD(gpa), &id) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    //a list can not hold more ids than there are, a longer one is a
+    //damaged index
+    while (id != 0) {
+        if (id > MAX_STD_ID || n > MAX_STD_ID) {
+            free(out);
+            return ERR_DB_FILE;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 16;
+            int *bigger = realloc(out, cap * sizeof(int));
+            if (bigger == NULL) {
+                free(out);
+                return ERR_DB_FILE;
+            }
+            out = bigger;
+        }
+        out[n++] = id;
+        if (gpa_read(h, NEXT(id), &id) != NO_ERROR) {
+            free(out);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (n > 1)
+        qsort(out, n, sizeof(int), cmp_ids);
+    *ids = out;
+    return n;
+}
+
+/*
+ *  read_gpa_bucket
+ *      fd:   linux file descriptor
+ *      gpa:  integer gpa, MIN_STD_GPA..MAX_STD_GPA
+ *      ids:  set to a malloc()ed array of the ids with that gpa in
+ *            ascending order, or NULL if there are none.  The caller
+ *            frees it.
+ *
+ *  Returns one list of the gpa index, building the index first if the
+ *  database does not have one yet.  Only the ids sharing one gpa are
+ *  sorted, never the whole table.  The list is read under a shared
+ *  superblock lock, the records are not locked.
+ *
+ *  returns:  the number of ids, ERR_DB_FILE on failure
+ */
+int read_gpa_bucket(int fd, int gpa, int **ids){
+    db_handle_t *h = db_handle(fd);
+
+    //building the index reads every record, writers are held off for that
+    *ids = NULL;
+    bool build = h != NULL && h->gpa_fd == -1;
+    if ((build ? lock_db_all(fd, F_RDLCK) : lock_db_meta(fd, F_RDLCK)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int n = read_gpa_list(fd, gpa, ids);
+    if (build)
+        unlock_db_all(fd);
+    else
+        unlock_db_meta(fd);
+    return n;
+}
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  The hash layout (see db.h).  Every change to the buckets or the
+ *  directory is made under the superblock lock, so writers are one at a
+ *  time.  Readers of a single record take no lock:  a bucket page carries
+ *  the hash prefix of its ids, and a reader that finds a bucket whose
+ *  prefix does not match the id (a split moved the id while the directory
+ *  was being read) simply looks again.  A split writes the new bucket,
+ *  then points the directory at it, then rewrites the old bucket, so the
+ *  record is in the bucket the directory names at every moment.
+ */
+
+#define DIR_OFF(i)      ((off_t)sizeof(db_dir_hdr_t) + (off_t)(i) * sizeof(uint32_t))
+#define DB_DIR_SIZE     ((size_t)DIR_OFF((off_t)1 << DB_HASH_MAX_DEPTH))
+#define HASH_MASK(d)    ((uint32_t)((1ULL << (d)) - 1))
+#define HASH_RETRIES    16      //lookups racing a split before giving up
+#define DIR_COPY_BATCH  16384   //entries copied at once when doubling
+
+//a bucket page as read from the file
+typedef union hash_bucket{
+    db_bucket_hdr_t hdr;
+    student_t       slots[DB_PAGE_SLOTS];   //slot 0 is the header
+} hash_bucket_t;
+
+/*
+ *  hash_dir_path
+ *      db_path:  name of the database file
+ *      buff:     where to build the name of its directory file
+ *      len:      size of buff
+ */
+void hash_dir_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_DIR_EXT, buff, len);
+}
+
+/*
+ *  open_hash_dir
+ *      h:  handle of a database with the hash layout
+ *
+ *  Opens the directory next to the db file and maps it.  The mapping
+ *  reserves room for the largest directory, so one that another process
+ *  doubles stays readable through it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_hash_dir(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    db_dir_hdr_t dh;
+
+    hash_dir_path(h->path, path, sizeof(path));
+    h->dir_fd = open(path, O_RDWR);
+    if (h->dir_fd == -1)
+        return ERR_DB_FILE;
+    if (pread(h->dir_fd, &dh, sizeof(dh), 0) != (ssize_t)sizeof(dh) ||
+            dh.magic != DB_DIR_MAGIC || dh.depth > DB_HASH_MAX_DEPTH) {
+        close(h->dir_fd);
+        h->dir_fd = -1;
+        return ERR_DB_FILE;
+    }
+
+    if (sdb_config.use_mmap) {
+        void *map = mmap(NULL, DB_DIR_SIZE, PROT_READ, MAP_SHARED,
+                         h->dir_fd, 0);
+        if (map != MAP_FAILED)
+            h->dir_map = map;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_hash_dir
+ *      h:  handle being closed
+ *
+ *  Unmaps and closes the directory, flushing it unless the durability
+ *  policy is relaxed.
+ */
+void close_hash_dir(db_handle_t *h){
+    if (h->dir_map != NULL) {
+        munmap(h->dir_map, DB_DIR_SIZE);
+        h->dir_map = NULL;
+    }
+    if (h->dir_fd != -1) {
+        if (h->dirty && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            fdatasync(h->dir_fd);
+        close(h->dir_fd);
+        h->dir_fd = -1;
+    }
+}
+
+/*
+ *  refresh_hash_dir
+ *      h:  handle of a database with the hash layout
+ *
+ *  compress_db() renames a new directory over the one other processes
+ *  have open, which they then reopen.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int refresh_hash_dir(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    struct stat path_st, fd_st;
+
+    hash_dir_path(h->path, path, sizeof(path));
+    if (stat(path, &path_st) == -1 || fstat(h->dir_fd, &fd_st) == -1)
+        return NO_ERROR;    //nothing to switch to
+    if (path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev)
+        return NO_ERROR;
+
+    close_hash_dir(h);
+    return open_hash_dir(h);
+}
+
+/*
+ *  read_dir_hdr / read_dir_entry
+ *      h:      handle of a database with the hash layout
+ *      dh:     directory header to read into
+ *      i:      directory entry, below 2^depth
+ *      entry:  set to the bucket page of entry i
+ *
+ *  The directory is only written with pwrite(), through the mapping when
+ *  there is one it is read.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int read_dir_hdr(db_handle_t *h, db_dir_hdr_t *dh){
+    if (h->dir_map != NULL) {
+        memcpy(dh, h->dir_map, sizeof(*dh));
+        return NO_ERROR;
+    }
+    if (pread(h->dir_fd, dh, sizeof(*dh), 0) != (ssize_t)sizeof(*dh))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int read_dir_entry(db_handle_t *h, uint32_t i, uint32_t *entry){
+    if (h->dir_map != NULL) {
+        memcpy(entry, h->dir_map + DIR_OFF(i), sizeof(*entry));
+        return NO_ERROR;
+    }
+    if (pread(h->dir_fd, entry, sizeof(*entry), DIR_OFF(i)) !=
+            (ssize_t)sizeof(*entry))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_dir(db_handle_t *h, const void *buf, size_t len, off_t off){
+    if (pwrite(h->dir_fd, buf, len, off) != (ssize_t)len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//a whole bucket page, a page past the end of the file reads as empty
+static int read_bucket(db_handle_t *h, uint32_t page, hash_bucket_t *b){
+    ssize_t got = pread(h->fd, b, DB_PAGE_SIZE, (off_t)page * DB_PAGE_SIZE);
+
+    if (got == -1)
+        return ERR_DB_FILE;
+    if (got < DB_PAGE_SIZE)
+        memset((char *)b + got, 0, DB_PAGE_SIZE - got);
+    return NO_ERROR;
+}
+
+static int write_bucket(db_handle_t *h, uint32_t page, const hash_bucket_t *b){
+    if (pwrite(h->fd, b, DB_PAGE_SIZE, (off_t)page * DB_PAGE_SIZE) !=
+            DB_PAGE_SIZE)
+        return ERR_DB_FILE;
+    h->dirty = true;
+    return NO_ERROR;
+}
+
+/*
+ *  find_bucket
+ *      h:     handle of a database with the hash layout
+ *      hash:  db_hash_id() of the id looked for
+ *      page:  set to the bucket page
+ *      b:     set to its contents
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int find_bucket(db_handle_t *h, uint32_t hash, uint32_t *page,
+                       hash_bucket_t *b){
+    db_dir_hdr_t dh;
+
+    for (int tries = 0; tries < HASH_RETRIES; tries++) {
+        if (read_dir_hdr(h, &dh) != NO_ERROR || dh.depth > DB_HASH_MAX_DEPTH ||
+                read_dir_entry(h, hash & HASH_MASK(dh.depth), page) != NO_ERROR ||
+                read_bucket(h, *page, b) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (b->hdr.depth <= DB_HASH_MAX_DEPTH &&
+                (hash & HASH_MASK(b->hdr.depth)) == b->hdr.prefix)
+            return NO_ERROR;
+        //the id moved to a new bucket while we looked, look again, or the
+        //whole file was rebuilt and the directory is an old one
+        if (tries > 0 && refresh_hash_dir(h) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return ERR_DB_FILE;
+}
+
+//the slot of id in the bucket, 0 if it is not there
+static int find_in_bucket(const hash_bucket_t *b, int id){
+    for (uint64_t live = b->hdr.live; live != 0; live &= live - 1) {
+        int i = __builtin_ctzll(live);
+        if (b->slots[1 + i].id == id)
+            return 1 + i;
+    }
+    return 0;
+}
+
+/*
+ *  read_hash_slot
+ *      h:   handle of a database with the hash layout
+ *      id:  student id
+ *      s:   set to the record, or EMPTY_STUDENT_RECORD
+ *
+ *  read_db_slot() for the hash layout.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_hash_slot(db_handle_t *h, int id, student_t *s){
+    hash_bucket_t b;
+    uint32_t page;
+
+    if (find_bucket(h, db_hash_id(id), &page, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int slot = find_in_bucket(&b, id);
+    *s = slot != 0 ? b.slots[slot] : EMPTY_STUDENT_RECORD;
+    return NO_ERROR;
+}
+
+/*
+ *  double_dir
+ *      h:   handle of a database with the hash layout
+ *      dh:  the directory header, its depth is raised by one
+ *
+ *  With the entries indexed by the low bits of the hash, doubling copies
+ *  the entries into the new upper half, nothing else moves.  The new depth
+ *  is written last, until then readers only use the lower half.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int double_dir(db_handle_t *h, db_dir_hdr_t *dh){
+    uint32_t n = 1U << dh->depth;
+    uint32_t *buf = malloc(sizeof(uint32_t) * DIR_COPY_BATCH);
+
+    if (buf == NULL || ftruncate(h->dir_fd, DIR_OFF(2 * (off_t)n)) == -1) {
+        free(buf);
+        return ERR_DB_FILE;
+    }
+    for (uint32_t i = 0; i < n; i += DIR_COPY_BATCH) {
+        size_t len = sizeof(uint32_t) * (n - i < DIR_COPY_BATCH ? n - i
+                                                                : DIR_COPY_BATCH);
+        if (pread(h->dir_fd, buf, len, DIR_OFF(i)) != (ssize_t)len ||
+                write_dir(h, buf, len, DIR_OFF(n + i)) != NO_ERROR) {
+            free(buf);
+            return ERR_DB_FILE;
+        }
+    }
+    free(buf);
+
+    dh->depth++;
+    return write_dir(h, dh, sizeof(*dh), 0);
+}
+
+/*
+ *  split_bucket
+ *      h:     handle of a database with the hash layout
+ *      page:  a full bucket
+ *      b:     its contents, changed to what is left in it
+ *
+ *  Moves the records whose hash has the next bit set to a new bucket at
+ *  the end of the file, see the order of the writes at the top.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure (the directory
+ *            can not grow past DB_HASH_MAX_DEPTH)
+ */
+static int split_bucket(db_handle_t *h, uint32_t page, hash_bucket_t *b){
+    db_dir_hdr_t dh;
+    hash_bucket_t nb;
+
+    if (read_dir_hdr(h, &dh) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (b->hdr.depth >= dh.depth) {
+        if (dh.depth >= DB_HASH_MAX_DEPTH || double_dir(h, &dh) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    uint32_t bit = 1U << b->hdr.depth;
+    uint32_t new_page = dh.nbuckets + 1;
+
+    memset(&nb, 0, sizeof(nb));
+    nb.hdr.depth = b->hdr.depth + 1;
+    nb.hdr.prefix = b->hdr.prefix | bit;
+    for (uint64_t live = b->hdr.live; live != 0; live &= live - 1) {
+        int i = __builtin_ctzll(live);
+        if ((db_hash_id(b->slots[1 + i].id) & bit) == 0)
+            continue;
+        nb.slots[1 + i] = b->slots[1 + i];
+        nb.hdr.live |= 1ULL << i;
+        nb.hdr.count++;
+        b->slots[1 + i] = EMPTY_STUDENT_RECORD;
+    }
+    b->hdr.live &= ~nb.hdr.live;
+    b->hdr.count -= nb.hdr.count;
+    b->hdr.depth++;
+
+    if (write_bucket(h, new_page, &nb) != NO_ERROR)
+        return ERR_DB_FILE;
+    dh.nbuckets++;
+    if (write_dir(h, &dh, sizeof(dh), 0) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    //every entry whose low depth+1 bits are the new prefix
+    for (uint64_t i = nb.hdr.prefix; i < (1ULL << dh.depth); i += 2ULL * bit) {
+        if (write_dir(h, &new_page, sizeof(new_page), DIR_OFF(i)) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return write_bucket(h, page, b);
+}
+
+/*
+ *  put_hash_slot
+ *      h:   handle of a database with the hash layout, the caller holds
+ *           the superblock lock
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  An add goes to a free slot of the bucket of id, splitting it first
+ *  when it is full, the record is written before the header makes it
+ *  live.  A delete clears the bit in the header and then the slot.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int put_hash_slot(db_handle_t *h, int id, const student_t *s){
+    uint32_t hash = db_hash_id(id);
+    hash_bucket_t b;
+    uint32_t page;
+    int rc = NO_ERROR;
+
+    for (;;) {
+        if (find_bucket(h, hash, &page, &b) != NO_ERROR)
+            return ERR_DB_FILE;
+        int slot = find_in_bucket(&b, id);
+        off_t page_off = (off_t)page * DB_PAGE_SIZE;
+
+        if (is_empty_record(s)) {
+            if (slot == 0)
+                return NO_ERROR;    //not there, nothing to clear
+            b.hdr.live &= ~(1ULL << (slot - 1));
+            b.hdr.count--;
+            if (pwrite(h->fd, &b.hdr, sizeof(b.hdr), page_off) !=
+                        (ssize_t)sizeof(b.hdr) ||
+                    pwrite(h->fd, s, STUDENT_RECORD_SIZE,
+                           page_off + (off_t)slot * STUDENT_RECORD_SIZE) !=
+                        STUDENT_RECORD_SIZE)
+                rc = ERR_DB_FILE;
+            break;
+        }
+
+        if (slot == 0 && b.hdr.count < DB_PAGE_RECORDS) {
+            slot = 1 + __builtin_ctzll(~b.hdr.live);
+            b.hdr.live |= 1ULL << (slot - 1);
+            b.hdr.count++;
+        }
+        if (slot != 0) {
+            if (pwrite(h->fd, s, STUDENT_RECORD_SIZE,
+                       page_off + (off_t)slot * STUDENT_RECORD_SIZE) !=
+                        STUDENT_RECORD_SIZE ||
+                    pwrite(h->fd, &b.hdr, sizeof(b.hdr), page_off) !=
+                        (ssize_t)sizeof(b.hdr))
+                rc = ERR_DB_FILE;
+            break;
+        }
+
+        if (split_bucket(h, page, &b) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    h->dirty = true;
+    return rc;
+}
+
+/*
+ *  apply_hash_slot
+ *      h:   handle of a database with the hash layout, the caller holds
+ *           the superblock lock
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  apply_db_slot() for the hash layout, put_hash_slot() flushed according
+ *  to the durability policy.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int apply_hash_slot(db_handle_t *h, int id, const student_t *s){
+    int rc = put_hash_slot(h, id, s);
+
+    if (rc == NO_ERROR && DB_DATA_DURABILITY == DB_DURABILITY_SYNC &&
+            (fdatasync(h->fd) == -1 || fdatasync(h->dir_fd) == -1))
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+static int cmp_student_id(const void *a, const void *b){
+    int ia = ((const student_t *)a)->id;
+    int ib = ((const student_t *)b)->id;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ *  read_hash_records
+ *      h:         handle of a database with the hash layout
+ *      first_id:  lowest id wanted
+ *      last_id:   highest id wanted
+ *      buf:       SCAN_BLOCK_SIZE bytes to read the buckets through
+ *      recs:      set to a malloc()ed array of the records, by id
+ *
+ *  The ids of a range are spread over every bucket, so the whole file is
+ *  read, SCAN_BLOCK_SIZE at a time, and the live records in the range are
+ *  sorted.  Used by the scan iterator, which keeps id order this way.
+ *
+ *  returns:  the number of records, ERR_DB_FILE on failure
+ */
+int read_hash_records(db_handle_t *h, int first_id, int last_id, char *buf,
+                      student_t **recs){
+    int n = 0;
+    int cap = 0;
+    off_t off = DB_PAGE_SIZE;
+
+    *recs = NULL;
+    for (;;) {
+        ssize_t got = pread(h->fd, buf, SCAN_BLOCK_SIZE, off);
+        if (got == -1) {
+            free(*recs);
+            *recs = NULL;
+            return ERR_DB_FILE;
+        }
+
+        for (ssize_t p = 0; p + DB_PAGE_SIZE <= got; p += DB_PAGE_SIZE) {
+            const hash_bucket_t *b = (const hash_bucket_t *)(buf + p);
+
+            for (uint64_t live = b->hdr.live; live != 0; live &= live - 1) {
+                const student_t *s = &b->slots[1 + __builtin_ctzll(live)];
+                if (s->id < first_id || s->id > last_id)
+                    continue;
+                if (n == cap) {
+                    cap = cap > 0 ? cap * 2 : 1024;
+                    student_t *grown = realloc(*recs, sizeof(student_t) * cap);
+                    if (grown == NULL) {
+                        free(*recs);
+                        *recs = NULL;
+                        return ERR_DB_FILE;
+                    }
+                    *recs = grown;
+                }
+                (*recs)[n++] = *s;
+            }
+        }
+        if (got < SCAN_BLOCK_SIZE)
+            break;
+        off += got;
+    }
+
+    if (n > 0)
+        qsort(*recs, n, sizeof(student_t), cmp_student_id);
+    return n;
+}
+
+/*
+ *  write_hash_db
+ *      fd:    linux file descriptor of the db, locked by the caller
+ *      recs:  n records, entries with id 0 are skipped
+ *      n:     number of entries
+ *      hdr:   the header to write, with the hash layout
+ *
+ *  Replaces the contents of the db file with a hash db of recs:  the file
+ *  is cut to one empty bucket, the records are added one by one the way
+ *  apply_hash_slot() adds them, and the new directory is flushed and
+ *  renamed over the old one.  The header is written last, flushing the db
+ *  file is left to the caller.  Used by --migrate=hash and by
+ *  compress_db(), which gets rid of the buckets deletes have emptied.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int write_hash_db(int fd, const student_t *recs, int n, const db_header_t *hdr){
+    db_handle_t *owner = db_handle(fd);
+    char path[DB_PATH_MAX];
+    char tmp_path[DB_PATH_MAX + 4];
+    db_handle_t h = { .fd = fd, .dir_fd = -1 };
+    db_dir_hdr_t dh = { .magic = DB_DIR_MAGIC, .depth = 0, .nbuckets = 1 };
+    hash_bucket_t b;
+    uint32_t first_bucket = 1;
+    int rc = NO_ERROR;
+
+    if (owner == NULL)
+        return ERR_DB_FILE;
+    hash_dir_path(owner->path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    h.dir_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, DB_FILE_MODE);
+    if (h.dir_fd == -1)
+        return ERR_DB_FILE;
+
+    memset(&b, 0, sizeof(b));
+    if (truncate_db_file(fd, 0) != NO_ERROR ||
+            write_bucket(&h, 1, &b) != NO_ERROR ||
+            write_dir(&h, &dh, sizeof(dh), 0) != NO_ERROR ||
+            write_dir(&h, &first_bucket, sizeof(first_bucket), DIR_OFF(0)) != NO_ERROR)
+        rc = ERR_DB_FILE;
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++) {
+        if (recs[i].id != DELETED_STUDENT_ID)
+            rc = put_hash_slot(&h, recs[i].id, &recs[i]);
+    }
+
+    if (rc == NO_ERROR && (fdatasync(h.dir_fd) == -1 || rename(tmp_path, path) != 0))
+        rc = ERR_DB_FILE;
+    close(h.dir_fd);
+    if (rc != NO_ERROR) {
+        unlink(tmp_path);
+        return rc;
+    }
+    return write_db_header(fd, hdr);
+}
@@ -0,0 +1,354 @@
+#define _GNU_SOURCE     //F_OFD_SETLK, F_OFD_SETLKW
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Record locking.  Processes working on the same db coordinate with
+ *  fcntl() open file description (OFD) locks.  Unlike classic POSIX record
+ *  locks they belong to the open file rather than to the process, so they
+ *  are not dropped when some other descriptor for the file is closed.
+ *
+ *  The locked bytes are a name space and not the bytes being written:  the
+ *  record of id N is locked as bytes N*64..N*64+63 whatever the layout.
+ *  Slot 0 (the superblock) stands for everything derived from the records:
+ *  the statistics, the name and gpa indexes, and in the compact layout the
+ *  id -> slot index and the allocation of slots.
+ *
+ *  Locks are always taken in the same order:  records, then the lock of
+ *  the write-ahead log (see sdb_wal.c), then the superblock.  Nobody holding
+ *  a later one waits for an earlier one, so writers can not deadlock each
+ *  other.  Locks of one descriptor on the same bytes merge, so the
+ *  superblock lock is counted and only released by the outermost
+ *  unlock_db_meta().
+ */
+
+/*
+ *  lock_db_range
+ *      fd:     linux file descriptor
+ *      start:  first byte to lock
+ *      len:    bytes to lock, 0 for everything from start on
+ *      type:   F_RDLCK (shared) or F_WRLCK (exclusive)
+ *      wait:   block until the lock is granted
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_OP if wait is false and another
+ *            process holds a conflicting lock, ERR_DB_FILE on failure
+ */
+int lock_db_range(int fd, off_t start, off_t len, short type, bool wait){
+    struct flock fl = {
+        .l_type = type, .l_whence = SEEK_SET, .l_start = start, .l_len = len,
+    };
+
+    while (fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl) == -1) {
+        if (errno == EINTR)
+            continue;
+        if (!wait && (errno == EAGAIN || errno == EACCES))
+            return ERR_DB_OP;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void unlock_db_range(int fd, off_t start, off_t len){
+    struct flock fl = {
+        .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = start, .l_len = len,
+    };
+
+    fcntl(fd, F_OFD_SETLK, &fl);
+}
+
+/*
+ *  refresh_file_len
+ *      h:  handle whose record or superblock lock was just taken
+ *
+ *  Another process may have cut the file (-z, compress_db(), --migrate)
+ *  while this one waited for the lock, the mapping must not be read past
+ *  the new end.  The file is only cut while every record is locked
+ *  exclusively, so the size stays good for as long as the lock is held.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int refresh_file_len(db_handle_t *h){
+    struct stat st;
+
+    if (h->map == NULL)
+        return NO_ERROR;
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+    h->file_len = st.st_size;
+    return NO_ERROR;
+}
+
+/*
+ *  db_file_replaced
+ *      h:  handle of an open database
+ *
+ *  compress_db() writes the compressed db to a new file and renames it over
+ *  the old one while it holds every record lock.  A process waiting for
+ *  one of them gets it on the old file, which by then has no name.
+ *
+ *  returns:  true if h->path names another file than the one h has open
+ */
+static bool db_file_replaced(const db_handle_t *h){
+    struct stat path_st, fd_st;
+
+    if (h->snapshot || stat(h->path, &path_st) == -1 ||
+            fstat(h->fd, &fd_st) == -1)
+        return false;       //nothing to switch to
+    return path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev;
+}
+
+/*
+ *  switch_db_file
+ *      fd:     linux file descriptor
+ *      start:  first byte of the lock just taken
+ *      len:    its length
+ *
+ *  Called with a lock just taken.  If the db file was replaced while this
+ *  process waited, the lock is dropped and the new file is opened in place
+ *  of the old one (reopen_db()), the caller then locks again.  Locks taken
+ *  earlier would be lost with the old file, with any held this fails.
+ *
+ *  returns:  NO_ERROR if the file was not replaced, ERR_DB_OP if it was
+ *            reopened, ERR_DB_FILE on failure
+ */
+static int switch_db_file(int fd, off_t start, off_t len){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || !db_file_replaced(h))
+        return NO_ERROR;
+
+    unlock_db_range(fd, start, len);
+    if (holds_db_locks(h) || reopen_db(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return ERR_DB_OP;
+}
+
+/*
+ *  layout_changed
+ *      h:  handle of an open database
+ *
+ *  --migrate rewrites the db file in place while other processes may have
+ *  it open, they must not go on using the layout they found at open.
+ *
+ *  returns:  true if the header in the file names another layout than h
+ */
+static bool layout_changed(db_handle_t *h){
+    db_header_t hdr;
+
+    if (refresh_file_len(h) != NO_ERROR)
+        return true;
+    if (h->map != NULL && h->file_len >= (off_t)sizeof(hdr)) {
+        memcpy(&hdr, h->map, sizeof(hdr));
+        if (hdr.magic != DB_MAGIC)
+            hdr.layout = DB_LAYOUT_DIRECT;
+    } else if (read_db_header(h->fd, &hdr) == ERR_DB_FILE) {
+        return true;
+    }
+    return hdr.layout != h->layout;
+}
+
+/*
+ *  lock_db_slots / unlock_db_slots
+ *      fd:      linux file descriptor
+ *      first:   first student id to lock
+ *      nslots:  number of ids
+ *      type:    F_RDLCK or F_WRLCK
+ *
+ *  Locks the records of ids first..first+nslots-1, waiting for writers
+ *  that have any of them locked.  A db file compress_db() replaced in the
+ *  meantime is switched to first (switch_db_file()).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure or if the db was
+ *            migrated to another layout since this process opened it
+ */
+int lock_db_slots(int fd, int first, int nslots, short type){
+    off_t start = (off_t)first * STUDENT_RECORD_SIZE;
+    off_t len = (off_t)nslots * STUDENT_RECORD_SIZE;
+    int rc;
+
+    do {
+        if (lock_db_range(fd, start, len, type, true) != NO_ERROR)
+            return ERR_DB_FILE;
+    } while ((rc = switch_db_file(fd, start, len)) == ERR_DB_OP);
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_handle_t *h = db_handle(fd);
+    if (h != NULL && layout_changed(h)) {
+        unlock_db_range(fd, start, len);
+        return ERR_DB_FILE;
+    }
+    if (h != NULL)
+        h->slot_locks++;
+    return NO_ERROR;
+}
+
+void unlock_db_slots(int fd, int first, int nslots){
+    db_handle_t *h = db_handle(fd);
+
+    unlock_db_range(fd, (off_t)first * STUDENT_RECORD_SIZE,
+                    (off_t)nslots * STUDENT_RECORD_SIZE);
+    if (h != NULL && h->slot_locks > 0)
+        h->slot_locks--;
+}
+
+/*
+ *  lock_db_page / unlock_db_page
+ *      fd:    linux file descriptor
+ *      page:  page of a db with the paged layout
+ *
+ *  Serializes the changes to one page header (see sdb_page.c).  Record
+ *  locks of different ids on the page do not conflict, so the header has a
+ *  lock of its own, a byte past the records at DB_PAGE_LOCK_OFF + page.
+ *  It is the innermost lock, nobody waits for another lock while holding
+ *  it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int lock_db_page(int fd, int page){
+    return lock_db_range(fd, DB_PAGE_LOCK_OFF + page, 1, F_WRLCK, true);
+}
+
+void unlock_db_page(int fd, int page){
+    unlock_db_range(fd, DB_PAGE_LOCK_OFF + page, 1);
+}
+
+/*
+ *  refresh_db_handle
+ *      h:  handle whose superblock lock was just taken
+ *
+ *  Other processes may have changed the superblock and the indexes since
+ *  this process last held the lock.  Their headers are read again and an
+ *  index that was rebuilt (renamed into place) is reopened, as is the
+ *  directory of a hashed db.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int refresh_db_handle(db_handle_t *h){
+    db_header_t hdr;
+
+    int rc = read_db_header(h->fd, &hdr);
+    if (rc == ERR_DB_FILE)
+        return ERR_DB_FILE;
+    if (rc == NO_ERROR) {
+        h->hdr = hdr;
+        h->stats_valid = hdr.version >= DB_STATS_VERSION;
+        h->hdr_dirty = false;
+    } else {
+        //records with no header (see init_db_header()), nobody keeps the
+        //statistics of this db, the cached ones must not be used either
+        h->stats_valid = false;
+        h->hdr_dirty = false;
+    }
+
+    if (h->layout == DB_LAYOUT_HASH)
+        return refresh_hash_dir(h);     //keeps no indexes
+    if (refresh_name_index(h) != NO_ERROR || refresh_gpa_index(h) != NO_ERROR ||
+            refresh_crc_index(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  lock_db_meta / unlock_db_meta
+ *      fd:    linux file descriptor
+ *      type:  F_RDLCK to read the indexes, F_WRLCK to change them
+ *
+ *  Takes the superblock lock, or counts one more use of it if this
+ *  descriptor already holds it.  Whoever changes what it protects writes
+ *  the headers back (save_db_indexes()) before the last unlock.  Nothing
+ *  is locked on a snapshot.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int lock_db_meta(int fd, short type){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->snapshot)
+        return NO_ERROR;
+    if (h->meta_locks > 0) {
+        h->meta_locks++;
+        return NO_ERROR;
+    }
+
+    int rc;
+    do {
+        if (lock_db_range(fd, 0, STUDENT_RECORD_SIZE, type, true) != NO_ERROR)
+            return ERR_DB_FILE;
+    } while ((rc = switch_db_file(fd, 0, STUDENT_RECORD_SIZE)) == ERR_DB_OP);
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    h = db_handle(fd);
+    if (refresh_file_len(h) != NO_ERROR || refresh_db_handle(h) != NO_ERROR) {
+        unlock_db_range(fd, 0, STUDENT_RECORD_SIZE);
+        return ERR_DB_FILE;
+    }
+    h->meta_locks = 1;
+    return NO_ERROR;
+}
+
+void unlock_db_meta(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->meta_locks == 0)
+        return;
+    if (--h->meta_locks == 0)
+        unlock_db_range(fd, 0, STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  lock_db_all / unlock_db_all
+ *      fd:    linux file descriptor
+ *      type:  F_RDLCK to keep writers out, F_WRLCK to keep everyone out
+ *
+ *  Locks every record and then the superblock (exclusively), for the
+ *  operations that work on the whole db:  rebuilding the statistics or an
+ *  index, compress_db().  The records of every id the hash layout can
+ *  hold are locked whatever the layout, so that a migration between the
+ *  lock and the unlock does not leave any behind.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int lock_db_all(int fd, short type){
+    if (lock_db_slots(fd, MIN_STD_ID, DB_HASH_MAX_ID, type) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (lock_db_meta(fd, F_WRLCK) != NO_ERROR) {
+        unlock_db_slots(fd, MIN_STD_ID, DB_HASH_MAX_ID);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void unlock_db_all(int fd){
+    unlock_db_meta(fd);
+    unlock_db_slots(fd, MIN_STD_ID, DB_HASH_MAX_ID);
+}
+
+/*
+ *  holds_db_locks
+ *      h:  handle of an open database
+ *
+ *  A scan started by a writer (for example to find the new lowest id after
+ *  a delete) must not lock blocks itself:  unlocking them would also drop
+ *  the writer's own record lock.  A snapshot needs no locks at all, it is
+ *  treated as locked already.
+ *
+ *  returns:  true if this process holds record or superblock locks on h,
+ *            or h is a snapshot
+ */
+bool holds_db_locks(const db_handle_t *h){
+    return h != NULL &&
+           (h->slot_locks > 0 || h->meta_locks > 0 || h->snapshot);
+}
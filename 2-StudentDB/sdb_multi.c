@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Multi-id -f and -d.  Instead of one process and one lseek()/read() per
+ *  id, the ids are sorted, mapped to the slots that hold them and slots
+ *  that sit next to each other in the file are read or written with one
+ *  preadv()/pwritev().  Results are reported in the order the ids were
+ *  given.
+ */
+
+//a record to read:  its slot in the file and where it goes in the output
+typedef struct multi_slot{
+    uint32_t slot;
+    int      idx;
+} multi_slot_t;
+
+static int cmp_multi_slot(const void *a, const void *b){
+    const multi_slot_t *sa = a;
+    const multi_slot_t *sb = b;
+
+    if (sa->slot != sb->slot)
+        return sa->slot < sb->slot ? -1 : 1;
+    return sa->idx - sb->idx;
+}
+
+static int cmp_id(const void *a, const void *b){
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ *  read_slot_run
+ *      fd:     linux file descriptor
+ *      order:  records in adjacent slots, order[i].slot == order[0].slot + i
+ *      n:      number of records, at most BULK_MAX_IOV
+ *      recs:   output array, recs[order[i].idx] is set, cleared beforehand
+ *
+ *  One preadv() for a run of adjacent slots.  A short read means the run
+ *  crosses EOF, the slots past it stay empty.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int read_slot_run(int fd, const multi_slot_t *order, int n,
+                         student_t *recs){
+    struct iovec iov[BULK_MAX_IOV];
+
+    for (int i = 0; i < n; i++) {
+        iov[i].iov_base = &recs[order[i].idx];
+        iov[i].iov_len = STUDENT_RECORD_SIZE;
+    }
+    if (preadv(fd, iov, n, (off_t)order[0].slot * STUDENT_RECORD_SIZE) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  read_db_slots
+ *      fd:    linux file descriptor
+ *      ids:   student ids, in any order
+ *      n:     number of ids
+ *      recs:  n records, recs[i] is set to the record of ids[i] or to
+ *             EMPTY_STUDENT_RECORD
+ *
+ *  read_db_slot() for many ids at once.  In the direct and compact layouts
+ *  every id is turned into its slot, the slots are sorted and each run of
+ *  adjacent slots is read with one preadv().  The paged and split layouts
+ *  read their records a page or a column entry at a time anyway, the hash
+ *  layout one bucket per id and the packed layout records of their own
+ *  length, those go through read_db_slot().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_db_slots(int fd, const int *ids, int n, student_t *recs){
+    db_handle_t *h = db_handle(fd);
+    int layout = h != NULL ? h->layout : DB_LAYOUT_DIRECT;
+    int max_id = db_max_id(fd);
+    int m = 0;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < n; i++)
+        recs[i] = EMPTY_STUDENT_RECORD;
+
+    if (layout == DB_LAYOUT_PAGED || layout == DB_LAYOUT_SPLIT ||
+            layout == DB_LAYOUT_HASH || layout == DB_LAYOUT_PACKED) {
+        for (int i = 0; i < n && rc == NO_ERROR; i++) {
+            if (ids[i] >= MIN_STD_ID && ids[i] <= max_id)
+                rc = read_db_slot(fd, ids[i], &recs[i]);
+        }
+        return rc;
+    }
+
+    multi_slot_t *order = malloc(sizeof(multi_slot_t) * (n > 0 ? n : 1));
+    if (order == NULL)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++) {
+        uint32_t slot = ids[i];
+
+        if (ids[i] < MIN_STD_ID || ids[i] > MAX_STD_ID)
+            continue;
+        if (layout == DB_LAYOUT_COMPACT) {
+            if (read_slot_index(h, ids[i], &slot) != NO_ERROR) {
+                free(order);
+                return ERR_DB_FILE;
+            }
+            if (slot == 0)
+                continue;
+        }
+        order[m].slot = slot;
+        order[m].idx = i;
+        m++;
+    }
+    qsort(order, m, sizeof(multi_slot_t), cmp_multi_slot);
+
+    //a repeated id is read once and copied, everything else in runs
+    for (int i = 0; i < m && rc == NO_ERROR; ) {
+        int j = i + 1;
+        while (j < m && order[j].slot == order[j - 1].slot + 1 &&
+                j - i < BULK_MAX_IOV)
+            j++;
+        //a run stops at a repeated slot, the copies are filled in after it
+        rc = read_slot_run(fd, &order[i], j - i, recs);
+        while (j < m && order[j].slot == order[j - 1].slot) {
+            recs[order[j].idx] = recs[order[j - 1].idx];
+            j++;
+        }
+        i = j;
+    }
+    free(order);
+    return rc;
+}
+
+/*
+ *  get_students
+ *      fd:   linux file descriptor
+ *      ids:  student ids, in the order they are to be printed
+ *      n:    number of ids
+ *
+ *  -f with several ids.  The found students are printed as one table in
+ *  the order of ids, an id that is not in the db gets the not found
+ *  message at its place.  With a single id the output is that of -f.
+ *
+ *  returns:  NO_ERROR       every student was found
+ *            SRCH_NOT_FOUND at least one was not
+ *            ERR_DB_FILE    database file I/O issue or a damaged record
+ *
+ *  console:  the table and M_STD_NOT_FND_MSG lines as described
+ *            M_DB_CRC_BAD     at the place of a damaged record
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int get_students(int fd, const int *ids, int n){
+    student_t *recs = malloc(sizeof(student_t) * (n > 0 ? n : 1));
+    bool header = false;
+    int rc = NO_ERROR;
+
+    if (recs == NULL || read_db_slots(fd, ids, n, recs) != NO_ERROR) {
+        free(recs);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int crc_rc = check_record_crc(fd, ids[i], &recs[i]);
+        if (crc_rc == ERR_DB_OP) {
+            printf(M_DB_CRC_BAD, ids[i]);
+            rc = ERR_DB_FILE;
+            continue;
+        }
+        if (crc_rc != NO_ERROR) {
+            free(recs);
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (is_empty_record(&recs[i])) {
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+            rc = SRCH_NOT_FOUND;
+            continue;
+        }
+        if (!header) {
+            printf(STUDENT_PRINT_HDR_STRING, "ID",
+                        "FIRST NAME", "LAST_NAME", "GPA");
+            header = true;
+        }
+        printf(STUDENT_PRINT_FMT_STRING, recs[i].id, recs[i].fname,
+               recs[i].lname, (float)(recs[i].gpa) / 100);
+    }
+    free(recs);
+    return rc;
+}
+
+/*
+ *  clear_slot_runs
+ *      fd:   linux file descriptor of a db with the direct layout
+ *      ids:  ids to clear, ascending
+ *      n:    number of ids
+ *
+ *  Writes EMPTY_STUDENT_RECORD over the slots of ids, one pwritev() per
+ *  run of adjacent ids, and punches the blocks that became empty.  They
+ *  are punched once for the whole span of ids, which the caller holds
+ *  locked:  the locks punch_empty_blocks() takes and drops around a run
+ *  would also drop the caller's on the ids next to it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int clear_slot_runs(int fd, const int *ids, int n){
+    struct iovec iov[BULK_MAX_IOV];
+
+    for (int i = 0; i < BULK_MAX_IOV; i++) {
+        iov[i].iov_base = (void *)&EMPTY_STUDENT_RECORD;
+        iov[i].iov_len = STUDENT_RECORD_SIZE;
+    }
+
+    for (int i = 0; i < n; ) {
+        int j = i + 1;
+        while (j < n && ids[j] == ids[j - 1] + 1 && j - i < BULK_MAX_IOV)
+            j++;
+
+        off_t start = (off_t)ids[i] * STUDENT_RECORD_SIZE;
+        ssize_t want = (ssize_t)(j - i) * STUDENT_RECORD_SIZE;
+        if (pwritev(fd, iov, j - i, start) != want)
+            return ERR_DB_FILE;
+        i = j;
+    }
+    if (n > 0)
+        punch_empty_blocks(fd, (off_t)ids[0] * STUDENT_RECORD_SIZE,
+                           ((off_t)ids[n - 1] + 1) * STUDENT_RECORD_SIZE);
+    return NO_ERROR;
+}
+
+/*
+ *  remove_students
+ *      fd:    linux file descriptor, the ids are write locked
+ *      recs:  the records to remove, ascending ids
+ *      n:     number of records
+ *
+ *  Second half of del_students().  The deletes are logged with one commit,
+ *  then applied and the indexes updated and saved once, under the
+ *  superblock lock.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int remove_students(int fd, const student_t *recs, int n){
+    db_handle_t *h = db_handle(fd);
+    int rc = wal_begin(fd);
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++)
+        rc = wal_append(fd, recs[i].id, &EMPTY_STUDENT_RECORD);
+    if (rc == NO_ERROR)
+        rc = wal_commit(fd);
+    if (rc != NO_ERROR) {
+        wal_end(fd);
+        return ERR_DB_FILE;
+    }
+
+    if (lock_db_meta(fd, F_WRLCK) != NO_ERROR) {
+        wal_end(fd);
+        return ERR_DB_FILE;
+    }
+
+    if (h == NULL || h->layout == DB_LAYOUT_DIRECT) {
+        int *ids = malloc(sizeof(int) * n);
+        if (ids == NULL) {
+            rc = ERR_DB_FILE;
+        } else {
+            for (int i = 0; i < n; i++)
+                ids[i] = recs[i].id;
+            rc = clear_slot_runs(fd, ids, n);
+            free(ids);
+        }
+        if (h != NULL)
+            h->dirty = true;
+        if (rc == NO_ERROR && DB_DATA_DURABILITY == DB_DURABILITY_SYNC &&
+                fdatasync(fd) == -1)
+            rc = ERR_DB_FILE;
+    } else {
+        for (int i = 0; i < n && rc == NO_ERROR; i++)
+            rc = apply_db_slot(fd, recs[i].id, &EMPTY_STUDENT_RECORD);
+    }
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++)
+        rc = update_db_indexes(fd, &recs[i], -1);
+    if (rc == NO_ERROR)
+        rc = save_db_indexes(fd);
+    unlock_db_meta(fd);
+    wal_end(fd);
+    return rc;
+}
+
+/*
+ *  del_students
+ *      fd:   linux file descriptor
+ *      ids:  student ids, in the order they are to be reported
+ *      n:    number of ids
+ *
+ *  -d with several ids.  The id span is write locked, as a bulk load
+ *  batch is, the records are read with read_db_slots() and the ones found
+ *  are removed together (see remove_students()).  Each id is reported at
+ *  its place, an id given twice is deleted the first time and not found
+ *  the second, as with separate -d runs.  With a single id the output is
+ *  that of -d.
+ *
+ *  returns:  NO_ERROR       every student was deleted
+ *            ERR_DB_OP      at least one was not in the database
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_STD_DEL_MSG and M_STD_NOT_FND_MSG lines as described
+ *            M_ERR_DB_READ    error reading the database file
+ *            M_ERR_DB_WRITE   error writing to the database file
+ */
+int del_students(int fd, const int *ids, int n){
+    int *uniq = malloc(sizeof(int) * (n > 0 ? n : 1));
+    student_t *recs = malloc(sizeof(student_t) * (n > 0 ? n : 1));
+    bool *reported = calloc(n > 0 ? n : 1, sizeof(bool));
+    int max_id = db_max_id(fd);
+    int m = 0;
+    int found = 0;
+    int rc = NO_ERROR;
+
+    if (uniq == NULL || recs == NULL || reported == NULL) {
+        free(uniq);
+        free(recs);
+        free(reported);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //the ids that can be in the db, ascending and once each
+    for (int i = 0; i < n; i++) {
+        if (ids[i] >= MIN_STD_ID && ids[i] <= max_id)
+            uniq[m++] = ids[i];
+    }
+    qsort(uniq, m, sizeof(int), cmp_id);
+    int kept = 0;
+    for (int i = 0; i < m; i++) {
+        if (kept == 0 || uniq[kept - 1] != uniq[i])
+            uniq[kept++] = uniq[i];
+    }
+    m = kept;
+
+    int first = m > 0 ? uniq[0] : 0;
+    int nids = m > 0 ? uniq[m - 1] - first + 1 : 0;
+    if (m > 0 && lock_db_slots(fd, first, nids, F_WRLCK) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+        printf(M_ERR_DB_READ);
+    } else if (m > 0) {
+        if (read_db_slots(fd, uniq, m, recs) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            printf(M_ERR_DB_READ);
+        } else {
+            for (int i = 0; i < m; i++) {
+                if (!is_empty_record(&recs[i])) {
+                    uniq[found] = uniq[i];
+                    recs[found++] = recs[i];
+                }
+            }
+            if (found > 0 && remove_students(fd, recs, found) != NO_ERROR) {
+                rc = ERR_DB_FILE;
+                printf(M_ERR_DB_WRITE);
+            }
+        }
+        unlock_db_slots(fd, first, nids);
+    }
+
+    for (int i = 0; i < n && rc != ERR_DB_FILE; i++) {
+        int *hit = bsearch(&ids[i], uniq, found, sizeof(int), cmp_id);
+        if (hit != NULL && !reported[hit - uniq]) {
+            reported[hit - uniq] = true;
+            printf(M_STD_DEL_MSG, ids[i]);
+        } else {
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+            rc = ERR_DB_OP;
+        }
+    }
+
+    free(uniq);
+    free(recs);
+    free(reported);
+    return rc;
+}
+
+/*
+ *  read_ids_file
+ *      path:  file of ids, "-" reads standard input
+ *      ids:   set to a malloc()ed array of the ids in file order
+ *      n:     set to the number of ids
+ *
+ *  The ids are separated by white space or commas, so one id per line,
+ *  a line of ids or the first column of -b CSV without its other columns
+ *  all work.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the file can not be
+ *            read, ERR_DB_OP if it holds something that is not an id
+ *
+ *  console:  M_ERR_IDS_OPEN  the file can not be opened
+ *            M_ERR_BAD_ID    a word in the file is not an id
+ */
+int read_ids_file(const char *path, int **ids, int *n){
+    FILE *in = stdin;
+    char word[32];
+    int len = 0;
+    int cap = 0;
+    int c;
+    int rc = NO_ERROR;
+
+    *ids = NULL;
+    *n = 0;
+    if (strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            printf(M_ERR_IDS_OPEN, path);
+            return ERR_DB_FILE;
+        }
+    }
+
+    do {
+        c = getc(in);
+        if (c != EOF && !isspace(c) && c != ',') {
+            if (len < (int)sizeof(word) - 1)
+                word[len] = c;
+            len++;
+            continue;
+        }
+        if (len == 0)
+            continue;
+
+        bool too_long = len >= (int)sizeof(word);
+        word[too_long ? (int)sizeof(word) - 1 : len] = '\0';
+        len = 0;
+        int id;
+        if (too_long || !parse_int_arg(word, &id)) {
+            printf(M_ERR_BAD_ID, word);
+            rc = ERR_DB_OP;
+            break;
+        }
+        if (*n == cap) {
+            cap = cap > 0 ? cap * 2 : 1024;
+            int *grown = realloc(*ids, sizeof(int) * cap);
+            if (grown == NULL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            *ids = grown;
+        }
+        (*ids)[(*n)++] = id;
+    } while (c != EOF);
+
+    if (rc == NO_ERROR && ferror(in))
+        rc = ERR_DB_FILE;
+    if (in != stdin)
+        fclose(in);
+    if (rc != NO_ERROR) {
+        free(*ids);
+        *ids = NULL;
+        *n = 0;
+    }
+    return rc;
+}
@@ -0,0 +1,658 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+//offsets into the name index file, see db.h
+#define NAME_LINKS      ((off_t)((MAX_STD_ID + 1) * sizeof(uint32_t)))
+#define NAME_NEXT_OFF   ((off_t)sizeof(name_index_hdr_t))
+#define NAME_PREV_OFF   (NAME_NEXT_OFF + NAME_LINKS)
+#define NAME_BUCKET_OFF (NAME_PREV_OFF + NAME_LINKS)
+
+static size_t name_file_size(uint32_t capacity){
+    return NAME_BUCKET_OFF + (off_t)capacity * sizeof(name_bucket_t);
+}
+
+/*
+ *  name_hash
+ *      lname:  last name, at most sizeof(student_t.lname) bytes are used
+ *
+ *  32 bit FNV-1a hash of the last name, the key of the name index.
+ *
+ *  returns:  the hash
+ */
+uint32_t name_hash(const char *lname){
+    size_t len = strnlen(lname, sizeof(((student_t *)0)->lname));
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)lname[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ *  name_index_path
+ *      db_path:  name of the database file
+ *      buff:     receives the name of its last name index
+ *      len:      size of buff
+ */
+void name_index_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_NAME_EXT, buff, len);
+}
+
+/*
+ *  name_read / name_write
+ *      h:    handle with an open name index
+ *      off:  offset into the index file
+ *      p:    buffer to fill in / to store
+ *      len:  bytes
+ *
+ *  Access part of the index, through the mapping when it is mapped.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int name_read(db_handle_t *h, off_t off, void *p, size_t len){
+    if (h->name_map != NULL) {
+        memcpy(p, h->name_map + off, len);
+        return NO_ERROR;
+    }
+    if (pread(h->name_fd, p, len, off) != (ssize_t)len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int name_write(db_handle_t *h, off_t off, const void *p, size_t len){
+    if (h->name_map != NULL) {
+        memcpy(h->name_map + off, p, len);
+        return NO_ERROR;
+    }
+    if (pwrite(h->name_fd, p, len, off) != (ssize_t)len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int read_link(db_handle_t *h, off_t base, uint32_t id, uint32_t *v){
+    return name_read(h, base + (off_t)id * sizeof(uint32_t), v, sizeof(*v));
+}
+
+static int write_link(db_handle_t *h, off_t base, uint32_t id, uint32_t v){
+    return name_write(h, base + (off_t)id * sizeof(uint32_t), &v, sizeof(v));
+}
+
+static int read_bucket(db_handle_t *h, uint32_t i, name_bucket_t *b){
+    return name_read(h, NAME_BUCKET_OFF + (off_t)i * sizeof(*b), b, sizeof(*b));
+}
+
+static int write_bucket(db_handle_t *h, uint32_t i, const name_bucket_t *b){
+    return name_write(h, NAME_BUCKET_OFF + (off_t)i * sizeof(*b), b, sizeof(*b));
+}
+
+/*
+ *  find_bucket
+ *      h:     handle with an open name index
+ *      hash:  name_hash() of the last name
+ *      slot:  set to the bucket holding hash, or to the free bucket that
+ *             ends its probe sequence
+ *      b:     set to the contents of that bucket (head 0 if free)
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int find_bucket(db_handle_t *h, uint32_t hash, uint32_t *slot,
+                       name_bucket_t *b){
+    uint32_t mask = h->name_hdr.capacity - 1;
+
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (read_bucket(h, i, b) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (b->head == 0 || b->hash == hash) {
+            *slot = i;
+            return NO_ERROR;
+        }
+    }
+}
+
+/*
+ *  table_find
+ *      t:         in memory bucket table, capacity buckets
+ *      capacity:  a power of two
+ *      hash:      name_hash() of the last name
+ *
+ *  returns:  the bucket holding hash, or the free bucket that ends its
+ *            probe sequence
+ */
+static uint32_t table_find(const name_bucket_t *t, uint32_t capacity, uint32_t hash){
+    uint32_t mask = capacity - 1;
+    uint32_t i = hash & mask;
+
+    while (t[i].head != 0 && t[i].hash != hash)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/*
+ *  table_grow
+ *      t:         in memory bucket table, *capacity buckets
+ *      capacity:  a power of two, doubled
+ *
+ *  Rehashes a table that is being built in memory into one twice the size.
+ *  Buckets keep their hash and their list, so no student records are read.
+ *
+ *  returns:  the new table (t is freed), or NULL if out of memory
+ */
+static name_bucket_t *table_grow(name_bucket_t *t, uint32_t *capacity){
+    uint32_t new_cap = *capacity * 2;
+    name_bucket_t *bigger = calloc(new_cap, sizeof(name_bucket_t));
+
+    if (bigger == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < *capacity; i++) {
+        if (t[i].head != 0)
+            bigger[table_find(bigger, new_cap, t[i].hash)] = t[i];
+    }
+    free(t);
+    *capacity = new_cap;
+    return bigger;
+}
+
+/*
+ *  write_name_file
+ *      h:         handle of the database the index belongs to
+ *      links:     next and prev arrays, 2 * (MAX_STD_ID+1) entries
+ *      t:         complete bucket table, capacity buckets
+ *      capacity:  a power of two
+ *      count:     buckets in use
+ *
+ *  Writes a new index next to the database and renames it into place, so
+ *  a crash leaves either the old index or the new one.  The handle is then
+ *  switched over to the new file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_name_file(db_handle_t *h, const uint32_t *links,
+                           const name_bucket_t *t, uint32_t capacity,
+                           uint32_t count){
+    char path[DB_PATH_MAX];
+    char tmp_path[DB_PATH_MAX + 4];
+    name_index_hdr_t hdr = {
+        .magic = DB_NAME_MAGIC, .version = DB_NAME_VERSION,
+        .capacity = capacity, .count = count,
+    };
+
+    name_index_path(h->path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, DB_FILE_MODE);
+    if (fd == -1)
+        return ERR_DB_FILE;
+
+    //most ids are on no list, only the pages of links that are not all
+    //zero are written so the file stays sparse
+    size_t len = (size_t)capacity * sizeof(name_bucket_t);
+    bool ok = ftruncate(fd, name_file_size(capacity)) == 0 &&
+              pwrite(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+              pwrite(fd, t, len, NAME_BUCKET_OFF) == (ssize_t)len;
+    static const char zero_page[4096];
+    const char *p = (const char *)links;
+    for (off_t off = 0; ok && off < 2 * NAME_LINKS; off += sizeof(zero_page)) {
+        size_t n = sizeof(zero_page);
+        if ((off_t)n > 2 * NAME_LINKS - off)
+            n = 2 * NAME_LINKS - off;
+        if (memcmp(p + off, zero_page, n) != 0)
+            ok = pwrite(fd, p + off, n, NAME_NEXT_OFF + off) == (ssize_t)n;
+    }
+    if (ok && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+        ok = fdatasync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return ERR_DB_FILE;
+    }
+
+    close_name_index(h);
+    return open_name_index(h);
+}
+
+/*
+ *  open_name_index
+ *      h:  handle of a database that is being opened
+ *
+ *  Opens the last name index of the database if it has one.  A database
+ *  without one simply has h->name_fd == -1, lookup_name_index() builds it
+ *  the first time it is needed.  An index that does not look right is
+ *  ignored (and will be rebuilt) rather than failing the open.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_name_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    name_index_hdr_t hdr;
+    struct stat st;
+
+    h->name_fd = -1;
+    h->name_map = NULL;
+    h->name_dirty = false;
+
+    name_index_path(h->path, path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+        return NO_ERROR;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+            hdr.magic != DB_NAME_MAGIC || hdr.version != DB_NAME_VERSION ||
+            hdr.capacity < DB_NAME_MIN_CAP ||
+            (hdr.capacity & (hdr.capacity - 1)) != 0 ||
+            fstat(fd, &st) == -1 ||
+            (size_t)st.st_size < name_file_size(hdr.capacity)) {
+        close(fd);
+        return NO_ERROR;
+    }
+
+    h->name_fd = fd;
+    h->name_hdr = hdr;
+
+    if (sdb_config.use_mmap) {
+        char *map = mmap(NULL, name_file_size(hdr.capacity),
+                         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            h->name_map = map;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_name_index
+ *      h:  handle of a database that is being closed
+ *
+ *  Unmaps and closes the last name index.  If it was written to the header
+ *  is written back and, with batch or sync durability, the index flushed.
+ */
+void close_name_index(db_handle_t *h){
+    if (h->name_fd == -1)
+        return;
+
+    if (h->name_map != NULL)
+        munmap(h->name_map, name_file_size(h->name_hdr.capacity));
+    if (h->name_dirty) {
+        pwrite(h->name_fd, &h->name_hdr, sizeof(h->name_hdr), 0);
+        if (DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            fdatasync(h->name_fd);
+    }
+    close(h->name_fd);
+
+    h->name_fd = -1;
+    h->name_map = NULL;
+    h->name_dirty = false;
+}
+
+/*
+ *  refresh_name_index
+ *      h:  handle of an open database, its superblock lock is held
+ *
+ *  Picks up changes other processes made to the index:  an index that
+ *  was built or rebuilt since it was opened is a different file, it is
+ *  reopened, otherwise only the header is read again.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int refresh_name_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    struct stat path_st, fd_st;
+    name_index_hdr_t hdr;
+
+    name_index_path(h->path, path, sizeof(path));
+    bool exists = stat(path, &path_st) == 0;
+    if (h->name_fd == -1 && !exists)
+        return NO_ERROR;
+
+    //the header in the file is current, the cached one is not written back
+    if (h->name_fd == -1 || !exists || fstat(h->name_fd, &fd_st) == -1 ||
+            fd_st.st_ino != path_st.st_ino || fd_st.st_dev != path_st.st_dev) {
+        h->name_dirty = false;
+        close_name_index(h);
+        return open_name_index(h);
+    }
+
+    if (pread(h->name_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+        return ERR_DB_FILE;
+    if (hdr.capacity != h->name_hdr.capacity) {
+        h->name_dirty = false;
+        close_name_index(h);
+        return open_name_index(h);
+    }
+    h->name_hdr = hdr;
+    return NO_ERROR;
+}
+
+/*
+ *  grow_name_index
+ *      h:  handle whose bucket table is three quarters full
+ *
+ *  Rehashes every bucket into a table twice the size and writes it out
+ *  with the lists copied as they are.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int grow_name_index(db_handle_t *h){
+    uint32_t capacity = h->name_hdr.capacity;
+    uint32_t *links = malloc(2 * NAME_LINKS);
+    name_bucket_t *t = malloc(capacity * sizeof(name_bucket_t));
+    int rc = ERR_DB_FILE;
+
+    if (links != NULL && t != NULL &&
+            name_read(h, NAME_NEXT_OFF, links, 2 * NAME_LINKS) == NO_ERROR &&
+            name_read(h, NAME_BUCKET_OFF, t, capacity * sizeof(name_bucket_t)) == NO_ERROR) {
+        name_bucket_t *bigger = table_grow(t, &capacity);
+        if (bigger != NULL) {
+            t = bigger;
+            rc = write_name_file(h, links, t, capacity, h->name_hdr.count);
+        }
+    }
+
+    free(links);
+    free(t);
+    return rc;
+}
+
+/*
+ *  remove_bucket
+ *      h:     handle with an open name index
+ *      slot:  bucket whose list just became empty
+ *
+ *  Frees the bucket and shifts the buckets after it back, as long as that
+ *  does not put them in front of their home bucket, so that no probe
+ *  sequence is broken.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int remove_bucket(db_handle_t *h, uint32_t slot){
+    uint32_t mask = h->name_hdr.capacity - 1;
+    uint32_t gap = slot;
+    name_bucket_t b;
+
+    for (uint32_t j = (slot + 1) & mask; ; j = (j + 1) & mask) {
+        if (read_bucket(h, j, &b) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (b.head == 0)
+            break;
+        uint32_t home = b.hash & mask;
+        if (((j - home) & mask) >= ((j - gap) & mask)) {
+            if (write_bucket(h, gap, &b) != NO_ERROR)
+                return ERR_DB_FILE;
+            gap = j;
+        }
+    }
+
+    b = (name_bucket_t){0};
+    if (write_bucket(h, gap, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+    h->name_hdr.count--;
+    return NO_ERROR;
+}
+
+/*
+ *  update_name_index
+ *      fd:     linux file descriptor
+ *      s:      record that was just added or deleted
+ *      delta:  1 for an add, -1 for a delete
+ *
+ *  Keeps the last name index in step with a change that has already been
+ *  written.  An add pushes the id on the front of the list for its name,
+ *  a delete unlinks it, both touch a fixed number of entries however many
+ *  students share the name.  The bucket count in the header is only
+ *  cached, save_name_index() writes it, so a bulk load writes it once.  A
+ *  database that has no name index yet is left alone.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int update_name_index(int fd, const student_t *s, int delta){
+    db_handle_t *h = db_handle(fd);
+    uint32_t id = s->id;
+    uint32_t hash = name_hash(s->lname);
+    uint32_t slot;
+    name_bucket_t b;
+
+    if (h == NULL || h->name_fd == -1)
+        return NO_ERROR;
+    if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+        return NO_ERROR;
+
+    if (find_bucket(h, hash, &slot, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+    h->name_dirty = true;
+
+    if (delta > 0) {
+        if (b.head == 0 && ((uint64_t)h->name_hdr.count + 1) * 4 >
+                (uint64_t)h->name_hdr.capacity * 3) {
+            if (grow_name_index(h) != NO_ERROR || h->name_fd == -1 ||
+                    find_bucket(h, hash, &slot, &b) != NO_ERROR)
+                return ERR_DB_FILE;
+            h->name_dirty = true;
+        }
+        if (b.head == id)
+            return NO_ERROR;    //already indexed
+
+        if (write_link(h, NAME_NEXT_OFF, id, b.head) != NO_ERROR ||
+                write_link(h, NAME_PREV_OFF, id, 0) != NO_ERROR ||
+                (b.head != 0 &&
+                 write_link(h, NAME_PREV_OFF, b.head, id) != NO_ERROR))
+            return ERR_DB_FILE;
+        if (b.head == 0)
+            h->name_hdr.count++;
+        b.head = id;
+        b.hash = hash;
+        return write_bucket(h, slot, &b);
+    }
+
+    if (b.head == 0)
+        return NO_ERROR;        //was not indexed
+
+    uint32_t prev, next;
+    if (read_link(h, NAME_PREV_OFF, id, &prev) != NO_ERROR ||
+            read_link(h, NAME_NEXT_OFF, id, &next) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (prev == 0 && b.head != id)
+        return NO_ERROR;        //was not indexed
+
+    if (prev != 0) {
+        if (write_link(h, NAME_NEXT_OFF, prev, next) != NO_ERROR)
+            return ERR_DB_FILE;
+    } else {
+        b.head = next;
+        if (write_bucket(h, slot, &b) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    if (next != 0 && write_link(h, NAME_PREV_OFF, next, prev) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (write_link(h, NAME_NEXT_OFF, id, 0) != NO_ERROR ||
+            write_link(h, NAME_PREV_OFF, id, 0) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (b.head == 0)
+        return remove_bucket(h, slot);
+    return NO_ERROR;
+}
+
+/*
+ *  save_name_index
+ *      fd:  linux file descriptor
+ *
+ *  Writes back the cached header of the name index if the index changed
+ *  and, with sync durability, flushes the index before the operation is
+ *  reported as done.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_name_index(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || h->name_fd == -1 || !h->name_dirty)
+        return NO_ERROR;
+
+    if (pwrite(h->name_fd, &h->name_hdr, sizeof(h->name_hdr), 0) !=
+            (ssize_t)sizeof(h->name_hdr))
+        return ERR_DB_FILE;
+
+    if (DB_DATA_DURABILITY != DB_DURABILITY_SYNC)
+        return NO_ERROR;
+    if (h->name_map != NULL &&
+            msync(h->name_map, name_file_size(h->name_hdr.capacity), MS_SYNC) == -1)
+        return ERR_DB_FILE;
+    if (fdatasync(h->name_fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  build_name_index
+ *      fd:  linux file descriptor
+ *
+ *  Creates the last name index of a database from one scan of its
+ *  records.  Only needed once per database, from then on add and delete
+ *  keep it current.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int build_name_index(int fd){
+    db_handle_t *h = db_handle(fd);
+    db_scan_t scan;
+    student_t *s;
+    uint32_t capacity = DB_NAME_MIN_CAP;
+    uint32_t count = 0;
+    int rc = ERR_DB_FILE;
+
+    if (h == NULL)
+        return ERR_DB_FILE;
+
+    uint32_t *links = calloc(2, NAME_LINKS);
+    name_bucket_t *t = calloc(capacity, sizeof(name_bucket_t));
+    if (links == NULL || t == NULL)
+        goto out;
+    uint32_t *next = links;
+    uint32_t *prev = links + MAX_STD_ID + 1;
+
+    if (open_db_scan(&scan, fd, MIN_STD_ID, MAX_STD_ID) != NO_ERROR) {
+        close_db_scan(&scan);
+        goto out;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0) {
+        uint32_t hash = name_hash(s->lname);
+        uint32_t i = table_find(t, capacity, hash);
+
+        if (t[i].head == 0 && ((uint64_t)count + 1) * 4 > (uint64_t)capacity * 3) {
+            name_bucket_t *bigger = table_grow(t, &capacity);
+            if (bigger == NULL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            t = bigger;
+            i = table_find(t, capacity, hash);
+        }
+
+        if (t[i].head == 0)
+            count++;
+        else
+            prev[t[i].head] = s->id;
+        next[s->id] = t[i].head;
+        t[i].head = s->id;
+        t[i].hash = hash;
+    }
+    close_db_scan(&scan);
+
+    if (rc == 0)
+        rc = write_name_file(h, links, t, capacity, count);
+out:
+    free(links);
+    free(t);
+    return rc == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+}
+
+//lookup_name_index() without the locking
+static int read_name_list(int fd, const char *lname, int **ids){
+    db_handle_t *h = db_handle(fd);
+    uint32_t hash = name_hash(lname);
+    uint32_t slot;
+    name_bucket_t b;
+    int n = 0;
+    int cap = 16;
+
+    *ids = NULL;
+    if (h == NULL)
+        return ERR_DB_FILE;
+    if (h->name_fd == -1 && (build_name_index(fd) != NO_ERROR || h->name_fd == -1))
+        return ERR_DB_FILE;
+
+    if (find_bucket(h, hash, &slot, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int *out = malloc(cap * sizeof(int));
+    if (out == NULL)
+        return ERR_DB_FILE;
+
+    //a list can not hold more ids than there are, a longer one is a
+    //damaged index
+    for (uint32_t id = b.head; id != 0; ) {
+        if (id > MAX_STD_ID || n > MAX_STD_ID) {
+            free(out);
+            return ERR_DB_FILE;
+        }
+        if (n == cap) {
+            int *bigger = realloc(out, 2 * cap * sizeof(int));
+            if (bigger == NULL) {
+                free(out);
+                return ERR_DB_FILE;
+            }
+            out = bigger;
+            cap *= 2;
+        }
+        out[n++] = id;
+        if (read_link(h, NAME_NEXT_OFF, id, &id) != NO_ERROR) {
+            free(out);
+            return ERR_DB_FILE;
+        }
+    }
+
+    *ids = out;
+    return n;
+}
+
+/*
+ *  lookup_name_index
+ *      fd:     linux file descriptor
+ *      lname:  last name to look up
+ *      ids:    set to a malloc()ed array of candidate ids, the caller
+ *              frees it
+ *
+ *  Collects the ids on the list for the hash of lname, building the index
+ *  first if the database does not have one yet.  Different names can
+ *  share a hash, so the caller still compares the records.  The list is
+ *  read under a shared superblock lock, the records are not locked.
+ *
+ *  returns:  the number of candidate ids, ERR_DB_FILE on failure
+ */
+int lookup_name_index(int fd, const char *lname, int **ids){
+    db_handle_t *h = db_handle(fd);
+
+    //building the index reads every record, writers are held off for that
+    *ids = NULL;
+    bool build = h != NULL && h->name_fd == -1;
+    if ((build ? lock_db_all(fd, F_RDLCK) : lock_db_meta(fd, F_RDLCK)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int n = read_name_list(fd, lname, ids);
+    if (build)
+        unlock_db_all(fd);
+    else
+        unlock_db_meta(fd);
+    return n;
+}
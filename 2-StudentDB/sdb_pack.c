@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  The packed layout (see db.h).  The directory is opened, mapped and
+ *  accessed like the index of a compacted db (read_slot_index() and
+ *  write_slot_index()), its entries are record offsets in DB_PACK_ALIGN
+ *  units instead of slot numbers.  An add writes the record at the end of
+ *  the file and then the entry that makes it visible, a delete clears the
+ *  entry and then the record.  Readers that take no lock check the id of
+ *  what they read, a zeroed record is one deleted under them.
+ */
+
+#define PACK_FIRST_OFF  ((off_t)sizeof(db_header_t))   //records start here
+
+/*
+ *  packed_dir_path
+ *      db_path:  name of the database file
+ *      buff:     where to build the name of its directory file
+ *      len:      size of buff
+ */
+void packed_dir_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_PACK_EXT, buff, len);
+}
+
+/*
+ *  pack_record
+ *      s:    record to pack
+ *      out:  room for DB_PACK_MAX bytes
+ *
+ *  returns:  the length of the packed record, padding included
+ */
+size_t pack_record(const student_t *s, char *out){
+    db_packed_t p = {
+        .id = s->id,
+        .gpa = (int16_t)s->gpa,
+        .flen = strnlen(s->fname, sizeof(s->fname)),
+        .llen = strnlen(s->lname, sizeof(s->lname)),
+    };
+    size_t len = DB_PACK_LEN(p.flen, p.llen);
+
+    memset(out, 0, len);
+    memcpy(out, &p, sizeof(p));
+    memcpy(out + sizeof(p), s->fname, p.flen);
+    memcpy(out + sizeof(p) + p.flen, s->lname, p.llen);
+    return len;
+}
+
+/*
+ *  unpack_record
+ *      buf:    packed record
+ *      avail:  bytes readable at buf
+ *      s:      receives the record, names zero padded as add_student()
+ *              leaves them
+ *
+ *  returns:  the length of the packed record, or -1 if buf does not hold
+ *            a whole record
+ */
+int unpack_record(const char *buf, size_t avail, student_t *s){
+    db_packed_t p;
+
+    if (avail < sizeof(p))
+        return -1;
+    memcpy(&p, buf, sizeof(p));
+    if (p.flen > sizeof(s->fname) || p.llen > sizeof(s->lname) ||
+            DB_PACK_LEN(p.flen, p.llen) > avail)
+        return -1;
+
+    *s = EMPTY_STUDENT_RECORD;
+    s->id = p.id;
+    s->gpa = p.gpa;
+    memcpy(s->fname, buf + sizeof(p), p.flen);
+    memcpy(s->lname, buf + sizeof(p) + p.flen, p.llen);
+    return DB_PACK_LEN(p.flen, p.llen);
+}
+
+/*
+ *  read_packed_bytes
+ *      h:    handle of a database with the packed layout
+ *      off:  file offset of a record
+ *      buf:  room for DB_PACK_MAX bytes
+ *
+ *  Reads the bytes a record at off can take up, through the mapping when
+ *  they are inside it and this process holds a lock (see read_phys_slot()).
+ *  A record near the end of the file is shorter.
+ *
+ *  returns:  bytes read, or ERR_DB_FILE on failure
+ */
+static ssize_t read_packed_bytes(db_handle_t *h, off_t off, char *buf){
+    if (h->map != NULL && holds_db_locks(h)) {
+        if (off + DB_PACK_MAX > h->file_len) {
+            struct stat st;
+            if (fstat(h->fd, &st) == -1)
+                return ERR_DB_FILE;
+            h->file_len = st.st_size;
+        }
+        off_t end = off + DB_PACK_MAX < h->file_len ? off + DB_PACK_MAX
+                                                     : h->file_len;
+        if (end > off && (size_t)end <= h->map_len) {
+            memcpy(buf, h->map + off, end - off);
+            return end - off;
+        }
+    }
+
+    ssize_t got = pread(h->fd, buf, DB_PACK_MAX, off);
+    return got == -1 ? ERR_DB_FILE : got;
+}
+
+/*
+ *  read_packed_slot
+ *      h:   handle of a database with the packed layout
+ *      id:  student id to read
+ *      *s:  where to unpack the record
+ *
+ *  read_db_slot() for the packed layout:  one directory entry and one
+ *  read of at most DB_PACK_MAX bytes.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure or if the
+ *            directory points at something that is not the record
+ */
+int read_packed_slot(db_handle_t *h, int id, student_t *s){
+    char buf[DB_PACK_MAX];
+    uint32_t ent;
+
+    *s = EMPTY_STUDENT_RECORD;
+    if (read_slot_index(h, id, &ent) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (ent == 0)
+        return NO_ERROR;
+
+    ssize_t got = read_packed_bytes(h, (off_t)ent * DB_PACK_ALIGN, buf);
+    if (got < 0 || unpack_record(buf, got, s) < 0)
+        return ERR_DB_FILE;
+
+    //deleted since the entry was read
+    if (s->id == DELETED_STUDENT_ID) {
+        *s = EMPTY_STUDENT_RECORD;
+        return NO_ERROR;
+    }
+    return s->id == id ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  clear_packed_record
+ *      h:    handle of a database with the packed layout
+ *      off:  file offset of a record no entry points at any more
+ *
+ *  Zeroes the record and punches the blocks that leaves empty.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int clear_packed_record(db_handle_t *h, off_t off){
+    static const char zero[DB_PACK_MAX];
+    char buf[DB_PACK_MAX];
+    student_t old;
+
+    ssize_t got = pread(h->fd, buf, sizeof(buf), off);
+    int len = got < 0 ? -1 : unpack_record(buf, got, &old);
+    if (len < 0)
+        return ERR_DB_FILE;
+
+    if (pwrite(h->fd, zero, len, off) != len)
+        return ERR_DB_FILE;
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(h->fd) == -1)
+        return ERR_DB_FILE;
+    punch_empty_blocks(h->fd, off, off + len);
+    return NO_ERROR;
+}
+
+/*
+ *  apply_packed_slot
+ *      h:   handle of a database with the packed layout, its superblock
+ *           lock is held so that only one process appends at a time
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  apply_db_slot() for the packed layout.  A record is appended at the
+ *  end of the file, a record it replaces (a log replayed twice) is
+ *  cleared like a deleted one.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int apply_packed_slot(db_handle_t *h, int id, const student_t *s){
+    char buf[DB_PACK_MAX];
+    uint32_t old;
+    struct stat st;
+
+    if (read_slot_index(h, id, &old) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (is_empty_record(s)) {
+        if (old == 0)
+            return NO_ERROR;
+        if (write_slot_index(h, id, 0) != NO_ERROR)
+            return ERR_DB_FILE;
+        h->dirty = true;
+        return clear_packed_record(h, (off_t)old * DB_PACK_ALIGN);
+    }
+
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+    off_t off = st.st_size > PACK_FIRST_OFF ? st.st_size : PACK_FIRST_OFF;
+    off = (off + DB_PACK_ALIGN - 1) / DB_PACK_ALIGN * DB_PACK_ALIGN;
+    if (off / DB_PACK_ALIGN > UINT32_MAX)
+        return ERR_DB_FILE;     //compress the db
+
+    //record first, then the directory entry that makes it visible
+    ssize_t len = pack_record(s, buf);
+    if (pwrite(h->fd, buf, len, off) != len)
+        return ERR_DB_FILE;
+    h->dirty = true;
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(h->fd) == -1)
+        return ERR_DB_FILE;
+    if (write_slot_index(h, id, off / DB_PACK_ALIGN) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (old != 0)
+        return clear_packed_record(h, (off_t)old * DB_PACK_ALIGN);
+    return NO_ERROR;
+}
+
+/*
+ *  write_packed_db
+ *      fd:    linux file descriptor of the db to write, locked by the
+ *             caller
+ *      recs:  MAX_STD_ID+1 records indexed by id, id 0 means no record
+ *      hdr:   the header for the db file, layout DB_LAYOUT_PACKED
+ *
+ *  Writes the packed image of recs, the records in id order, used by
+ *  migrate_db() and compress_db().  The directory is written first under
+ *  a temporary name and renamed into place, it is ignored until the
+ *  header says the db is packed, then the records and the header are
+ *  written over the db file and the file is cut after the last record.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int write_packed_db(int fd, const student_t *recs, const db_header_t *hdr){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+    char tmp_path[DB_PATH_MAX + 4];
+    int rc = ERR_DB_FILE;
+
+    if (h == NULL)
+        return ERR_DB_FILE;
+    packed_dir_path(h->path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    uint32_t *dir = calloc(MAX_STD_ID + 1, sizeof(uint32_t));
+    char *img = malloc(PACK_FIRST_OFF + (size_t)(MAX_STD_ID + 1) * DB_PACK_MAX);
+    if (dir == NULL || img == NULL)
+        goto out;
+
+    memcpy(img, hdr, sizeof(*hdr));
+    size_t len = PACK_FIRST_OFF;
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id++) {
+        if (recs[id].id == DELETED_STUDENT_ID)
+            continue;
+        dir[id] = len / DB_PACK_ALIGN;
+        len += pack_record(&recs[id], img + len);
+    }
+
+    if (save_slot_index(tmp_path, dir) != NO_ERROR)
+        goto out;
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        goto out;
+    }
+
+    //the header goes last, the records are nothing without it
+    size_t body = len - PACK_FIRST_OFF;
+    if (pwrite(fd, img + PACK_FIRST_OFF, body, PACK_FIRST_OFF) == (ssize_t)body &&
+            truncate_db_file(fd, len) == NO_ERROR &&
+            pwrite(fd, img, sizeof(*hdr), 0) == (ssize_t)sizeof(*hdr))
+        rc = NO_ERROR;
+
+out:
+    free(dir);
+    free(img);
+    return rc;
+}
@@ -0,0 +1,408 @@
+#define _GNU_SOURCE     //fallocate(), SEEK_DATA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  The paged layout (see db.h).  Every id still has a fixed place, on page
+ *  DB_PAGE_OF(id), so get_student() reads the page header and the record
+ *  from one page.  A record is live while its bit in the page header is
+ *  set.  Changes to a page are made under its page lock (see sdb_lock.c):
+ *  an add writes the record and then sets the bit, a delete clears the bit
+ *  and then the record.  A crash between the two writes leaves the record
+ *  out rather than half there, and the log replay (sdb_wal.c) redoes it.
+ */
+
+static off_t page_slot(int page){
+    return (off_t)page * DB_PAGE_SLOTS;
+}
+
+static off_t record_slot(int id){
+    return page_slot(DB_PAGE_OF(id)) + 1 + DB_PAGE_INDEX(id);
+}
+
+/*
+ *  read_page_hdr / write_page_hdr
+ *      fd:    linux file descriptor
+ *      page:  page number, 1 or more
+ *      ph:    header to read into or write
+ *
+ *  The page header is the first 64 byte slot of the page.  A page past the
+ *  end of the file, or punched out of it, reads as an empty header.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_page_hdr(int fd, int page, db_page_hdr_t *ph){
+    return read_phys_slot(fd, page_slot(page), (student_t *)ph);
+}
+
+static int write_page_hdr(int fd, int page, const db_page_hdr_t *ph){
+    return write_phys_slot(fd, page_slot(page), (const student_t *)ph);
+}
+
+/*
+ *  read_paged_slot
+ *      fd:  linux file descriptor of a db with the paged layout
+ *      id:  student id to read
+ *      *s:  where to copy the record
+ *
+ *  read_db_slot() for the paged layout.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_paged_slot(int fd, int id, student_t *s){
+    db_page_hdr_t ph;
+
+    if (read_page_hdr(fd, DB_PAGE_OF(id), &ph) != NO_ERROR)
+        return ERR_DB_FILE;
+    if ((ph.live & (1ULL << DB_PAGE_INDEX(id))) == 0) {
+        *s = EMPTY_STUDENT_RECORD;
+        return NO_ERROR;
+    }
+    return read_phys_slot(fd, record_slot(id), s);
+}
+
+/*
+ *  apply_paged_slot
+ *      h:   handle of a database with the paged layout
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  apply_db_slot() for the paged layout.  The file grows a whole page at a
+ *  time, and a page whose last record is deleted is punched out of it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int apply_paged_slot(db_handle_t *h, int id, const student_t *s){
+    int fd = h->fd;
+    int page = DB_PAGE_OF(id);
+    uint64_t bit = 1ULL << DB_PAGE_INDEX(id);
+    db_page_hdr_t ph;
+    int rc = ERR_DB_FILE;
+
+    if (lock_db_page(fd, page) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (read_page_hdr(fd, page, &ph) != NO_ERROR)
+        goto out;
+
+    if (!is_empty_record(s)) {
+        if (grow_db_file(fd, (off_t)(page + 1) * DB_PAGE_SIZE) != NO_ERROR ||
+                write_phys_slot(fd, record_slot(id), s) != NO_ERROR)
+            goto out;
+        if ((ph.live & bit) == 0) {
+            ph.live |= bit;
+            ph.count++;
+        }
+        rc = write_page_hdr(fd, page, &ph);
+    } else if (ph.live & bit) {
+        ph.live &= ~bit;
+        ph.count--;
+        if (write_page_hdr(fd, page, &ph) != NO_ERROR ||
+                write_phys_slot(fd, record_slot(id), s) != NO_ERROR)
+            goto out;
+        if (ph.count == 0)
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      (off_t)page * DB_PAGE_SIZE, DB_PAGE_SIZE);
+        rc = NO_ERROR;
+    } else {
+        rc = NO_ERROR;      //not there, nothing to clear
+    }
+
+out:
+    unlock_db_page(fd, page);
+    return rc;
+}
+
+/*
+ *  punch_empty_pages
+ *      fd:          linux file descriptor of a db with the paged layout
+ *      first_page:  first page to look at
+ *      last_page:   last page to look at
+ *
+ *  Punches out every page in the range whose header has a count of 0,
+ *  reading nothing but the headers.  Holes are skipped with SEEK_DATA, so
+ *  pages that are punched already are not even read.
+ *
+ *  returns:  bytes deallocated, or ERR_DB_FILE on an I/O error
+ */
+long long punch_empty_pages(int fd, int first_page, int last_page){
+    struct stat st;
+    long long freed = 0;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (first_page < 1)
+        first_page = 1;
+
+    for (int p = first_page; p <= last_page; p++) {
+        off_t off = (off_t)p * DB_PAGE_SIZE;
+        db_page_hdr_t ph;
+
+        if (off >= st.st_size)
+            break;
+        off_t data = lseek(fd, off, SEEK_DATA);
+        if (data == -1 && errno == ENXIO)
+            break;      //nothing but holes from here on
+        if (data != -1 && data >= off + DB_PAGE_SIZE) {
+            p = data / DB_PAGE_SIZE - 1;
+            continue;
+        }
+
+        if (lock_db_page(fd, p) != NO_ERROR)
+            return ERR_DB_FILE;
+        int rc = read_page_hdr(fd, p, &ph);
+        if (rc == NO_ERROR && ph.count == 0 &&
+                fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          off, DB_PAGE_SIZE) == 0)
+            freed += DB_PAGE_SIZE;
+        unlock_db_page(fd, p);
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return freed;
+}
+
+/*
+ *  last_used_page
+ *      fd:  linux file descriptor of a db with the paged layout
+ *
+ *  returns:  the last page with a live record, 0 if there is none, or
+ *            ERR_DB_FILE on an I/O error
+ */
+int last_used_page(int fd){
+    struct stat st;
+    db_page_hdr_t ph;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    for (int p = (st.st_size - 1) / DB_PAGE_SIZE; p >= 1; p--) {
+        if (read_page_hdr(fd, p, &ph) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (ph.count > 0)
+            return p;
+    }
+    return 0;
+}
+
+/*
+ *  write_pages
+ *      fd:    linux file descriptor
+ *      recs:  MAX_STD_ID+1 records indexed by id, id 0 means no record
+ *      hdr:   the header for page 0
+ *      last:  last page that holds a record
+ *
+ *  Writes the paged image of recs over the file, from the last page down
+ *  to page 0 with the new header.  Pages without records are punched out.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_pages(int fd, const student_t *recs, const db_header_t *hdr,
+                       int last){
+    char *page = malloc(DB_PAGE_SIZE);
+    student_t *slots = (student_t *)page;
+    db_page_hdr_t *ph = (db_page_hdr_t *)page;
+    int rc = NO_ERROR;
+
+    if (page == NULL)
+        return ERR_DB_FILE;
+
+    for (int p = last; p >= 0 && rc == NO_ERROR; p--) {
+        off_t off = (off_t)p * DB_PAGE_SIZE;
+
+        memset(page, 0, DB_PAGE_SIZE);
+        if (p == 0) {
+            memcpy(page, hdr, sizeof(*hdr));
+        } else {
+            int first = DB_PAGE_FIRST_ID(p);
+            for (int i = 0; i < DB_PAGE_RECORDS && first + i <= MAX_STD_ID; i++) {
+                if (recs[first + i].id == DELETED_STUDENT_ID)
+                    continue;
+                slots[1 + i] = recs[first + i];
+                ph->live |= 1ULL << i;
+                ph->count++;
+            }
+            if (ph->count == 0 &&
+                    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                              off, DB_PAGE_SIZE) == 0)
+                continue;
+        }
+        if (pwrite(fd, page, DB_PAGE_SIZE, off) != DB_PAGE_SIZE)
+            rc = ERR_DB_FILE;
+    }
+
+    free(page);
+    return rc;
+}
+
+/*
+ *  migrate_db
+ *      fd:      linux file descriptor of the open db
+ *      layout:  DB_LAYOUT_PAGED, DB_LAYOUT_SPLIT, DB_LAYOUT_HASH or
+ *               DB_LAYOUT_PACKED
+ *
+ *  Converts the db to the paged, the split, the hash or the packed layout
+ *  in place:  the records are read into memory (at most MAX_STD_ID of
+ *  them, 6.4 MB), then the same file is rewritten, page by page for the
+ *  paged layout, as the names after a new hot column for the split one
+ *  (see write_split_db()), into buckets for the hash one (see
+ *  write_hash_db()) or packed after a new directory (see
+ *  write_packed_db()), the header last, and cut to its new length.  The
+ *  index of a compacted db, the hot column of a split one and the
+ *  directory of a hashed or packed one are removed.  The name and gpa indexes are by
+ *  id and stay valid, except that the hash layout does not keep them.  A
+ *  hashed db with an id past MAX_STD_ID can not be migrated back.
+ *
+ *  All records are locked for the duration.  Other processes that have
+ *  the db open notice the new layout the next time they lock a record
+ *  (see lock_db_slots()) and fail instead of writing to the old places.
+ *  The rewrite is not atomic, a crash in the middle of it leaves a file
+ *  that is neither layout, so keep a copy of a db that matters.
+ *
+ *  returns:  the fd of the reopened db, ERR_DB_FILE on failure
+ *
+ *  console:  M_DB_MIGRATED      on success, with the time taken and the
+ *                               disk space used before and after
+ *            M_DB_MIGRATE_NOOP  the db has that layout already
+ *            M_ERR_MIGRATE_ID   a hashed db holds an id the layout can not
+ *                               hold
+ *            M_ERR_DB_READ      error reading the db file
+ *            M_ERR_DB_WRITE     error writing the db file
+ *            M_ERR_DB_OPEN      the migrated db can not be reopened
+ */
+int migrate_db(int fd, int layout){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+    char idx_path[DB_PATH_MAX];
+    char hot_path[DB_PATH_MAX];
+    char dir_path[DB_PATH_MAX];
+    char off_path[DB_PATH_MAX];
+    struct timespec start, end;
+    db_scan_t scan;
+    student_t *s;
+    int count = 0;
+    int rc;
+
+    if (h == NULL) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (h->layout == layout) {
+        printf(M_DB_MIGRATE_NOOP, db_layout_name(layout));
+        return fd;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    snprintf(path, sizeof(path), "%s", h->path);
+    db_index_path(path, idx_path, sizeof(idx_path));
+    hot_column_path(path, hot_path, sizeof(hot_path));
+    hash_dir_path(path, dir_path, sizeof(dir_path));
+    packed_dir_path(path, off_path, sizeof(off_path));
+    long long disk_before = db_disk_usage(path) + db_disk_usage(idx_path) +
+                            db_disk_usage(hot_path) + db_disk_usage(dir_path) +
+                            db_disk_usage(off_path);
+    int old_layout = h->layout;
+
+    student_t *recs = calloc(MAX_STD_ID + 1, sizeof(student_t));
+    if (recs == NULL || lock_db_all(fd, F_WRLCK) != NO_ERROR) {
+        free(recs);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //the statistics are recomputed on the way through
+    db_header_t hdr = { .magic = DB_MAGIC, .version = DB_VERSION,
+                        .layout = layout };
+
+    rc = open_db_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID);
+    while (rc == NO_ERROR && (rc = next_db_record(&scan, &s)) > 0) {
+        if (s->id > MAX_STD_ID && old_layout == DB_LAYOUT_HASH) {
+            printf(M_ERR_MIGRATE_ID, s->id, db_layout_name(layout));
+            rc = ERR_DB_OP;
+            break;
+        }
+        if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+            continue;   //not addressable, can not have been added by us
+        recs[s->id] = *s;
+        add_to_stats(&hdr, s);
+        count++;
+        rc = NO_ERROR;
+    }
+    close_db_scan(&scan);
+    if (rc < 0) {
+        free(recs);
+        unlock_db_all(fd);
+        if (rc != ERR_DB_OP)
+            printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (layout == DB_LAYOUT_SPLIT) {
+        rc = write_split_db(fd, recs, &hdr);
+    } else if (layout == DB_LAYOUT_PACKED) {
+        rc = write_packed_db(fd, recs, &hdr);
+    } else if (layout == DB_LAYOUT_HASH) {
+        //the file outgrows any mapping, it is not mapped again
+        unmap_db(h);
+        rc = write_hash_db(fd, recs, MAX_STD_ID + 1, &hdr);
+    } else {
+        int last = count > 0 ? DB_PAGE_OF(hdr.max_id) : 0;
+        rc = write_pages(fd, recs, &hdr, last);
+        if (rc == NO_ERROR)
+            rc = truncate_db_file(fd, (off_t)(last + 1) * DB_PAGE_SIZE);
+    }
+    free(recs);
+    if (rc == NO_ERROR && fdatasync(fd) == -1)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR) {
+        unlock_db_all(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    if (old_layout == DB_LAYOUT_COMPACT)
+        unlink(idx_path);
+    if (old_layout == DB_LAYOUT_SPLIT)
+        unlink(hot_path);
+    if (old_layout == DB_LAYOUT_HASH)
+        unlink(dir_path);
+    if (old_layout == DB_LAYOUT_PACKED)
+        unlink(off_path);
+    if (layout == DB_LAYOUT_HASH) {
+        char index_path[DB_PATH_MAX];
+
+        name_index_path(path, index_path, sizeof(index_path));
+        unlink(index_path);
+        gpa_index_path(path, index_path, sizeof(index_path));
+        unlink(index_path);
+        crc_index_path(path, index_path, sizeof(index_path));
+        unlink(index_path);
+    }
+
+    //the handle still has the old layout and mapping, open the db again
+    unlock_db_all(fd);
+    close_db(fd);
+    fd = open_db(path, false);
+    if (fd < 0) {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf(M_DB_MIGRATED, count, db_layout_name(layout), secs, disk_before,
+           db_disk_usage(path) + db_disk_usage(hot_path) +
+           db_disk_usage(dir_path) + db_disk_usage(off_path));
+    return fd;
+}
@@ -0,0 +1,309 @@
+#define _GNU_SOURCE     //open_memstream()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Parallel scans for -j N.  The ids are cut into N ranges, each range is
+ *  scanned on a thread of its own with its own iterator (every thread
+ *  reads with pread(), so they share the fd but not a file offset), and
+ *  the per range results are put back together in id order.  Ranges start
+ *  on a page boundary of the paged layout:  a scan of a paged db locks
+ *  whole pages, and two threads of one process unlocking overlapping
+ *  ranges of the same open file would drop each other's locks.
+ *
+ *  The calling thread scans the first range itself, N-1 threads are
+ *  started for the others.
+ */
+
+/*
+ *  split_db_ranges
+ *      fd:     linux file descriptor
+ *      jobs:   number of ranges wanted, at most PAR_MAX_JOBS
+ *      parts:  room for jobs parts, cleared and given their ranges
+ *
+ *  The ranges cover the ids that can be in the db, MIN_STD_ID..MAX_STD_ID
+ *  or, when the superblock statistics are kept, min_id..max_id.  The last
+ *  range runs to SCAN_LAST_ID so that a plain scan and a parallel one see
+ *  the same records.  A scan of a hashed db reads every bucket whatever
+ *  its range, so it is not split.
+ *
+ *  returns:  the number of parts, fewer than jobs for a small id range
+ */
+int split_db_ranges(int fd, int jobs, par_part_t *parts){
+    db_handle_t *h = db_handle(fd);
+    int lo = MIN_STD_ID;
+    int hi = MAX_STD_ID;
+
+    if (h != NULL && h->stats_valid && h->hdr.count > 0) {
+        lo = h->hdr.min_id;
+        hi = h->hdr.max_id;
+    }
+    if (jobs > PAR_MAX_JOBS)
+        jobs = PAR_MAX_JOBS;
+    if (h != NULL && h->layout == DB_LAYOUT_HASH)
+        jobs = 1;
+
+    //whole pages per range, at least one
+    int first_page = DB_PAGE_OF(lo);
+    int pages = DB_PAGE_OF(hi) - first_page + 1;
+    if (jobs > pages)
+        jobs = pages;
+
+    memset(parts, 0, sizeof(*parts) * jobs);
+    for (int j = 0; j < jobs; j++) {
+        int p = first_page + (int)((long long)pages * j / jobs);
+        int next = first_page + (int)((long long)pages * (j + 1) / jobs);
+
+        parts[j].fd = fd;
+        parts[j].first_id = j == 0 ? MIN_STD_ID : DB_PAGE_FIRST_ID(p);
+        parts[j].last_id = j == jobs - 1 ? SCAN_LAST_ID
+                                         : DB_PAGE_FIRST_ID(next) - 1;
+    }
+    return jobs;
+}
+
+/*
+ *  run_parts
+ *      parts:   parts to work on
+ *      n:       number of parts
+ *      worker:  thread function, called with a par_part_t and setting
+ *               its rc
+ *
+ *  returns:  NO_ERROR if every part succeeded, ERR_DB_FILE otherwise
+ */
+static int run_parts(par_part_t *parts, int n, void *(*worker)(void *)){
+    pthread_t tid[PAR_MAX_JOBS];
+    bool started[PAR_MAX_JOBS] = { false };
+    int rc = NO_ERROR;
+
+    //the scan kernels are picked once, before there are threads to race
+    is_empty_record(&EMPTY_STUDENT_RECORD);
+
+    for (int j = 1; j < n; j++) {
+        if (pthread_create(&tid[j], NULL, worker, &parts[j]) == 0)
+            started[j] = true;
+        else
+            parts[j].rc = ERR_DB_FILE;
+    }
+    worker(&parts[0]);
+    for (int j = 1; j < n; j++) {
+        if (started[j])
+            pthread_join(tid[j], NULL);
+    }
+
+    for (int j = 0; j < n; j++) {
+        if (parts[j].rc < 0)
+            rc = ERR_DB_FILE;
+    }
+    return rc;
+}
+
+/*
+ *  free_par_parts
+ *      parts:  parts returned by one of the par_ functions
+ *      n:      number of parts
+ */
+void free_par_parts(par_part_t *parts, int n){
+    for (int j = 0; j < n; j++) {
+        free(parts[j].out);
+        free(parts[j].recs);
+        parts[j].out = NULL;
+        parts[j].recs = NULL;
+    }
+}
+
+//formats the rows of print_db() for one range into the part's buffer
+static void *format_worker(void *arg){
+    par_part_t *part = arg;
+    db_scan_t scan;
+    student_t *s;
+
+    FILE *out = open_memstream(&part->out, &part->out_len);
+    if (out == NULL) {
+        part->rc = ERR_DB_FILE;
+        return NULL;
+    }
+
+    part->rc = open_db_scan(&scan, part->fd, part->first_id, part->last_id);
+    while (part->rc == NO_ERROR && (part->rc = next_db_record(&scan, &s)) > 0) {
+        fprintf(out, STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname,
+                (float)(s->gpa) / 100);
+        part->nrecs++;
+        part->rc = NO_ERROR;
+    }
+    close_db_scan(&scan);
+    fclose(out);
+    return NULL;
+}
+
+/*
+ *  par_format_db
+ *      fd:     linux file descriptor
+ *      jobs:   number of threads
+ *      parts:  room for jobs parts, set to the formatted rows of each
+ *              range (out, out_len) and their number (nrecs)
+ *
+ *  The rows of print_db(), formatted on jobs threads.  Writing the out
+ *  buffers of the parts one after the other prints them in id order.
+ *  The caller frees the parts with free_par_parts().
+ *
+ *  returns:  the number of parts, ERR_DB_FILE on failure
+ */
+int par_format_db(int fd, int jobs, par_part_t *parts){
+    int n = split_db_ranges(fd, jobs, parts);
+
+    if (run_parts(parts, n, format_worker) != NO_ERROR) {
+        free_par_parts(parts, n);
+        return ERR_DB_FILE;
+    }
+    return n;
+}
+
+//the statistics of one range, from its ids and gpas alone
+static void *stats_worker(void *arg){
+    par_part_t *part = arg;
+    db_scan_t scan;
+    student_t *s;
+
+    part->rc = open_db_hot_scan(&scan, part->fd, part->first_id, part->last_id);
+    while (part->rc == NO_ERROR && (part->rc = next_db_record(&scan, &s)) > 0) {
+        add_to_stats(&part->hdr, s);
+        part->rc = NO_ERROR;
+    }
+    close_db_scan(&scan);
+    return NULL;
+}
+
+/*
+ *  merge_stats
+ *      hdr:   statistics of the ranges merged so far
+ *      part:  statistics of one more range
+ */
+static void merge_stats(db_header_t *hdr, const db_header_t *part){
+    if (part->count == 0)
+        return;
+    if (hdr->count == 0 || part->min_id < hdr->min_id)
+        hdr->min_id = part->min_id;
+    if (hdr->count == 0 || part->max_id > hdr->max_id)
+        hdr->max_id = part->max_id;
+    hdr->count += part->count;
+    hdr->gpa_sum += part->gpa_sum;
+    for (int b = 0; b < DB_GPA_BUCKETS; b++)
+        hdr->gpa_hist[b] += part->gpa_hist[b];
+}
+
+/*
+ *  par_compute_stats
+ *      fd:    linux file descriptor
+ *      jobs:  number of threads
+ *      hdr:   superblock whose statistics are recomputed
+ *
+ *  compute_db_stats() on jobs threads.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int par_compute_stats(int fd, int jobs, db_header_t *hdr){
+    par_part_t parts[PAR_MAX_JOBS];
+    int n = split_db_ranges(fd, jobs, parts);
+
+    if (run_parts(parts, n, stats_worker) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int j = 0; j < n; j++)
+        merge_stats(hdr, &parts[j].hdr);
+    return NO_ERROR;
+}
+
+//copies the live records of one range into the part's array
+static void *collect_worker(void *arg){
+    par_part_t *part = arg;
+    db_scan_t scan;
+    student_t *s;
+    int cap = 0;
+
+    part->rc = open_db_scan(&scan, part->fd, part->first_id, part->last_id);
+    while (part->rc == NO_ERROR && (part->rc = next_db_record(&scan, &s)) > 0) {
+        part->rc = NO_ERROR;
+        if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+            continue;   //not addressable, can not have been added by us
+
+        if (part->nrecs == cap) {
+            cap = cap > 0 ? cap * 2 : 1024;
+            student_t *recs = realloc(part->recs, sizeof(student_t) * cap);
+            if (recs == NULL) {
+                part->rc = ERR_DB_FILE;
+                break;
+            }
+            part->recs = recs;
+        }
+        part->recs[part->nrecs++] = *s;
+        add_to_stats(&part->hdr, s);
+    }
+    close_db_scan(&scan);
+    return NULL;
+}
+
+//writes the records of one range at its slot, with one pwrite()
+static void *write_worker(void *arg){
+    par_part_t *part = arg;
+    size_t len = (size_t)part->nrecs * STUDENT_RECORD_SIZE;
+
+    part->rc = NO_ERROR;
+    if (len > 0 && pwrite(part->out_fd, part->recs, len,
+                          (off_t)part->first_slot * STUDENT_RECORD_SIZE) !=
+                       (ssize_t)len)
+        part->rc = ERR_DB_FILE;
+    return NULL;
+}
+
+/*
+ *  par_pack_db
+ *      fd:      linux file descriptor, read locked by the caller
+ *      jobs:    number of threads
+ *      out_fd:  file the records are packed into, from slot 1 on
+ *      slots:   MAX_STD_ID+1 entries, set to the slot of every record
+ *      hdr:     superblock given the statistics of the packed records
+ *
+ *  The parallel half of compress_db().  The live records of every range
+ *  are read into memory on jobs threads.  The slot of the first record of
+ *  a range is then known before anything is written (1 plus the records
+ *  of the ranges below it), so every range is written at its own offset,
+ *  again on jobs threads.
+ *
+ *  returns:  the number of records packed, ERR_DB_FILE if fd could not be
+ *            read, ERR_DB_OP if out_fd could not be written
+ */
+int par_pack_db(int fd, int jobs, int out_fd, uint32_t *slots,
+                db_header_t *hdr){
+    par_part_t parts[PAR_MAX_JOBS];
+    int n = split_db_ranges(fd, jobs, parts);
+    uint32_t next_slot = 1;
+    int rc;
+
+    if (run_parts(parts, n, collect_worker) != NO_ERROR) {
+        free_par_parts(parts, n);
+        return ERR_DB_FILE;
+    }
+
+    for (int j = 0; j < n; j++) {
+        parts[j].out_fd = out_fd;
+        parts[j].first_slot = next_slot;
+        for (int i = 0; i < parts[j].nrecs; i++)
+            slots[parts[j].recs[i].id] = next_slot + i;
+        next_slot += parts[j].nrecs;
+        merge_stats(hdr, &parts[j].hdr);
+    }
+
+    rc = run_parts(parts, n, write_worker);
+    free_par_parts(parts, n);
+    return rc == NO_ERROR ? (int)next_slot - 1 : ERR_DB_OP;
+}
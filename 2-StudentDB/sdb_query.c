@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Queries (-q).  A query is a list of comparisons joined by &&, for
+ *  example "gpa>=350 && lname=doe && id<50000".  The fields are id, gpa
+ *  (a 3 digit int, or a real number such as 3.5), fname and lname, the
+ *  operators = (or ==), !=, <, <=, > and >=.  A name is a word, or any
+ *  text in single or double quotes, and compares like the names -s looks
+ *  up.
+ *
+ *  The query is compiled before the db is read.  Comparisons of the id
+ *  are folded into one id range that is handed to the scan, so only that
+ *  part of the file (or of the index, column or directory) is read, and
+ *  those of the gpa into one gpa range.  What is left (!= and the names)
+ *  becomes a list of tests, each a small function picked when the query
+ *  is compiled.  A query that does not look at the names is run on the
+ *  id and gpa column of a split db (open_db_hot_scan()), only the names
+ *  of the matches are read.
+ */
+
+#define QUERY_MAX_TERMS 16      //tests left after the ranges are folded
+
+//which comparison results a test accepts, < is Q_LT, <= is Q_LT | Q_EQ
+#define Q_LT    1
+#define Q_EQ    2
+#define Q_GT    4
+
+typedef struct query_term{
+    bool  (*test)(const student_t *s, const struct query_term *t);
+    size_t off;             //offset of the field in student_t
+    size_t len;             //size of a name field
+    int    ops;             //Q_* results that pass
+    int    num;             //value an id or gpa is compared with
+    char   str[sizeof(((student_t *)0)->lname)];   //name compared with
+} query_term_t;
+
+typedef struct query{
+    long long first_id;     //id range pushed down to the scan
+    long long last_id;
+    long long min_gpa;      //gpa range, tested first
+    long long max_gpa;
+    bool   names;           //some test reads a name
+    int    nterms;
+    query_term_t terms[QUERY_MAX_TERMS];
+} query_t;
+
+//the tests a query term compiles to, they return true if s passes t
+static bool test_int(const student_t *s, const query_term_t *t){
+    int v = *(const int *)((const char *)s + t->off);
+    return t->ops & (v < t->num ? Q_LT : v == t->num ? Q_EQ : Q_GT);
+}
+
+static bool test_name(const student_t *s, const query_term_t *t){
+    int c = strncmp((const char *)s + t->off, t->str, t->len);
+    return t->ops & (c < 0 ? Q_LT : c == 0 ? Q_EQ : Q_GT);
+}
+
+static const char *skip_blanks(const char *p){
+    while (isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+/*
+ *  parse_query_op
+ *      p:    text after a field name
+ *      ops:  receives the Q_* results the operator accepts
+ *
+ *  returns:  the text after the operator, or NULL if there is none
+ */
+static const char *parse_query_op(const char *p, int *ops){
+    static const struct { const char *text; int ops; } op_names[] = {
+        { "==", Q_EQ }, { "!=", Q_LT | Q_GT }, { "<=", Q_LT | Q_EQ },
+        { ">=", Q_GT | Q_EQ }, { "=", Q_EQ }, { "<", Q_LT }, { ">", Q_GT },
+    };
+
+    for (size_t i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++) {
+        size_t len = strlen(op_names[i].text);
+        if (strncmp(p, op_names[i].text, len) == 0) {
+            *ops = op_names[i].ops;
+            return p + len;
+        }
+    }
+    return NULL;
+}
+
+/*
+ *  fold_range
+ *      lo, hi:  range of values that can still pass
+ *      ops:     Q_* results the comparison accepts
+ *      val:     value compared with
+ *
+ *  Narrows [lo, hi] to the values for which the comparison holds.
+ *
+ *  returns:  false for !=, which is not a range and must be tested
+ */
+static bool fold_range(long long *lo, long long *hi, int ops, long long val){
+    long long from = (ops & Q_LT) ? LLONG_MIN : (ops & Q_EQ) ? val : val + 1;
+    long long to = (ops & Q_GT) ? LLONG_MAX : (ops & Q_EQ) ? val : val - 1;
+
+    if (ops == (Q_LT | Q_GT))
+        return false;
+    if (from > *lo)
+        *lo = from;
+    if (to < *hi)
+        *hi = to;
+    return true;
+}
+
+/*
+ *  parse_query_term
+ *      p:  text of one comparison, leading blanks skipped
+ *      q:  query the comparison is added to
+ *
+ *  returns:  the text after the comparison, or NULL if it is malformed
+ */
+static const char *parse_query_term(const char *p, query_t *q){
+    static const struct { const char *name; size_t off; size_t len; } fields[] = {
+        { "id",    offsetof(student_t, id),    0 },
+        { "gpa",   offsetof(student_t, gpa),   0 },
+        { "fname", offsetof(student_t, fname), sizeof(((student_t *)0)->fname) },
+        { "lname", offsetof(student_t, lname), sizeof(((student_t *)0)->lname) },
+    };
+    query_term_t t = {0};
+    size_t flen = 0;
+    int f = -1;
+
+    while (isalpha((unsigned char)p[flen]))
+        flen++;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        if (flen == strlen(fields[i].name) && strncmp(p, fields[i].name, flen) == 0)
+            f = i;
+    if (f < 0)
+        return NULL;
+    t.off = fields[f].off;
+    t.len = fields[f].len;
+
+    p = parse_query_op(skip_blanks(p + flen), &t.ops);
+    if (p == NULL)
+        return NULL;
+    p = skip_blanks(p);
+
+    if (t.len > 0) {
+        //a name, quoted or up to the next blank or &
+        const char *end;
+        bool quoted = *p == '\'' || *p == '"';
+        if (quoted) {
+            end = strchr(p + 1, *p);
+            if (end == NULL)
+                return NULL;
+            p++;
+        } else {
+            end = p;
+            while (*end != '\0' && *end != '&' && !isspace((unsigned char)*end))
+                end++;
+            if (end == p)
+                return NULL;
+        }
+        //stored names are cut to fit their field, so are the ones compared
+        size_t n = end - p < (ptrdiff_t)t.len - 1 ? (size_t)(end - p) : t.len - 1;
+        memcpy(t.str, p, n);
+        t.test = test_name;
+        q->names = true;
+        p = quoted ? end + 1 : end;
+    } else {
+        char *end;
+        long long val = strtoll(p, &end, 10);
+        if (end == p)
+            return NULL;
+        if (t.off == offsetof(student_t, gpa) && *end == '.') {
+            double real = strtod(p, &end);
+            val = (long long)(real * 100.0 + (real < 0 ? -0.5 : 0.5));
+        }
+        p = end;
+
+        //past the range of an int every comparison comes out the same
+        if (val < (long long)INT_MIN - 1)
+            val = (long long)INT_MIN - 1;
+        if (val > (long long)INT_MAX + 1)
+            val = (long long)INT_MAX + 1;
+
+        bool folded = t.off == offsetof(student_t, id)
+                    ? fold_range(&q->first_id, &q->last_id, t.ops, val)
+                    : fold_range(&q->min_gpa, &q->max_gpa, t.ops, val);
+        if (folded)
+            return p;
+        if (val < INT_MIN || val > INT_MAX)
+            return p;           //!= a value no record can have
+        t.num = (int)val;
+        t.test = test_int;
+    }
+
+    if (q->nterms == QUERY_MAX_TERMS)
+        return NULL;
+    q->terms[q->nterms++] = t;
+    return p;
+}
+
+/*
+ *  compile_query
+ *      text:  the query, see the top of this file
+ *      q:     receives the compiled query
+ *
+ *  returns:  NULL on success, otherwise where in text the query stops
+ *            making sense
+ */
+static const char *compile_query(const char *text, query_t *q){
+    memset(q, 0, sizeof(*q));
+    q->first_id = LLONG_MIN;
+    q->last_id = LLONG_MAX;
+    q->min_gpa = LLONG_MIN;
+    q->max_gpa = LLONG_MAX;
+
+    const char *p = skip_blanks(text);
+    for (;;) {
+        const char *next = parse_query_term(p, q);
+        if (next == NULL)
+            return p;
+        p = skip_blanks(next);
+        if (*p == '\0')
+            return NULL;
+        if (strncmp(p, "&&", 2) != 0)
+            return p;
+        p = skip_blanks(p + 2);
+    }
+}
+
+//true if s passes every test of q, the id range is the scan's
+static bool query_matches(const query_t *q, const student_t *s){
+    if (s->gpa < q->min_gpa || s->gpa > q->max_gpa)
+        return false;
+    for (int i = 0; i < q->nterms; i++)
+        if (!q->terms[i].test(s, &q->terms[i]))
+            return false;
+    return true;
+}
+
+/*
+ *  print_csv_name / print_json_name
+ *      name:  a name field
+ *      len:   size of the field
+ *
+ *  A name as a CSV field, quoted only if it has to be, or as a JSON string.
+ */
+static void print_csv_name(const char *name, size_t len){
+    size_t n = strnlen(name, len);
+
+    if (strcspn(name, ",\"\r\n") >= n) {
+        printf("%.*s", (int)n, name);
+        return;
+    }
+    putchar('"');
+    for (size_t i = 0; i < n; i++) {
+        if (name[i] == '"')
+            putchar('"');
+        putchar(name[i]);
+    }
+    putchar('"');
+}
+
+static void print_json_name(const char *name, size_t len){
+    size_t n = strnlen(name, len);
+
+    putchar('"');
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = name[i];
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+/*
+ *  print_match_row / end_match_rows
+ *      s:      a record that matched
+ *      found:  records printed before this one, or in all
+ *
+ *  Prints a match of -q or -r in the --format chosen:  the print_db() table
+ *  (with its header in front of the first row), the tab separated rows of
+ *  -i, CSV rows that -b loads back, or the elements of a JSON array, which
+ *  end_match_rows() closes.
+ */
+void print_match_row(const student_t *s, int found){
+    switch (sdb_config.format) {
+        case SDB_FORMAT_TSV:
+            printf("%d\t%.*s\t%.*s\t%d\n", s->id, (int)sizeof(s->fname),
+                   s->fname, (int)sizeof(s->lname), s->lname, s->gpa);
+            break;
+        case SDB_FORMAT_CSV:
+            printf("%d,", s->id);
+            print_csv_name(s->fname, sizeof(s->fname));
+            putchar(',');
+            print_csv_name(s->lname, sizeof(s->lname));
+            printf(",%d\n", s->gpa);
+            break;
+        case SDB_FORMAT_JSON:
+            printf("%s{\"id\":%d,\"fname\":", found == 0 ? "[\n" : ",\n", s->id);
+            print_json_name(s->fname, sizeof(s->fname));
+            printf(",\"lname\":");
+            print_json_name(s->lname, sizeof(s->lname));
+            printf(",\"gpa\":%d.%02d}", s->gpa / 100, s->gpa % 100);
+            break;
+        default:
+            if (found == 0)
+                printf(STUDENT_PRINT_HDR_STRING, "ID",
+                            "FIRST NAME", "LAST_NAME", "GPA");
+            printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+                                    s->lname, (float)(s->gpa) / 100);
+            break;
+    }
+}
+
+void end_match_rows(int found){
+    if (sdb_config.format == SDB_FORMAT_JSON)
+        printf(found == 0 ? "[]\n" : "\n]\n");
+}
+
+/*
+ *  run_query
+ *      fd:    linux file descriptor
+ *      text:  the query, see the top of this file
+ *
+ *  Compiles the query and prints the students that match it, in id order.
+ *
+ *  returns:  the number of students printed
+ *            ERR_DB_OP      the query does not parse
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND no student matched
+ *
+ *  console:  the matches in the --format chosen (text, tsv, csv or json)
+ *            M_STD_QUERY_NOT_FND  no student matched, in the text format
+ *            M_ERR_QUERY          the query does not parse
+ *            M_ERR_DB_READ        error reading the db file
+ */
+int run_query(int fd, const char *text){
+    db_handle_t *h = db_handle(fd);
+    query_t q;
+    db_scan_t scan;
+    student_t *s;
+    student_t whole;
+    int found = 0;
+    int rc = NO_ERROR;
+
+    const char *bad = compile_query(text, &q);
+    if (bad != NULL) {
+        printf(M_ERR_QUERY, *bad != '\0' ? bad : "end of query");
+        return ERR_DB_OP;
+    }
+
+    //ids below MIN_STD_ID never occur, the scan stops at the last one
+    int first = q.first_id < MIN_STD_ID ? MIN_STD_ID
+              : q.first_id > INT_MAX ? INT_MAX : (int)q.first_id;
+    int last = q.last_id >= SCAN_LAST_ID ? SCAN_LAST_ID : (int)q.last_id;
+
+    bool hot = !q.names && h != NULL && h->layout == DB_LAYOUT_SPLIT;
+
+    if (first <= last && q.min_gpa <= q.max_gpa) {
+        rc = hot ? open_db_hot_scan(&scan, fd, first, last)
+                 : open_db_scan(&scan, fd, first, last);
+        while (rc == NO_ERROR && (rc = next_db_record(&scan, &s)) > 0) {
+            rc = NO_ERROR;
+            if (!query_matches(&q, s))
+                continue;
+            if (hot) {
+                //read the whole record, it may have gone since the scan
+                int got = get_student(fd, s->id, &whole);
+                if (got == SRCH_NOT_FOUND)
+                    continue;
+                if (got != NO_ERROR) {
+                    rc = ERR_DB_FILE;
+                    break;
+                }
+                s = &whole;
+            }
+            print_match_row(s, found++);
+        }
+        close_db_scan(&scan);
+        if (rc < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+    }
+
+    end_match_rows(found);
+    if (found == 0) {
+        if (sdb_config.format == SDB_FORMAT_TEXT)
+            printf(M_STD_QUERY_NOT_FND);
+        return SRCH_NOT_FOUND;
+    }
+    return found;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Id range reads (-r).  In the direct layout the records of ids
+ *  first..last are the bytes first*64..last*64+63 of the file, a range
+ *  is read with one pread() of exactly those bytes (or straight from the
+ *  mapping), SCAN_BLOCK_SIZE at a time for ranges larger than that.  The
+ *  other layouts keep their records elsewhere, the scan iterator is given
+ *  the range instead (see open_db_scan()).
+ *
+ *  --after id --limit N pages through the db:  the range starts past the
+ *  last id of the previous page and stops after N records, so every page
+ *  costs the same however deep into the db it is.
+ */
+
+#define RANGE_BLOCK_RECS    (SCAN_BLOCK_SIZE / STUDENT_RECORD_SIZE)
+
+typedef struct range_out{
+    int  limit;             //records to print, 0 for all
+    int  found;             //records printed
+    int  last_id;           //id of the last record printed
+    bool more;              //a record past the limit was seen
+} range_out_t;
+
+//prints s unless the limit is reached, true when the read can stop
+static bool range_record(range_out_t *out, const student_t *s){
+    if (out->limit > 0 && out->found == out->limit) {
+        out->more = true;
+        return true;
+    }
+    print_match_row(s, out->found++);
+    out->last_id = s->id;
+    return false;
+}
+
+/*
+ *  read_direct_range
+ *      h:     handle of a database with the direct layout
+ *      first: first id to read
+ *      last:  last id to read
+ *      out:   what to print
+ *
+ *  Reads the records of first..last a block at a time, each block under a
+ *  shared lock on its ids, through the mapping when the block is inside
+ *  it and with one pread() otherwise.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int read_direct_range(db_handle_t *h, int first, int last,
+                             range_out_t *out){
+    struct stat st;
+    student_t *buf = NULL;
+    bool lock = !holds_db_locks(h);
+    int rc = NO_ERROR;
+
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+    h->file_len = st.st_size;
+
+    //ids past the end of the file have no record
+    long long end_id = st.st_size / STUDENT_RECORD_SIZE - 1;
+    if (last > end_id)
+        last = (int)end_id;
+
+    for (int id = first; rc == NO_ERROR && id <= last; ) {
+        int n = last - id + 1 < RANGE_BLOCK_RECS ? last - id + 1
+                                                 : RANGE_BLOCK_RECS;
+        off_t off = (off_t)id * STUDENT_RECORD_SIZE;
+        size_t len = (size_t)n * STUDENT_RECORD_SIZE;
+        const student_t *recs;
+
+        if (lock && lock_db_slots(h->fd, id, n, F_RDLCK) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        //the lock refreshed file_len, a file cut since the fstat() above
+        //must not be read through the mapping
+        if (h->map != NULL && off + (off_t)len <= h->file_len &&
+                off + len <= h->map_len) {
+            recs = (const student_t *)(h->map + off);
+        } else {
+            if (buf == NULL && (buf = malloc(SCAN_BLOCK_SIZE)) == NULL)
+                rc = ERR_DB_FILE;
+            else if (pread(h->fd, buf, len, off) != (ssize_t)len)
+                rc = ERR_DB_FILE;
+            recs = buf;
+        }
+
+        bool stop = false;
+        for (int i = 0; rc == NO_ERROR && !stop && i < n; i++)
+            if (!is_empty_record(&recs[i]) && recs[i].id == id + i)
+                stop = range_record(out, &recs[i]);
+        if (lock)
+            unlock_db_slots(h->fd, id, n);
+        if (stop)
+            break;
+        id += n;
+    }
+
+    free(buf);
+    return rc;
+}
+
+/*
+ *  print_db_range
+ *      fd:     linux file descriptor
+ *      first:  first id to print
+ *      last:   last id to print, SCAN_LAST_ID for every id past first
+ *      limit:  most records to print, 0 for no limit
+ *
+ *  Prints the students with ids first..last in id order, in the --format
+ *  chosen (see print_match_row()).  When the limit cuts the range short
+ *  the id to continue after is printed.
+ *
+ *  returns:  the number of students printed
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND no student in the range
+ *
+ *  console:  the students in the --format chosen, and in the text format
+ *            M_DB_RANGE_MORE      the limit was reached before the end
+ *            M_STD_RANGE_NOT_FND  no student in first..last
+ *            M_STD_AFTER_NOT_FND  no student past first - 1
+ *            M_ERR_DB_READ        error reading the db file
+ */
+int print_db_range(int fd, int first, int last, int limit){
+    db_handle_t *h = db_handle(fd);
+    range_out_t out = { .limit = limit };
+    int lo = first < MIN_STD_ID ? MIN_STD_ID : first;
+    int rc = NO_ERROR;
+
+    if (lo <= last && h != NULL && h->layout == DB_LAYOUT_DIRECT) {
+        rc = read_direct_range(h, lo, last, &out);
+    } else if (lo <= last) {
+        db_scan_t scan;
+        student_t *s;
+
+        rc = open_db_scan(&scan, fd, lo, last);
+        while (rc == NO_ERROR && (rc = next_db_record(&scan, &s)) > 0) {
+            rc = NO_ERROR;
+            if (range_record(&out, s))
+                break;
+        }
+        close_db_scan(&scan);
+    }
+    if (rc < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    end_match_rows(out.found);
+    if (sdb_config.format != SDB_FORMAT_TEXT)
+        return out.found > 0 ? out.found : SRCH_NOT_FOUND;
+
+    if (out.found == 0) {
+        if (last == SCAN_LAST_ID)
+            printf(M_STD_AFTER_NOT_FND, first - 1);
+        else
+            printf(M_STD_RANGE_NOT_FND, first, last);
+        return SRCH_NOT_FOUND;
+    }
+    if (out.more)
+        printf(M_DB_RANGE_MORE, out.last_id);
+    return out.found;
+}
+
+/*
+ *  print_db_range_after
+ *      fd:     linux file descriptor
+ *      after:  last id of the previous page
+ *      limit:  most records to print, 0 for no limit
+ *
+ *  -r --after, print_db_range() of the ids past after.  There is none past
+ *  INT_MAX, which has no id after it to start the range from.
+ *
+ *  returns:  as print_db_range()
+ */
+int print_db_range_after(int fd, int after, int limit){
+    if (after < INT_MAX)
+        return print_db_range(fd, after + 1, SCAN_LAST_ID, limit);
+
+    end_match_rows(0);
+    if (sdb_config.format == SDB_FORMAT_TEXT)
+        printf(M_STD_AFTER_NOT_FND, after);
+    return SRCH_NOT_FOUND;
+}
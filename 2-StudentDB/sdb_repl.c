@@ -0,0 +1,327 @@
+#define _GNU_SOURCE     //open_memstream()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  The single record operations (add, find, delete, count and print) in a
+ *  form that can be run many times against one open db:  by sdbsc -i for
+ *  commands read from stdin, and by sdbsc --serve for the requests of its
+ *  clients.  A command is a line of words, "a 1 john doe 345", "f 1",
+ *  "d 1", "c" or "p".  The operation may also be written the way it is on
+ *  the command line ("-f 1").
+ */
+
+/*
+ *  db_op_letter
+ *      word:  first word of a command
+ *
+ *  returns:  the operation letter of "x" or "-x", 0 for anything else
+ */
+char db_op_letter(const char *word){
+    if (word[0] == '-')
+        word++;
+    if (word[0] == '\0' || word[1] != '\0')
+        return 0;
+    return word[0];
+}
+
+/*
+ *  split_db_op
+ *      line:  command line, changed in place
+ *      args:  set to the words of the line
+ *      max:   room in args
+ *
+ *  returns:  the number of words, words past max are dropped
+ */
+int split_db_op(char *line, char *args[], int max){
+    int n = 0;
+    char *save;
+
+    for (char *w = strtok_r(line, " \t\r\n", &save); w != NULL && n < max;
+            w = strtok_r(NULL, " \t\r\n", &save))
+        args[n++] = w;
+    return n;
+}
+
+/*
+ *  parse_db_op
+ *      op:     operation letter
+ *      nargs:  number of words after the operation
+ *      args:   the words after the operation
+ *      req:    request to fill in
+ *
+ *  Checks the number of arguments the way main() does, and that the id of
+ *  -f and -d is a number.  The other values are checked when the operation
+ *  runs.
+ *
+ *  returns:  NO_ERROR on success, EXIT_FAIL_ARGS for an operation that can
+ *            not be run this way or a wrong number of arguments
+ */
+int parse_db_op(char op, int nargs, char *args[], sdb_request_t *req){
+    memset(req, 0, sizeof(*req));
+    req->magic = SDB_MSG_MAGIC;
+    req->op = op;
+
+    switch (op) {
+        case 'a':
+            if (nargs != 4)
+                return EXIT_FAIL_ARGS;
+            req->s.id = atoi(args[0]);
+            strncpy(req->s.fname, args[1], sizeof(req->s.fname) - 1);
+            strncpy(req->s.lname, args[2], sizeof(req->s.lname) - 1);
+            req->s.gpa = atoi(args[3]);
+            return NO_ERROR;
+        case 'f':
+        case 'd':
+            if (nargs != 1 || !parse_int_arg(args[0], &req->s.id))
+                return EXIT_FAIL_ARGS;
+            return NO_ERROR;
+        case 'c':
+        case 'p':
+            return nargs == 0 ? NO_ERROR : EXIT_FAIL_ARGS;
+        default:
+            return EXIT_FAIL_ARGS;
+    }
+}
+
+/*
+ *  run_db_op
+ *      fd:   linux file descriptor of the db
+ *      req:  operation to run
+ *
+ *  Runs one operation the way main() would.
+ *
+ *  returns:  the exit code sdbsc would have exited with
+ *
+ *  console:  what sdbsc prints for the operation
+ */
+int run_db_op(int fd, const sdb_request_t *req){
+    char fname[sizeof(req->s.fname) + 1];
+    char lname[sizeof(req->s.lname) + 1];
+    student_t student;
+    int rc;
+
+    switch (req->op) {
+        case 'a':
+            if (validate_db_range(fd, req->s.id, req->s.gpa) != NO_ERROR) {
+                printf(M_ERR_STD_RNG);
+                return EXIT_FAIL_ARGS;
+            }
+            snprintf(fname, sizeof(fname), "%.*s", (int)sizeof(req->s.fname),
+                     req->s.fname);
+            snprintf(lname, sizeof(lname), "%.*s", (int)sizeof(req->s.lname),
+                     req->s.lname);
+            rc = add_student(fd, req->s.id, fname, lname, req->s.gpa);
+            return rc < 0 ? EXIT_FAIL_DB : EXIT_OK;
+
+        case 'f':
+            rc = get_student(fd, req->s.id, &student);
+            if (rc != NO_ERROR) {
+                printf(rc == SRCH_NOT_FOUND ? M_STD_NOT_FND_MSG : M_ERR_DB_READ,
+                       req->s.id);
+                return EXIT_FAIL_DB;
+            }
+            print_student(&student);
+            return EXIT_OK;
+
+        case 'd':
+            return del_student(fd, req->s.id) < 0 ? EXIT_FAIL_DB : EXIT_OK;
+
+        case 'c':
+            //other processes may have changed the count since it was cached
+            if (lock_db_meta(fd, F_RDLCK) != NO_ERROR) {
+                printf(M_ERR_DB_READ);
+                return EXIT_FAIL_DB;
+            }
+            unlock_db_meta(fd);
+            return count_db_records(fd) < 0 ? EXIT_FAIL_DB : EXIT_OK;
+
+        case 'p':
+            return print_db(fd) < 0 ? EXIT_FAIL_DB : EXIT_OK;
+
+        default:
+            return EXIT_FAIL_ARGS;
+    }
+}
+
+/*
+ *  capture_db_op
+ *      fd:   linux file descriptor of the db
+ *      req:  operation to run
+ *      out:  set to a malloc()ed copy of the console output, caller frees
+ *      len:  set to the length of the output
+ *
+ *  Runs the operation with stdout pointed at a memory stream.  glibc
+ *  allows stdout to be assigned (see "Standard Streams" in the GNU C
+ *  Library manual), so every message ends up in out unchanged.
+ *
+ *  returns:  the exit code sdbsc would have exited with
+ */
+int capture_db_op(int fd, const sdb_request_t *req, char **out, size_t *len){
+    *out = NULL;
+    *len = 0;
+    FILE *mem = open_memstream(out, len);
+    if (mem == NULL)
+        return EXIT_FAIL_DB;
+
+    FILE *console = stdout;
+    stdout = mem;
+    int exit_code = run_db_op(fd, req);
+    fclose(mem);
+    stdout = console;
+
+    return exit_code;
+}
+
+/*
+ *  print_tsv_row / print_tsv_status
+ *
+ *  The tab separated replies of -i --format=tsv.  Every command gets zero
+ *  or more record rows (id, first name, last name, gpa as a 3 digit int)
+ *  and then one status line, "ok", "ok<TAB>count" for c, or
+ *  "err<TAB>exit code<TAB>message".  Rows start with a digit, so a reader
+ *  can tell them from the status line.
+ */
+static void print_tsv_row(const student_t *s){
+    printf("%d\t%.*s\t%.*s\t%d\n", s->id, (int)sizeof(s->fname), s->fname,
+           (int)sizeof(s->lname), s->lname, s->gpa);
+}
+
+static void print_tsv_status(int exit_code, const char *msg, size_t len){
+    if (exit_code == EXIT_OK) {
+        printf("ok\n");
+        return;
+    }
+
+    printf("err\t%d\t", exit_code);
+    while (len > 0 && msg[len - 1] == '\n')
+        len--;
+    for (size_t i = 0; i < len; i++)
+        putchar(msg[i] == '\n' || msg[i] == '\t' ? ' ' : msg[i]);
+    putchar('\n');
+}
+
+/*
+ *  run_tsv_op
+ *      fd:   linux file descriptor of the db
+ *      req:  operation to run
+ *
+ *  Runs one operation and replies in the tab separated format.  Failures
+ *  run the normal operation, its message becomes the status line.
+ *
+ *  returns:  the exit code sdbsc would have exited with
+ */
+static int run_tsv_op(int fd, const sdb_request_t *req){
+    student_t student;
+    student_t *s;
+    db_scan_t scan;
+    char *out;
+    size_t len;
+    int rc;
+
+    switch (req->op) {
+        case 'f':
+            if (get_student(fd, req->s.id, &student) == NO_ERROR) {
+                print_tsv_row(&student);
+                print_tsv_status(EXIT_OK, NULL, 0);
+                return EXIT_OK;
+            }
+            break;
+
+        case 'c':
+            if (lock_db_meta(fd, F_RDLCK) != NO_ERROR)
+                break;
+            unlock_db_meta(fd);
+            if ((rc = get_db_count(fd)) >= 0) {
+                printf("ok\t%d\n", rc);
+                return EXIT_OK;
+            }
+            break;
+
+        case 'p':
+            rc = open_db_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID);
+            if (rc == NO_ERROR) {
+                while ((rc = next_db_record(&scan, &s)) > 0)
+                    print_tsv_row(s);
+            }
+            close_db_scan(&scan);
+            if (rc < 0) {
+                print_tsv_status(EXIT_FAIL_DB, M_ERR_DB_READ, strlen(M_ERR_DB_READ));
+                return EXIT_FAIL_DB;
+            }
+            print_tsv_status(EXIT_OK, NULL, 0);
+            return EXIT_OK;
+    }
+
+    rc = capture_db_op(fd, req, &out, &len);
+    print_tsv_status(rc, out, out != NULL ? len : 0);
+    free(out);
+    return rc;
+}
+
+/*
+ *  repl_db
+ *      fd:  linux file descriptor of the open db
+ *
+ *  Reads commands from stdin, one per line, and runs them against the one
+ *  open db, so a script can push any number of operations through a
+ *  single process.  Empty lines and lines starting with # are skipped.
+ *  Output is written through a REPL_OUT_BUF stdout buffer, it is only
+ *  flushed after every command when stdin is a terminal.  With
+ *  --format=tsv the replies are tab separated, see print_tsv_row().
+ *
+ *  returns:  the exit code of the last command that failed, EXIT_OK if
+ *            none did
+ *
+ *  console:  the output of each command as sdbsc prints it
+ *            M_ERR_BAD_OPTION  a line that is not a command
+ */
+int repl_db(int fd){
+    bool tsv = sdb_config.format == SDB_FORMAT_TSV;
+    bool interactive = isatty(STDIN_FILENO);
+    int exit_code = EXIT_OK;
+    char *line = NULL;
+    size_t cap = 0;
+
+    setvbuf(stdout, NULL, _IOFBF, REPL_OUT_BUF);
+
+    while (getline(&line, &cap, stdin) != -1) {
+        char *args[DB_OP_MAX_ARGS];
+        sdb_request_t req;
+        int rc;
+
+        int n = split_db_op(line, args, DB_OP_MAX_ARGS);
+        if (n == 0 || args[0][0] == '#')
+            continue;
+
+        char op = db_op_letter(args[0]);
+        if (parse_db_op(op, n - 1, args + 1, &req) != NO_ERROR) {
+            rc = EXIT_FAIL_ARGS;
+            if (tsv)
+                printf("err\t%d\t", rc);
+            printf(M_ERR_BAD_OPTION, args[0]);
+        } else if (tsv) {
+            rc = run_tsv_op(fd, &req);
+        } else {
+            rc = run_db_op(fd, &req);
+        }
+
+        if (rc != EXIT_OK)
+            exit_code = rc;
+        if (interactive)
+            fflush(stdout);
+    }
+
+    fflush(stdout);
+    free(line);
+    return exit_code;
+}
@@ -0,0 +1,679 @@
+#define _GNU_SOURCE     //SEEK_DATA, SEEK_HOLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Empty record tests.  A slot is empty when all 64 bytes are zero, the
+ *  scalar version ORs the record together 8 bytes at a time, the SSE2 and
+ *  AVX2 versions OR it together 16 or 32 bytes at a time.  Each returns the
+ *  index of the first live record in recs[0..n), or n if there is none.
+ */
+static int find_live_scalar(const student_t *recs, int n){
+    for (int i = 0; i < n; i++) {
+        const uint64_t *w = (const uint64_t *)&recs[i];
+        if ((w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) != 0)
+            return i;
+    }
+    return n;
+}
+
+#ifdef SCAN_HAVE_X86
+__attribute__((target("sse2")))
+static int find_live_sse2(const student_t *recs, int n){
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < n; i++) {
+        const __m128i *p = (const __m128i *)&recs[i];
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p),
+                                              _mm_loadu_si128(p + 1)),
+                                 _mm_or_si128(_mm_loadu_si128(p + 2),
+                                              _mm_loadu_si128(p + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+            return i;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static int find_live_avx2(const student_t *recs, int n){
+    int i = 0;
+
+    //test 4 records (256 bytes) per iteration, then narrow down
+    for (; i + 4 <= n; i += 4) {
+        const __m256i *p = (const __m256i *)&recs[i];
+        __m256i v = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+            _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+        v = _mm256_or_si256(v, _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256(p + 4), _mm256_loadu_si256(p + 5)),
+            _mm256_or_si256(_mm256_loadu_si256(p + 6), _mm256_loadu_si256(p + 7))));
+        if (!_mm256_testz_si256(v, v))
+            break;
+    }
+
+    for (; i < n; i++) {
+        const __m256i *p = (const __m256i *)&recs[i];
+        __m256i v = _mm256_or_si256(_mm256_loadu_si256(p),
+                                    _mm256_loadu_si256(p + 1));
+        if (!_mm256_testz_si256(v, v))
+            return i;
+    }
+    return n;
+}
+#endif
+
+static int (*find_live)(const student_t *recs, int n);
+
+//cleared the first time the filesystem rejects SEEK_DATA, --no-seek-data
+//takes the same path
+static bool seek_data_supported = true;
+
+/*
+ *  pick_find_live
+ *
+ *  Selects the empty record test, once:  the fastest the cpu supports, or
+ *  the one --scan asks for so that the slower ones can be tested against
+ *  it.  One the cpu lacks falls back to the next one down.
+ */
+static void pick_find_live(void){
+    if (find_live != NULL)
+        return;
+
+    find_live = find_live_scalar;
+#ifdef SCAN_HAVE_X86
+    int kernel = sdb_config.scan_kernel;
+
+    __builtin_cpu_init();
+    if ((kernel == SDB_SCAN_AUTO || kernel == SDB_SCAN_AVX2) &&
+            __builtin_cpu_supports("avx2"))
+        find_live = find_live_avx2;
+    else if (kernel != SDB_SCAN_SCALAR && __builtin_cpu_supports("sse2"))
+        find_live = find_live_sse2;
+#endif
+}
+
+/*
+ *  is_empty_record
+ *      s:  record to test
+ *
+ *  returns:  true if every byte of *s is zero (the slot is free)
+ */
+bool is_empty_record(const student_t *s){
+    pick_find_live();
+    return find_live(s, 1) == 1;
+}
+
+/*
+ *  is_empty_block
+ *      p:    start of a run of slots
+ *      len:  length in bytes, a multiple of STUDENT_RECORD_SIZE
+ *
+ *  returns:  true if every slot in the run is free
+ */
+bool is_empty_block(const void *p, size_t len){
+    int n = len / STUDENT_RECORD_SIZE;
+
+    pick_find_live();
+    return find_live((const student_t *)p, n) == n;
+}
+
+/*
+ *  start_db_scan
+ *      scan:      cleared iterator to set up
+ *      fd, first_id, last_id:  as for open_db_scan()
+ *
+ *  The part of open_db_scan() and open_db_hot_scan() after the iterator
+ *  has been cleared and its mode set.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int start_db_scan(db_scan_t *scan, int fd, int first_id, int last_id){
+    struct stat st;
+    db_handle_t *h = db_handle(fd);
+
+    pick_find_live();
+
+    if (first_id < 0 || fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    if (posix_memalign((void **)&scan->buf, SCAN_BUF_ALIGN, SCAN_BLOCK_SIZE) != 0) {
+        scan->buf = NULL;
+        return ERR_DB_FILE;
+    }
+
+    scan->fd = fd;
+
+    //a packed db is walked through its directory like a compacted one,
+    //the records it points at are read a block at a time
+    if (h != NULL && h->layout == DB_LAYOUT_PACKED) {
+        scan->h = h;
+        scan->lock = !holds_db_locks(h);
+        scan->next_id = first_id;
+        scan->last_id = last_id < MAX_STD_ID ? last_id : MAX_STD_ID;
+        if ((scan->cold = malloc(SCAN_BLOCK_SIZE)) == NULL)
+            return ERR_DB_FILE;
+        return NO_ERROR;
+    }
+
+    //a compacted db is walked through its index to keep the id order
+    if (h != NULL && h->layout == DB_LAYOUT_COMPACT) {
+        scan->h = h;
+        scan->next_id = first_id;
+        scan->last_id = last_id < MAX_STD_ID ? last_id : MAX_STD_ID;
+        return NO_ERROR;
+    }
+
+    //a scan run by a writer is covered by the writer's own locks
+    scan->lock = h != NULL && !holds_db_locks(h);
+
+    //the ids of a hashed db are all over its buckets, the records in range
+    //are read and sorted up front, under the superblock lock that keeps
+    //buckets from being split while they are read
+    if (h != NULL && h->layout == DB_LAYOUT_HASH) {
+        int rc;
+
+        scan->h = h;
+        if (scan->lock && lock_db_meta(fd, F_RDLCK) != NO_ERROR)
+            return ERR_DB_FILE;
+        rc = read_hash_records(h, first_id, last_id, scan->buf, &scan->hashed);
+        if (scan->lock)
+            unlock_db_meta(fd);
+        if (rc < 0)
+            return ERR_DB_FILE;
+        scan->nrecs = rc;
+        return NO_ERROR;
+    }
+
+    //a split db is walked through its hot column, the names of a block
+    //are read in one more pread() unless only ids and gpas are wanted
+    if (h != NULL && h->layout == DB_LAYOUT_SPLIT) {
+        scan->h = h;
+        scan->next_id = first_id > MIN_STD_ID ? first_id : MIN_STD_ID;
+        scan->last_id = last_id < MAX_STD_ID ? last_id : MAX_STD_ID;
+        if (!scan->hot_only && (scan->cold = malloc(SCAN_BLOCK_SIZE)) == NULL)
+            return ERR_DB_FILE;
+        return NO_ERROR;
+    }
+
+    //a paged db is read in whole pages, from the page of first_id on
+    if (h != NULL && h->layout == DB_LAYOUT_PAGED) {
+        int first = first_id > MIN_STD_ID ? first_id : MIN_STD_ID;
+        int last = last_id < MAX_STD_ID ? last_id : MAX_STD_ID;
+
+        scan->paged = true;
+        scan->next_id = first;
+        scan->last_id = last;
+        scan->next_off = (off_t)DB_PAGE_OF(first) * DB_PAGE_SIZE;
+        scan->end = (off_t)(DB_PAGE_OF(last) + 1) * DB_PAGE_SIZE;
+        if (scan->end > st.st_size)
+            scan->end = st.st_size;
+        scan->extent_end = scan->next_off;
+        return NO_ERROR;
+    }
+
+    scan->next_off = (off_t)first_id * STUDENT_RECORD_SIZE;
+    scan->end = ((off_t)last_id + 1) * STUDENT_RECORD_SIZE;
+    if (scan->end > st.st_size)
+        scan->end = st.st_size;
+    scan->extent_end = scan->next_off;
+
+    return NO_ERROR;
+}
+
+/*
+ *  open_db_scan
+ *      scan:      iterator to initialize
+ *      fd:        linux file descriptor
+ *      first_id:  first slot to visit
+ *      last_id:   last slot to visit, clipped to the end of the file
+ *
+ *  Prepares an iterator over the live records in slots first_id..last_id.
+ *  The file is read SCAN_BLOCK_SIZE bytes at a time into a page aligned
+ *  buffer, so a full 100000 slot database takes 7 reads instead of 100000.
+ *  Holes in a sparse file are skipped without being read, see
+ *  next_db_extent().  A compacted db is visited in id order through its
+ *  index instead, see next_compact_record(), a packed db through its
+ *  directory, see next_packed_record(), a paged db a page at a time
+ *  through the page bitmaps, see next_paged_record(), and a split db
+ *  through its hot column, see next_split_record().  A hashed db is read
+ *  whole when the scan is opened, see read_hash_records().  Each block is
+ *  read under a shared lock on its records (see sdb_lock.c), so the scan waits
+ *  for writers in that block only and they only wait for the read.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_db_scan(db_scan_t *scan, int fd, int first_id, int last_id){
+    memset(scan, 0, sizeof(*scan));
+    return start_db_scan(scan, fd, first_id, last_id);
+}
+
+/*
+ *  open_db_hot_scan
+ *      scan:      iterator to initialize
+ *      fd:        linux file descriptor
+ *      first_id:  first id to visit
+ *      last_id:   last id to visit
+ *
+ *  open_db_scan() for callers that only look at the id and the gpa of a
+ *  record.  In the split layout the names are then never read and the
+ *  records returned have empty names, a block of the hot column covers
+ *  eight times the ids a block of records does.  In the other layouts
+ *  this is open_db_scan().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_db_hot_scan(db_scan_t *scan, int fd, int first_id, int last_id){
+    memset(scan, 0, sizeof(*scan));
+    scan->hot_only = true;
+    return start_db_scan(scan, fd, first_id, last_id);
+}
+
+/*
+ *  next_db_extent
+ *      scan:  iterator that has read up to the end of its current extent
+ *
+ *  Moves next_off to the start of the next allocated extent and sets
+ *  extent_end to where that extent stops, using lseek() SEEK_DATA and
+ *  SEEK_HOLE.  A database holding ids 1 and 99999 is a 6.4 MB sparse file
+ *  with two small extents, so only those are read.  Filesystems without
+ *  SEEK_DATA support report the whole file as one extent.
+ *
+ *  returns:  1 if there is data left, 0 if the rest of the range is a hole,
+ *            ERR_DB_FILE on failure
+ */
+static int next_db_extent(db_scan_t *scan){
+    if (!seek_data_supported || !sdb_config.use_seek_data) {
+        scan->extent_end = scan->end;
+        return 1;
+    }
+
+    off_t data = lseek(scan->fd, scan->next_off, SEEK_DATA);
+    if (data == -1) {
+        if (errno == ENXIO)
+            return 0;   //nothing but a hole until EOF
+        if (errno == EINVAL || errno == EOPNOTSUPP) {
+            seek_data_supported = false;
+            scan->extent_end = scan->end;
+            return 1;
+        }
+        return ERR_DB_FILE;
+    }
+
+    off_t hole = lseek(scan->fd, data, SEEK_HOLE);
+    if (hole == -1)
+        return ERR_DB_FILE;
+
+    //extents are filesystem block aligned so this normally changes nothing,
+    //but never start in the middle of a record, or of a page
+    data -= data % (scan->paged ? DB_PAGE_SIZE : STUDENT_RECORD_SIZE);
+    if (data > scan->next_off)
+        scan->next_off = data;
+    scan->extent_end = hole;
+    return 1;
+}
+
+/*
+ *  fill_db_scan
+ *      scan:  iterator whose buffer has been used up
+ *
+ *  Reads the next block of the current extent into the buffer.
+ *
+ *  returns:  1 if records were read, 0 at the end of the range, ERR_DB_FILE
+ *            on a read error or if the file ends inside a record
+ */
+static int fill_db_scan(db_scan_t *scan){
+    if (scan->next_off >= scan->end)
+        return 0;
+
+    if (scan->next_off >= scan->extent_end) {
+        int rc = next_db_extent(scan);
+        if (rc <= 0)
+            return rc;
+        if (scan->next_off >= scan->end)
+            return 0;
+    }
+
+    off_t stop = scan->extent_end < scan->end ? scan->extent_end : scan->end;
+    size_t want = SCAN_BLOCK_SIZE;
+    if ((off_t)want > stop - scan->next_off)
+        want = stop - scan->next_off;
+
+    //the shared lock makes every record in the block either complete or
+    //not there yet, it is held for the read only.  The records of a paged
+    //db are not at their id's offset, its locks cover the ids on the pages
+    off_t lock_off = scan->next_off;
+    off_t lock_len = want;
+    if (scan->paged) {
+        int first_page = scan->next_off / DB_PAGE_SIZE;
+        int pages = (want + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE;
+        lock_off = (off_t)DB_PAGE_FIRST_ID(first_page) * STUDENT_RECORD_SIZE;
+        lock_len = (off_t)pages * DB_PAGE_RECORDS * STUDENT_RECORD_SIZE;
+    }
+    if (scan->lock && lock_db_range(scan->fd, lock_off, lock_len, F_RDLCK,
+                                    true) != NO_ERROR)
+        return ERR_DB_FILE;
+    ssize_t got = pread(scan->fd, scan->buf, want, scan->next_off);
+    if (scan->lock)
+        unlock_db_range(scan->fd, lock_off, lock_len);
+    if (got <= 0 || got % STUDENT_RECORD_SIZE != 0)
+        return ERR_DB_FILE;
+
+    scan->buf_off = scan->next_off;
+    scan->nrecs = got / STUDENT_RECORD_SIZE;
+    scan->pos = 0;
+    scan->next_off += got;
+    return 1;
+}
+
+/*
+ *  read_dir_block
+ *      scan:  iterator over a compacted or packed db whose block of index
+ *             entries has been used up
+ *
+ *  Moves on to the next block of index entries, directly in the mapping
+ *  when it is mapped.
+ *
+ *  returns:  1 if there are entries, 0 when the scan is done, ERR_DB_FILE
+ *            on an I/O error
+ */
+static int read_dir_block(db_scan_t *scan){
+    db_handle_t *h = scan->h;
+
+    if (scan->next_id > scan->last_id)
+        return 0;
+
+    int n = SCAN_BLOCK_SIZE / sizeof(uint32_t);
+    if (n > scan->last_id - scan->next_id + 1)
+        n = scan->last_id - scan->next_id + 1;
+
+    if (h->idx_map != NULL) {
+        scan->slots = h->idx_map + scan->next_id;
+    } else {
+        ssize_t got = pread(h->idx_fd, scan->buf, (size_t)n * sizeof(uint32_t),
+                            (off_t)scan->next_id * sizeof(uint32_t));
+        if (got == -1)
+            return ERR_DB_FILE;
+        if (got == 0)
+            return 0;
+        n = got / sizeof(uint32_t);
+        scan->slots = (uint32_t *)scan->buf;
+    }
+
+    scan->base_id = scan->next_id;
+    scan->nrecs = n;
+    scan->pos = 0;
+    scan->next_id += n;
+    return 1;
+}
+
+/*
+ *  next_compact_record
+ *      scan:  iterator over a db with the compact layout
+ *      s:     set to point at the next live record
+ *
+ *  Walks the id -> slot index a block at a time (directly in the mapping
+ *  when it is mapped) and reads the slot of every id that has one.
+ *
+ *  returns:  1 if a record was found, 0 when the scan is done, ERR_DB_FILE
+ *            on an I/O error
+ */
+static int next_compact_record(db_scan_t *scan, student_t **s){
+    for (;;) {
+        while (scan->pos < scan->nrecs) {
+            int i = scan->pos++;
+            if (scan->slots[i] == 0)
+                continue;
+            if (read_phys_slot(scan->fd, scan->slots[i], &scan->rec) != NO_ERROR)
+                return ERR_DB_FILE;
+            if (scan->rec.id != scan->base_id + i)
+                return ERR_DB_FILE;     //index and data disagree
+            *s = &scan->rec;
+            return 1;
+        }
+
+        int rc = read_dir_block(scan);
+        if (rc <= 0)
+            return rc;
+    }
+}
+
+/*
+ *  next_packed_record
+ *      scan:  iterator over a db with the packed layout
+ *      s:     set to point at the next live record
+ *
+ *  Walks the directory like next_compact_record() and unpacks the record
+ *  of every id that has one from a window of the file read SCAN_BLOCK_SIZE
+ *  bytes at a time.  Records written in id order (by --migrate or -x) are
+ *  read sequentially, one added later only costs a read if it is not in
+ *  the window.  A record that is not the one the directory said (it was
+ *  deleted after the entry was read) is read again under its record lock.
+ *
+ *  returns:  1 if a record was found, 0 when the scan is done, ERR_DB_FILE
+ *            on an I/O error
+ */
+static int next_packed_record(db_scan_t *scan, student_t **s){
+    for (;;) {
+        while (scan->pos < scan->nrecs) {
+            int i = scan->pos++;
+            int id = scan->base_id + i;
+            if (scan->slots[i] == 0)
+                continue;
+
+            off_t off = (off_t)scan->slots[i] * DB_PACK_ALIGN;
+            if (off < scan->cold_off ||
+                    off + DB_PACK_MAX > scan->cold_off + (off_t)scan->cold_len) {
+                ssize_t got = pread(scan->fd, scan->cold, SCAN_BLOCK_SIZE, off);
+                if (got == -1)
+                    return ERR_DB_FILE;
+                scan->cold_off = off;
+                scan->cold_len = got;
+            }
+
+            if (unpack_record(scan->cold + (off - scan->cold_off),
+                              scan->cold_len - (off - scan->cold_off),
+                              &scan->rec) < 0 || scan->rec.id != id) {
+                if (!scan->lock)
+                    return ERR_DB_FILE;     //directory and data disagree
+                if (lock_db_slots(scan->fd, id, 1, F_RDLCK) != NO_ERROR)
+                    return ERR_DB_FILE;
+                int rc = read_packed_slot(scan->h, id, &scan->rec);
+                unlock_db_slots(scan->fd, id, 1);
+                if (rc != NO_ERROR)
+                    return ERR_DB_FILE;
+                if (scan->rec.id == DELETED_STUDENT_ID)
+                    continue;
+            }
+            *s = &scan->rec;
+            return 1;
+        }
+
+        int rc = read_dir_block(scan);
+        if (rc <= 0)
+            return rc;
+    }
+}
+
+/*
+ *  next_split_record
+ *      scan:  iterator over a db with the split layout
+ *      s:     set to point at the next live record
+ *
+ *  Reads the hot column a block at a time, and the names of the same ids
+ *  with it unless the scan is hot_only.  Both are read under the shared
+ *  lock of the ids, so a record is either all there or not at all.
+ *
+ *  returns:  1 if a record was found, 0 when the scan is done, ERR_DB_FILE
+ *            on an I/O error
+ */
+static int next_split_record(db_scan_t *scan, student_t **s){
+    db_hot_t *hot = (db_hot_t *)scan->buf;
+
+    for (;;) {
+        while (scan->pos < scan->nrecs) {
+            int i = scan->pos++;
+            if (hot[i].id == DELETED_STUDENT_ID)
+                continue;
+
+            scan->rec.id = hot[i].id;
+            scan->rec.gpa = hot[i].gpa;
+            if (scan->cold != NULL)
+                memcpy((char *)&scan->rec + offsetof(student_t, fname),
+                       scan->cold + (size_t)i * DB_COLD_SIZE, DB_COLD_SIZE);
+            *s = &scan->rec;
+            return 1;
+        }
+
+        if (scan->next_id > scan->last_id)
+            return 0;
+
+        int n = scan->cold != NULL ? SCAN_BLOCK_SIZE / DB_COLD_SIZE
+                                   : SCAN_BLOCK_SIZE / (int)sizeof(db_hot_t);
+        if (n > scan->last_id - scan->next_id + 1)
+            n = scan->last_id - scan->next_id + 1;
+
+        off_t lock_off = (off_t)scan->next_id * STUDENT_RECORD_SIZE;
+        off_t lock_len = (off_t)n * STUDENT_RECORD_SIZE;
+        if (scan->lock && lock_db_range(scan->fd, lock_off, lock_len, F_RDLCK,
+                                        true) != NO_ERROR)
+            return ERR_DB_FILE;
+        int rc = read_hot_block(scan->h, scan->next_id, n, hot);
+        if (rc == NO_ERROR && scan->cold != NULL) {
+            size_t want = (size_t)n * DB_COLD_SIZE;
+            ssize_t got = pread(scan->fd, scan->cold, want,
+                                DB_COLD_OFF(scan->next_id));
+            if (got == -1)
+                rc = ERR_DB_FILE;
+            else if ((size_t)got < want)
+                memset(scan->cold + got, 0, want - got);
+        }
+        if (scan->lock)
+            unlock_db_range(scan->fd, lock_off, lock_len);
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+
+        scan->base_id = scan->next_id;
+        scan->nrecs = n;
+        scan->pos = 0;
+        scan->next_id += n;
+    }
+}
+
+/*
+ *  next_paged_record
+ *      scan:  iterator over a db with the paged layout
+ *      s:     set to point at the next live record
+ *
+ *  Walks the pages in the buffer and, on each, only the records whose bit
+ *  is set in the page header.  Empty pages cost one header test.
+ *
+ *  returns:  1 if a record was found, 0 when the scan is done, ERR_DB_FILE
+ *            on an I/O error
+ */
+static int next_paged_record(db_scan_t *scan, student_t **s){
+    for (;;) {
+        while (scan->live != 0) {
+            int i = __builtin_ctzll(scan->live);
+            scan->live &= scan->live - 1;
+
+            int id = DB_PAGE_FIRST_ID((scan->buf_off + (char *)scan->page -
+                                       scan->buf) / DB_PAGE_SIZE) + i;
+            if (id < scan->next_id)
+                continue;
+            if (id > scan->last_id)
+                return 0;
+            *s = &scan->page[1 + i];
+            return 1;
+        }
+
+        if (scan->pos < scan->nrecs) {
+            student_t *recs = (student_t *)scan->buf;
+            const db_page_hdr_t *ph = (const db_page_hdr_t *)&recs[scan->pos];
+
+            if (scan->pos + DB_PAGE_SLOTS > scan->nrecs)
+                return ERR_DB_FILE;     //the file ends inside a page
+            scan->page = &recs[scan->pos];
+            scan->live = ph->count > 0 ? ph->live : 0;
+            scan->pos += DB_PAGE_SLOTS;
+            continue;
+        }
+
+        int rc = fill_db_scan(scan);
+        if (rc <= 0)
+            return rc;
+    }
+}
+
+/*
+ *  next_db_record
+ *      scan:  iterator from open_db_scan()
+ *      s:     set to point at the next live record.  The pointer is into
+ *             the scan buffer and is valid until the next call.
+ *
+ *  returns:  1 if a record was found, 0 when the scan is done, ERR_DB_FILE
+ *            on an I/O error
+ */
+int next_db_record(db_scan_t *scan, student_t **s){
+    if (scan->h != NULL && scan->h->layout == DB_LAYOUT_HASH) {
+        if (scan->pos >= scan->nrecs)
+            return 0;
+        *s = &scan->hashed[scan->pos++];
+        return 1;
+    }
+    if (scan->h != NULL && scan->h->layout == DB_LAYOUT_SPLIT)
+        return next_split_record(scan, s);
+    if (scan->h != NULL && scan->h->layout == DB_LAYOUT_PACKED)
+        return next_packed_record(scan, s);
+    if (scan->h != NULL)
+        return next_compact_record(scan, s);
+    if (scan->paged)
+        return next_paged_record(scan, s);
+
+    for (;;) {
+        if (scan->pos < scan->nrecs) {
+            student_t *recs = (student_t *)scan->buf;
+            int i = scan->pos + find_live(recs + scan->pos, scan->nrecs - scan->pos);
+            if (i < scan->nrecs) {
+                scan->pos = i + 1;
+                *s = &recs[i];
+                return 1;
+            }
+            scan->pos = scan->nrecs;
+        }
+
+        int rc = fill_db_scan(scan);
+        if (rc <= 0)
+            return rc;
+    }
+}
+
+/*
+ *  close_db_scan
+ *      scan:  iterator to release
+ */
+void close_db_scan(db_scan_t *scan){
+    free(scan->buf);
+    free(scan->cold);
+    free(scan->hashed);
+    scan->buf = NULL;
+    scan->cold = NULL;
+    scan->hashed = NULL;
+}
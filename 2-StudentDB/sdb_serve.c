@@ -0,0 +1,488 @@
+#define _GNU_SOURCE     //accept4()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  sdbsc --serve keeps the database open, mapped and with its indexes
+ *  loaded, and runs the operations sent to it by sdbsc --client over a
+ *  Unix domain socket next to the db file.  A client process does not open
+ *  the db at all, it only sends fixed size sdb_request_t messages and
+ *  copies the console output from the replies to its own stdout.
+ *
+ *  The server is a single thread polling all connections.  Requests of one
+ *  connection are run in the order they arrive, a client may send up to
+ *  CLIENT_WINDOW of them before reading the replies.  The record locks
+ *  (see sdb_lock.c) are still taken, so other sdbsc processes can keep
+ *  working on the same db next to the server.
+ *
+ *  The sockets are non-blocking.  Replies go to a queue of their
+ *  connection and are sent as far as the socket takes them, the rest when
+ *  poll() reports it writable again.  A connection with replies still
+ *  queued is not read from, so a client that stops reading holds up
+ *  nobody but itself, and its queue never grows past one window of
+ *  replies.
+ */
+
+//per connection state, requests can arrive split over several reads
+typedef struct serve_conn{
+    int    sock;
+    size_t have;                                    //bytes in buf
+    char   buf[CLIENT_WINDOW * sizeof(sdb_request_t)];
+    char  *out;                                     //queued replies
+    size_t out_len;                                 //bytes in out
+    size_t out_sent;                                //bytes of out sent
+    size_t out_cap;                                 //size of out
+} serve_conn_t;
+
+static volatile sig_atomic_t serve_stop;
+
+static void stop_server(int sig){
+    (void)sig;
+    serve_stop = 1;
+}
+
+static void sock_path(char *buff, size_t len){
+    snprintf(buff, len, "%s%s", DB_FILE, DB_SOCK_EXT);
+}
+
+/*
+ *  write_full / read_full
+ *      sock:  connected socket
+ *      p:     bytes to send / buffer to fill
+ *      len:   number of bytes
+ *
+ *  returns:  NO_ERROR once all len bytes went through, ERR_DB_FILE if the
+ *            peer went away or on an error
+ */
+static int write_full(int sock, const void *p, size_t len){
+    const char *c = p;
+
+    while (len > 0) {
+        ssize_t n = write(sock, c, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        c += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+static int read_full(int sock, void *p, size_t len){
+    char *c = p;
+
+    while (len > 0) {
+        ssize_t n = read(sock, c, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        c += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  queue_reply
+ *      c:      connection to reply on
+ *      p:      bytes to queue
+ *      len:    number of bytes
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ */
+static int queue_reply(serve_conn_t *c, const void *p, size_t len){
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap > 0 ? c->out_cap : 4096;
+        while (cap < c->out_len + len)
+            cap *= 2;
+        char *out = realloc(c->out, cap);
+        if (out == NULL)
+            return ERR_DB_FILE;
+        c->out = out;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, p, len);
+    c->out_len += len;
+    return NO_ERROR;
+}
+
+/*
+ *  send_replies
+ *      c:  connection with queued replies
+ *
+ *  Writes queued replies until they are all sent or the socket is full.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the client went away
+ */
+static int send_replies(serve_conn_t *c){
+    while (c->out_sent < c->out_len) {
+        ssize_t n = write(c->sock, c->out + c->out_sent,
+                          c->out_len - c->out_sent);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return NO_ERROR;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        c->out_sent += n;
+    }
+    c->out_len = 0;
+    c->out_sent = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  serve_requests
+ *      fd:  linux file descriptor of the db
+ *      c:   connection that has just read more bytes
+ *
+ *  Runs every complete request in the connection buffer and queues the
+ *  replies, a partial request is kept for the next read.
+ *
+ *  returns:  number of requests run, ERR_DB_FILE if the connection has to
+ *            be dropped (bad message or out of memory)
+ */
+static int serve_requests(int fd, serve_conn_t *c){
+    size_t used = 0;
+    int n = 0;
+
+    while (c->have - used >= sizeof(sdb_request_t)) {
+        sdb_request_t req;
+        char *out;
+        size_t len;
+
+        memcpy(&req, c->buf + used, sizeof(req));
+        used += sizeof(req);
+        if (req.magic != SDB_MSG_MAGIC)
+            return ERR_DB_FILE;
+
+        sdb_reply_t reply = { .exit_code = capture_db_op(fd, &req, &out, &len),
+                              .len = out != NULL ? len : 0 };
+        int rc = queue_reply(c, &reply, sizeof(reply));
+        if (rc == NO_ERROR)
+            rc = queue_reply(c, out, reply.len);
+        free(out);
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+        n++;
+    }
+
+    memmove(c->buf, c->buf + used, c->have - used);
+    c->have -= used;
+    return n;
+}
+
+//drops a connection and whatever replies it still had queued
+static void close_conn(serve_conn_t *c){
+    close(c->sock);
+    free(c->out);
+    free(c);
+}
+
+/*
+ *  open_server_socket
+ *      path:  socket to create
+ *
+ *  A socket file left behind by a server that died is removed, one that a
+ *  server still answers on is not taken over.
+ *
+ *  returns:  the listening socket, or -1 on failure
+ */
+static int open_server_socket(const char *path){
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    //a socket name has to fit sun_path whole
+    int n = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (n < 0 || (size_t)n >= sizeof(addr.sun_path))
+        return -1;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(sock);
+        return -1;
+    }
+    unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(sock, SOMAXCONN) == -1) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ *  serve_db
+ *      fd:  linux file descriptor of the open db
+ *
+ *  Runs the server until it gets SIGINT or SIGTERM, then removes the
+ *  socket and returns so that main() closes the db as usual.
+ *
+ *  returns:  NO_ERROR after a clean shutdown, ERR_DB_FILE if the socket
+ *            can not be set up
+ *
+ *  console:  M_SERVE_READY    once the socket accepts connections
+ *            M_SERVE_STOPPED  on shutdown
+ *            M_ERR_SERVE      the socket could not be set up, or another
+ *                             server is running
+ */
+int serve_db(int fd){
+    char path[DB_PATH_MAX];
+    struct pollfd pfd[SERVE_MAX_CLIENTS + 1];
+    serve_conn_t *conns[SERVE_MAX_CLIENTS + 1] = {0};
+    unsigned long long served = 0;
+    int nfds = 1;
+
+    sock_path(path, sizeof(path));
+    int lsock = open_server_socket(path);
+    if (lsock == -1) {
+        printf(M_ERR_SERVE, path);
+        return ERR_DB_FILE;
+    }
+
+    struct sigaction sa = { .sa_handler = stop_server };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pfd[0].fd = lsock;
+    pfd[0].events = POLLIN;
+    printf(M_SERVE_READY, DB_FILE, path);
+    fflush(stdout);
+
+    while (!serve_stop) {
+        if (poll(pfd, nfds, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            serve_conn_t *c = NULL;
+            if (sock != -1 && nfds <= SERVE_MAX_CLIENTS &&
+                    (c = calloc(1, sizeof(*c))) != NULL) {
+                c->sock = sock;
+                conns[nfds] = c;
+                pfd[nfds].fd = sock;
+                pfd[nfds].events = POLLIN;
+                pfd[nfds].revents = 0;
+                nfds++;
+            } else if (sock != -1) {
+                close(sock);
+            }
+        }
+
+        for (int i = 1; i < nfds; i++) {
+            serve_conn_t *c = conns[i];
+            int rc = ERR_DB_FILE;
+
+            if (pfd[i].revents == 0)
+                continue;
+            if (pfd[i].revents & POLLOUT) {
+                rc = send_replies(c);
+            } else if (pfd[i].revents & POLLIN) {
+                ssize_t n = read(c->sock, c->buf + c->have,
+                                 sizeof(c->buf) - c->have);
+                if (n == -1 && (errno == EAGAIN || errno == EINTR))
+                    rc = 0;
+                if (n > 0) {
+                    c->have += n;
+                    rc = serve_requests(fd, c);
+                    if (rc >= 0 && send_replies(c) != NO_ERROR)
+                        rc = ERR_DB_FILE;
+                }
+            }
+            if (rc >= 0) {
+                served += rc;
+                //read the next requests only once the replies are out
+                pfd[i].events = c->out_len > 0 ? POLLOUT : POLLIN;
+                continue;
+            }
+
+            //the client is done or misbehaved, the last slot moves here
+            close_conn(c);
+            nfds--;
+            conns[i] = conns[nfds];
+            pfd[i] = pfd[nfds];
+            i--;
+        }
+
+        //group commit of everything run in this round
+        sync_wal(db_handle(fd));
+    }
+
+    for (int i = 1; i < nfds; i++)
+        close_conn(conns[i]);
+    close(lsock);
+    unlink(path);
+
+    printf(M_SERVE_STOPPED, served);
+    return NO_ERROR;
+}
+
+/*
+ *  read_reply
+ *      sock:       connected socket
+ *      exit_code:  set to the exit code from the reply
+ *
+ *  Copies the console output of one reply to stdout.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the server went away
+ */
+static int read_reply(int sock, int *exit_code){
+    sdb_reply_t reply;
+    char buf[65536];
+
+    if (read_full(sock, &reply, sizeof(reply)) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (size_t left = reply.len; left > 0; ) {
+        size_t n = left < sizeof(buf) ? left : sizeof(buf);
+        if (read_full(sock, buf, n) != NO_ERROR)
+            return ERR_DB_FILE;
+        fwrite(buf, 1, n, stdout);
+        left -= n;
+    }
+    *exit_code = reply.exit_code;
+    return NO_ERROR;
+}
+
+/*
+ *  send_batch
+ *      sock:       connected socket
+ *      reqs:       requests to send
+ *      n:          number of requests
+ *      exit_code:  updated with the exit code of every failed request
+ *
+ *  Sends the requests with one write() and prints the replies in order.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the server went away
+ */
+static int send_batch(int sock, const sdb_request_t *reqs, int n, int *exit_code){
+    if (n == 0)
+        return NO_ERROR;
+    if (write_full(sock, reqs, (size_t)n * sizeof(*reqs)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++) {
+        int rc;
+        if (read_reply(sock, &rc) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (rc != EXIT_OK)
+            *exit_code = rc;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  run_stream
+ *      sock:  connected socket
+ *
+ *  Reads operations from stdin, one per line ("a 1 john doe 345" or
+ *  "-a 1 john doe 345", see sdb_repl.c), and sends them to the server
+ *  CLIENT_WINDOW at a time.  A script can push tens of thousands of
+ *  operations through one client process this way.
+ *
+ *  returns:  the exit code of the last operation that failed, EXIT_OK if
+ *            none did
+ */
+static int run_stream(int sock){
+    sdb_request_t reqs[CLIENT_WINDOW];
+    char *line = NULL;
+    size_t cap = 0;
+    int n = 0;
+    int exit_code = EXIT_OK;
+
+    while (getline(&line, &cap, stdin) != -1) {
+        char *args[DB_OP_MAX_ARGS];
+
+        int nargs = split_db_op(line, args, DB_OP_MAX_ARGS);
+        if (nargs == 0)
+            continue;
+
+        if (parse_db_op(db_op_letter(args[0]), nargs - 1, args + 1,
+                        &reqs[n]) == NO_ERROR) {
+            if (++n < CLIENT_WINDOW)
+                continue;
+        } else {
+            //flush what is pending first so the output stays in order
+            if (send_batch(sock, reqs, n, &exit_code) != NO_ERROR)
+                break;
+            n = 0;
+            printf(M_ERR_BAD_OPTION, args[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            continue;
+        }
+
+        if (send_batch(sock, reqs, n, &exit_code) != NO_ERROR)
+            break;
+        n = 0;
+    }
+
+    if (!feof(stdin) || send_batch(sock, reqs, n, &exit_code) != NO_ERROR)
+        exit_code = EXIT_FAIL_DB;
+    free(line);
+    return exit_code;
+}
+
+/*
+ *  run_client
+ *      argc, argv:  the arguments of main() after the global options
+ *
+ *  Sends one operation, or with "-" a stream of them from stdin, to the
+ *  server and prints the replies.
+ *
+ *  returns:  the exit code for the shell
+ *
+ *  console:  M_ERR_CLIENT  no server is listening on the socket
+ *            the output of the operations, exactly as sdbsc prints it
+ */
+int run_client(int argc, char *argv[]){
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    sdb_request_t req;
+    int exit_code = EXIT_OK;
+
+    bool stream = argc == 2 && strcmp(argv[1], "-") == 0;
+    if (!stream && (argv[1][0] != '-' ||
+            parse_db_op(db_op_letter(argv[1]), argc - 2, argv + 2, &req) != NO_ERROR)) {
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+
+    sock_path(addr.sun_path, sizeof(addr.sun_path));
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 ||
+            connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        printf(M_ERR_CLIENT, addr.sun_path);
+        if (sock != -1)
+            close(sock);
+        return EXIT_FAIL_DB;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (stream)
+        exit_code = run_stream(sock);
+    else if (send_batch(sock, &req, 1, &exit_code) != NO_ERROR)
+        exit_code = EXIT_FAIL_DB;
+
+    close(sock);
+    return exit_code;
+}
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE     //SEEK_DATA, SEEK_HOLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <linux/fs.h>   //FICLONE
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Snapshots (--snapshot).  A scan of the db itself only locks one block
+ *  at a time, so a long print running next to writers shows every record
+ *  whole but not all of them as of the same moment.  A snapshot is a
+ *  private copy of the db file and of the file its layout keeps next to
+ *  it (index, hot column or directory), taken while a shared lock on the
+ *  record of every id keeps writers out, which the scan then reads with
+ *  no locks at all.  Writers only wait for the copy, not for the scan.
+ *
+ *  The copy is a reflink (FICLONE) where the filesystem has them, the
+ *  files then share their blocks until a writer changes one, so taking a
+ *  snapshot costs the same whatever the size of the db.  Elsewhere the
+ *  data extents are copied with copy_db_range() and the holes are kept.
+ *  The copies are unlinked as soon as they are open, nothing is left
+ *  behind when the reader exits.
+ */
+
+#define SNAP_COPY_BUF   (64 * 1024)     //bytes per read() when copying by hand
+
+/*
+ *  snapshot_path
+ *      db_path:  name of the database file
+ *      buff:     receives the name of this process' snapshot of it, in
+ *                the same directory so that it can share its blocks
+ *      len:      size of buff, a name that does not fit is left empty
+ */
+void snapshot_path(const char *db_path, char *buff, size_t len){
+    const char *base = strrchr(db_path, '/');
+    int dir_len = base == NULL ? 0 : (int)(base + 1 - db_path);
+
+    int n = snprintf(buff, len, "%.*s%s%d_%s", dir_len, db_path,
+                     SNAP_DB_PREFIX, (int)getpid(), db_path + dir_len);
+    if (n < 0 || (size_t)n >= len)
+        buff[0] = '\0';
+}
+
+/*
+ *  copy_extent
+ *      in_fd:   file to copy from
+ *      out_fd:  file to copy to, at the same offset
+ *      off:     first byte to copy
+ *      len:     number of bytes
+ *
+ *  copy_db_range(), and read() / write() for whatever it did not copy.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int copy_extent(int in_fd, int out_fd, off_t off, off_t len){
+    char *buf = NULL;
+
+    size_t done = copy_db_range(in_fd, off, out_fd, off, len);
+    off += done;
+    len -= done;
+
+    while (len > 0) {
+        if (buf == NULL && (buf = malloc(SNAP_COPY_BUF)) == NULL)
+            return ERR_DB_FILE;
+        size_t want = len < SNAP_COPY_BUF ? (size_t)len : SNAP_COPY_BUF;
+        ssize_t n = pread(in_fd, buf, want, off);
+        if (n <= 0 || pwrite(out_fd, buf, n, off) != n) {
+            free(buf);
+            return ERR_DB_FILE;
+        }
+        off += n;
+        len -= n;
+    }
+    free(buf);
+    return NO_ERROR;
+}
+
+/*
+ *  clone_db_file
+ *      in_fd:  open db file, or a file kept next to it
+ *      path:   name of the copy to create
+ *
+ *  Copies the file to path, with a reflink when the filesystem can make
+ *  one, otherwise one data extent at a time.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int clone_db_file(int in_fd, const char *path){
+    struct stat st;
+    int rc = NO_ERROR;
+
+    int out_fd = open(path, O_RDWR | O_CREAT | O_EXCL, DB_FILE_MODE);
+    if (out_fd == -1)
+        return ERR_DB_FILE;
+
+    if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+        close(out_fd);
+        return NO_ERROR;
+    }
+
+    if (fstat(in_fd, &st) == -1 || ftruncate(out_fd, st.st_size) == -1) {
+        close(out_fd);
+        return ERR_DB_FILE;
+    }
+
+    off_t off = 0;
+    while (rc == NO_ERROR && off < st.st_size) {
+        off_t data = lseek(in_fd, off, SEEK_DATA);
+        if (data == -1 && errno == ENXIO)
+            break;              //only a hole is left
+        off_t end = st.st_size;
+        if (data == -1) {
+            data = off;         //no SEEK_DATA, copy it all
+        } else {
+            off_t hole = lseek(in_fd, data, SEEK_HOLE);
+            if (hole != -1 && hole < end)
+                end = hole;
+        }
+        rc = copy_extent(in_fd, out_fd, data, end - data);
+        off = end;
+    }
+
+    close(out_fd);
+    return rc;
+}
+
+/*
+ *  open_db_snapshot
+ *      fd:  linux file descriptor of an open database
+ *
+ *  Takes a snapshot of the database:  waits for the writers that are
+ *  changing a record, keeps new ones out while the files are copied, then
+ *  opens and attaches the copy (attach_db_snapshot()) and unlinks it.  The
+ *  descriptor returned is scanned like the db it was taken from, with
+ *  none of the locking (see holds_db_locks()), and released with
+ *  close_db().  fd itself is not changed.
+ *
+ *  returns:  the fd of the snapshot, or ERR_DB_FILE on failure
+ *
+ *  console:  M_ERR_DB_SNAPSHOT  the snapshot could not be taken
+ */
+int open_db_snapshot(int fd){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+    char side_path[DB_PATH_MAX];
+    void (*side_name)(const char *, char *, size_t) = NULL;
+    int side_fd = -1;
+    int rc = NO_ERROR;
+
+    if (h != NULL)
+        snapshot_path(h->path, path, sizeof(path));
+    if (h == NULL || path[0] == '\0') {
+        printf(M_ERR_DB_SNAPSHOT);
+        return ERR_DB_FILE;
+    }
+
+    //writers hold their record lock until the indexes are saved, so once
+    //every record is locked shared the files are all at the same point
+    if (lock_db_slots(fd, MIN_STD_ID, DB_HASH_MAX_ID, F_RDLCK) != NO_ERROR) {
+        printf(M_ERR_DB_SNAPSHOT);
+        return ERR_DB_FILE;
+    }
+    if (lock_db_meta(fd, F_RDLCK) != NO_ERROR) {
+        unlock_db_slots(fd, MIN_STD_ID, DB_HASH_MAX_ID);
+        printf(M_ERR_DB_SNAPSHOT);
+        return ERR_DB_FILE;
+    }
+
+    //the file next to it that the layout reads records through, if any
+    switch (h->layout) {
+        case DB_LAYOUT_COMPACT:
+            side_name = db_index_path;
+            side_fd = h->idx_fd;
+            break;
+        case DB_LAYOUT_PACKED:
+            side_name = packed_dir_path;
+            side_fd = h->idx_fd;
+            break;
+        case DB_LAYOUT_SPLIT:
+            side_name = hot_column_path;
+            side_fd = h->hot_fd;
+            break;
+        case DB_LAYOUT_HASH:
+            side_name = hash_dir_path;
+            side_fd = h->dir_fd;
+            break;
+    }
+    if (side_name != NULL)
+        side_name(path, side_path, sizeof(side_path));
+
+    if (clone_db_file(fd, path) != NO_ERROR ||
+            (side_name != NULL && clone_db_file(side_fd, side_path) != NO_ERROR))
+        rc = ERR_DB_FILE;
+    unlock_db_meta(fd);
+    unlock_db_slots(fd, MIN_STD_ID, DB_HASH_MAX_ID);
+
+    int snap_fd = -1;
+    if (rc == NO_ERROR) {
+        snap_fd = open(path, O_RDWR);
+        if (snap_fd != -1 && attach_db_snapshot(snap_fd, path) != NO_ERROR) {
+            close(snap_fd);
+            snap_fd = -1;
+        }
+    }
+
+    //open files live on without their names
+    unlink(path);
+    if (side_name != NULL)
+        unlink(side_path);
+
+    if (snap_fd == -1) {
+        printf(M_ERR_DB_SNAPSHOT);
+        return ERR_DB_FILE;
+    }
+    return snap_fd;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+//the superblock shares slot 0 with nothing else, it has to fit exactly
+_Static_assert(sizeof(db_header_t) == sizeof(student_t),
+               "db_header_t must be the size of a student record");
+
+/*
+ *  gpa_bucket
+ *      gpa:  integer gpa, MIN_STD_GPA..MAX_STD_GPA
+ *
+ *  returns:  the histogram bucket the gpa is counted in
+ */
+int gpa_bucket(int gpa){
+    int b = gpa / DB_GPA_BUCKET_WIDTH;
+
+    if (b < 0)
+        return 0;
+    if (b >= DB_GPA_BUCKETS)
+        return DB_GPA_BUCKETS - 1;
+    return b;
+}
+
+/*
+ *  add_to_stats
+ *      hdr:  superblock to update
+ *      s:    record that was added
+ *
+ *  Counts one more record in the statistics of hdr.
+ */
+void add_to_stats(db_header_t *hdr, const student_t *s){
+    if (hdr->count == 0 || (uint32_t)s->id < hdr->min_id)
+        hdr->min_id = s->id;
+    if (hdr->count == 0 || (uint32_t)s->id > hdr->max_id)
+        hdr->max_id = s->id;
+    hdr->count++;
+    hdr->gpa_sum += s->gpa;
+    hdr->gpa_hist[gpa_bucket(s->gpa)]++;
+}
+
+/*
+ *  find_lowest_id / find_highest_id
+ *      fd:    linux file descriptor
+ *      from:  search starts here and moves up (lowest) or down (highest)
+ *      to:    search stops here
+ *
+ *  Used after the record holding the lowest or highest id was deleted.
+ *  Both go through the scan iterator in windows, so that they stop as soon
+ *  as a window holds a live record.  The next live id is usually close by,
+ *  so the first window is one page of slots and each one after that is
+ *  twice as large, up to a full scan block.  A scan of a hashed db reads
+ *  every bucket whatever its range, so there it is done once over the
+ *  whole range.
+ *
+ *  returns:  the id found, 0 if there is none, ERR_DB_FILE on failure
+ */
+#define FIRST_ID_WINDOW (SCAN_BUF_ALIGN / STUDENT_RECORD_SIZE)
+#define MAX_ID_WINDOW   (SCAN_BLOCK_SIZE / STUDENT_RECORD_SIZE)
+
+//the lowest or highest id in lo..hi, in one scan
+static int find_id_in(int fd, int lo, int hi, bool highest){
+    db_scan_t scan;
+    student_t *s;
+    int found = 0;
+    int rc;
+
+    if (open_db_hot_scan(&scan, fd, lo, hi) != NO_ERROR) {
+        close_db_scan(&scan);
+        return ERR_DB_FILE;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0) {
+        found = s->id;
+        if (!highest)
+            break;
+    }
+    close_db_scan(&scan);
+    return rc < 0 ? ERR_DB_FILE : found;
+}
+
+static int find_lowest_id(int fd, int from, int to){
+    int window = FIRST_ID_WINDOW;
+
+    if (db_max_id(fd) > MAX_STD_ID)
+        return find_id_in(fd, from, to, false);
+    for (int lo = from; lo <= to; lo += window) {
+        int hi = to - lo < window ? to : lo + window - 1;
+        db_scan_t scan;
+        student_t *s;
+
+        if (lo > from && window < MAX_ID_WINDOW)
+            window *= 2;
+        if (open_db_hot_scan(&scan, fd, lo, hi) != NO_ERROR) {
+            close_db_scan(&scan);
+            return ERR_DB_FILE;
+        }
+        int rc = next_db_record(&scan, &s);
+        int found = rc > 0 ? s->id : 0;
+        close_db_scan(&scan);
+
+        if (rc < 0)
+            return ERR_DB_FILE;
+        if (found != 0)
+            return found;
+    }
+    return 0;
+}
+
+static int find_highest_id(int fd, int from, int to){
+    int window = FIRST_ID_WINDOW;
+
+    if (db_max_id(fd) > MAX_STD_ID)
+        return find_id_in(fd, to, from, true);
+
+    for (int hi = from; hi >= to; hi -= window) {
+        int lo = hi - to < window ? to : hi - window + 1;
+        db_scan_t scan;
+        student_t *s;
+        int found = 0;
+        int rc;
+
+        if (hi < from && window < MAX_ID_WINDOW)
+            window *= 2;
+        if (open_db_hot_scan(&scan, fd, lo, hi) != NO_ERROR) {
+            close_db_scan(&scan);
+            return ERR_DB_FILE;
+        }
+        while ((rc = next_db_record(&scan, &s)) > 0)
+            found = s->id;
+        close_db_scan(&scan);
+
+        if (rc < 0)
+            return ERR_DB_FILE;
+        if (found != 0)
+            return found;
+    }
+    return 0;
+}
+
+/*
+ *  update_db_stats
+ *      fd:     linux file descriptor
+ *      s:      record that was just added or deleted
+ *      delta:  1 for an add, -1 for a delete
+ *
+ *  Keeps the superblock statistics of an open database in step with a
+ *  change that has already been written.  Only the cached copy in the
+ *  handle is changed, save_db_stats() writes it out, which lets a bulk load
+ *  write the superblock once.  Databases whose statistics are not being
+ *  maintained (written by older versions) are left alone.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int update_db_stats(int fd, const student_t *s, int delta){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || !h->stats_valid)
+        return NO_ERROR;
+
+    db_header_t *hdr = &h->hdr;
+    h->hdr_dirty = true;
+
+    if (delta > 0) {
+        add_to_stats(hdr, s);
+        return NO_ERROR;
+    }
+
+    if (hdr->count > 0)
+        hdr->count--;
+    hdr->gpa_sum -= s->gpa;
+    hdr->gpa_hist[gpa_bucket(s->gpa)]--;
+
+    if (hdr->count == 0) {
+        hdr->min_id = 0;
+        hdr->max_id = 0;
+        return NO_ERROR;
+    }
+
+    //the bounds only move when one of them was deleted
+    if ((uint32_t)s->id == hdr->min_id) {
+        int id = find_lowest_id(fd, s->id + 1, hdr->max_id);
+        if (id < 0)
+            return ERR_DB_FILE;
+        hdr->min_id = id;
+    }
+    if ((uint32_t)s->id == hdr->max_id) {
+        int id = find_highest_id(fd, s->id - 1, hdr->min_id);
+        if (id < 0)
+            return ERR_DB_FILE;
+        hdr->max_id = id;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  save_db_stats
+ *      fd:  linux file descriptor
+ *
+ *  Writes the cached superblock back to slot 0 if it changed.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_db_stats(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h == NULL || !h->hdr_dirty)
+        return NO_ERROR;
+
+    if (write_db_header(fd, &h->hdr) != NO_ERROR)
+        return ERR_DB_FILE;
+    h->hdr_dirty = false;
+    return NO_ERROR;
+}
+
+/*
+ *  compute_db_stats
+ *      fd:   linux file descriptor
+ *      hdr:  superblock whose statistics are recomputed
+ *
+ *  Recomputes the statistics with a full scan of the ids and gpas (see
+ *  open_db_hot_scan()), split over sdb_config.jobs threads with -j.
+ *  Everything but the statistics (magic, layout) is kept, the version is
+ *  set to DB_VERSION.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int compute_db_stats(int fd, db_header_t *hdr){
+    db_scan_t scan;
+    student_t *s;
+    int rc;
+
+    hdr->magic = DB_MAGIC;
+    hdr->version = DB_VERSION;
+    hdr->count = 0;
+    hdr->min_id = 0;
+    hdr->max_id = 0;
+    hdr->gpa_sum = 0;
+    memset(hdr->gpa_hist, 0, sizeof(hdr->gpa_hist));
+
+    if (sdb_config.jobs > 1)
+        return par_compute_stats(fd, sdb_config.jobs, hdr);
+
+    if (open_db_hot_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID) != NO_ERROR) {
+        close_db_scan(&scan);
+        return ERR_DB_FILE;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0)
+        add_to_stats(hdr, s);
+    close_db_scan(&scan);
+
+    return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
@@ -0,0 +1,1268 @@
+#define _GNU_SOURCE     //mremap(), fallocate(), copy_file_range()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+//runtime options, filled in by main() from the global command line options
+sdb_config_t sdb_config = {
+    .durability = DB_DURABILITY_RELAXED,
+    .use_mmap   = true,
+    .jobs       = 1,
+    .use_seek_data = true,
+};
+
+//handles for the database files this process has open.  There is normally
+//only one (student.db) plus the temporary file used by compress_db()
+static db_handle_t db_handles[DB_MAX_HANDLES];
+
+/*
+ *  db_handle
+ *      fd:  linux file descriptor returned from open_db()
+ *
+ *  returns:  the handle registered for fd, or NULL if fd was not opened
+ *            through open_db().  Callers use the plain syscall path when
+ *            there is no handle.
+ */
+db_handle_t *db_handle(int fd){
+    for (int i = 0; i < DB_MAX_HANDLES; i++) {
+        if (db_handles[i].in_use && db_handles[i].fd == fd)
+            return &db_handles[i];
+    }
+    return NULL;
+}
+
+/*
+ *  map_db
+ *      h:  handle of the database to map
+ *
+ *  Maps the database file into memory.  For the direct addressed layout the
+ *  file can never be larger than (MAX_STD_ID+1) records, so the mapping
+ *  reserves that much address space up front.  Growing the file afterwards
+ *  only needs an ftruncate(), the mapping itself does not move.  Pages past
+ *  EOF must never be touched (SIGBUS), so every access is checked against
+ *  file_len.  Another process may cut the file, file_len is read again
+ *  whenever a record or the superblock is locked (see sdb_lock.c), and the
+ *  file is only cut while no other process holds a lock on any record
+ *  (see cut_db_file()).
+ *  The hash layout has no such bound and is never mapped, its buckets are
+ *  read and written with pread() and pwrite().
+ *
+ *  returns:  NO_ERROR     the file is mapped
+ *            ERR_DB_FILE  mmap failed, or the db has the hash layout, h->map
+ *                         is left NULL so the caller falls back to the
+ *                         read()/write() path
+ */
+int map_db(db_handle_t *h){
+    struct stat st;
+    size_t len = DB_MAP_RESERVE;
+
+    if (h->layout == DB_LAYOUT_HASH)
+        return ERR_DB_FILE;
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    h->file_len = st.st_size;
+    if ((size_t)st.st_size > len)
+        len = st.st_size;
+
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+    if (map == MAP_FAILED) {
+        h->map = NULL;
+        h->map_len = 0;
+        return ERR_DB_FILE;
+    }
+
+    h->map = map;
+    h->map_len = len;
+    return NO_ERROR;
+}
+
+/*
+ *  unmap_db
+ *      h:  handle of the database to unmap
+ *
+ *  Releases the mapping.  With the batch durability policy this is where
+ *  the dirty pages are flushed.
+ */
+void unmap_db(db_handle_t *h){
+    if (h->map == NULL)
+        return;
+
+    if (h->dirty && DB_DATA_DURABILITY == DB_DURABILITY_BATCH)
+        msync(h->map, h->file_len, MS_SYNC);
+
+    munmap(h->map, h->map_len);
+    h->map = NULL;
+    h->map_len = 0;
+}
+
+/*
+ *  grow_db_map
+ *      h:        handle of a mapped database
+ *      new_len:  required file length in bytes
+ *
+ *  Extends the database file to new_len bytes (never shrinks it) and makes
+ *  sure the mapping covers the new length.  Another process may have grown
+ *  the file already, so the current size is re-read first.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int grow_db_map(db_handle_t *h, off_t new_len){
+    struct stat st;
+
+    //two processes growing the file at once must not have the smaller
+    //ftruncate() cut off what the other one wrote
+    if (lock_db_range(h->fd, DB_GROW_LOCK_OFF, 1, F_WRLCK, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (fstat(h->fd, &st) == -1) {
+        unlock_db_range(h->fd, DB_GROW_LOCK_OFF, 1);
+        return ERR_DB_FILE;
+    }
+    h->file_len = st.st_size;
+
+    if (h->file_len < new_len) {
+        if (ftruncate(h->fd, new_len) == -1) {
+            unlock_db_range(h->fd, DB_GROW_LOCK_OFF, 1);
+            return ERR_DB_FILE;
+        }
+        h->file_len = new_len;
+    }
+    unlock_db_range(h->fd, DB_GROW_LOCK_OFF, 1);
+
+    if ((size_t)h->file_len > h->map_len) {
+        void *map = mremap(h->map, h->map_len, h->file_len, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED)
+            return ERR_DB_FILE;
+        h->map = map;
+        h->map_len = h->file_len;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  open_slot_index
+ *      h:  handle of a database with the compact or the packed layout
+ *
+ *  Opens and maps the id -> slot index next to the db file, or the
+ *  id -> offset directory of a packed db, which is used the same way.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int open_slot_index(db_handle_t *h){
+    char path[DB_PATH_MAX];
+
+    if (h->layout == DB_LAYOUT_PACKED)
+        packed_dir_path(h->path, path, sizeof(path));
+    else
+        db_index_path(h->path, path, sizeof(path));
+    h->idx_fd = open(path, O_RDWR);
+    if (h->idx_fd == -1)
+        return ERR_DB_FILE;
+
+    if (sdb_config.use_mmap) {
+        void *map = mmap(NULL, DB_INDEX_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, h->idx_fd, 0);
+        if (map != MAP_FAILED)
+            h->idx_map = map;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_db_handle
+ *      h:  handle to release
+ *
+ *  Commits the log, unmaps (flushing according to the durability policy)
+ *  and closes everything kept next to the db file, then frees the handle.
+ *  The db file descriptor itself is left open.
+ */
+static void close_db_handle(db_handle_t *h){
+    //first, a checkpoint started here needs every file still open
+    close_wal(h);
+
+    unmap_db(h);
+    if (h->dirty && h->map == NULL &&
+            DB_DATA_DURABILITY == DB_DURABILITY_BATCH)
+        fdatasync(h->fd);
+    if (h->idx_map != NULL)
+        munmap(h->idx_map, DB_INDEX_SIZE);
+    if (h->idx_fd != -1) {
+        if (h->dirty && DB_DATA_DURABILITY != DB_DURABILITY_RELAXED)
+            fdatasync(h->idx_fd);
+        close(h->idx_fd);
+    }
+    close_hot_column(h);
+    close_hash_dir(h);
+    close_name_index(h);
+    close_gpa_index(h);
+    close_crc_index(h);
+    h->in_use = false;
+}
+
+/*
+ *  init_db_header
+ *      h:  handle being attached to a file that was empty at open
+ *
+ *  Writes the superblock before any record goes in.  A process that opened
+ *  the file after the first record was written and found no header would
+ *  take the db for one written by an older version and leave the
+ *  statistics alone, while the others go on keeping them.  Whoever locks
+ *  slot 0 first writes the header, the others read it back.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int init_db_header(db_handle_t *h){
+    db_header_t hdr;
+    struct stat st;
+
+    if (lock_db_range(h->fd, 0, STUDENT_RECORD_SIZE, F_WRLCK, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int rc = read_db_header(h->fd, &hdr);
+    if (rc == NO_ERROR) {
+        h->hdr = hdr;
+        h->stats_valid = hdr.version >= DB_STATS_VERSION;
+    } else if (rc == SRCH_NOT_FOUND && fstat(h->fd, &st) == 0) {
+        h->hdr.magic = DB_MAGIC;
+        h->hdr.version = DB_VERSION;
+        h->hdr.layout = DB_LAYOUT_DIRECT;
+        //records written without a header, by an older version
+        h->stats_valid = st.st_size == 0;
+        rc = h->stats_valid ? write_db_header(h->fd, &h->hdr) : NO_ERROR;
+    } else {
+        rc = ERR_DB_FILE;
+    }
+
+    unlock_db_range(h->fd, 0, STUDENT_RECORD_SIZE);
+    h->layout = h->hdr.layout;
+    return rc;
+}
+
+/*
+ *  attach_handle
+ *      h:         free handle to fill in
+ *      fd:        file descriptor just returned by open()
+ *      path:      name of the database file
+ *      snapshot:  fd is a snapshot (see sdb_snap.c), only what a scan needs
+ *                 is opened:  no name, gpa or checksum index and no log
+ *
+ *  attach_db(), attach_db_snapshot() and reopen_db().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the header or index can
+ *            not be read
+ */
+static int attach_handle(db_handle_t *h, int fd, const char *path,
+                         bool snapshot){
+    db_header_t hdr;
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    h->fd = fd;
+    h->idx_fd = -1;
+    h->hot_fd = -1;
+    h->dir_fd = -1;
+    h->name_fd = -1;
+    h->gpa_fd = -1;
+    h->crc_fd = -1;
+    h->wal_fd = -1;
+    h->snapshot = snapshot;
+    snprintf(h->path, sizeof(h->path), "%s", path);
+
+    int rc = read_db_header(fd, &hdr);
+    if (rc == ERR_DB_FILE)
+        return ERR_DB_FILE;
+    h->layout = hdr.layout;
+
+    //statistics are only trusted if this version wrote the header,
+    //or if the file is brand new and this version writes it now
+    if (rc == NO_ERROR) {
+        h->hdr = hdr;
+        h->stats_valid = hdr.version >= DB_STATS_VERSION;
+    } else if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        if (snapshot) {
+            h->hdr.magic = DB_MAGIC;
+            h->hdr.version = DB_VERSION;
+            h->hdr.layout = DB_LAYOUT_DIRECT;
+            h->stats_valid = true;
+        } else if (init_db_header(h) != NO_ERROR) {
+            return ERR_DB_FILE;
+        }
+    }
+
+    if ((h->layout == DB_LAYOUT_COMPACT || h->layout == DB_LAYOUT_PACKED) &&
+            open_slot_index(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->layout == DB_LAYOUT_SPLIT && open_hot_column(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->layout == DB_LAYOUT_HASH && open_hash_dir(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    //the indexes are arrays by id, they can not cover a hash db
+    if (h->layout != DB_LAYOUT_HASH && !snapshot) {
+        open_name_index(h);
+        open_gpa_index(h);
+        open_crc_index(h);
+    }
+
+    h->in_use = true;
+    if (sdb_config.use_mmap)
+        map_db(h);
+    if (snapshot)
+        return NO_ERROR;
+
+    //changes left in the log are applied before anything is read
+    if (open_wal(h) != NO_ERROR) {
+        close_db_handle(h);
+        return ERR_DB_FILE;
+    }
+
+    //--crc checksums the records once, later opens find the file
+    if (sdb_config.use_crc && h->crc_fd == -1 &&
+            h->layout != DB_LAYOUT_HASH &&
+            build_crc_index(fd) != NO_ERROR) {
+        close_db_handle(h);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+//attach_handle() on the first free handle
+static int attach_free_handle(int fd, const char *path, bool snapshot){
+    for (int i = 0; i < DB_MAX_HANDLES; i++) {
+        if (!db_handles[i].in_use)
+            return attach_handle(&db_handles[i], fd, path, snapshot);
+    }
+    return ERR_DB_FILE;
+}
+
+/*
+ *  attach_db
+ *      fd:    file descriptor just returned by open()
+ *      path:  name of the database file
+ *
+ *  Registers fd as an open database, reads its header to find the layout
+ *  (opening the index of a compacted db, the hot column of a split one or
+ *  the directory of a hashed or a packed one) and the superblock statistics,
+ *  and, unless disabled, maps it.  A
+ *  failed mapping is not an error, the handle simply stays unmapped.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the header or index can
+ *            not be read or there are no free handles
+ */
+int attach_db(int fd, const char *path){
+    return attach_free_handle(fd, path, false);
+}
+
+/*
+ *  attach_db_snapshot
+ *      fd:    file descriptor of a snapshot copy of a database
+ *      path:  name of the copy, its index or directory is found next to it
+ *
+ *  attach_db() for open_db_snapshot().  The copy is only ever scanned, so
+ *  the name, gpa and checksum indexes are left closed and the log of the
+ *  db it was taken from (already applied to it) is not looked for.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int attach_db_snapshot(int fd, const char *path){
+    return attach_free_handle(fd, path, true);
+}
+
+/*
+ *  reopen_db
+ *      fd:  linux file descriptor returned from open_db()
+ *
+ *  compress_db() renames a new db file over the one other processes have
+ *  open.  The file now under the name is opened in place of the old one,
+ *  on the same descriptor number (dup2()), and attached again to the same
+ *  handle, so pointers to it stay good.  The caller must not hold any lock
+ *  on the old file, those go with it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int reopen_db(int fd){
+    db_handle_t *h = db_handle(fd);
+    char path[DB_PATH_MAX];
+
+    if (h == NULL)
+        return ERR_DB_FILE;
+    snprintf(path, sizeof(path), "%s", h->path);
+
+    int new_fd = open(path, O_RDWR);
+    if (new_fd == -1)
+        return ERR_DB_FILE;
+
+    close_db_handle(h);
+    int rc = dup2(new_fd, fd) == -1 ? ERR_DB_FILE : NO_ERROR;
+    close(new_fd);
+    if (rc == NO_ERROR)
+        rc = attach_handle(h, fd, path, false);
+    return rc;
+}
+
+/*
+ *  close_db
+ *      fd:  linux file descriptor returned from open_db()
+ *
+ *  Unmaps (flushing according to the durability policy) and closes the
+ *  database.  Safe to call on descriptors that were never attached.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if close() failed
+ */
+int close_db(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h != NULL)
+        close_db_handle(h);
+
+    if (close(fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  read_phys_slot / write_phys_slot
+ *      fd:    linux file descriptor
+ *      slot:  physical slot number, the record is at slot * STUDENT_RECORD_SIZE
+ *      *s:    record to read into or write from
+ *
+ *  Raw access to one 64 byte slot of the file, through the mapping when
+ *  there is one, otherwise one lseek() and one read() or write().  A read
+ *  by a caller that holds no lock (see holds_db_locks()) is always one
+ *  pread():  the file may be cut under it at any time, and a page of the
+ *  mapping past the new end would kill the process with SIGBUS.  Lookups
+ *  (get_student()) lock the id they read to use the mapping.  A slot
+ *  past the end of the file reads as EMPTY_STUDENT_RECORD, writing past the
+ *  end grows the file.  With the sync durability policy a write is flushed
+ *  before returning.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_phys_slot(int fd, off_t slot, student_t *s){
+    db_handle_t *h = db_handle(fd);
+    off_t offset = slot * STUDENT_RECORD_SIZE;
+
+    if (h != NULL && h->map != NULL && !holds_db_locks(h)) {
+        ssize_t got = pread(fd, s, STUDENT_RECORD_SIZE, offset);
+        if (got == -1)
+            return ERR_DB_FILE;
+        memset((char *)s + got, 0, STUDENT_RECORD_SIZE - got);
+        return NO_ERROR;
+    }
+
+    if (h != NULL && h->map != NULL) {
+        //the file may have been grown by another process since we last
+        //looked, refresh the size before treating the slot as missing
+        if (offset + STUDENT_RECORD_SIZE > h->file_len) {
+            struct stat st;
+            if (fstat(fd, &st) == -1)
+                return ERR_DB_FILE;
+            h->file_len = st.st_size;
+        }
+
+        if (offset + STUDENT_RECORD_SIZE > h->file_len ||
+                (size_t)(offset + STUDENT_RECORD_SIZE) > h->map_len) {
+            *s = EMPTY_STUDENT_RECORD;
+            return NO_ERROR;
+        }
+
+        memcpy(s, h->map + offset, STUDENT_RECORD_SIZE);
+        return NO_ERROR;
+    }
+
+    if (lseek(fd, offset, SEEK_SET) == -1)
+        return ERR_DB_FILE;
+
+    ssize_t bytes = read(fd, s, STUDENT_RECORD_SIZE);
+    if (bytes == -1)
+        return ERR_DB_FILE;
+
+    //short read means EOF, whatever is missing is an empty slot
+    if (bytes < STUDENT_RECORD_SIZE)
+        memset((char *)s + bytes, 0, STUDENT_RECORD_SIZE - bytes);
+
+    return NO_ERROR;
+}
+
+int write_phys_slot(int fd, off_t slot, const student_t *s){
+    db_handle_t *h = db_handle(fd);
+    off_t offset = slot * STUDENT_RECORD_SIZE;
+
+    if (h != NULL && h->map != NULL) {
+        if (offset + STUDENT_RECORD_SIZE > h->file_len &&
+                grow_db_map(h, offset + STUDENT_RECORD_SIZE) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        memcpy(h->map + offset, s, STUDENT_RECORD_SIZE);
+        h->dirty = true;
+
+        if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC) {
+            long page = sysconf(_SC_PAGESIZE);
+            off_t start = offset & ~((off_t)page - 1);
+            if (msync(h->map + start, offset + STUDENT_RECORD_SIZE - start,
+                        MS_SYNC) == -1)
+                return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    if (lseek(fd, offset, SEEK_SET) == -1)
+        return ERR_DB_FILE;
+
+    if (write(fd, s, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+
+    if (h != NULL)
+        h->dirty = true;
+
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(fd) == -1)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  read_slot_index / write_slot_index
+ *      h:     handle of a compacted database
+ *      id:    student id
+ *      slot:  slot holding the student, 0 means the student is not in the db
+ *
+ *  Access the id -> slot index of the DB_LAYOUT_COMPACT layout.  The index
+ *  is an array of uint32_t slots indexed by id, so a lookup is O(1).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_slot_index(db_handle_t *h, int id, uint32_t *slot){
+    if (id < 0 || id > MAX_STD_ID) {
+        *slot = 0;
+        return NO_ERROR;
+    }
+
+    if (h->idx_map != NULL) {
+        *slot = h->idx_map[id];
+        return NO_ERROR;
+    }
+
+    ssize_t got = pread(h->idx_fd, slot, sizeof(*slot), (off_t)id * sizeof(*slot));
+    if (got == -1)
+        return ERR_DB_FILE;
+    if (got < (ssize_t)sizeof(*slot))
+        *slot = 0;
+    return NO_ERROR;
+}
+
+int write_slot_index(db_handle_t *h, int id, uint32_t slot){
+    if (id < 0 || id > MAX_STD_ID)
+        return ERR_DB_FILE;
+
+    if (h->idx_map != NULL) {
+        h->idx_map[id] = slot;
+        if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC) {
+            long page = sysconf(_SC_PAGESIZE);
+            uintptr_t start = (uintptr_t)&h->idx_map[id] & ~((uintptr_t)page - 1);
+            if (msync((void *)start, page, MS_SYNC) == -1)
+                return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    if (pwrite(h->idx_fd, &slot, sizeof(slot), (off_t)id * sizeof(slot)) !=
+            (ssize_t)sizeof(slot))
+        return ERR_DB_FILE;
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(h->idx_fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  read_db_slot
+ *      fd:  linux file descriptor
+ *      id:  student id to read
+ *      *s:  where to copy the record
+ *
+ *  Copies the record for id into *s, or EMPTY_STUDENT_RECORD if there is
+ *  none.  In the direct layout the record lives in slot id, in the compact
+ *  layout the slot comes from the index, in the paged layout it is found
+ *  on its page (see sdb_page.c), in the split layout it is put together
+ *  from its two halves (see sdb_column.c), in the hash layout it is looked
+ *  up in its bucket (see sdb_hash.c), in the packed layout it is unpacked
+ *  from where the directory points (see sdb_pack.c).  Slot 0 holds the db header and is
+ *  never returned as a student.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int read_db_slot(int fd, int id, student_t *s){
+    db_handle_t *h = db_handle(fd);
+    uint32_t slot = id;
+
+    if (id < 0)
+        return ERR_DB_FILE;
+
+    if (id < MIN_STD_ID) {
+        *s = EMPTY_STUDENT_RECORD;
+        return NO_ERROR;
+    }
+
+    if (h != NULL && h->layout == DB_LAYOUT_PAGED)
+        return read_paged_slot(fd, id, s);
+    if (h != NULL && h->layout == DB_LAYOUT_SPLIT)
+        return read_split_slot(h, id, s);
+    if (h != NULL && h->layout == DB_LAYOUT_HASH)
+        return read_hash_slot(h, id, s);
+    if (h != NULL && h->layout == DB_LAYOUT_PACKED)
+        return read_packed_slot(h, id, s);
+
+    if (h != NULL && h->layout == DB_LAYOUT_COMPACT) {
+        if (read_slot_index(h, id, &slot) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (slot == 0) {
+            *s = EMPTY_STUDENT_RECORD;
+            return NO_ERROR;
+        }
+    }
+
+    return read_phys_slot(fd, slot, s);
+}
+
+/*
+ *  write_db_slot
+ *      fd:  linux file descriptor
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  Stores *s as the record for id.  In --wal mode the change is logged and
+ *  committed first (see sdb_wal.c), then applied with apply_db_slot().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int write_db_slot(int fd, int id, const student_t *s){
+    if (id < MIN_STD_ID)
+        return ERR_DB_FILE;
+
+    if (wal_begin(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    int rc = wal_append(fd, id, s);
+    if (rc == NO_ERROR)
+        rc = wal_commit(fd);
+    if (rc == NO_ERROR)
+        rc = apply_db_slot(fd, id, s);
+    wal_end(fd);
+    return rc;
+}
+
+/*
+ *  apply_compact_slot
+ *      h:   handle of a database with the compact layout
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  apply_db_slot() for the compact layout:  a new record is appended at
+ *  the end of the file, a deleted one leaves a free slot for the
+ *  compactor.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int apply_compact_slot(db_handle_t *h, int id, const student_t *s){
+    uint32_t slot;
+
+    if (read_slot_index(h, id, &slot) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (is_empty_record(s)) {
+        if (slot == 0)
+            return NO_ERROR;
+        if (write_phys_slot(h->fd, slot, s) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (write_slot_index(h, id, 0) != NO_ERROR)
+            return ERR_DB_FILE;
+        punch_empty_blocks(h->fd, (off_t)slot * STUDENT_RECORD_SIZE,
+                           ((off_t)slot + 1) * STUDENT_RECORD_SIZE);
+        return NO_ERROR;
+    }
+
+    if (slot == 0) {
+        struct stat st;
+        if (fstat(h->fd, &st) == -1)
+            return ERR_DB_FILE;
+        slot = (st.st_size + STUDENT_RECORD_SIZE - 1) / STUDENT_RECORD_SIZE;
+        if (slot == 0)
+            slot = 1;
+    }
+
+    //record first, then the index entry that makes it visible
+    if (write_phys_slot(h->fd, slot, s) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_slot_index(h, id, slot);
+}
+
+/*
+ *  apply_db_slot
+ *      fd:  linux file descriptor
+ *      id:  student id to write
+ *      *s:  record to store, EMPTY_STUDENT_RECORD removes the student
+ *
+ *  Writes *s into the db file without logging it, used by write_db_slot()
+ *  and by the log replay.  In the direct layout that is slot id,
+ *  growing the file (and mapping) when the slot is past EOF.  In the compact
+ *  layout a new student is appended to the end of the file and the index
+ *  updated, a removed one has its slot cleared and its index entry reset.
+ *  The paged layout also keeps the page header in step, see sdb_page.c,
+ *  the split layout writes the hot entry and the names, see sdb_column.c.
+ *  The hash layout may split a bucket, see sdb_hash.c, and the packed
+ *  layout appends like the compact one, see sdb_pack.c, both under the
+ *  superblock lock.
+ *  When clearing a slot leaves its whole filesystem block empty the block
+ *  is punched out of the file so the disk space is freed right away.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int apply_db_slot(int fd, int id, const student_t *s){
+    db_handle_t *h = db_handle(fd);
+    uint32_t slot = id;
+
+    if (id < MIN_STD_ID)
+        return ERR_DB_FILE;
+
+    if (h != NULL && h->layout == DB_LAYOUT_PAGED)
+        return apply_paged_slot(h, id, s);
+    if (h != NULL && h->layout == DB_LAYOUT_SPLIT)
+        return apply_split_slot(h, id, s);
+
+    if (h == NULL || (h->layout != DB_LAYOUT_COMPACT &&
+                      h->layout != DB_LAYOUT_HASH &&
+                      h->layout != DB_LAYOUT_PACKED)) {
+        if (write_phys_slot(fd, slot, s) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (is_empty_record(s))
+            punch_empty_blocks(fd, (off_t)slot * STUDENT_RECORD_SIZE,
+                               ((off_t)slot + 1) * STUDENT_RECORD_SIZE);
+        return NO_ERROR;
+    }
+
+    //slots are shared by all ids in these layouts, allocating or freeing
+    //one is done under the superblock lock
+    if (lock_db_meta(fd, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    int rc;
+    if (h->layout == DB_LAYOUT_HASH)
+        rc = apply_hash_slot(h, id, s);
+    else if (h->layout == DB_LAYOUT_PACKED)
+        rc = apply_packed_slot(h, id, s);
+    else
+        rc = apply_compact_slot(h, id, s);
+    unlock_db_meta(fd);
+    return rc;
+}
+
+/*
+ *  update_db_indexes
+ *      fd:     linux file descriptor
+ *      s:      record that was just added or deleted
+ *      delta:  1 for an add, -1 for a delete
+ *
+ *  Brings everything derived from the records up to date after a change:
+ *  the superblock statistics, the last name index, the gpa index and the
+ *  record checksums.  The
+ *  headers are only changed in memory, save_db_indexes() writes them.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int update_db_indexes(int fd, const student_t *s, int delta){
+    if (update_db_stats(fd, s, delta) != NO_ERROR ||
+            update_name_index(fd, s, delta) != NO_ERROR ||
+            update_gpa_index(fd, s, delta) != NO_ERROR ||
+            update_crc_index(fd, s, delta) != NO_ERROR)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  save_db_indexes
+ *      fd:  linux file descriptor
+ *
+ *  Writes the headers changed by update_db_indexes(), once per operation
+ *  or once per bulk load.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_db_indexes(int fd){
+    if (save_db_stats(fd) != NO_ERROR ||
+            save_name_index(fd) != NO_ERROR ||
+            save_gpa_index(fd) != NO_ERROR ||
+            save_crc_index(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  save_db_change
+ *      fd:     linux file descriptor
+ *      s:      record that was just added or deleted
+ *      delta:  1 for an add, -1 for a delete
+ *
+ *  update_db_indexes() and save_db_indexes() for a single change, under
+ *  the superblock lock so that changes made by concurrent processes are
+ *  applied one after the other (see sdb_lock.c).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_db_change(int fd, const student_t *s, int delta){
+    if (lock_db_meta(fd, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int rc = update_db_indexes(fd, s, delta);
+    if (rc == NO_ERROR)
+        rc = save_db_indexes(fd);
+    unlock_db_meta(fd);
+    return rc;
+}
+
+/*
+ *  read_db_header / write_db_header
+ *      fd:   linux file descriptor
+ *      hdr:  header to read into or write
+ *
+ *  The header lives in slot 0, see db.h.
+ *
+ *  returns:  NO_ERROR        header read or written
+ *            SRCH_NOT_FOUND  (read only) the file has no header
+ *            ERR_DB_FILE     I/O error, or a header from a newer version
+ */
+int read_db_header(int fd, db_header_t *hdr){
+    ssize_t got = pread(fd, hdr, sizeof(*hdr), 0);
+
+    if (got == -1)
+        return ERR_DB_FILE;
+    if (got < (ssize_t)sizeof(*hdr) || hdr->magic != DB_MAGIC) {
+        memset(hdr, 0, sizeof(*hdr));
+        return SRCH_NOT_FOUND;
+    }
+    if (hdr->version > DB_VERSION)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+int write_db_header(int fd, const db_header_t *hdr){
+    db_handle_t *h = db_handle(fd);
+
+    //the header is the same size as a record and lives in slot 0
+    if (h != NULL && h->map != NULL && h->file_len >= (off_t)sizeof(*hdr))
+        return write_phys_slot(fd, 0, (const student_t *)hdr);
+
+    if (pwrite(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr))
+        return ERR_DB_FILE;
+    if (h != NULL)
+        h->dirty = true;
+    if (DB_DATA_DURABILITY == DB_DURABILITY_SYNC && fdatasync(fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  side_file_path
+ *      db_path:  name of the database file
+ *      ext:      extension of a file kept next to it
+ *      buff:     receives db_path followed by ext
+ *      len:      size of buff
+ *
+ *  A name that does not fit in buff is left empty:  opening "" fails,
+ *  where a name cut short could open some other file.
+ */
+void side_file_path(const char *db_path, const char *ext, char *buff,
+                    size_t len){
+    int n = snprintf(buff, len, "%s%s", db_path, ext);
+
+    if (n < 0 || (size_t)n >= len)
+        buff[0] = '\0';
+}
+
+/*
+ *  db_index_path
+ *      db_path:  name of the database file
+ *      buff:     where to build the name of its index file
+ *      len:      size of buff
+ */
+void db_index_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_INDEX_EXT, buff, len);
+}
+
+/*
+ *  save_slot_index
+ *      path:   index file to create
+ *      slots:  MAX_STD_ID+1 entries, slots[id] is the slot of student id
+ *
+ *  Writes a complete id -> slot index.  Only the pages that hold a non
+ *  zero entry are written, the rest of the file is left as a hole.  The
+ *  index is flushed before it is closed, it is about to be renamed into
+ *  place (see compress_db()).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int save_slot_index(const char *path, const uint32_t *slots){
+    const size_t page = 4096;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, DB_FILE_MODE);
+
+    if (fd == -1)
+        return ERR_DB_FILE;
+
+    if (ftruncate(fd, DB_INDEX_SIZE) == -1) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    for (size_t off = 0; off < DB_INDEX_SIZE; off += page) {
+        size_t len = DB_INDEX_SIZE - off < page ? DB_INDEX_SIZE - off : page;
+        const char *p = (const char *)slots + off;
+        size_t i = 0;
+
+        while (i < len && p[i] == 0)
+            i++;
+        if (i == len)
+            continue;
+
+        if (pwrite(fd, p, len, off) != (ssize_t)len) {
+            close(fd);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (fdatasync(fd) == -1) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    if (close(fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  db_disk_usage
+ *      path:  file to look at
+ *
+ *  returns:  bytes of disk allocated to the file (holes do not count), or
+ *            0 if it does not exist
+ */
+long long db_disk_usage(const char *path){
+    struct stat st;
+
+    if (stat(path, &st) == -1)
+        return 0;
+    return (long long)st.st_blocks * 512;
+}
+
+/*
+ *  punch_block
+ *      h:    handle of the database, NULL if it has none
+ *      fd:   linux file descriptor
+ *      off:  start of a filesystem block
+ *      len:  bytes of the block inside the file
+ *      blk:  filesystem block size
+ *      buf:  read buffer for unmapped files, allocated on first use
+ *
+ *  Punches the block out of the file if it holds nothing but free slots
+ *  and is not a hole already.
+ *
+ *  returns:  bytes deallocated, or ERR_DB_FILE on an I/O error
+ */
+static long long punch_block(db_handle_t *h, int fd, off_t off, off_t len,
+                             off_t blk, char **buf){
+    const char *p;
+
+    if (h != NULL && h->map != NULL && (size_t)(off + len) <= h->map_len) {
+        p = h->map + off;
+    } else {
+        if (*buf == NULL && (*buf = malloc(blk)) == NULL)
+            return ERR_DB_FILE;
+        if (pread(fd, *buf, len, off) != len)
+            return ERR_DB_FILE;
+        p = *buf;
+    }
+
+    if (!is_empty_block(p, len - len % STUDENT_RECORD_SIZE))
+        return 0;
+
+    //already a hole, nothing to give back
+    off_t data = lseek(fd, off, SEEK_DATA);
+    if (data == -1 || data >= off + len)
+        return 0;
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, blk) == 0)
+        return blk;
+    return 0;
+}
+
+/*
+ *  punch_empty_blocks
+ *      fd:     linux file descriptor
+ *      start:  first byte of the range
+ *      end:    end of the range (exclusive)
+ *
+ *  Deallocates every filesystem block that overlaps [start, end) and holds
+ *  nothing but free slots, using fallocate(FALLOC_FL_PUNCH_HOLE).  The file
+ *  size does not change and the punched range reads back as zeros, so this
+ *  is invisible to everything but du.  Filesystems that can not punch holes
+ *  are silently left alone.
+ *
+ *  The caller holds the write locks on [start, end).  In the direct layout
+ *  the rest of a block holds other ids, those are locked without waiting
+ *  so that a record another process is adding there is never punched
+ *  away, a block that is busy is simply skipped.  The first block also
+ *  holds the superblock, its lock is only taken (and dropped) here when
+ *  the caller does not hold it already.
+ *
+ *  returns:  bytes deallocated, or ERR_DB_FILE on an I/O error
+ */
+long long punch_empty_blocks(int fd, off_t start, off_t end){
+    db_handle_t *h = db_handle(fd);
+    struct stat st;
+    long long freed = 0;
+    char *buf = NULL;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (h != NULL)
+        h->file_len = st.st_size;
+
+    off_t blk = st.st_blksize > 0 ? st.st_blksize : 4096;
+    if (end > st.st_size)
+        end = st.st_size;
+
+    bool lock = h != NULL && h->layout == DB_LAYOUT_DIRECT;
+
+    for (off_t off = start - start % blk; off < end; off += blk) {
+        off_t len = off + blk <= st.st_size ? blk : st.st_size - off;
+        off_t rest[3][2];
+        int nrest = 0;
+
+        //the superblock is locked on its own, a caller that holds it
+        //(remove_students(), the log replay) must keep it
+        off_t head_off = off > 0 ? off : STUDENT_RECORD_SIZE;
+        if (lock && off == 0 && h->meta_locks == 0) {
+            rest[nrest][0] = 0;
+            rest[nrest++][1] = STUDENT_RECORD_SIZE;
+        }
+        if (lock && start > head_off) {
+            rest[nrest][0] = head_off;
+            rest[nrest++][1] = start - head_off;
+        }
+        if (lock && off + blk > end) {
+            rest[nrest][0] = end;
+            rest[nrest++][1] = off + blk - end;
+        }
+
+        int locked = 0;
+        while (locked < nrest && lock_db_range(fd, rest[locked][0],
+                    rest[locked][1], F_WRLCK, false) == NO_ERROR)
+            locked++;
+        long long rc = locked == nrest ? punch_block(h, fd, off, len, blk, &buf)
+                                       : 0;
+        while (locked > 0) {
+            locked--;
+            unlock_db_range(fd, rest[locked][0], rest[locked][1]);
+        }
+        if (rc < 0) {
+            free(buf);
+            return ERR_DB_FILE;
+        }
+        freed += rc;
+    }
+
+    free(buf);
+    return freed;
+}
+
+/*
+ *  truncate_db_file
+ *      fd:   linux file descriptor
+ *      len:  new length of the file
+ *
+ *  Shrinks (or grows) the db file and keeps the handle's idea of the file
+ *  size in step.  The mapping itself is left alone, pages past the new EOF
+ *  are never touched.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int truncate_db_file(int fd, off_t len){
+    db_handle_t *h = db_handle(fd);
+
+    if (ftruncate(fd, len) == -1)
+        return ERR_DB_FILE;
+    if (h != NULL) {
+        h->file_len = len;
+        h->dirty = true;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  cut_db_file
+ *      fd:      linux file descriptor
+ *      len:     new, shorter length of the file
+ *      first:   first id the caller holds exclusively
+ *      nslots:  number of such ids, 0 if it holds the others shared
+ *
+ *  truncate_db_file() for a db that other processes may have mapped.  They
+ *  read a record through their mapping once they hold its lock, and only
+ *  look at the file size when they take the lock, so the file is cut only
+ *  if every other id can be locked exclusively without waiting.  When one
+ *  is busy the file keeps its length, the end that would have been cut is
+ *  free slots.  Every id but first..first+nslots-1 is unlocked afterwards,
+ *  so a caller holding them shared calls this just before unlocking.
+ *
+ *  returns:  NO_ERROR if the file was cut or is busy, ERR_DB_FILE on failure
+ */
+int cut_db_file(int fd, off_t len, int first, int nslots){
+    off_t lo = (off_t)MIN_STD_ID * STUDENT_RECORD_SIZE;
+    off_t mid = (off_t)first * STUDENT_RECORD_SIZE;
+    off_t hi = mid + (off_t)nslots * STUDENT_RECORD_SIZE;
+    int rc;
+
+    rc = mid > lo ? lock_db_range(fd, lo, mid - lo, F_WRLCK, false) : NO_ERROR;
+    if (rc != NO_ERROR)
+        return rc == ERR_DB_OP ? NO_ERROR : ERR_DB_FILE;
+    rc = lock_db_range(fd, hi, DB_GROW_LOCK_OFF - hi, F_WRLCK, false);
+    if (rc == NO_ERROR)
+        rc = truncate_db_file(fd, len);
+    else if (rc == ERR_DB_OP)
+        rc = NO_ERROR;
+
+    if (mid > lo)
+        unlock_db_range(fd, lo, mid - lo);
+    unlock_db_range(fd, hi, DB_GROW_LOCK_OFF - hi);
+    return rc;
+}
+
+/*
+ *  grow_db_file
+ *      fd:   linux file descriptor
+ *      len:  required length of the file
+ *
+ *  Extends the db file to at least len bytes, through grow_db_map() when
+ *  it is mapped.  Used by the paged layout, which grows a page at a time.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int grow_db_file(int fd, off_t len){
+    db_handle_t *h = db_handle(fd);
+    struct stat st;
+
+    if (h != NULL && h->map != NULL) {
+        if (h->file_len >= len)
+            return NO_ERROR;
+        return grow_db_map(h, len);
+    }
+
+    if (lock_db_range(fd, DB_GROW_LOCK_OFF, 1, F_WRLCK, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    int rc = NO_ERROR;
+    if (fstat(fd, &st) == -1 || (st.st_size < len && ftruncate(fd, len) == -1))
+        rc = ERR_DB_FILE;
+    unlock_db_range(fd, DB_GROW_LOCK_OFF, 1);
+    return rc;
+}
+
+/*
+ *  copy_db_range
+ *      in_fd:    file to copy from
+ *      in_off:   offset of the first byte to copy
+ *      out_fd:   file to copy to
+ *      out_off:  where the first byte goes
+ *      len:      number of bytes
+ *
+ *  Copies len bytes between two files with copy_file_range(), so the data
+ *  never passes through user space and a filesystem that can share
+ *  extents (reflinks) does not copy it at all.  Stops at the first error,
+ *  including a kernel or filesystem that does not support the call, the
+ *  caller writes whatever is left itself.
+ *
+ *  returns:  the number of bytes copied, len unless copy_file_range()
+ *            failed
+ */
+size_t copy_db_range(int in_fd, off_t in_off, int out_fd, off_t out_off,
+                     size_t len){
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = copy_file_range(in_fd, &in_off, out_fd, &out_off,
+                                    len - done, 0);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+/*
+ *  sync_db_dir
+ *      path:  a file whose directory entry was just created or renamed
+ *
+ *  Flushes the directory holding path, which makes a rename() durable.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int sync_db_dir(const char *path){
+    char dir[DB_PATH_MAX];
+    const char *slash = strrchr(path, '/');
+
+    if (slash == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path) + 1, path);
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+        return ERR_DB_FILE;
+    int rc = fsync(fd) == -1 ? ERR_DB_FILE : NO_ERROR;
+    close(fd);
+    return rc;
+}
+
+/*
+ *  db_layout_name
+ *      layout:  DB_LAYOUT_* value
+ *
+ *  returns:  the name of the layout, as --migrate takes it
+ */
+const char *db_layout_name(int layout){
+    switch (layout) {
+        case DB_LAYOUT_DIRECT:
+            return "direct";
+        case DB_LAYOUT_COMPACT:
+            return "compact";
+        case DB_LAYOUT_PAGED:
+            return "paged";
+        case DB_LAYOUT_SPLIT:
+            return "split";
+        case DB_LAYOUT_HASH:
+            return "hash";
+        case DB_LAYOUT_PACKED:
+            return "packed";
+        default:
+            return "unknown";
+    }
+}
+
+/*
+ *  db_max_id
+ *      fd:  linux file descriptor
+ *
+ *  returns:  the largest id the db can hold, DB_HASH_MAX_ID for the hash
+ *            layout and MAX_STD_ID for the others
+ */
+int db_max_id(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (h != NULL && h->layout == DB_LAYOUT_HASH)
+        return DB_HASH_MAX_ID;
+    return MAX_STD_ID;
+}
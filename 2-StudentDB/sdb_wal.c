@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  wal_path
+ *      db_path:  name of the database file
+ *      buff:     receives the name of its write-ahead log
+ *      len:      size of buff
+ */
+void wal_path(const char *db_path, char *buff, size_t len){
+    side_file_path(db_path, DB_WAL_EXT, buff, len);
+}
+
+/*
+ *  wal_check
+ *      r:  log record
+ *
+ *  returns:  the FNV-1a check value of the sequence number, id and image
+ */
+static uint32_t wal_check(const wal_record_t *r){
+    const unsigned char *p = (const unsigned char *)&r->seq;
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(r->seq) + sizeof(r->id); i++)
+        h = (h ^ p[i]) * 16777619u;
+    p = (const unsigned char *)&r->rec;
+    for (size_t i = 0; i < sizeof(r->rec); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+//true if changes to the database behind h go through the log
+static bool wal_active(db_handle_t *h){
+    return h != NULL && h->wal_fd != -1 && sdb_config.use_wal;
+}
+
+/*
+ *  checkpoint_wal
+ *      h:  handle of a database with a write-ahead log, whose lock is held
+ *
+ *  Flushes the db file and everything kept next to it, then empties the
+ *  log.  The order matters:  once the log is empty the records it held
+ *  only exist in the db file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int checkpoint_wal(db_handle_t *h){
+    if (fdatasync(h->fd) == -1)
+        return ERR_DB_FILE;
+    if (h->idx_fd != -1 && fdatasync(h->idx_fd) == -1)
+        return ERR_DB_FILE;
+    if (h->name_fd != -1 && fdatasync(h->name_fd) == -1)
+        return ERR_DB_FILE;
+    if (h->gpa_fd != -1 && fdatasync(h->gpa_fd) == -1)
+        return ERR_DB_FILE;
+    if (h->dir_fd != -1 && fdatasync(h->dir_fd) == -1)
+        return ERR_DB_FILE;
+
+    if (ftruncate(h->wal_fd, 0) == -1 || fdatasync(h->wal_fd) == -1)
+        return ERR_DB_FILE;
+    h->wal_size = 0;
+    h->wal_seq = 0;
+    h->wal_unsynced = false;
+    return NO_ERROR;
+}
+
+//a logged id and where in the log it is, sorted to find the last of each
+typedef struct wal_pos{
+    int id;
+    int pos;
+} wal_pos_t;
+
+static int cmp_wal_pos(const void *a, const void *b){
+    const wal_pos_t *pa = a;
+    const wal_pos_t *pb = b;
+
+    if (pa->id != pb->id)
+        return (pa->id > pb->id) - (pa->id < pb->id);
+    return (pa->pos > pb->pos) - (pa->pos < pb->pos);
+}
+
+/*
+ *  replay_wal
+ *      h:  handle of a database whose log is not empty
+ *
+ *  Redoes the logged changes.  Every record is a full image of a slot, so
+ *  only the last record for each id matters, and it is skipped when the db
+ *  file already holds that image.  Replaying the log of processes that
+ *  exited normally therefore only costs the reads and leaves the log
+ *  alone.  Images that were lost from the db file are written again, the
+ *  statistics and indexes are updated for them, and a checkpoint makes the
+ *  repair durable.  Replay stops at the first record that is torn or out
+ *  of sequence, that tail is dropped by the checkpoint as well.  The last
+ *  record of an id is found by sorting the records by id, the ids of a
+ *  hashed db are too sparse for an array.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int replay_wal(db_handle_t *h){
+    struct stat st;
+    wal_record_t *recs = NULL;
+    wal_pos_t *order = NULL;
+    bool *last = NULL;
+    int max_id = db_max_id(h->fd);
+    int n = 0;
+    int applied = 0;
+    int rc = ERR_DB_FILE;
+
+    if (fstat(h->wal_fd, &st) == -1)
+        return ERR_DB_FILE;
+    int avail = st.st_size / sizeof(wal_record_t);
+    bool torn = st.st_size % sizeof(wal_record_t) != 0;
+
+    recs = malloc((size_t)avail * sizeof(wal_record_t));
+    order = malloc((size_t)(avail > 0 ? avail : 1) * sizeof(wal_pos_t));
+    last = calloc(avail > 0 ? avail : 1, sizeof(bool));
+    if (recs == NULL || order == NULL || last == NULL)
+        goto out;
+    if (pread(h->wal_fd, recs, (size_t)avail * sizeof(wal_record_t), 0) !=
+            (ssize_t)((size_t)avail * sizeof(wal_record_t)))
+        goto out;
+
+    //find the valid prefix and the last record of every id in it
+    for (n = 0; n < avail; n++) {
+        wal_record_t *r = &recs[n];
+        if (r->magic != DB_WAL_MAGIC || r->seq != (uint32_t)n + 1 ||
+                r->check != wal_check(r) ||
+                r->id < MIN_STD_ID || r->id > max_id) {
+            torn = true;
+            break;
+        }
+        order[n].id = r->id;
+        order[n].pos = n;
+    }
+    qsort(order, n, sizeof(wal_pos_t), cmp_wal_pos);
+    for (int i = 0; i < n; i++) {
+        if (i == n - 1 || order[i + 1].id != order[i].id)
+            last[order[i].pos] = true;
+    }
+
+    rc = NO_ERROR;
+    for (int i = 0; i < n && rc == NO_ERROR; i++) {
+        wal_record_t *r = &recs[i];
+        student_t cur;
+
+        if (!last[i])
+            continue;
+        if (read_db_slot(h->fd, r->id, &cur) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (memcmp(&cur, &r->rec, sizeof(cur)) == 0)
+            continue;
+
+        if ((!is_empty_record(&cur) &&
+                update_db_indexes(h->fd, &cur, -1) != NO_ERROR) ||
+                apply_db_slot(h->fd, r->id, &r->rec) != NO_ERROR ||
+                (!is_empty_record(&r->rec) &&
+                update_db_indexes(h->fd, &r->rec, 1) != NO_ERROR))
+            rc = ERR_DB_FILE;
+        applied++;
+    }
+
+    if (rc == NO_ERROR && applied > 0)
+        rc = save_db_indexes(h->fd);
+    if (rc == NO_ERROR && (applied > 0 || torn))
+        rc = checkpoint_wal(h);
+out:
+    free(recs);
+    free(order);
+    free(last);
+    return rc;
+}
+
+/*
+ *  open_wal
+ *      h:  handle of a database that is being opened
+ *
+ *  Opens the write-ahead log, creating it in --wal mode, and replays it if
+ *  an earlier process left changes in it.  The replay does not depend on
+ *  --wal:  a log is always applied before anyone reads the db.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int open_wal(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    struct stat st;
+    int rc = NO_ERROR;
+
+    h->wal_fd = -1;
+    h->wal_buf = NULL;
+    h->wal_nbuf = 0;
+    h->wal_unsynced = false;
+
+    wal_path(h->path, path, sizeof(path));
+    h->wal_fd = open(path, O_RDWR | O_APPEND | (sdb_config.use_wal ? O_CREAT : 0),
+                     DB_FILE_MODE);
+    if (h->wal_fd == -1)
+        return sdb_config.use_wal ? ERR_DB_FILE : NO_ERROR;
+
+    if (flock(h->wal_fd, LOCK_EX) == -1)
+        return ERR_DB_FILE;
+    if (fstat(h->wal_fd, &st) == -1) {
+        rc = ERR_DB_FILE;
+    } else if (st.st_size > 0) {
+        //the indexes may be repaired, see sdb_lock.c for the lock order
+        rc = lock_db_meta(h->fd, F_WRLCK);
+        if (rc == NO_ERROR)
+            rc = replay_wal(h);
+        unlock_db_meta(h->fd);
+    }
+    flock(h->wal_fd, LOCK_UN);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (sdb_config.use_wal) {
+        h->wal_buf = malloc(WAL_BUF_RECORDS * sizeof(wal_record_t));
+        if (h->wal_buf == NULL)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  wal_flush
+ *      h:  handle with records in its log buffer
+ *
+ *  Appends the buffered records to the log with one write().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int wal_flush(db_handle_t *h){
+    size_t len = (size_t)h->wal_nbuf * sizeof(wal_record_t);
+
+    if (len == 0)
+        return NO_ERROR;
+    if (write(h->wal_fd, h->wal_buf, len) != (ssize_t)len)
+        return ERR_DB_FILE;
+    h->wal_size += len;
+    h->wal_nbuf = 0;
+    h->wal_unsynced = true;
+    return NO_ERROR;
+}
+
+/*
+ *  close_wal
+ *      h:  handle of a database that is being closed
+ *
+ *  With the batch policy this is the group commit:  one fdatasync() of the
+ *  log covers everything the process changed.  When the log has grown past
+ *  WAL_CHECKPOINT_SIZE a checkpoint is started in a child process, so the
+ *  flush of the db file does not hold up the command that triggered it.
+ */
+void close_wal(db_handle_t *h){
+    if (h->wal_fd == -1)
+        return;
+
+    //reap checkpoints started earlier by this process
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+
+    if (wal_active(h)) {
+        wal_flush(h);
+        if (h->wal_unsynced && sdb_config.durability != DB_DURABILITY_RELAXED)
+            fdatasync(h->wal_fd);
+
+        if (h->wal_size >= WAL_CHECKPOINT_SIZE) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                //the child has its own copies of every descriptor
+                int rc = ERR_DB_FILE;
+                if (flock(h->wal_fd, LOCK_EX) == 0)
+                    rc = checkpoint_wal(h);
+                _exit(rc == NO_ERROR ? 0 : 1);
+            }
+            if (pid == -1 && flock(h->wal_fd, LOCK_EX) == 0) {
+                checkpoint_wal(h);
+                flock(h->wal_fd, LOCK_UN);
+            }
+        }
+    }
+
+    close(h->wal_fd);
+    free(h->wal_buf);
+    h->wal_fd = -1;
+    h->wal_buf = NULL;
+}
+
+/*
+ *  sync_wal
+ *      h:  handle of an open database
+ *
+ *  The group commit of a process that keeps the db open (sdbsc --serve)
+ *  and so never gets to close_wal():  flushes the log written since the
+ *  last call, and checkpoints it once it has grown past WAL_CHECKPOINT_SIZE.
+ */
+void sync_wal(db_handle_t *h){
+    if (!wal_active(h))
+        return;
+
+    wal_flush(h);
+    if (h->wal_unsynced && sdb_config.durability != DB_DURABILITY_RELAXED) {
+        fdatasync(h->wal_fd);
+        h->wal_unsynced = false;
+    }
+
+    if (h->wal_size >= WAL_CHECKPOINT_SIZE && flock(h->wal_fd, LOCK_EX) == 0) {
+        checkpoint_wal(h);
+        flock(h->wal_fd, LOCK_UN);
+    }
+}
+
+/*
+ *  drain_wal
+ *      h:  handle of a database that is changed without --wal
+ *
+ *  A change that is not logged must not leave an older image of its record
+ *  in a log that --wal processes keep, the next open would replay it over
+ *  the change (a delete would bring the student back).  A log with records
+ *  in it is checkpointed first:  every logged image is in the db file once
+ *  the log lock is free, and new records of the ids being changed wait for
+ *  their record locks, so after the checkpoint the change is the only copy.
+ *  The log is looked for on every change, a --wal process may create it
+ *  after this one opened the db, or -z remove it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int drain_wal(db_handle_t *h){
+    char path[DB_PATH_MAX];
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (h->wal_fd != -1 &&
+            (fstat(h->wal_fd, &st) == -1 || st.st_nlink == 0)) {
+        close(h->wal_fd);
+        h->wal_fd = -1;
+    }
+    if (h->wal_fd == -1) {
+        wal_path(h->path, path, sizeof(path));
+        h->wal_fd = open(path, O_RDWR | O_APPEND);
+        if (h->wal_fd == -1 || fstat(h->wal_fd, &st) == -1)
+            return NO_ERROR;    //no log, nothing to replay
+    }
+    if (st.st_size == 0)
+        return NO_ERROR;
+
+    if (flock(h->wal_fd, LOCK_EX) == -1)
+        return ERR_DB_FILE;
+    if (fstat(h->wal_fd, &st) == -1)
+        rc = ERR_DB_FILE;
+    else if (st.st_size > 0)
+        rc = checkpoint_wal(h);
+    flock(h->wal_fd, LOCK_UN);
+    return rc;
+}
+
+/*
+ *  wal_begin
+ *      fd:  linux file descriptor
+ *
+ *  Starts logging a change:  takes the log lock, so that a checkpoint can
+ *  not empty the log between a record being logged and its image reaching
+ *  the db file, and picks up the log position other processes left.  The
+ *  lock is held until wal_end().  Outside --wal mode nothing is logged,
+ *  but a log other processes keep is checkpointed first (drain_wal()).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int wal_begin(int fd){
+    db_handle_t *h = db_handle(fd);
+    struct stat st;
+
+    if (h != NULL && !sdb_config.use_wal && !h->snapshot)
+        return drain_wal(h);
+    if (!wal_active(h))
+        return NO_ERROR;
+
+    if (flock(h->wal_fd, LOCK_EX) == -1)
+        return ERR_DB_FILE;
+    if (fstat(h->wal_fd, &st) == -1) {
+        flock(h->wal_fd, LOCK_UN);
+        return ERR_DB_FILE;
+    }
+    h->wal_size = st.st_size;
+    h->wal_seq = st.st_size / sizeof(wal_record_t);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_append
+ *      fd:  linux file descriptor
+ *      id:  student id of the slot that changes
+ *      s:   new contents of the slot, EMPTY_STUDENT_RECORD for a delete
+ *
+ *  Adds a record to the log buffer, the buffer goes to the log when it is
+ *  full or at wal_commit().  Does nothing outside --wal mode.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int wal_append(int fd, int id, const student_t *s){
+    db_handle_t *h = db_handle(fd);
+
+    if (!wal_active(h))
+        return NO_ERROR;
+
+    wal_record_t *r = &h->wal_buf[h->wal_nbuf++];
+    r->magic = DB_WAL_MAGIC;
+    r->seq = ++h->wal_seq;
+    r->id = id;
+    r->rec = *s;
+    r->check = wal_check(r);
+
+    if (h->wal_nbuf == WAL_BUF_RECORDS)
+        return wal_flush(h);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_commit
+ *      fd:  linux file descriptor
+ *
+ *  Writes the buffered records to the log.  With the sync policy the log
+ *  is also flushed, so a single fdatasync() commits however many records
+ *  were appended since wal_begin().  With the batch policy the flush waits
+ *  for close_wal(), with the relaxed policy it is left to the kernel.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int wal_commit(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (!wal_active(h))
+        return NO_ERROR;
+
+    if (wal_flush(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (sdb_config.durability == DB_DURABILITY_SYNC && h->wal_unsynced) {
+        if (fdatasync(h->wal_fd) == -1)
+            return ERR_DB_FILE;
+        h->wal_unsynced = false;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  wal_end
+ *      fd:  linux file descriptor
+ *
+ *  Releases the log lock taken by wal_begin().
+ */
+void wal_end(int fd){
+    db_handle_t *h = db_handle(fd);
+
+    if (wal_active(h))
+        flock(h->wal_fd, LOCK_UN);
+}
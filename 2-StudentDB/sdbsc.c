@@ -2,9 +2,12 @@
 #include <stdlib.h>
 #include <fcntl.h>      //c library for system call file routines
 #include <string.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <math.h>
+#include <limits.h>
 
 //database include files
 #include "db.h"
@@ -12,6 +15,34 @@
 
 #include <time.h>
 
+/*
+ *  finish_db_compress
+ *
+ *  compress_db() renames the new db file over DB_FILE first, that is the
+ *  moment the compressed db replaces the old one, and its index (or the
+ *  directory of a packed db) after that.  An index left under its
+ *  temporary name with the temporary db file gone is the index of
+ *  DB_FILE, it is renamed into place.  While the temporary db file is
+ *  still there the old db is the current one and the temporary files are
+ *  simply left for the next compress_db().
+ */
+static void finish_db_compress(void){
+    void (*index_path[])(const char *, char *, size_t) = {
+        db_index_path, packed_dir_path
+    };
+    char tmp_idx[DB_PATH_MAX];
+    char db_idx[DB_PATH_MAX];
+
+    if (access(TMP_DB_FILE, F_OK) == 0)
+        return;
+    for (size_t i = 0; i < sizeof(index_path) / sizeof(index_path[0]); i++) {
+        index_path[i](TMP_DB_FILE, tmp_idx, sizeof(tmp_idx));
+        index_path[i](DB_FILE, db_idx, sizeof(db_idx));
+        if (access(tmp_idx, F_OK) == 0 && rename(tmp_idx, db_idx) == 0)
+            sync_db_dir(db_idx);
+    }
+}
+
 /*
  *  open_db
  *      dbFile:  name of the database file
@@ -26,14 +57,15 @@
 int open_db(char *dbFile, bool should_truncate){
     // Set permissions: rw-rw----
     // see sys/stat.h for constants
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    mode_t mode = DB_FILE_MODE;
 
     //open the file if it exists for Read and Write,
     //create it if it does not exist
     int    flags = O_RDWR | O_CREAT;
 
-    if (should_truncate)
-        flags += O_TRUNC;
+    //a compress_db() that stopped between its two renames is finished
+    if (strcmp(dbFile, DB_FILE) == 0)
+        finish_db_compress();
 
     // Now open file
     int fd = open(dbFile, flags, mode);
@@ -44,6 +76,66 @@ int open_db(char *dbFile, bool should_truncate){
         return ERR_DB_FILE;
     }
 
+    //an emptied db goes back to the direct layout, so a compacted db
+    //loses its index as well, a split one its hot column, and a hashed or
+    //packed one its directory.  The name and gpa indexes are rebuilt when
+    //next used, the checksums right away if there were any, and a log must
+    //not replay records into the empty file.  Other processes may have the
+    //file mapped, it is only cut while they hold no lock on it (see
+    //cut_db_file())
+    bool had_crc = false;
+    if (should_truncate) {
+        char idx_path[DB_PATH_MAX];
+        if (lock_db_range(fd, 0, 0, F_WRLCK, true) != NO_ERROR) {
+            printf(M_ERR_DB_OPEN);
+            close(fd);
+            return ERR_DB_FILE;
+        }
+        crc_index_path(dbFile, idx_path, sizeof(idx_path));
+        had_crc = unlink(idx_path) == 0;
+        db_index_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        hash_dir_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        packed_dir_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        hot_column_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        name_index_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        gpa_index_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        wal_path(dbFile, idx_path, sizeof(idx_path));
+        unlink(idx_path);
+        //the header goes back in before anyone can add a record, see
+        //init_db_header()
+        db_header_t hdr = { .magic = DB_MAGIC, .version = DB_VERSION,
+                            .layout = DB_LAYOUT_DIRECT };
+        int cut = ftruncate(fd, 0);
+        if (cut == 0 && write_db_header(fd, &hdr) != NO_ERROR)
+            cut = -1;
+        unlock_db_range(fd, 0, 0);
+        if (cut == -1) {
+            printf(M_ERR_DB_OPEN);
+            close(fd);
+            return ERR_DB_FILE;
+        }
+    }
+
+    //register the handle, read the header and map the file.  A failed
+    //mapping is not an error, the lseek/read/write path is used instead
+    if (attach_db(fd, dbFile) != NO_ERROR) {
+        printf(M_ERR_DB_OPEN);
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    if (had_crc && db_handle(fd)->crc_fd == -1 &&
+            build_crc_index(fd) != NO_ERROR) {
+        printf(M_ERR_DB_OPEN);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
     return fd;
 }
 
@@ -54,25 +146,41 @@ int open_db(char *dbFile, bool should_truncate){
  *      *s:  a pointer where the located (if found) student data will be
  *           copied
  *
+ *  A db with record checksums (--crc) has the record checked against its
+ *  checksum, a damaged record is reported and treated as unreadable.  The
+ *  record is read under a shared lock on its id, unless the caller holds
+ *  locks already, so it comes straight from the mapping:  the file is
+ *  not cut while the lock is held (see read_phys_slot()).
+ *
  *  returns:  NO_ERROR       student located and copied into *s
- *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_FILE    database file I/O issue or damaged record
  *            SRCH_NOT_FOUND student was not located in the database
  *
- *  console:  Does not produce any console I/O used by other functions
+ *  console:  M_DB_CRC_BAD   the record does not match its checksum,
+ *                           otherwise no console I/O
  */
 int get_student(int fd, int id, student_t *s){
+    db_handle_t *h = db_handle(fd);
+
     if (s == NULL) {
         return ERR_DB_FILE;
     }
 
-    int offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    bool lock = h != NULL && id >= MIN_STD_ID && !holds_db_locks(h);
+    if (lock && lock_db_slots(fd, id, 1, F_RDLCK) != NO_ERROR) {
         return ERR_DB_FILE;
     }
 
-    if (read(fd, s, STUDENT_RECORD_SIZE) == -1) {
-        return ERR_DB_FILE;
+    int rc = read_db_slot(fd, id, s);
+    if (rc == NO_ERROR) {
+        rc = check_record_crc(fd, id, s);
+        if (rc == ERR_DB_OP)
+            printf(M_DB_CRC_BAD, id);
     }
+    if (lock)
+        unlock_db_slots(fd, id, 1);
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
 
     if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0) {
         return SRCH_NOT_FOUND;
@@ -107,20 +215,29 @@ int get_student(int fd, int id, student_t *s){
  *
  */
 int add_student(int fd, int id, char *fname, char *lname, int gpa){
-    if (validate_range(id, gpa) == EXIT_FAIL_ARGS) {
+    if (validate_db_range(fd, id, gpa) == EXIT_FAIL_ARGS) {
         printf(M_ERR_STD_RNG);
         return ERR_DB_OP;
     }
 
     student_t student = {0};
 
+    //the slot stays locked from the duplicate check until the indexes
+    //are updated, other writers only wait if they want the same id
+    if (lock_db_slots(fd, id, 1, F_WRLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
     int result = get_student(fd, id, &student);
     if (result == ERR_DB_FILE) {
+        unlock_db_slots(fd, id, 1);
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
     if (result == NO_ERROR) {
+        unlock_db_slots(fd, id, 1);
         printf(M_ERR_DB_ADD_DUP, id);
         return ERR_DB_OP;
     }
@@ -130,13 +247,11 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa){
     strncpy(student.lname, lname, sizeof(student.lname) - 1);
     student.gpa = gpa;
 
-    int offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    if (write(fd, &student, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
+    result = write_db_slot(fd, id, &student);
+    if (result == NO_ERROR)
+        result = save_db_change(fd, &student, 1);
+    unlock_db_slots(fd, id, 1);
+    if (result != NO_ERROR) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -169,25 +284,30 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa){
  */
 int del_student(int fd, int id){
     student_t student = {0};
-    int result = get_student(fd, id, &student);
 
+    if (lock_db_slots(fd, id, 1, F_WRLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    int result = get_student(fd, id, &student);
     if (result == ERR_DB_FILE) {
+        unlock_db_slots(fd, id, 1);
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
     if (result == SRCH_NOT_FOUND) {
+        unlock_db_slots(fd, id, 1);
         printf(M_STD_NOT_FND_MSG, id);
         return ERR_DB_OP;
     }
 
-    int offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    if (write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
+    result = write_db_slot(fd, id, &EMPTY_STUDENT_RECORD);
+    if (result == NO_ERROR)
+        result = save_db_change(fd, &student, -1);
+    unlock_db_slots(fd, id, 1);
+    if (result != NO_ERROR) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -196,17 +316,37 @@ int del_student(int fd, int id){
     return NO_ERROR;
 }
 
+/*
+ *  get_db_count
+ *      fd:     linux file descriptor
+ *
+ *  The record count from the superblock, or from a scan of a database
+ *  written by an older version.  Nothing is printed.
+ *
+ *  returns:  <number>       the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int get_db_count(int fd){
+    db_handle_t *h = db_handle(fd);
+    db_header_t hdr;
+
+    if (h != NULL && h->stats_valid)
+        return h->hdr.count;
+    if (compute_db_stats(fd, &hdr) != NO_ERROR)
+        return ERR_DB_FILE;
+    return hdr.count;
+}
+
 /*
  *  count_db_records
  *      fd:     linux file descriptor
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  Counts the number of records in the database.  The superblock keeps a
+ *  running count (see db.h), so normally this does not read any records.
+ *  Databases written by older versions have no superblock statistics, for
+ *  those the scan iterator (see sdb_scan.c) reads the file in large blocks
+ *  and skips the slots that are empty or previously deleted, every record
+ *  it returns is counted.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
@@ -221,50 +361,535 @@ int del_student(int fd, int id){
  *
  */
 int count_db_records(int fd){
-    student_t student = {0};
-    int count = 0;
-    int bytes = 0;
+    int count = get_db_count(fd);
+
+    if (count < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (count == 0) {
+        printf(M_DB_EMPTY);
+    } else {
+        printf(M_DB_RECORD_CNT, count);
+    }
+
+    return count;
+}
+
+/*
+ *  print_db_stats
+ *      fd:     linux file descriptor
+ *
+ *  Prints the record count, the id range, the average gpa and the gpa
+ *  histogram.  They come straight from the superblock, a database written
+ *  by an older version is scanned instead and a hint to run
+ *  --rebuild-stats is printed.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_RECORD_CNT, M_DB_STATS_RANGE, M_DB_STATS_AVG and one
+ *            M_DB_STATS_HIST line per bucket, or M_DB_EMPTY
+ *            M_DB_STATS_STALE  the statistics had to be computed
+ *            M_ERR_DB_READ     error reading the database file
+ *
+ */
+int print_db_stats(int fd){
+    db_handle_t *h = db_handle(fd);
+    db_header_t hdr;
+    bool stale = (h == NULL || !h->stats_valid);
+
+    if (!stale) {
+        hdr = h->hdr;
+    } else if (compute_db_stats(fd, &hdr) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (hdr.count == 0) {
+        printf(M_DB_EMPTY);
+    } else {
+        printf(M_DB_RECORD_CNT, hdr.count);
+        printf(M_DB_STATS_RANGE, hdr.min_id, hdr.max_id);
+        printf(M_DB_STATS_AVG, (double)hdr.gpa_sum / hdr.count / 100);
+        for (int b = 0; b < DB_GPA_BUCKETS; b++) {
+            int lo = b * DB_GPA_BUCKET_WIDTH;
+            int hi = (b == DB_GPA_BUCKETS - 1) ? MAX_STD_GPA
+                                               : lo + DB_GPA_BUCKET_WIDTH - 1;
+            printf(M_DB_STATS_HIST, lo / 100.0, hi / 100.0, hdr.gpa_hist[b]);
+        }
+    }
+
+    if (stale)
+        printf(M_DB_STATS_STALE);
+    return NO_ERROR;
+}
+
+/*
+ *  print_db_aggregates
+ *      fd:     linux file descriptor
+ *
+ *  Computes the count, sum, average, minimum, maximum, standard deviation
+ *  (of the population) and histogram of the gpas in one pass, see
+ *  aggregate_db(), and prints them as one line of key=value pairs so a
+ *  script does not have to parse -p.  Gpas are printed as real values,
+ *  the histogram as the DB_GPA_BUCKETS counts separated by commas.  Unlike
+ *  -S this reads the records, the superblock has no minimum, maximum or
+ *  sum of squares.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_AGGREGATES  on success, also for an empty db (count=0)
+ *            M_ERR_DB_READ    error reading the database file
+ *
+ */
+int print_db_aggregates(int fd){
+    gpa_agg_t a;
+    char hist[DB_GPA_BUCKETS * 12];
+    int len = 0;
+
+    if (aggregate_db(fd, &a) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int b = 0; b < DB_GPA_BUCKETS; b++)
+        len += snprintf(hist + len, sizeof(hist) - len, "%s%u",
+                        b > 0 ? "," : "", a.hist[b]);
+
+    double avg = 0;
+    double stddev = 0;
+    if (a.count > 0) {
+        //n * sum_sq - sum^2 is n^2 times the variance, exact in integers
+        double var = (double)(a.count * a.sum_sq - a.sum * a.sum) /
+                     ((double)a.count * a.count);
+        avg = (double)a.sum / a.count / 100;
+        stddev = sqrt(var) / 100;
+    }
+
+    printf(M_DB_AGGREGATES, (long long)a.count, (long long)(a.sum / 100),
+           (long long)(a.sum % 100), avg, a.min / 100, a.min % 100,
+           a.max / 100, a.max % 100, stddev, hist);
+    return NO_ERROR;
+}
+
+/*
+ *  rebuild_db_stats
+ *      fd:     linux file descriptor
+ *
+ *  Recovery path for databases written by older versions (no header, or a
+ *  version 1 header):  recomputes the statistics with one scan and writes
+ *  a current superblock into slot 0, after which add_student() and
+ *  del_student() maintain it.  Also repairs a superblock that is out of
+ *  step with the records.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_STATS_REBUILT  on success
+ *            M_ERR_DB_READ       error reading the database file
+ *            M_ERR_DB_WRITE      error writing the superblock
+ *
+ */
+int rebuild_db_stats(int fd){
+    db_handle_t *h = db_handle(fd);
+    db_header_t hdr = {0};
+
+    if (lock_db_all(fd, F_RDLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (h != NULL)
+        hdr = h->hdr;
+
+    if (compute_db_stats(fd, &hdr) != NO_ERROR) {
+        unlock_db_all(fd);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (write_db_header(fd, &hdr) != NO_ERROR) {
+        unlock_db_all(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    if (h != NULL) {
+        h->hdr = hdr;
+        h->stats_valid = true;
+        h->hdr_dirty = false;
+    }
+    unlock_db_all(fd);
+
+    printf(M_DB_STATS_REBUILT, hdr.count);
+    return NO_ERROR;
+}
+
+static int cmp_ids(const void *a, const void *b){
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ *  print_found_student
+ *      s:      record to print
+ *      found:  records printed before this one
+ *
+ *  Prints one search result in the print_db() format, with the column
+ *  header in front of the first one.
+ */
+static void print_found_student(const student_t *s, int found){
+    if (found == 0)
+        printf(STUDENT_PRINT_HDR_STRING, "ID",
+                    "FIRST NAME", "LAST_NAME", "GPA");
+    float calculated_gpa_from_s = (float)(s->gpa) / 100;
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+                                s->lname, calculated_gpa_from_s);
+}
+
+/*
+ *  scan_db_matches
+ *      fd:    linux file descriptor
+ *      keep:  test a record must pass, with arg
+ *      arg:   passed to keep
+ *      recs:  set to a malloc()ed array of the records that pass, by id
+ *
+ *  A db with the hash layout keeps no name or gpa index (they are arrays
+ *  indexed by id), -s, -g and -t find their records with one scan of it
+ *  instead.
+ *
+ *  returns:  the number of records, ERR_DB_FILE on failure
+ */
+static int scan_db_matches(int fd, bool (*keep)(const student_t *, const void *),
+                           const void *arg, student_t **recs){
+    db_scan_t scan;
+    student_t *s;
+    int n = 0;
+    int cap = 0;
+    int rc;
+
+    *recs = NULL;
+    if (open_db_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID) != NO_ERROR) {
+        close_db_scan(&scan);
+        return ERR_DB_FILE;
+    }
+    while ((rc = next_db_record(&scan, &s)) > 0) {
+        if (!keep(s, arg))
+            continue;
+        if (n == cap) {
+            cap = cap > 0 ? cap * 2 : 64;
+            student_t *grown = realloc(*recs, sizeof(student_t) * cap);
+            if (grown == NULL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            *recs = grown;
+        }
+        (*recs)[n++] = *s;
+    }
+    close_db_scan(&scan);
+
+    if (rc < 0) {
+        free(*recs);
+        *recs = NULL;
+        return ERR_DB_FILE;
+    }
+    return n;
+}
+
+//scan_db_matches() tests for -s, -g and -t, key is a student_t or gpas
+static bool name_matches(const student_t *s, const void *key){
+    const student_t *k = key;
+
+    return strncmp(s->lname, k->lname, sizeof(k->lname)) == 0 &&
+           (k->fname[0] == '\0' ||
+            strncmp(s->fname, k->fname, sizeof(k->fname)) == 0);
+}
+
+static bool gpa_matches(const student_t *s, const void *range){
+    const int *r = range;
+
+    return s->gpa >= r[0] && s->gpa <= r[1];
+}
+
+//by gpa and by id within a gpa, cmp_gpa_desc with the highest gpa first
+static int cmp_gpa_asc(const void *a, const void *b){
+    const student_t *x = a, *y = b;
+
+    if (x->gpa != y->gpa)
+        return (x->gpa > y->gpa) - (x->gpa < y->gpa);
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int cmp_gpa_desc(const void *a, const void *b){
+    const student_t *x = a, *y = b;
+
+    if (x->gpa != y->gpa)
+        return (x->gpa < y->gpa) - (x->gpa > y->gpa);
+    return (x->id > y->id) - (x->id < y->id);
+}
 
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+/*
+ *  find_students_by_name
+ *      fd:     linux file descriptor
+ *      lname:  last name to look for
+ *      fname:  first name the matches must also have, or NULL
+ *
+ *  Prints every student with the given last name (and first name, if one
+ *  is given), in id order, in the same format as print_db().  The ids come
+ *  from the last name index (see sdb_name.c), so only the matching records
+ *  are read.  Names are truncated exactly like add_student() stores them.
+ *  The first search on a database without an index builds it.  A db with
+ *  the hash layout is scanned, see scan_db_matches().
+ *
+ *  returns:  the number of students printed
+ *            SRCH_NOT_FOUND  no student has that name
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  the matching records, or M_STD_NAME_NOT_FND
+ *            M_ERR_DB_READ   error reading the database or its index
+ *
+ */
+int find_students_by_name(int fd, char *lname, char *fname){
+    student_t key = {0};
+    student_t student;
+    int *ids;
+    int found = 0;
+
+    strncpy(key.fname, fname != NULL ? fname : "", sizeof(key.fname) - 1);
+    strncpy(key.lname, lname, sizeof(key.lname) - 1);
+
+    if (db_max_id(fd) > MAX_STD_ID) {
+        student_t *recs;
+        int n = scan_db_matches(fd, name_matches, &key, &recs);
+        if (n < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        for (int i = 0; i < n; i++)
+            print_found_student(&recs[i], found++);
+        free(recs);
+        if (found == 0) {
+            printf(M_STD_NAME_NOT_FND, key.lname);
+            return SRCH_NOT_FOUND;
+        }
+        return found;
+    }
+
+    int n = lookup_name_index(fd, key.lname, &ids);
+    if (n < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
+    qsort(ids, n, sizeof(int), cmp_ids);
 
-    while ((bytes = read(fd, &student, STUDENT_RECORD_SIZE)) > 0) {
-        if (bytes < STUDENT_RECORD_SIZE) {
+    for (int i = 0; i < n; i++) {
+        if (read_db_slot(fd, ids[i], &student) != NO_ERROR) {
+            free(ids);
             printf(M_ERR_DB_READ);
             return ERR_DB_FILE;
         }
+        if (student.id != ids[i] ||
+                strncmp(student.lname, key.lname, sizeof(key.lname)) != 0 ||
+                (fname != NULL &&
+                 strncmp(student.fname, key.fname, sizeof(key.fname)) != 0))
+            continue;
+
+        print_found_student(&student, found++);
+    }
+    free(ids);
+
+    if (found == 0) {
+        printf(M_STD_NAME_NOT_FND, key.lname);
+        return SRCH_NOT_FOUND;
+    }
+    return found;
+}
 
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            count++;
+/*
+ *  print_gpa_bucket
+ *      fd:     linux file descriptor
+ *      gpa:    integer gpa whose students are printed
+ *      found:  records printed so far, updated
+ *      limit:  stop once found reaches this many
+ *
+ *  Prints the students with one gpa from the gpa index, in id order.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int print_gpa_bucket(int fd, int gpa, int *found, int limit){
+    student_t student;
+    int *ids;
+
+    int n = read_gpa_bucket(fd, gpa, &ids);
+    if (n < 0)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n && *found < limit; i++) {
+        if (read_db_slot(fd, ids[i], &student) != NO_ERROR) {
+            free(ids);
+            return ERR_DB_FILE;
         }
+        if (student.id != ids[i] || student.gpa != gpa)
+            continue;   //index out of step, do not print a wrong answer
+        print_found_student(&student, (*found)++);
     }
+    free(ids);
+    return NO_ERROR;
+}
 
-    if (bytes == -1) {
+/*
+ *  find_students_by_gpa
+ *      fd:       linux file descriptor
+ *      min_gpa:  lowest gpa to print, as a 3 digit int like add_student()
+ *      max_gpa:  highest gpa to print
+ *
+ *  Prints every student whose gpa is in min_gpa..max_gpa, lowest gpa
+ *  first and by id within a gpa.  The gpa index (see sdb_gpa.c) has one
+ *  list per integer gpa, so the lists are simply walked in order and only
+ *  the matching records are read.  The first query on a database without
+ *  a gpa index builds it.  A db with the hash layout is scanned and the
+ *  matches sorted, see scan_db_matches().
+ *
+ *  returns:  the number of students printed
+ *            SRCH_NOT_FOUND  no student has a gpa in the range
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  the matching records, or M_STD_GPA_NOT_FND
+ *            M_ERR_DB_READ   error reading the database or its index
+ *
+ */
+int find_students_by_gpa(int fd, int min_gpa, int max_gpa){
+    int found = 0;
+    int lo = min_gpa < MIN_STD_GPA ? MIN_STD_GPA : min_gpa;
+    int hi = max_gpa > MAX_STD_GPA ? MAX_STD_GPA : max_gpa;
+
+    if (db_max_id(fd) > MAX_STD_ID) {
+        int range[2] = { lo, hi };
+        student_t *recs;
+        int n = scan_db_matches(fd, gpa_matches, range, &recs);
+        if (n < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (n > 0)
+            qsort(recs, n, sizeof(student_t), cmp_gpa_asc);
+        for (int i = 0; i < n; i++)
+            print_found_student(&recs[i], found++);
+        free(recs);
+    } else {
+        for (int gpa = lo; gpa <= hi; gpa++) {
+            if (print_gpa_bucket(fd, gpa, &found, MAX_STD_ID + 1) != NO_ERROR) {
+                printf(M_ERR_DB_READ);
+                return ERR_DB_FILE;
+            }
+        }
+    }
+
+    if (found == 0) {
+        printf(M_STD_GPA_NOT_FND, min_gpa / 100.0, max_gpa / 100.0);
+        return SRCH_NOT_FOUND;
+    }
+    return found;
+}
+
+/*
+ *  print_top_students
+ *      fd:  linux file descriptor
+ *      k:   number of students to print
+ *
+ *  Prints the k students with the highest gpa, highest first and by id
+ *  within a gpa, walking the gpa index down from MAX_STD_GPA and stopping
+ *  as soon as k have been printed.  A db with the hash layout is scanned
+ *  and sorted, see scan_db_matches().
+ *
+ *  returns:  the number of students printed
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  the records, or M_DB_EMPTY
+ *            M_ERR_DB_READ   error reading the database or its index
+ *
+ */
+int print_top_students(int fd, int k){
+    int found = 0;
+
+    if (db_max_id(fd) > MAX_STD_ID) {
+        int range[2] = { MIN_STD_GPA, MAX_STD_GPA };
+        student_t *recs;
+        int n = scan_db_matches(fd, gpa_matches, range, &recs);
+        if (n < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (n > 0)
+            qsort(recs, n, sizeof(student_t), cmp_gpa_desc);
+        for (int i = 0; i < n && found < k; i++)
+            print_found_student(&recs[i], found++);
+        free(recs);
+        if (found == 0)
+            printf(M_DB_EMPTY);
+        return found;
+    }
+
+    for (int gpa = MAX_STD_GPA; gpa >= MIN_STD_GPA && found < k; gpa--) {
+        if (print_gpa_bucket(fd, gpa, &found, k) != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (found == 0)
+        printf(M_DB_EMPTY);
+    return found;
+}
+
+/*
+ *  print_db_parallel
+ *      fd:  linux file descriptor
+ *
+ *  print_db() with -j.  The rows of every id range are formatted into a
+ *  buffer on a thread of their own (par_format_db()), the buffers are then
+ *  written out in id order, so the output is the same as without -j.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  as print_db()
+ */
+static int print_db_parallel(int fd){
+    par_part_t parts[PAR_MAX_JOBS];
+    int nrecs = 0;
+
+    int n = par_format_db(fd, sdb_config.jobs, parts);
+    if (n < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    if (count == 0) {
+    for (int j = 0; j < n; j++)
+        nrecs += parts[j].nrecs;
+    if (nrecs == 0) {
         printf(M_DB_EMPTY);
     } else {
-        printf(M_DB_RECORD_CNT, count);
+        printf(STUDENT_PRINT_HDR_STRING, "ID",
+                    "FIRST NAME", "LAST_NAME", "GPA");
+        for (int j = 0; j < n; j++)
+            fwrite(parts[j].out, 1, parts[j].out_len, stdout);
     }
+    free_par_parts(parts, n);
 
-    return count;
+    return NO_ERROR;
 }
 
 /*
  *  print_db
  *      fd:     linux file descriptor
  *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
+ *  Prints all records in the database.  The scan iterator (see sdb_scan.c)
+ *  returns the live records in id order and skips the slots that are
+ *  empty or previously deleted. Be careful as the database might be empty.
  *  on the first real row encountered print the header for the required output:
  *
  *     printf(STUDENT_PRINT_HDR_STRING, "ID",
@@ -289,35 +914,34 @@ int count_db_records(int fd){
  *
  */
 int print_db(int fd){
-    student_t student = {0};
-    int bytes = 0;
+    db_scan_t scan;
+    student_t *student;
     bool record_found = 0;
+    int rc;
+
+    if (sdb_config.jobs > 1)
+        return print_db_parallel(fd);
 
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+    if (open_db_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID) != NO_ERROR) {
+        close_db_scan(&scan);
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    while ((bytes = read(fd, &student, STUDENT_RECORD_SIZE)) > 0) {
-        if (bytes < STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
+    while ((rc = next_db_record(&scan, &student)) > 0) {
+        if (!record_found) {
+            printf(STUDENT_PRINT_HDR_STRING, "ID",
+                        "FIRST NAME", "LAST_NAME", "GPA");
+            record_found = 1;
         }
 
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            if (!record_found) {
-                printf(STUDENT_PRINT_HDR_STRING, "ID",
-                            "FIRST NAME", "LAST_NAME", "GPA");
-                record_found = 1;
-            }
-
-            float calculated_gpa_from_s = (float)(student.gpa) / 100;
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
-                                        student.lname, calculated_gpa_from_s);
-        }
+        float calculated_gpa_from_s = (float)(student->gpa) / 100;
+        printf(STUDENT_PRINT_FMT_STRING, student->id, student->fname,
+                                    student->lname, calculated_gpa_from_s);
     }
+    close_db_scan(&scan);
 
-    if (bytes == -1) {
+    if (rc < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
@@ -371,6 +995,426 @@ void print_student(student_t *s){
                             s->lname, calculated_gpa_from_s);
 }
 
+/*
+ *  compress_paged_db
+ *      fd:     linux file descriptor of a db with the paged layout
+ *
+ *  compress_db() for the paged layout.  Records never move, so the file
+ *  is compressed in place:  the pages without a live record are punched
+ *  out, found by their headers alone, and the file is cut after the last
+ *  page that is in use.
+ *
+ *  returns:  fd, or ERR_DB_FILE on failure
+ *
+ *  console:  as compress_db(), the index size is always 0
+ */
+static int compress_paged_db(int fd){
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long disk_before = db_disk_usage(DB_FILE);
+
+    if (lock_db_all(fd, F_RDLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    int count = get_db_count(fd);
+    int last = last_used_page(fd);
+    int rc = last < 0 || count < 0 ? ERR_DB_FILE : NO_ERROR;
+    if (rc == NO_ERROR &&
+            punch_empty_pages(fd, 1, MAX_STD_ID / DB_PAGE_RECORDS + 1) < 0)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && cut_db_file(fd, (off_t)(last + 1) * DB_PAGE_SIZE,
+                                      MIN_STD_ID, 0) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    unlock_db_all(fd);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf(M_DB_COMPRESSED_OK);
+    printf(M_DB_COMPRESS_STATS, count, secs, disk_before,
+           db_disk_usage(DB_FILE), 0LL);
+    return fd;
+}
+
+/*
+ *  compress_split_db
+ *      fd:     linux file descriptor of a db with the split layout
+ *
+ *  compress_db() for the split layout.  Records never move, the blocks of
+ *  the hot column and of the names that deleted students left empty are
+ *  punched out and the names are cut after the highest id.
+ *
+ *  returns:  fd, or ERR_DB_FILE on failure
+ *
+ *  console:  as compress_db(), the db size includes the hot column
+ */
+static int compress_split_db(int fd){
+    db_handle_t *h = db_handle(fd);
+    struct timespec start, end;
+    char hot_path[DB_PATH_MAX];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    hot_column_path(DB_FILE, hot_path, sizeof(hot_path));
+    long long disk_before = db_disk_usage(DB_FILE) + db_disk_usage(hot_path);
+
+    if (lock_db_all(fd, F_RDLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    int count = get_db_count(fd);
+    int last = h->stats_valid ? (int)h->hdr.max_id : MAX_STD_ID;
+    int rc = count < 0 ? ERR_DB_FILE : NO_ERROR;
+    if (rc == NO_ERROR && punch_split_range(fd, MIN_STD_ID, MAX_STD_ID) < 0)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR &&
+            cut_db_file(fd, DB_COLD_OFF(last + 1), MIN_STD_ID, 0) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    unlock_db_all(fd);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf(M_DB_COMPRESSED_OK);
+    printf(M_DB_COMPRESS_STATS, count, secs, disk_before,
+           db_disk_usage(DB_FILE) + db_disk_usage(hot_path), 0LL);
+    return fd;
+}
+
+/*
+ *  compress_packed_db
+ *      fd:     linux file descriptor of a db with the packed layout
+ *
+ *  compress_db() for the packed layout.  The live records are written in
+ *  id order to the temporary db file and directory, without the space
+ *  deleted records left behind, which then replace the db the way
+ *  compress_db() replaces it.
+ *
+ *  returns:  the fd of the compressed db, or ERR_DB_FILE on failure
+ *
+ *  console:  as compress_db(), the index size is that of the directory
+ */
+static int compress_packed_db(int fd){
+    struct timespec start, end;
+    char tmp_off[DB_PATH_MAX];
+    char db_off[DB_PATH_MAX];
+    db_scan_t scan;
+    student_t *s;
+    int count = 0;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    packed_dir_path(TMP_DB_FILE, tmp_off, sizeof(tmp_off));
+    packed_dir_path(DB_FILE, db_off, sizeof(db_off));
+    long long disk_before = db_disk_usage(DB_FILE);
+
+    int tmp_fd = open_db(TMP_DB_FILE, true);
+    if (tmp_fd < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //writers are held off until the new file has replaced this one, then
+    //find it replaced when they get their lock (see lock_db_slots())
+    student_t *recs = calloc(MAX_STD_ID + 1, sizeof(student_t));
+    if (recs == NULL || lock_db_all(fd, F_RDLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        free(recs);
+        close_db(tmp_fd);
+        return ERR_DB_FILE;
+    }
+
+    db_header_t hdr = { .magic = DB_MAGIC, .version = DB_VERSION,
+                        .layout = DB_LAYOUT_PACKED };
+
+    rc = open_db_scan(&scan, fd, MIN_STD_ID, MAX_STD_ID);
+    while (rc == NO_ERROR && (rc = next_db_record(&scan, &s)) > 0) {
+        recs[s->id] = *s;
+        add_to_stats(&hdr, s);
+        count++;
+        rc = NO_ERROR;
+    }
+    close_db_scan(&scan);
+    if (rc < 0) {
+        printf(M_ERR_DB_READ);
+    } else if (write_packed_db(tmp_fd, recs, &hdr) != NO_ERROR ||
+               fdatasync(tmp_fd) == -1) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+    }
+    free(recs);
+    close_db(tmp_fd);
+    if (rc < 0) {
+        unlock_db_all(fd);
+        return ERR_DB_FILE;
+    }
+
+    //the locks go with the old file, only once it has been replaced
+    rc = rename(TMP_DB_FILE, DB_FILE) != 0 || sync_db_dir(DB_FILE) != NO_ERROR ||
+         (rename(tmp_off, db_off) != 0 && errno != ENOENT) ||
+         sync_db_dir(db_off) != NO_ERROR ? ERR_DB_FILE : NO_ERROR;
+    close_db(fd);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+
+    fd = open_db(DB_FILE, false);
+    if (fd < 0) {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf(M_DB_COMPRESSED_OK);
+    printf(M_DB_COMPRESS_STATS, count, secs, disk_before,
+           db_disk_usage(DB_FILE), db_disk_usage(db_off));
+    return fd;
+}
+
+/*
+ *  compress_hash_db
+ *      fd:     linux file descriptor of a db with the hash layout
+ *
+ *  compress_db() for the hash layout.  Buckets are never merged, so after
+ *  many deletes the records are spread over more buckets than they need.
+ *  They are read into memory and the file and directory are written again
+ *  from scratch (write_hash_db()), which packs them into as few buckets
+ *  as the hash allows.
+ *
+ *  returns:  fd, or ERR_DB_FILE on failure
+ *
+ *  console:  as compress_db(), the index size is the directory's
+ */
+static int compress_hash_db(int fd){
+    db_handle_t *h = db_handle(fd);
+    struct timespec start, end;
+    char dir_path[DB_PATH_MAX];
+    db_scan_t scan;
+    student_t *s;
+    student_t *recs = NULL;
+    int count = 0;
+    int cap = 0;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    hash_dir_path(DB_FILE, dir_path, sizeof(dir_path));
+    long long disk_before = db_disk_usage(DB_FILE);
+
+    if (lock_db_all(fd, F_WRLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = open_db_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID);
+    while (rc == NO_ERROR && (rc = next_db_record(&scan, &s)) > 0) {
+        rc = NO_ERROR;
+        if (count == cap) {
+            cap = cap > 0 ? cap * 2 : 1024;
+            student_t *grown = realloc(recs, sizeof(student_t) * cap);
+            if (grown == NULL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            recs = grown;
+        }
+        recs[count++] = *s;
+    }
+    close_db_scan(&scan);
+    if (rc < 0) {
+        free(recs);
+        unlock_db_all(fd);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //the directory is replaced, the one mapped here is the old file
+    close_hash_dir(h);
+    rc = write_hash_db(fd, recs, count, &h->hdr);
+    free(recs);
+    if (rc == NO_ERROR)
+        rc = open_hash_dir(h);
+    unlock_db_all(fd);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf(M_DB_COMPRESSED_OK);
+    printf(M_DB_COMPRESS_STATS, count, secs, disk_before,
+           db_disk_usage(DB_FILE), db_disk_usage(dir_path));
+    return fd;
+}
+
+//a run of adjacent live records at least this long is copied by the
+//kernel (one filesystem block), shorter ones are gathered and written
+#define COPY_RUN_MIN    (SCAN_BUF_ALIGN / STUDENT_RECORD_SIZE)
+
+//what pack_db_records() has read but not written yet
+typedef struct pack_out{
+    int        in_fd;
+    int        out_fd;
+    student_t *buf;         //records for slots buf_slot on, SCAN_BLOCK_SIZE
+    int        nbuf;        //records in buf
+    off_t      buf_slot;    //slot of buf[0] in the new file
+    int        run_start;   //first record in buf of the current run
+    off_t      run_off;     //offset of that record in the old file
+} pack_out_t;
+
+//writes buf[0..n) at its slots
+static int write_pack_buf(pack_out_t *p, int n){
+    size_t len = (size_t)n * STUDENT_RECORD_SIZE;
+
+    if (n > 0 && pwrite(p->out_fd, p->buf, len,
+                        p->buf_slot * STUDENT_RECORD_SIZE) != (ssize_t)len)
+        return ERR_DB_OP;
+    return NO_ERROR;
+}
+
+/*
+ *  end_pack_run
+ *      p:  output whose current run of adjacent records has ended
+ *
+ *  A long run is copied from the old file to the new one with
+ *  copy_db_range(), after the records gathered in front of it are
+ *  written, and the buffer starts over.  A short one stays in the buffer.
+ *  Whatever the kernel could not copy is written from the buffer, which
+ *  holds the run as well.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_OP if the new file can not be
+ *            written
+ */
+static int end_pack_run(pack_out_t *p){
+    int n = p->nbuf - p->run_start;
+
+    if (n >= COPY_RUN_MIN) {
+        size_t len = (size_t)n * STUDENT_RECORD_SIZE;
+        off_t dst = (p->buf_slot + p->run_start) * STUDENT_RECORD_SIZE;
+        size_t done;
+
+        if (write_pack_buf(p, p->run_start) != NO_ERROR)
+            return ERR_DB_OP;
+        done = copy_db_range(p->in_fd, p->run_off, p->out_fd, dst, len);
+        if (done < len &&
+                pwrite(p->out_fd, (char *)(p->buf + p->run_start) + done,
+                       len - done, dst + done) != (ssize_t)(len - done))
+            return ERR_DB_OP;
+        p->buf_slot += p->nbuf;
+        p->nbuf = 0;
+    }
+    p->run_start = p->nbuf;
+    return NO_ERROR;
+}
+
+/*
+ *  pack_db_records
+ *      fd:      linux file descriptor, read locked by the caller
+ *      out_fd:  file the records are packed into, from slot 1 on
+ *      slots:   MAX_STD_ID+1 entries, set to the slot of every record
+ *      hdr:     superblock given the statistics of the packed records
+ *
+ *  The single threaded half of compress_db(), par_pack_db() is the one
+ *  used with -j.  The scan finds the live records, which have to be read
+ *  for their ids anyway, and the runs of them that sit next to each other
+ *  in the old file (ids in a row in the direct layout, slots in a row in
+ *  the compact one) are moved with copy_file_range(), see end_pack_run().
+ *  The records between the runs are gathered into a block sized buffer
+ *  so they take as few write() calls as the old file takes reads.
+ *
+ *  returns:  the number of records packed, ERR_DB_FILE if fd could not be
+ *            read, ERR_DB_OP if out_fd could not be written
+ */
+static int pack_db_records(int fd, int out_fd, uint32_t *slots,
+                           db_header_t *hdr){
+    db_handle_t *h = db_handle(fd);
+    pack_out_t p = { .in_fd = fd, .out_fd = out_fd, .buf_slot = 1 };
+    int buf_max = SCAN_BLOCK_SIZE / STUDENT_RECORD_SIZE;
+    db_scan_t scan;
+    student_t *student;
+    int count = 0;
+    int rc;
+
+    //slot 0 of the new file is its header, written by the caller
+    p.buf = malloc(SCAN_BLOCK_SIZE);
+    if (p.buf == NULL)
+        return ERR_DB_FILE;
+    if (open_db_scan(&scan, fd, MIN_STD_ID, SCAN_LAST_ID) != NO_ERROR) {
+        free(p.buf);
+        close_db_scan(&scan);
+        return ERR_DB_FILE;
+    }
+
+    while ((rc = next_db_record(&scan, &student)) > 0) {
+        uint32_t slot = student->id;
+
+        if (student->id < MIN_STD_ID || student->id > MAX_STD_ID)
+            continue;   //not addressable, can not have been added by us
+        if (h != NULL && h->layout == DB_LAYOUT_COMPACT &&
+                read_slot_index(h, student->id, &slot) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        off_t off = (off_t)slot * STUDENT_RECORD_SIZE;
+
+        //a record that does not follow the last one ends the run, a full
+        //buffer ends it and is written out
+        if ((p.nbuf > p.run_start &&
+                off != p.run_off + (off_t)(p.nbuf - p.run_start) *
+                                   STUDENT_RECORD_SIZE) ||
+                p.nbuf == buf_max) {
+            if (end_pack_run(&p) != NO_ERROR) {
+                count = ERR_DB_OP;
+                break;
+            }
+        }
+        if (p.nbuf == buf_max) {
+            if (write_pack_buf(&p, p.nbuf) != NO_ERROR) {
+                count = ERR_DB_OP;
+                break;
+            }
+            p.buf_slot += p.nbuf;
+            p.nbuf = 0;
+            p.run_start = 0;
+        }
+        if (p.nbuf == p.run_start)
+            p.run_off = off;
+
+        slots[student->id] = p.buf_slot + p.nbuf;
+        add_to_stats(hdr, student);
+        p.buf[p.nbuf++] = *student;
+        count++;
+    }
+    close_db_scan(&scan);
+
+    if (rc < 0)
+        count = ERR_DB_FILE;
+    else if (count >= 0 && (end_pack_run(&p) != NO_ERROR ||
+                            write_pack_buf(&p, p.nbuf) != NO_ERROR))
+        count = ERR_DB_OP;
+    free(p.buf);
+    return count;
+}
+
 /*
  *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
  *
@@ -397,6 +1441,24 @@ void print_student(student_t *s){
  *         #define DB_FILE     "student.db"        //name of database file
  *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
  *
+ *  Packing the records together breaks the id * STUDENT_RECORD_SIZE
+ *  addressing, so the compressed file is written in the DB_LAYOUT_COMPACT
+ *  layout (see db.h):  a header in slot 0, the live records in id order in
+ *  slots 1..n, and an id -> slot index next to it (DB_FILE DB_INDEX_EXT).
+ *  get_student(), add_student() and del_student() consult the index
+ *  transparently so lookups stay O(1).  The index is written sparsely, only
+ *  the pages that hold an entry take up disk space.
+ *
+ *  The new file and its index are flushed before they are renamed over
+ *  the old ones, the db file first (see finish_db_compress()), so a crash
+ *  leaves either the old db or the new one.  Runs of adjacent records are
+ *  copied by the kernel, see pack_db_records().
+ *
+ *  A db with the paged, the split, the hash or the packed layout keeps
+ *  it, see compress_paged_db(), compress_split_db(), compress_hash_db()
+ *  and compress_packed_db().  With -j the records are
+ *  read and written on sdb_config.jobs threads, see par_pack_db().
+ *
  *  Note that you are passed in the fd of the database file to be compressed,
  *  it is very likely you will need to close it to overwrite it with the
  *  compressed version of the file.  To ensure the caller can work with the
@@ -408,6 +1470,8 @@ void print_student(student_t *s){
  *
  *
  *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_DB_COMPRESS_STATS on success, the cost of the compaction and
+ *                             the disk space used before and after
  *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
  *                             this error should also be returned after you
  *                             compressed the database file and if you are unable
@@ -420,48 +1484,86 @@ void print_student(student_t *s){
  *
  */
 int compress_db(int fd){
-    student_t student = {0};
-    int bytes = 0;
+    db_handle_t *h = db_handle(fd);
     int tmp_fd = -1;
-
-    tmp_fd = open_db(TMP_DB_FILE, false);
+    int count;
+    struct timespec start, end;
+    char tmp_idx[DB_PATH_MAX];
+    char db_idx[DB_PATH_MAX];
+
+    if (h != NULL && h->layout == DB_LAYOUT_PAGED)
+        return compress_paged_db(fd);
+    if (h != NULL && h->layout == DB_LAYOUT_SPLIT)
+        return compress_split_db(fd);
+    if (h != NULL && h->layout == DB_LAYOUT_HASH)
+        return compress_hash_db(fd);
+    if (h != NULL && h->layout == DB_LAYOUT_PACKED)
+        return compress_packed_db(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long disk_before = db_disk_usage(DB_FILE);
+
+    tmp_fd = open_db(TMP_DB_FILE, true);
     if (tmp_fd < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+    uint32_t *slots = calloc(MAX_STD_ID + 1, sizeof(uint32_t));
+
+    //writers are held off until the new file has replaced this one, then
+    //find it replaced when they get their lock (see lock_db_slots())
+    if (slots == NULL || lock_db_all(fd, F_RDLCK) != NO_ERROR) {
         printf(M_ERR_DB_READ);
-        close(tmp_fd);
+        free(slots);
+        unlock_db_all(fd);
+        close_db(tmp_fd);
         return ERR_DB_FILE;
     }
 
-    while ((bytes = read(fd, &student, STUDENT_RECORD_SIZE)) > 0) {
-        if (bytes < STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            close(tmp_fd);
-            return ERR_DB_FILE;
-        }
+    //the superblock statistics are recomputed on the way through
+    db_header_t hdr = { .magic = DB_MAGIC, .version = DB_VERSION,
+                        .layout = DB_LAYOUT_COMPACT };
 
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            if (write(tmp_fd, &student, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
-                printf(M_ERR_DB_WRITE);
-                close(tmp_fd);
-                return ERR_DB_FILE;
-            }
-        }
+    if (sdb_config.jobs > 1)
+        count = par_pack_db(fd, sdb_config.jobs, tmp_fd, slots, &hdr);
+    else
+        count = pack_db_records(fd, tmp_fd, slots, &hdr);
+
+    if (count >= 0 &&
+            pwrite(tmp_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+        count = ERR_DB_OP;
     }
 
-    if (bytes == -1) {
-        printf(M_ERR_DB_READ);
-        close(tmp_fd);
+    //the new file is on disk before its name can replace the old one
+    if (count >= 0 && fdatasync(tmp_fd) == -1)
+        count = ERR_DB_OP;
+
+    db_index_path(TMP_DB_FILE, tmp_idx, sizeof(tmp_idx));
+    db_index_path(DB_FILE, db_idx, sizeof(db_idx));
+    if (count >= 0 && save_slot_index(tmp_idx, slots) != NO_ERROR)
+        count = ERR_DB_OP;
+    free(slots);
+
+    if (count < 0) {
+        printf(count == ERR_DB_FILE ? M_ERR_DB_READ : M_ERR_DB_WRITE);
+        unlock_db_all(fd);
+        close_db(tmp_fd);
         return ERR_DB_FILE;
     }
 
-    close(tmp_fd);
-    close(fd);
-
-    if (rename(TMP_DB_FILE, DB_FILE) != 0) {
+    close_db(tmp_fd);
+
+    //renaming the db file is what replaces the old db, see
+    //finish_db_compress() for a crash before the index is renamed too.
+    //A process opening the db in between may have renamed it already.
+    //The locks go with the old file, only once it has been replaced
+    int rc = rename(TMP_DB_FILE, DB_FILE) != 0 ||
+             sync_db_dir(DB_FILE) != NO_ERROR ||
+             (rename(tmp_idx, db_idx) != 0 && errno != ENOENT) ||
+             sync_db_dir(db_idx) != NO_ERROR ? ERR_DB_FILE : NO_ERROR;
+    close_db(fd);
+    if (rc != NO_ERROR) {
         printf(M_ERR_DB_CREATE);
         return ERR_DB_FILE;
     }
@@ -472,10 +1574,174 @@ int compress_db(int fd){
         return ERR_DB_FILE;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
     printf(M_DB_COMPRESSED_OK);
+    printf(M_DB_COMPRESS_STATS, count, secs, disk_before,
+           db_disk_usage(DB_FILE), db_disk_usage(db_idx));
     return fd;
 }
 
+//compact_db_range() without the locking
+static int compact_range(int fd, int first, int nslots){
+    db_handle_t *h = db_handle(fd);
+    struct stat st;
+    student_t student;
+    int moved = 0;
+
+    if (first < MIN_STD_ID)
+        first = MIN_STD_ID;
+
+    if (fstat(fd, &st) == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    long long disk_before = (long long)st.st_blocks * 512;
+    off_t end_slot = (off_t)first + nslots;
+
+    if (h != NULL && h->layout == DB_LAYOUT_COMPACT) {
+        off_t last = st.st_size / STUDENT_RECORD_SIZE - 1;
+
+        for (off_t slot = first; slot < end_slot && slot < last; slot++) {
+            if (read_phys_slot(fd, slot, &student) != NO_ERROR) {
+                printf(M_ERR_DB_READ);
+                return ERR_DB_FILE;
+            }
+            if (!is_empty_record(&student))
+                continue;
+
+            //find the last live record, it fills this hole
+            for (;;) {
+                if (read_phys_slot(fd, last, &student) != NO_ERROR) {
+                    printf(M_ERR_DB_READ);
+                    return ERR_DB_FILE;
+                }
+                if (!is_empty_record(&student) || last <= slot)
+                    break;
+                last--;
+            }
+            if (last <= slot)
+                break;
+
+            //copy, repoint the index, then clear the old slot
+            if (write_phys_slot(fd, slot, &student) != NO_ERROR ||
+                    write_slot_index(h, student.id, slot) != NO_ERROR ||
+                    write_phys_slot(fd, last, &EMPTY_STUDENT_RECORD) != NO_ERROR) {
+                printf(M_ERR_DB_WRITE);
+                return ERR_DB_FILE;
+            }
+            moved++;
+            last--;
+        }
+
+        //drop the free slots at the end of the file
+        for (; last >= MIN_STD_ID; last--) {
+            if (read_phys_slot(fd, last, &student) != NO_ERROR) {
+                printf(M_ERR_DB_READ);
+                return ERR_DB_FILE;
+            }
+            if (!is_empty_record(&student))
+                break;
+        }
+        if ((last + 1) * STUDENT_RECORD_SIZE < st.st_size &&
+                cut_db_file(fd, (last + 1) * STUDENT_RECORD_SIZE, first,
+                            nslots > 0 ? nslots : 1) != NO_ERROR) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (h != NULL && h->layout == DB_LAYOUT_PAGED) {
+        //pages are emptied by their header, the range is one of ids
+        if (punch_empty_pages(fd, DB_PAGE_OF(first),
+                              DB_PAGE_OF(end_slot - 1)) < 0) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+    } else if (h != NULL && h->layout == DB_LAYOUT_SPLIT) {
+        if (punch_split_range(fd, first, end_slot - 1) < 0) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+    } else if (h != NULL && (h->layout == DB_LAYOUT_HASH ||
+                             h->layout == DB_LAYOUT_PACKED)) {
+        //the ids of a range are in every bucket, or anywhere in a packed
+        //file, nothing in the file is theirs alone, compress_db() rebuilds
+        //it instead
+    } else if (punch_empty_blocks(fd, (off_t)first * STUDENT_RECORD_SIZE,
+                                  end_slot * STUDENT_RECORD_SIZE) < 0) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_COMPACT_STEP, disk_before - (long long)st.st_blocks * 512,
+           first, (int)(end_slot - 1), moved);
+    return NO_ERROR;
+}
+
+/*
+ *  compact_db_range
+ *      fd:      linux file descriptor
+ *      first:   first slot of the range to work on
+ *      nslots:  number of slots in the range
+ *
+ *  Incremental alternative to compress_db() that never rewrites the whole
+ *  file, so a churn heavy db can be kept small a range at a time.
+ *
+ *  In the direct layout records can not move, so the step punches out every
+ *  filesystem block in the range that has become completely empty (for
+ *  example from deletes made by older versions that did not punch holes).
+ *
+ *  In the compact layout free slots in the range are filled with records
+ *  moved from the end of the file, the index is updated for each move, the
+ *  free tail of the file is truncated and emptied blocks are punched.
+ *
+ *  In the paged layout the range is one of ids, the pages holding them
+ *  whose header counts no live record are punched.  In the split layout
+ *  it is one of ids too, the blocks of the hot column and of the names
+ *  that lie inside it and hold no live record are punched.  A step on the
+ *  hash layout reclaims nothing, its buckets hold ids from every range,
+ *  nor does one on the packed layout, whose deletes punch their blocks.
+ *
+ *  Writers of the ids in the range wait for the step, in the compact
+ *  layout all writers do since records from the end of the file move.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_COMPACT_STEP  on success, bytes reclaimed and records moved
+ *            M_ERR_DB_READ      error reading the db file
+ *            M_ERR_DB_WRITE     error writing the db file
+ *
+ */
+int compact_db_range(int fd, int first, int nslots){
+    //a length of 0 would lock to the end of the file
+    int nlock = nslots > 0 ? nslots : 1;
+
+    if (first < MIN_STD_ID)
+        first = MIN_STD_ID;
+    if (lock_db_slots(fd, first, nlock, F_WRLCK) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (lock_db_meta(fd, F_WRLCK) != NO_ERROR) {
+        unlock_db_slots(fd, first, nlock);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    int rc = compact_range(fd, first, nslots);
+    unlock_db_meta(fd);
+    unlock_db_slots(fd, first, nlock);
+    return rc;
+}
 
 /*
  *  validate_range
@@ -503,6 +1769,24 @@ int validate_range(int id, int gpa){
     return NO_ERROR;
 }
 
+/*
+ *  validate_db_range
+ *      fd:  linux file descriptor
+ *      id:  proposed student id
+ *      gpa: proposed gpa
+ *
+ *  validate_range() for the db open on fd:  a db with the hash layout
+ *  takes ids up to DB_HASH_MAX_ID.
+ *
+ *  returns:    NO_ERROR       on success, both ID and GPA are in range
+ *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ */
+int validate_db_range(int fd, int id, int gpa){
+    if (id > MAX_STD_ID && id <= db_max_id(fd))
+        id = MAX_STD_ID;    //in range for this db, only the gpa is left
+    return validate_range(id, gpa);
+}
+
 /*
  *  usage
  *      exename:  the name of the executable from argv[0]
@@ -515,15 +1799,207 @@ int validate_range(int id, int gpa){
  *
  */
 void usage(char *exename){
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|b|c|d|f|p|s|g|t|r|q|S|A|V|x|X|z|i] options.  Where:\n",
+           exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-b file|-:  bulk loads id,first,last,gpa rows (CSV or columns)\n");
     printf("\t-c:  counts the records in the database\n");
-    printf("\t-d id:  deletes a student\n");
-    printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-d id [id ...]:  deletes students\n");
+    printf("\t-f id [id ...]:  finds and prints students in the database\n");
+    printf("\t-d|-f --ids-from file:  the same for the ids in file, - reads stdin\n");
     printf("\t-p:  prints all records in the student database\n");
+    printf("\t-s last_name [first_name]:  finds students by name\n");
+    printf("\t-g min max:  prints students with a gpa in min..max (3 digit ints)\n");
+    printf("\t-t k:  prints the k students with the highest gpa\n");
+    printf("\t-r first last | -r --after id [--limit N]:  prints the students\n"
+           "\t    with ids first..last, or up to N past id to page through the db\n");
+    printf("\t-q query:  prints the students that match, for example\n"
+           "\t    \"gpa>=350 && lname=doe && id<50000\" (id, gpa, fname, lname\n"
+           "\t    compared with = != < <= > >=)\n");
+    printf("\t-S:  prints the record count, id range and gpa statistics\n");
+    printf("\t-A:  prints count, sum, avg, min, max, stddev and histogram of the gpas\n");
+    printf("\t-V:  checks every record against its checksum, see --crc\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-X first_slot count:  incrementally compact a range of slots\n");
     printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-i:  runs a, f, d, c and p commands read from stdin, one per line\n");
+    printf("\t--rebuild-stats:  recompute the statistics of an older db\n");
+    printf("\t--migrate[=paged|split|hash|packed]:  convert the db to the paged\n"
+           "\t    format, to an id and gpa column plus a names file, to hash\n"
+           "\t    buckets that take ids up to %d, or to unpadded records, in\n"
+           "\t    place\n", DB_HASH_MAX_ID);
+    printf("\t--serve:  keep the db open and run --client operations sent to student.db.sock\n");
+    printf("global options, given before the operation:\n");
+    printf("\t--durability=relaxed|batch|sync:  when changes are flushed to disk\n");
+    printf("\t--no-mmap:  use read()/write() instead of mapping the db file\n");
+    printf("\t--scan=auto|avx2|sse2|scalar:  empty slot test scans use, auto picks\n"
+           "\t    the fastest the cpu has\n");
+    printf("\t--no-seek-data:  scans read the holes of a sparse db instead of\n"
+           "\t    skipping them with SEEK_DATA\n");
+    printf("\t--wal:  log changes to student.db.wal and flush only the log\n");
+    printf("\t--crc:  keep a CRC32C of every record in student.db.crc\n");
+    printf("\t--snapshot:  run -p, -q, -r, -c, -A or -S on a copy of the db taken\n"
+           "\t    at one moment, writers only wait for the copy\n");
+    printf("\t--client:  send -a, -f, -d, -c or -p to the server, - reads them from stdin\n");
+    printf("\t--format=text|tsv|csv|json:  replies of -i as sdbsc prints them, or tab\n"
+           "\t    separated, and the rows -q and -r print, also as CSV or a JSON array\n");
+    printf("\t-j N:  scan the db on N threads for -p, -x and --rebuild-stats\n");
+}
+
+/*
+ *  parse_int_arg
+ *      arg:  command line argument
+ *      val:  receives its value
+ *
+ *  Reads a whole decimal argument that fits an int, where atoi() would
+ *  take "12x" for 12 and wrap one past INT_MAX.
+ *
+ *  returns:  true when arg is such a number
+ */
+bool parse_int_arg(const char *arg, int *val){
+    char *end;
+
+    errno = 0;
+    long v = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno == ERANGE ||
+            v < INT_MIN || v > INT_MAX)
+        return false;
+    *val = (int)v;
+    return true;
+}
+
+/*
+ *  run_multi_id_op
+ *      fd:          linux file descriptor
+ *      opt:         'f' or 'd'
+ *      argc, argv:  as main() has them, argv[2] on are the ids, or
+ *                   --ids-from and a file of ids ("-" for stdin)
+ *
+ *  -f and -d with more than one id, see get_students() and
+ *  del_students().
+ *
+ *  returns:  the exit code
+ */
+static int run_multi_id_op(int fd, char opt, int argc, char *argv[]){
+    int *ids = NULL;
+    int n = 0;
+    int rc;
+
+    if (strcmp(argv[2], "--ids-from") == 0) {
+        if (argc != 4) {
+            usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+        rc = read_ids_file(argv[3], &ids, &n);
+        if (rc != NO_ERROR)
+            return rc == ERR_DB_OP ? EXIT_FAIL_ARGS : EXIT_FAIL_DB;
+    } else {
+        n = argc - 2;
+        ids = malloc(sizeof(int) * n);
+        if (ids == NULL)
+            return EXIT_FAIL_DB;
+        for (int i = 0; i < n; i++) {
+            if (!parse_int_arg(argv[i + 2], &ids[i])) {
+                printf(M_ERR_BAD_ID, argv[i + 2]);
+                free(ids);
+                return EXIT_FAIL_ARGS;
+            }
+        }
+    }
+
+    if (opt == 'f')
+        rc = get_students(fd, ids, n);
+    else
+        rc = del_students(fd, ids, n);
+    free(ids);
+
+    return rc == NO_ERROR ? EXIT_OK : EXIT_FAIL_DB;
+}
+
+/*
+ *  parse_global_opts
+ *      argc, argv:  the arguments passed to main()
+ *
+ *  Global options start with "--", or are -j N, and come before the
+ *  operation, for example:  prog_name --durability=sync -a 1 John Doe 341.
+ *  They only change sdb_config, the operation itself is still handled by
+ *  main().  -j is capped at PAR_MAX_JOBS.
+ *
+ *  returns:    the number of arguments consumed, or -1 if an option value
+ *              is not valid
+ *
+ *  console:  M_ERR_BAD_OPTION if an option value is not valid
+ *
+ */
+int parse_global_opts(int argc, char *argv[]){
+    int i = 1;
+
+    while (i < argc) {
+        char *arg = argv[i];
+
+        if (strcmp(arg, "-j") == 0) {
+            char *end;
+            long jobs = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+            if (jobs < 1 || *end != '\0') {
+                printf(M_ERR_BAD_OPTION, arg);
+                return -1;
+            }
+            sdb_config.jobs = jobs > PAR_MAX_JOBS ? PAR_MAX_JOBS : (int)jobs;
+            i += 2;
+            continue;
+        }
+        if (strncmp(arg, "--", 2) != 0)
+            break;
+
+        if (strncmp(arg, "--durability=", 13) == 0) {
+            char *val = arg + 13;
+            if (strcmp(val, "relaxed") == 0)
+                sdb_config.durability = DB_DURABILITY_RELAXED;
+            else if (strcmp(val, "batch") == 0)
+                sdb_config.durability = DB_DURABILITY_BATCH;
+            else if (strcmp(val, "sync") == 0)
+                sdb_config.durability = DB_DURABILITY_SYNC;
+            else {
+                printf(M_ERR_BAD_OPTION, arg);
+                return -1;
+            }
+        } else if (strcmp(arg, "--no-mmap") == 0) {
+            sdb_config.use_mmap = false;
+        } else if (strcmp(arg, "--scan=auto") == 0) {
+            sdb_config.scan_kernel = SDB_SCAN_AUTO;
+        } else if (strcmp(arg, "--scan=avx2") == 0) {
+            sdb_config.scan_kernel = SDB_SCAN_AVX2;
+        } else if (strcmp(arg, "--scan=sse2") == 0) {
+            sdb_config.scan_kernel = SDB_SCAN_SSE2;
+        } else if (strcmp(arg, "--scan=scalar") == 0) {
+            sdb_config.scan_kernel = SDB_SCAN_SCALAR;
+        } else if (strcmp(arg, "--no-seek-data") == 0) {
+            sdb_config.use_seek_data = false;
+        } else if (strcmp(arg, "--wal") == 0) {
+            sdb_config.use_wal = true;
+        } else if (strcmp(arg, "--crc") == 0) {
+            sdb_config.use_crc = true;
+        } else if (strcmp(arg, "--snapshot") == 0) {
+            sdb_config.use_snapshot = true;
+        } else if (strcmp(arg, "--client") == 0) {
+            sdb_config.client = true;
+        } else if (strcmp(arg, "--format=text") == 0) {
+            sdb_config.format = SDB_FORMAT_TEXT;
+        } else if (strcmp(arg, "--format=tsv") == 0) {
+            sdb_config.format = SDB_FORMAT_TSV;
+        } else if (strcmp(arg, "--format=csv") == 0) {
+            sdb_config.format = SDB_FORMAT_CSV;
+        } else if (strcmp(arg, "--format=json") == 0) {
+            sdb_config.format = SDB_FORMAT_JSON;
+        } else {
+            //not a global option, leave it for main()
+            break;
+        }
+        i++;
+    }
+
+    return i - 1;
 }
 
 
@@ -535,12 +2011,26 @@ int main(int argc, char *argv[]){
     int exit_code;      //exit code to shell
     int id;             //userid from argv[2]
     int gpa;            //gpa from argv[5]
+    int layout;         //layout --migrate converts to
+    int limit;          //most records -r prints, 0 for all
+    int first, last;    //id range -r prints
+    int count;          //slots -X compacts
+    bool after;         //-r --after
 
     //space for a student structure which we will get back from
     //some of the functions we will be writing such as get_student(),
     //and print_student().
     student_t student = {0};
 
+    //consume the global options so that argv[1] is the operation
+    int nopts = parse_global_opts(argc, argv);
+    if (nopts < 0){
+        exit(EXIT_FAIL_ARGS);
+    }
+    argv[nopts] = argv[0];
+    argv += nopts;
+    argc -= nopts;
+
     //This function must have at least one arg, and the arg must start
     //with a dash
     if ((argc < 2) || (*argv[1] != '-')){
@@ -552,12 +2042,26 @@ int main(int argc, char *argv[]){
     //-h -a -c -d -f -p -x -z
     opt = (char)*(argv[1]+1);   //get the option flag
 
+    //long options that are operations map onto their own opt values
+    if (strcmp(argv[1], "--rebuild-stats") == 0)
+        opt = OPT_REBUILD_STATS;
+    else if (strcmp(argv[1], "--serve") == 0)
+        opt = OPT_SERVE;
+    else if (strncmp(argv[1], "--migrate", 9) == 0 &&
+             (argv[1][9] == '\0' || argv[1][9] == '='))
+        opt = OPT_MIGRATE;
+
     //handle the help flag and then exit normally
     if (opt == 'h'){
         usage(argv[0]);
         exit(EXIT_OK);
     }
 
+    //a client only talks to sdbsc --serve, it never opens the db itself
+    if (sdb_config.client){
+        exit(run_client(argc, argv));
+    }
+
     //now lets open the file and continue if there is no error
     //note we are not truncating the file using the second
     //parameter
@@ -566,6 +2070,16 @@ int main(int argc, char *argv[]){
         exit(EXIT_FAIL_DB);
     }
 
+    //read-only scans can run on a snapshot instead, see sdb_snap.c
+    if (sdb_config.use_snapshot && opt != '\0' && strchr("pqrcAS", opt) != NULL){
+        int snap_fd = open_db_snapshot(fd);
+        close_db(fd);
+        if (snap_fd < 0){
+            exit(EXIT_FAIL_DB);
+        }
+        fd = snap_fd;
+    }
+
     //set rc to the return code of the operation to ensure the program
     //use that to determine the proper exit_code.  Look at the header
     //sdbsc.h for expected values.
@@ -588,7 +2102,7 @@ int main(int argc, char *argv[]){
             id = atoi(argv[2]);
             gpa = atoi(argv[5]);
 
-            exit_code = validate_range(id,gpa);
+            exit_code = validate_db_range(fd, id, gpa);
             if (exit_code == EXIT_FAIL_ARGS){
                 printf(M_ERR_STD_RNG);
                 break;
@@ -600,6 +2114,22 @@ int main(int argc, char *argv[]){
 
             break;
 
+        case 'b':
+            //   arv[0] arv[1]  arv[2]
+            //prog_name     -b    file
+            //-------------------------
+            //example:  prog_name -b students.csv
+            //          prog_name -p | prog_name -b -
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = bulk_load(fd, argv[2]);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
         case 'c':
             //    arv[0] arv[1]
             //prog_name     -c
@@ -611,16 +2141,25 @@ int main(int argc, char *argv[]){
             break;
 
         case 'd':
-            //   arv[0]  arv[1]  arv[2]
-            //prog_name     -d      id
+            //   arv[0]  arv[1]  arv[2]  [arv[3] ...]
+            //prog_name     -d      id  [id ...]
+            //prog_name     -d  --ids-from  file
             //-------------------------
             //example:  prog_name -d 100
-            if (argc != 3){
+            if (argc < 3){
                 usage(argv[0]);
                 exit_code = EXIT_FAIL_ARGS;
                 break;
             }
-            id = atoi(argv[2]);
+            if (argc > 3 || strcmp(argv[2], "--ids-from") == 0){
+                exit_code = run_multi_id_op(fd, opt, argc, argv);
+                break;
+            }
+            if (!parse_int_arg(argv[2], &id)){
+                printf(M_ERR_BAD_ID, argv[2]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
             rc = del_student(fd, id);
             if (rc < 0)
                 exit_code = EXIT_FAIL_DB;
@@ -628,16 +2167,25 @@ int main(int argc, char *argv[]){
             break;
 
         case 'f':
-            //    arv[0] arv[1]  arv[2]
-            //prog_name     -f      id
+            //    arv[0] arv[1]  arv[2]  [arv[3] ...]
+            //prog_name     -f      id  [id ...]
+            //prog_name     -f  --ids-from  file
             //-------------------------
             //example:  prog_name -f 100
-            if (argc != 3){
+            if (argc < 3){
                 usage(argv[0]);
                 exit_code = EXIT_FAIL_ARGS;
                 break;
             }
-            id = atoi(argv[2]);
+            if (argc > 3 || strcmp(argv[2], "--ids-from") == 0){
+                exit_code = run_multi_id_op(fd, opt, argc, argv);
+                break;
+            }
+            if (!parse_int_arg(argv[2], &id)){
+                printf(M_ERR_BAD_ID, argv[2]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
             rc = get_student(fd, id, &student);
 
 
@@ -656,6 +2204,96 @@ int main(int argc, char *argv[]){
             }
             break;
 
+        case 's':
+            //    arv[0] arv[1]     arv[2]      arv[3]
+            //prog_name     -s  last_name  [first_name]
+            //--------------------------------------------
+            //example:  prog_name -s doe john
+            if (argc != 3 && argc != 4){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = find_students_by_name(fd, argv[2], argc == 4 ? argv[3] : NULL);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'g':
+            //    arv[0] arv[1]  arv[2]  arv[3]
+            //prog_name     -g     min     max
+            //----------------------------------
+            //example:  prog_name -g 350 400
+            if (argc != 4){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = find_students_by_gpa(fd, atoi(argv[2]), atoi(argv[3]));
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 't':
+            //    arv[0] arv[1]  arv[2]
+            //prog_name     -t       k
+            //-------------------------
+            //example:  prog_name -t 100
+            if (argc != 3 || atoi(argv[2]) <= 0){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = print_top_students(fd, atoi(argv[2]));
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'r':
+            //    arv[0] arv[1]   arv[2]  arv[3]   arv[4]  arv[5]
+            //prog_name     -r    first    last [--limit      N]
+            //prog_name     -r  --after      id [--limit      N]
+            //----------------------------------------------------
+            //example:  prog_name -r 1000 2000
+            //example:  prog_name -r --after 1000 --limit 50
+            after = argc > 2 && strcmp(argv[2], "--after") == 0;
+            if ((argc != 4 && argc != 6) ||
+                    (!after && !parse_int_arg(argv[2], &first)) ||
+                    !parse_int_arg(argv[3], &last) ||
+                    (argc == 6 && (strcmp(argv[4], "--limit") != 0 ||
+                                   !parse_int_arg(argv[5], &limit) ||
+                                   limit <= 0))){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            if (argc == 4)
+                limit = 0;
+            if (after)
+                rc = print_db_range_after(fd, last, limit);
+            else
+                rc = print_db_range(fd, first, last, limit);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'q':
+            //    arv[0] arv[1]  arv[2]
+            //prog_name     -q   query
+            //-------------------------
+            //example:  prog_name -q "gpa>=350 && lname=doe && id<50000"
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = run_query(fd, argv[2]);
+            if (rc == ERR_DB_OP)
+                exit_code = EXIT_FAIL_ARGS;
+            else if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
         case 'p':
             //    arv[0] arv[1]
             //prog_name     -p
@@ -679,6 +2317,107 @@ int main(int argc, char *argv[]){
                 exit_code = EXIT_FAIL_DB;
             break;
 
+        case OPT_MIGRATE:
+            //    arv[0]                         arv[1]
+            //prog_name  --migrate[=paged|split|hash|packed]
+            //-----------------------------------------------
+            //example:  prog_name --migrate=split
+            if (strcmp(argv[1], "--migrate") == 0 ||
+                    strcmp(argv[1], "--migrate=paged") == 0) {
+                layout = DB_LAYOUT_PAGED;
+            } else if (strcmp(argv[1], "--migrate=split") == 0) {
+                layout = DB_LAYOUT_SPLIT;
+            } else if (strcmp(argv[1], "--migrate=hash") == 0) {
+                layout = DB_LAYOUT_HASH;
+            } else if (strcmp(argv[1], "--migrate=packed") == 0) {
+                layout = DB_LAYOUT_PACKED;
+            } else {
+                printf(M_ERR_BAD_OPTION, argv[1]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+
+            //like compress_db, migrate_db returns the fd of the new file
+            fd = migrate_db(fd, layout);
+            if (fd < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'A':
+            //    arv[0] arv[1]
+            //prog_name     -A
+            //-----------------
+            //example:  prog_name -A
+            rc = print_db_aggregates(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'S':
+            //    arv[0] arv[1]
+            //prog_name     -S
+            //-----------------
+            //example:  prog_name -S
+            rc = print_db_stats(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'V':
+            //    arv[0] arv[1]
+            //prog_name     -V
+            //-----------------
+            //example:  prog_name --crc -V
+            rc = verify_db(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case OPT_REBUILD_STATS:
+            //    arv[0]           arv[1]
+            //prog_name  --rebuild-stats
+            //---------------------------
+            //example:  prog_name --rebuild-stats
+            rc = rebuild_db_stats(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'i':
+            //   arv[0] arv[1]
+            //prog_name     -i
+            //-----------------
+            //example:  printf "a 1 john doe 345\nf 1\n" | prog_name -i
+            exit_code = repl_db(fd);
+            break;
+
+        case OPT_SERVE:
+            //    arv[0]   arv[1]
+            //prog_name  --serve
+            //-------------------
+            //example:  prog_name --serve &
+            //          prog_name --client -f 100
+            rc = serve_db(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'X':
+            //   arv[0] arv[1]      arv[2] arv[3]
+            //prog_name     -X  first_slot  count
+            //-----------------------------------
+            //example:  prog_name -X 1 65536
+            if (argc != 4 || !parse_int_arg(argv[2], &first) ||
+                    !parse_int_arg(argv[3], &count) || count <= 0){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = compact_db_range(fd, first, count);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
         case 'z':
             //    arv[0] arv[1]
             //prog_name     -x
@@ -686,7 +2425,7 @@ int main(int argc, char *argv[]){
             //example:  prog_name -x
             //HINT:  close the db file, we already have fd
             //       and reopen db indicating truncate=true
-            close(fd);
+            close_db(fd);
             fd = open_db(DB_FILE, true);
             if (fd < 0){
                 exit_code = EXIT_FAIL_DB;
@@ -703,6 +2442,6 @@ int main(int argc, char *argv[]){
 
     //don't forget to close the file before exiting, and setting the
     //proper exit code - see the header file for expected values
-    close(fd);
+    close_db(fd);
     exit(exit_code);
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #ifndef __SDB_H__
+#define __SDB_H__
 
+#include <sys/types.h>
 #include "db.h" //get student record type
 
 //prototypes for functions go below for this assignment
@@ -8,11 +10,408 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
 int compress_db(int fd);
+int compact_db_range(int fd, int first, int nslots);
+int print_db_stats(int fd);
+int print_db_aggregates(int fd);
+int find_students_by_name(int fd, char *lname, char *fname);
+int find_students_by_gpa(int fd, int min_gpa, int max_gpa);
+int print_top_students(int fd, int k);
+int rebuild_db_stats(int fd);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
+int validate_db_range(int fd, int id, int gpa);
+int get_db_count(int fd);
 int count_db_records(int fd);
 int print_db(int fd);
 void usage(char *);
+int parse_global_opts(int argc, char *argv[]);
+bool parse_int_arg(const char *arg, int *val);
+int close_db(int fd);
+
+//durability policies, they control when changes are forced to disk
+// DB_DURABILITY_RELAXED  leave it to the kernel to write dirty pages back
+// DB_DURABILITY_BATCH    flush once, when the database is closed
+// DB_DURABILITY_SYNC     flush after every add or delete
+//In --wal mode the policy applies to the write-ahead log instead of the db
+//file, which is only flushed by checkpoints, see sdb_wal.c
+#define DB_DURABILITY_RELAXED   0
+#define DB_DURABILITY_BATCH     1
+#define DB_DURABILITY_SYNC      2
+#define DB_DATA_DURABILITY      (sdb_config.use_wal ? DB_DURABILITY_RELAXED \
+                                                    : sdb_config.durability)
+
+//runtime options that are not part of the database file itself, they are
+//set from the global command line options before the db is opened
+typedef struct sdb_config{
+    int  durability;        //one of the DB_DURABILITY_* values
+    bool use_mmap;          //false forces the lseek/read/write path
+    bool use_wal;           //log changes to the write-ahead log first
+    bool client;            //send the operation to sdbsc --serve
+    int  format;            //SDB_FORMAT_*, for -i and -q
+    int  jobs;              //threads used by print, count and compress, -j
+    bool use_crc;           //create the record checksums if there are none
+    bool use_snapshot;      //run -p, -q, -r, -c, -A and -S on a snapshot
+    int  scan_kernel;       //SDB_SCAN_*, the empty record test scans use
+    bool use_seek_data;     //false reads the holes instead of skipping them
+} sdb_config_t;
+
+//reply formats of -i, see sdb_repl.c
+#define SDB_FORMAT_TEXT         0
+#define SDB_FORMAT_TSV          1
+#define SDB_FORMAT_CSV          2       //-q and -r only, -i replies as text
+#define SDB_FORMAT_JSON         3       //-q and -r only, -i replies as text
+
+//empty record tests, see sdb_scan.c.  A kernel the cpu lacks falls back to
+//the next one down
+#define SDB_SCAN_AUTO           0       //the fastest the cpu has
+#define SDB_SCAN_SCALAR         1
+#define SDB_SCAN_SSE2           2
+#define SDB_SCAN_AVX2           3
+
+extern sdb_config_t sdb_config;
+
+//state kept for every database opened with open_db()
+#define DB_FILE_MODE    (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)    //rw-rw----
+#define DB_MAX_HANDLES  4
+#define DB_PATH_MAX     256
+#define DB_MAP_RESERVE  ((size_t)(DB_PAGE_OF(MAX_STD_ID) + 1) * DB_PAGE_SIZE)
+                        //largest db file, the paged layout needs the most
+#define DB_INDEX_SIZE   ((size_t)(MAX_STD_ID + 1) * sizeof(uint32_t))
+#define DB_HOT_SIZE     ((size_t)(MAX_STD_ID + 1) * sizeof(db_hot_t))
+
+typedef struct db_handle{
+    bool   in_use;
+    int    fd;
+    char   path[DB_PATH_MAX];   //name the db was opened with
+    int    layout;          //DB_LAYOUT_* from the header
+    char  *map;             //mmap of the db file, NULL if not mapped
+    size_t map_len;         //bytes of address space reserved for map
+    off_t  file_len;        //current size of the db file
+    bool   dirty;           //written to since it was opened
+    int    idx_fd;          //id -> slot index (compact layout) or id ->
+                            //offset directory (packed layout), or -1
+    uint32_t *idx_map;      //mmap of the index, NULL if not mapped
+    int    hot_fd;          //id and gpa column (split layout), or -1
+    db_hot_t *hot_map;      //mmap of the hot column, NULL if not mapped
+    int    dir_fd;          //bucket directory (hash layout), or -1
+    char  *dir_map;         //mmap of the directory, NULL if not mapped
+    db_header_t hdr;        //cached copy of the header / superblock
+    bool   stats_valid;     //hdr statistics are being maintained
+    bool   hdr_dirty;       //hdr changed since it was last written
+    int    name_fd;         //last name index, or -1 if there is none
+    name_index_hdr_t name_hdr;  //cached copy of the name index header
+    char  *name_map;        //mmap of the whole name index, or NULL
+    bool   name_dirty;      //name index written to since it was opened
+    int    gpa_fd;          //gpa index, or -1 if there is none
+    gpa_index_hdr_t gpa_hdr;    //cached copy of the gpa index header
+    char  *gpa_map;         //mmap of the whole gpa index, or NULL
+    bool   gpa_dirty;       //gpa index written to since it was opened
+    int    crc_fd;          //record checksums, or -1 if there are none
+    uint32_t *crc_map;      //mmap of the checksums (past the header), or NULL
+    bool   crc_dirty;       //checksums written to since they were opened
+    int    wal_fd;          //write-ahead log, or -1 if there is none
+    uint32_t wal_seq;       //sequence number of the last logged record
+    off_t  wal_size;        //bytes in the log
+    wal_record_t *wal_buf;  //records not written to the log yet
+    int    wal_nbuf;        //records in wal_buf
+    bool   wal_unsynced;    //log written to since it was last flushed
+    int    slot_locks;      //record locks held through this handle
+    int    meta_locks;      //nesting depth of the superblock lock
+    bool   snapshot;        //private copy from open_db_snapshot(), nobody
+                            //else writes it so it is never locked
+} db_handle_t;
+
+//storage engine prototypes for sdb_store.c
+db_handle_t *db_handle(int fd);
+int attach_db(int fd, const char *path);
+int attach_db_snapshot(int fd, const char *path);
+int reopen_db(int fd);
+int map_db(db_handle_t *h);
+void unmap_db(db_handle_t *h);
+int grow_db_map(db_handle_t *h, off_t new_len);
+int read_db_slot(int fd, int id, student_t *s);
+int write_db_slot(int fd, int id, const student_t *s);
+int apply_db_slot(int fd, int id, const student_t *s);
+int update_db_indexes(int fd, const student_t *s, int delta);
+int save_db_indexes(int fd);
+int save_db_change(int fd, const student_t *s, int delta);
+int read_phys_slot(int fd, off_t slot, student_t *s);
+int write_phys_slot(int fd, off_t slot, const student_t *s);
+int read_slot_index(db_handle_t *h, int id, uint32_t *slot);
+int write_slot_index(db_handle_t *h, int id, uint32_t slot);
+int read_db_header(int fd, db_header_t *hdr);
+int write_db_header(int fd, const db_header_t *hdr);
+void side_file_path(const char *db_path, const char *ext, char *buff,
+                    size_t len);
+void db_index_path(const char *db_path, char *buff, size_t len);
+int save_slot_index(const char *path, const uint32_t *slots);
+long long db_disk_usage(const char *path);
+long long punch_empty_blocks(int fd, off_t start, off_t end);
+int truncate_db_file(int fd, off_t len);
+int cut_db_file(int fd, off_t len, int first, int nslots);
+int grow_db_file(int fd, off_t len);
+size_t copy_db_range(int in_fd, off_t in_off, int out_fd, off_t out_off,
+                     size_t len);
+int sync_db_dir(const char *path);
+const char *db_layout_name(int layout);
+int db_max_id(int fd);
+
+//paged layout prototypes for sdb_page.c
+int read_page_hdr(int fd, int page, db_page_hdr_t *ph);
+int read_paged_slot(int fd, int id, student_t *s);
+int apply_paged_slot(db_handle_t *h, int id, const student_t *s);
+long long punch_empty_pages(int fd, int first_page, int last_page);
+int last_used_page(int fd);
+int migrate_db(int fd, int layout);
+
+//hash layout prototypes for sdb_hash.c
+void hash_dir_path(const char *db_path, char *buff, size_t len);
+int open_hash_dir(db_handle_t *h);
+void close_hash_dir(db_handle_t *h);
+int refresh_hash_dir(db_handle_t *h);
+int read_hash_slot(db_handle_t *h, int id, student_t *s);
+int apply_hash_slot(db_handle_t *h, int id, const student_t *s);
+int read_hash_records(db_handle_t *h, int first_id, int last_id, char *buf,
+                      student_t **recs);
+int write_hash_db(int fd, const student_t *recs, int n, const db_header_t *hdr);
+
+//packed layout prototypes for sdb_pack.c
+void packed_dir_path(const char *db_path, char *buff, size_t len);
+size_t pack_record(const student_t *s, char *out);
+int unpack_record(const char *buf, size_t avail, student_t *s);
+int read_packed_slot(db_handle_t *h, int id, student_t *s);
+int apply_packed_slot(db_handle_t *h, int id, const student_t *s);
+int write_packed_db(int fd, const student_t *recs, const db_header_t *hdr);
+
+//split layout prototypes for sdb_column.c
+void hot_column_path(const char *db_path, char *buff, size_t len);
+int open_hot_column(db_handle_t *h);
+void close_hot_column(db_handle_t *h);
+int read_split_slot(db_handle_t *h, int id, student_t *s);
+int apply_split_slot(db_handle_t *h, int id, const student_t *s);
+int read_hot_block(db_handle_t *h, int first, int n, db_hot_t *buf);
+long long punch_split_range(int fd, int first, int last);
+int write_split_db(int fd, const student_t *recs, const db_header_t *hdr);
+
+//bulk load prototypes for sdb_bulk.c
+#define BULK_BATCH_ROWS 65536   //rows validated and written together
+#define BULK_MAX_IOV    1024    //IOV_MAX on linux
+
+typedef struct bulk_stats{
+    int added;
+    int duplicates;
+    int rejected;
+} bulk_stats_t;
+
+int bulk_load(int fd, char *path);
+
+//superblock statistics prototypes for sdb_stats.c
+int gpa_bucket(int gpa);
+void add_to_stats(db_header_t *hdr, const student_t *s);
+int update_db_stats(int fd, const student_t *s, int delta);
+int save_db_stats(int fd);
+int compute_db_stats(int fd, db_header_t *hdr);
+
+//aggregate prototypes for sdb_agg.c
+#define AGG_BATCH       4096    //gpas handed to the kernel at once
+
+typedef struct gpa_agg{
+    int64_t  count;
+    int64_t  sum;                       //of the integer gpas
+    int64_t  sum_sq;                    //of their squares
+    int32_t  min;
+    int32_t  max;
+    uint32_t hist[DB_GPA_BUCKETS];      //as in the superblock
+} gpa_agg_t;
+
+int aggregate_db(int fd, gpa_agg_t *a);
+
+//parallel scan prototypes for sdb_par.c
+#define PAR_MAX_JOBS    64
+
+typedef struct par_part{
+    int    fd;
+    int    first_id;        //ids scanned by this part
+    int    last_id;
+    int    rc;              //NO_ERROR, or the error the part ran into
+    int    nrecs;           //records found
+    char  *out;             //par_format_db():  formatted rows
+    size_t out_len;
+    student_t *recs;        //par_pack_db():  the records, in id order
+    db_header_t hdr;        //statistics of the records found
+    int    out_fd;          //par_pack_db():  file written to
+    uint32_t first_slot;    //and the slot of recs[0] in it
+} par_part_t;
+
+int split_db_ranges(int fd, int jobs, par_part_t *parts);
+void free_par_parts(par_part_t *parts, int n);
+int par_format_db(int fd, int jobs, par_part_t *parts);
+int par_compute_stats(int fd, int jobs, db_header_t *hdr);
+int par_pack_db(int fd, int jobs, int out_fd, uint32_t *slots,
+                db_header_t *hdr);
+
+//multi-id get and delete prototypes for sdb_multi.c
+int read_db_slots(int fd, const int *ids, int n, student_t *recs);
+int get_students(int fd, const int *ids, int n);
+int del_students(int fd, const int *ids, int n);
+int read_ids_file(const char *path, int **ids, int *n);
+
+//last name index prototypes for sdb_name.c
+uint32_t name_hash(const char *lname);
+void name_index_path(const char *db_path, char *buff, size_t len);
+int open_name_index(db_handle_t *h);
+void close_name_index(db_handle_t *h);
+int update_name_index(int fd, const student_t *s, int delta);
+int save_name_index(int fd);
+int build_name_index(int fd);
+int lookup_name_index(int fd, const char *lname, int **ids);
+int refresh_name_index(db_handle_t *h);
+
+//gpa index prototypes for sdb_gpa.c
+void gpa_index_path(const char *db_path, char *buff, size_t len);
+int open_gpa_index(db_handle_t *h);
+void close_gpa_index(db_handle_t *h);
+int update_gpa_index(int fd, const student_t *s, int delta);
+int save_gpa_index(int fd);
+int build_gpa_index(int fd);
+int read_gpa_bucket(int fd, int gpa, int **ids);
+int refresh_gpa_index(db_handle_t *h);
+
+//record checksum prototypes for sdb_crc.c
+uint32_t crc32c(const void *buf, size_t len);
+uint32_t record_crc(const student_t *s);
+void crc_index_path(const char *db_path, char *buff, size_t len);
+int open_crc_index(db_handle_t *h);
+void close_crc_index(db_handle_t *h);
+int refresh_crc_index(db_handle_t *h);
+int update_crc_index(int fd, const student_t *s, int delta);
+int save_crc_index(int fd);
+int build_crc_index(int fd);
+int check_record_crc(int fd, int id, student_t *s);
+int verify_db(int fd);
+
+//query prototypes for sdb_query.c
+int run_query(int fd, const char *text);
+void print_match_row(const student_t *s, int found);
+void end_match_rows(int found);
+
+//id range prototypes for sdb_range.c
+int print_db_range(int fd, int first, int last, int limit);
+int print_db_range_after(int fd, int after, int limit);
+
+//snapshot prototypes for sdb_snap.c
+void snapshot_path(const char *db_path, char *buff, size_t len);
+int open_db_snapshot(int fd);
+
+//write-ahead log prototypes for sdb_wal.c
+#define WAL_BUF_RECORDS     1024            //records per write() to the log
+#define WAL_CHECKPOINT_SIZE (1024*1024)     //log size that starts a checkpoint
+
+void wal_path(const char *db_path, char *buff, size_t len);
+int open_wal(db_handle_t *h);
+void close_wal(db_handle_t *h);
+int wal_begin(int fd);
+int wal_append(int fd, int id, const student_t *s);
+int wal_commit(int fd);
+void wal_end(int fd);
+int checkpoint_wal(db_handle_t *h);
+void sync_wal(db_handle_t *h);
+
+//record locking prototypes for sdb_lock.c
+#define DB_GROW_LOCK_OFF    (((off_t)DB_HASH_MAX_ID + 1) * STUDENT_RECORD_SIZE)
+                                    //byte locked to grow the file, past
+                                    //the record lock of every id
+#define DB_PAGE_LOCK_OFF    (DB_GROW_LOCK_OFF + 1)   //+ page:  a page header
+
+int lock_db_range(int fd, off_t start, off_t len, short type, bool wait);
+void unlock_db_range(int fd, off_t start, off_t len);
+int lock_db_slots(int fd, int first, int nslots, short type);
+void unlock_db_slots(int fd, int first, int nslots);
+int lock_db_page(int fd, int page);
+void unlock_db_page(int fd, int page);
+int lock_db_meta(int fd, short type);
+void unlock_db_meta(int fd);
+int lock_db_all(int fd, short type);
+void unlock_db_all(int fd);
+bool holds_db_locks(const db_handle_t *h);
+
+//server and client prototypes for sdb_serve.c.  A request is one fixed
+//size message, the reply is a header followed by the console output the
+//operation produced, so the client prints exactly what sdbsc would have
+#define SDB_MSG_MAGIC       0x51424453      //"SDBQ"
+#define SERVE_MAX_CLIENTS   64              //connections served at once
+#define CLIENT_WINDOW       64              //requests a client has in flight
+
+typedef struct sdb_request{
+    uint32_t  magic;        //SDB_MSG_MAGIC
+    uint32_t  op;           //operation letter:  'a' 'f' 'd' 'c' or 'p'
+    student_t s;            //the record for 'a', the id for 'f' and 'd'
+} sdb_request_t;
+
+typedef struct sdb_reply{
+    int32_t   exit_code;    //what sdbsc would have exited with
+    uint32_t  len;          //bytes of console output that follow
+} sdb_reply_t;
+
+int serve_db(int fd);
+int run_client(int argc, char *argv[]);
+
+//operations run by -i, --serve and --client, see sdb_repl.c
+#define DB_OP_MAX_ARGS      8               //words on one command line
+#define REPL_OUT_BUF        (64*1024)       //stdout buffer of -i
+
+char db_op_letter(const char *word);
+int split_db_op(char *line, char *args[], int max);
+int parse_db_op(char op, int nargs, char *args[], sdb_request_t *req);
+int run_db_op(int fd, const sdb_request_t *req);
+int capture_db_op(int fd, const sdb_request_t *req, char **out, size_t *len);
+int repl_db(int fd);
+
+//scan iterator prototypes for sdb_scan.c
+#define SCAN_BLOCK_SIZE (1024*1024)     //bytes read per scan syscall
+#define SCAN_BUF_ALIGN  4096
+#define SCAN_LAST_ID    0x7fffffff      //scan to the end of the file
+
+typedef struct db_scan{
+    int    fd;
+    db_handle_t *h;         //set when walking a compacted or packed db by
+                            //its index, a split db by its hot column or a
+                            //hashed db
+    char  *buf;             //SCAN_BLOCK_SIZE bytes, SCAN_BUF_ALIGN aligned
+    off_t  buf_off;         //file offset of buf[0]
+    int    nrecs;           //records in buf
+    int    pos;             //next record in buf to test
+    off_t  next_off;        //file offset of the next block to read
+    off_t  end;             //stop reading at this offset
+    off_t  extent_end;      //end of the allocated extent being read
+    bool   lock;            //take a shared lock on each block read
+    bool   paged;           //paged layout:  records found through bitmaps
+    bool   hot_only;        //split layout:  only id and gpa are wanted
+    char  *cold;            //split layout:  names of the ids in buf,
+                            //packed layout:  SCAN_BLOCK_SIZE bytes of records
+    off_t  cold_off;        //packed layout:  file offset of cold[0]
+    size_t cold_len;        //packed layout:  bytes read into cold
+    student_t *page;        //paged layout:  page being walked
+    uint64_t live;          //paged layout:  live bits not returned yet
+    uint32_t *slots;        //compact and packed layout: index or directory
+                            //entries being walked
+    int    base_id;         //compact, split and packed layout: id of the
+                            //first entry in the block
+    int    next_id;         //compact, split and packed layout: first id of
+                            //the next block, paged layout:  first id to visit
+    int    last_id;         //compact, paged, split and packed layout: last
+                            //id to visit
+    student_t rec;          //compact, split and packed layout: the record
+                            //returned
+    student_t *hashed;      //hash layout:  the records in range, by id
+} db_scan_t;
+
+bool is_empty_record(const student_t *s);
+bool is_empty_block(const void *p, size_t len);
+int open_db_scan(db_scan_t *scan, int fd, int first_id, int last_id);
+int open_db_hot_scan(db_scan_t *scan, int fd, int first_id, int last_id);
+int next_db_record(db_scan_t *scan, student_t **s);
+void close_db_scan(db_scan_t *scan);
 
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
@@ -24,6 +423,7 @@ void usage(char *);
 #define ERR_DB_OP       -2
 #define SRCH_NOT_FOUND  -3
 #define NOT_IMPLEMENTED_YET 0
+#define WARN_BULK_SKIP  -4      //bulk load line is a comment or header
 
 
 //error codes to be returned to the shell
@@ -36,6 +436,11 @@ void usage(char *);
 #define EXIT_FAIL_ARGS  2
 #define EXIT_NOT_IMPL   3
 
+//opt values in main() for operations that only have a long option
+#define OPT_REBUILD_STATS   1
+#define OPT_SERVE           2
+#define OPT_MIGRATE         3
+
 //Output messages
 #define M_ERR_STD_RNG     "Cant add student, either ID or GPA out of allowable range!\n"
 #define M_ERR_DB_CREATE   "Error creating DB file, exiting!\n"
@@ -48,11 +453,42 @@ void usage(char *);
 #define M_STD_ADDED       "Student %d added to database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
 #define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
+#define M_STD_NAME_NOT_FND "No student with last name %s was found in database.\n"
+#define M_STD_RANGE_NOT_FND "No student with an id between %d and %d was found in database.\n"
+#define M_STD_AFTER_NOT_FND "No student with an id past %d was found in database.\n"
+#define M_DB_RANGE_MORE   "More students follow, continue with --after %d.\n"
+#define M_STD_QUERY_NOT_FND "No student matched the query.\n"
+#define M_ERR_QUERY       "Cant parse the query at: %s\n"
+#define M_STD_GPA_NOT_FND "No student with a GPA between %.2f and %.2f was found in database.\n"
 #define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
+#define M_DB_COMPRESS_STATS "Compacted %d record(s) in %.3f sec: db %lld -> %lld bytes on disk, index %lld bytes\n"
+#define M_DB_COMPACT_STEP "Reclaimed %lld bytes in slots %d-%d, %d record(s) moved.\n"
+#define M_DB_MIGRATED     "Migrated %d record(s) to the %s format in %.3f sec: db %lld -> %lld bytes on disk\n"
+#define M_DB_MIGRATE_NOOP "Database already uses the %s format.\n"
+#define M_ERR_MIGRATE_ID  "Cant migrate, student %d is past the largest id of the %s format.\n"
 #define M_DB_ZERO_OK      "All database records removed!\n"
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
+#define M_DB_STATS_RANGE  "Lowest id: %u, highest id: %u\n"
+#define M_DB_STATS_AVG    "Average GPA: %.2f\n"
+#define M_DB_STATS_HIST   "GPA %.2f-%.2f: %u\n"
+#define M_DB_STATS_STALE  "Statistics are not maintained for this database, run --rebuild-stats.\n"
+#define M_DB_AGGREGATES   "count=%lld sum=%lld.%02lld avg=%.4f min=%d.%02d max=%d.%02d stddev=%.4f hist=%s\n"
+#define M_DB_STATS_REBUILT "Statistics rebuilt for %u student record(s).\n"
+#define M_DB_CRC_BAD      "Student %d failed its checksum.\n"
+#define M_DB_VERIFIED     "Verified %d student record(s) in %.3f sec (%.0f MB/s), %d bad.\n"
+#define M_ERR_DB_NO_CRC   "Database has no record checksums, add them with --crc.\n"
+#define M_ERR_DB_SNAPSHOT "Error taking a snapshot of the database.\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_ERR_BULK_OPEN   "Cant open bulk load file %s\n"
+#define M_ERR_IDS_OPEN    "Cant open ids file %s\n"
+#define M_ERR_BAD_ID      "Not a student id: %s\n"
+#define M_BULK_SUMMARY    "Bulk load: %d added, %d duplicate(s), %d rejected in %.3f sec (%.0f rows/sec)\n"
+#define M_ERR_BAD_OPTION  "Unknown option or bad value: %s\n"
+#define M_ERR_SERVE       "Cant serve the database on %s\n"
+#define M_ERR_CLIENT      "Cant reach the sdbsc server on %s\n"
+#define M_SERVE_READY     "Serving %s on %s\n"
+#define M_SERVE_STOPPED   "Server stopped after %llu request(s).\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -190,7 +190,6 @@ setup_file() {
 #}
 
 @test "Compress db - try 1" {
-    skip
     run ./sdbsc -x
     [ "$status" -eq 0 ]
     [ "${lines[0]}" = "Database successfully compressed!" ] || {
@@ -210,8 +209,24 @@ setup_file() {
 #    }
 #}
 
+@test "Lookups still work after compress" {
+    run ./sdbsc -f 63
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "63 jim doe 0.02" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -f 64
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 64 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
 @test "Delete student 99999 in db" {
-    skip
     run ./sdbsc -d 99999
     [ "$status" -eq 0 ]
     [ "${lines[0]}" = "Student 99999 was deleted from database." ] || {
@@ -221,7 +236,6 @@ setup_file() {
 }
 
 @test "Compress db again - try 2" {
-    skip
     run ./sdbsc -x
     [ "$status" -eq 0 ]
     [ "${lines[0]}" = "Database successfully compressed!" ] || {
@@ -239,4 +253,762 @@ setup_file() {
 #        echo "4.0K     ./student.db"
 #        return 1
 #    }
-#}
\ No newline at end of file
+#}
+
+@test "Find student 3 without mmap and with sync durability" {
+    run ./sdbsc --no-mmap -f 3
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "3 jane doe 0.03" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc --durability=sync -f 3
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "3 jane doe 0.03" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Reject a bad global option value" {
+    run ./sdbsc --durability=never -c
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Unknown option or bad value: --durability=never" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Bulk load rows from stdin" {
+    run bash -c "printf '64,janet,doe,310\n3,dup,row,100\n7,bad,gpa,900\n' | ./sdbsc -b -"
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" == "Bulk load: 1 added, 1 duplicate(s), 1 rejected in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 4 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Incremental compaction keeps every record" {
+    run ./sdbsc -d 3
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -X 1 100
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" == "Reclaimed "*" bytes in slots 1-100, 1 record(s) moved." ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -X 1 -5
+    [ "$status" -eq 2 ]
+    run ./sdbsc -X 1 lots
+    [ "$status" -eq 2 ]
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 1 john doe 0.03 63 jim doe 0.02 64 janet doe 3.10"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Statistics come from the superblock" {
+    run ./sdbsc -S
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Lowest id: 1, highest id: 64" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "Average GPA: 1.05" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc --rebuild-stats
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Statistics rebuilt for 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Find students by last name" {
+    run ./sdbsc -s doe jim
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 63 jim doe 0.02"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -d 63
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -s doe
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 1 john doe 0.03 64 janet doe 3.10"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -s smith
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No student with last name smith was found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "GPA range and top students come from the gpa index" {
+    run ./sdbsc -g 300 400
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 64 janet doe 3.10"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -t 5
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 64 janet doe 3.10 1 john doe 0.03"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Changes made with --wal are logged and the log is checkpointed" {
+    run ./sdbsc --wal -a 7 amy lee 350
+    [ "$status" -eq 0 ]
+    [ "$(stat -c %s ./student.db.wal)" -eq 80 ]
+
+    # a torn record at the end of the log is dropped on the next open
+    printf 'SDBW' >> ./student.db.wal
+    run ./sdbsc -f 7
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST NAME GPA 7 amy lee 3.50"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+    [ ! -s ./student.db.wal ]
+
+    run ./sdbsc --wal -d 7
+    [ "$status" -eq 0 ]
+
+    # a change made without --wal is not undone by the log
+    ./sdbsc --wal -a 5 bob smith 300
+    ./sdbsc -d 5
+    run ./sdbsc -f 5
+    [ "$status" -eq 1 ]
+    [ "$output" = "Student 5 was not found in database." ]
+    [ ! -s ./student.db.wal ]
+}
+
+@test "Concurrent adds of one id only succeed once" {
+    for i in 1 2 3 4 5 6; do
+        ./sdbsc -a 5 racer$i lee 300 > ./race.$i &
+    done
+    wait
+    added=$(cat ./race.* | grep -c "added to database")
+    rm -f ./race.*
+    [ "$added" -eq 1 ]
+
+    run ./sdbsc -s lee
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 2 ]
+
+    run ./sdbsc -d 5
+    [ "$status" -eq 0 ]
+}
+
+@test "Operations sent to sdbsc --serve print what sdbsc prints" {
+    ./sdbsc --serve > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./student.db.sock ] && break
+        sleep 0.1
+    done
+
+    run ./sdbsc --client -a 8 ben ng 310
+    [ "$status" -eq 0 ]
+    [ "$output" = "Student 8 added to database." ]
+
+    local_output=$(./sdbsc -f 8)
+    run ./sdbsc --client -f 8
+    [ "$status" -eq 0 ]
+    [ "$output" = "$local_output" ]
+
+    run bash -c 'printf -- "-d 8\n-f 8\n" | ./sdbsc --client -'
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 8 was deleted from database." ]
+    [ "${lines[1]}" = "Student 8 was not found in database." ]
+
+    kill $server
+    wait $server
+    [ ! -e ./student.db.sock ]
+
+    run ./sdbsc --client -c
+    [ "$status" -eq 1 ]
+}
+
+@test "Commands read by -i run against one open db" {
+    run bash -c 'printf "a 9 kim park 320\nf 9\nq\nd 9\nc\n" | ./sdbsc -i'
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Student 9 added to database." ]
+    [ "${lines[3]}" = "Unknown option or bad value: q" ]
+    [ "${lines[4]}" = "Student 9 was deleted from database." ]
+
+    run bash -c 'printf "a 9 kim park 320\nf 9\nd 9\nf 9\n" | ./sdbsc --format=tsv -i'
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "ok" ]
+    [ "${lines[1]}" = "$(printf '9\tkim\tpark\t320')" ]
+    [ "${lines[2]}" = "ok" ]
+    [ "${lines[3]}" = "ok" ]
+    [ "${lines[4]}" = "$(printf 'err\t1\tStudent 9 was not found in database.')" ]
+}
+
+@test "--migrate moves the db to the paged format in place" {
+    ./sdbsc -a 10 ann lee 301
+    ./sdbsc -a 200 bo kim 402
+    before=$(./sdbsc -p)
+
+    run ./sdbsc --migrate
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Migrated "*" record(s) to the paged format"* ]]
+
+    run ./sdbsc -p
+    [ "$output" = "$before" ]
+
+    run ./sdbsc --migrate
+    [ "$output" = "Database already uses the paged format." ]
+
+    ./sdbsc -d 200
+    run ./sdbsc -f 200
+    [ "$status" -eq 1 ]
+    ./sdbsc -a 201 cy wu 250
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    run ./sdbsc -f 201
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "201    cy                       wu                               2.50" ]
+
+    ./sdbsc -z
+}
+
+@test "--migrate=split keeps ids and gpas in a column of their own" {
+    ./sdbsc -a 11 dee ray 288
+    ./sdbsc -a 300 eli fox 377
+    before=$(./sdbsc -p)
+    stats=$(./sdbsc -S)
+
+    run ./sdbsc --migrate=split
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Migrated 2 record(s) to the split format"* ]]
+    [ -f ./student.db.hot ]
+
+    run ./sdbsc -p
+    [ "$output" = "$before" ]
+    ./sdbsc --rebuild-stats
+    run ./sdbsc -S
+    [ "$output" = "$stats" ]
+
+    ./sdbsc -d 300
+    run ./sdbsc -g 300 400
+    [ "$output" = "No student with a GPA between 3.00 and 4.00 was found in database." ]
+
+    run ./sdbsc --migrate
+    [ "$status" -eq 0 ]
+    [ ! -e ./student.db.hot ]
+    run ./sdbsc -f 11
+    [ "${lines[1]}" = "11     dee                      ray                              2.88" ]
+
+    ./sdbsc -z
+}
+
+@test "-A prints the gpa aggregates on one line" {
+    run ./sdbsc -A
+    [ "$status" -eq 0 ]
+    [ "$output" = "count=0 sum=0.00 avg=0.0000 min=0.00 max=0.00 stddev=0.0000 hist=0,0,0,0,0,0,0,0,0,0" ]
+
+    ./sdbsc -a 21 ana bell 100
+    ./sdbsc -a 22 ben cole 250
+    ./sdbsc -a 23 cam dunn 400
+
+    run ./sdbsc -A
+    [ "$status" -eq 0 ]
+    [ "$output" = "count=3 sum=7.50 avg=2.5000 min=1.00 max=4.00 stddev=1.2247 hist=0,0,1,0,0,1,0,0,1,0" ]
+
+    ./sdbsc -z
+}
+
+@test "-j prints, counts and compresses like a single thread" {
+    ./sdbsc -a 1 ann lee 310
+    ./sdbsc -a 64 bo nash 275
+    ./sdbsc -a 5000 cy ortiz 390
+    ./sdbsc -a 99999 di park 120
+    before=$(./sdbsc -p)
+
+    run ./sdbsc -j 4 -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "$before" ]
+
+    run ./sdbsc -j 4 --rebuild-stats
+    [ "$output" = "Statistics rebuilt for 4 student record(s)." ]
+
+    run ./sdbsc -j 3 -x
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Database successfully compressed!"* ]]
+    run ./sdbsc -j 2 -p
+    [ "$output" = "$before" ]
+
+    run ./sdbsc -j 0 -p
+    [ "$status" -eq 2 ]
+
+    ./sdbsc -z
+    run ./sdbsc -j 2 -p
+    [ "$output" = "Database contains no student records." ]
+}
+
+@test "-f and -d take several ids and report them in the order given" {
+    ./sdbsc -a 3 ann lee 310
+    ./sdbsc -a 4 bo nash 275
+    ./sdbsc -a 70 cy ortiz 390
+
+    run ./sdbsc -f 70 9 3 4
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "ID     FIRST NAME               LAST_NAME                        GPA" ]
+    [ "${lines[1]}" = "70     cy                       ortiz                            3.90" ]
+    [ "${lines[2]}" = "Student 9 was not found in database." ]
+    [ "${lines[3]}" = "3      ann                      lee                              3.10" ]
+    [ "${lines[4]}" = "4      bo                       nash                             2.75" ]
+
+    run ./sdbsc -d 4 3 4
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 4 was deleted from database." ]
+    [ "${lines[1]}" = "Student 3 was deleted from database." ]
+    [ "${lines[2]}" = "Student 4 was not found in database." ]
+
+    run bash -c "printf '70\n3\n' | ./sdbsc -f --ids-from -"
+    [ "${lines[1]}" = "70     cy                       ortiz                            3.90" ]
+    [ "${lines[2]}" = "Student 3 was not found in database." ]
+
+    run ./sdbsc -d 70x 3
+    [ "$status" -eq 2 ]
+    [ "$output" = "Not a student id: 70x" ]
+    run ./sdbsc -f abc
+    [ "$status" -eq 2 ]
+    [ "$output" = "Not a student id: abc" ]
+    run bash -c "printf '70 3x\n' | ./sdbsc -d --ids-from -"
+    [ "$status" -eq 2 ]
+    [ "$output" = "Not a student id: 3x" ]
+
+    run ./sdbsc -c
+    [ "$output" = "Database contains 1 student record(s)." ]
+
+    ./sdbsc -z
+}
+
+@test "--migrate=hash takes ids past MAX_STD_ID" {
+    ./sdbsc -a 5 ann lee 310
+    ./sdbsc -a 100 bo nash 275
+
+    run ./sdbsc -a 2000000000 cy ortiz 390
+    [ "$status" -eq 2 ]
+
+    run ./sdbsc --migrate=hash
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Migrated 2 record(s) to the hash format"* ]]
+
+    run ./sdbsc -a 2000000000 cy ortiz 390
+    [ "$output" = "Student 2000000000 added to database." ]
+    ./sdbsc -a 100001 di park 120
+
+    run ./sdbsc -f 2000000000
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2000000000 cy                       ortiz                            3.90" ]
+
+    run ./sdbsc -p
+    [ "${lines[1]}" = "5      ann                      lee                              3.10" ]
+    [ "${lines[3]}" = "100001 di                       park                             1.20" ]
+    [ "${lines[4]}" = "2000000000 cy                       ortiz                            3.90" ]
+
+    run ./sdbsc -s ortiz
+    [ "${lines[1]}" = "2000000000 cy                       ortiz                            3.90" ]
+
+    run ./sdbsc -t 1
+    [ "${lines[1]}" = "2000000000 cy                       ortiz                            3.90" ]
+
+    run ./sdbsc --migrate=paged
+    [ "$status" -eq 1 ]
+    [ "$output" = "Cant migrate, student 100001 is past the largest id of the paged format." ]
+
+    ./sdbsc -d 2000000000 100001
+    run ./sdbsc -c
+    [ "$output" = "Database contains 2 student record(s)." ]
+
+    run ./sdbsc --migrate=paged
+    [ "$status" -eq 0 ]
+    [ ! -e student.db.dir ]
+    run ./sdbsc -f 100
+    [ "${lines[1]}" = "100    bo                       nash                             2.75" ]
+
+    ./sdbsc -z
+}
+
+@test "-x copies runs of records and survives a crash between its renames" {
+    for id in $(seq 1 200); do echo "$id,f$id,l$id,$((id + 100))"; done > ./bulk.csv
+    ./sdbsc -b ./bulk.csv
+    rm -f ./bulk.csv
+    ./sdbsc -d 7 150
+    before=$(./sdbsc -p)
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Database successfully compressed!"* ]]
+    [ ! -e .tmp_student.db ]
+    run ./sdbsc -p
+    [ "$output" = "$before" ]
+
+    #the db file was renamed, the index was not
+    mv student.db.idx .tmp_student.db.idx
+    run ./sdbsc -p
+    [ "$output" = "$before" ]
+    [ -e student.db.idx ]
+    [ ! -e .tmp_student.db.idx ]
+
+    ./sdbsc -z
+}
+
+@test "--crc checksums the records and -V finds a damaged one" {
+    run ./sdbsc -V
+    [ "$status" -eq 1 ]
+    [ "$output" = "Database has no record checksums, add them with --crc." ]
+
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 3 jane doe 390
+    ./sdbsc --crc -a 5 jim beam 210
+    [ -e student.db.crc ]
+    ./sdbsc -d 3
+
+    run ./sdbsc -V
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Verified 2 student record(s) in "*", 0 bad." ]]
+
+    #one byte of the last name of student 5
+    printf 'X' | dd of=student.db bs=1 seek=$((5 * 64 + 30)) conv=notrunc 2>/dev/null
+
+    run ./sdbsc -V
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 5 failed its checksum." ]
+    [[ "${lines[1]}" == *", 1 bad." ]]
+
+    run ./sdbsc -f 5
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 5 failed its checksum." ]
+
+    run ./sdbsc -f 1
+    [ "$status" -eq 0 ]
+
+    #emptied, the db keeps its checksums
+    ./sdbsc -z
+    [ -e student.db.crc ]
+    run ./sdbsc -V
+    [ "$status" -eq 0 ]
+    rm -f student.db.crc
+}
+
+@test "--migrate=packed keeps -p output and shrinks the db" {
+    for id in $(seq 1 40); do
+        ./sdbsc -a $id first$id last$id $((id * 7)) > /dev/null
+    done
+    ./sdbsc -d 7
+    before="$(./sdbsc -p)"
+    size_before=$(stat -c %s student.db)
+
+    run ./sdbsc --migrate=packed
+    [ "$status" -eq 0 ]
+    [[ "$output" == "Migrated 39 record(s) to the packed format"* ]]
+    [ -e student.db.off ]
+    [ "$(stat -c %s student.db)" -lt $((size_before / 2)) ]
+
+    run ./sdbsc -p
+    [ "$output" = "$before" ]
+
+    ./sdbsc -a 7 a-longer-first-name and-a-longer-last-name 400
+    ./sdbsc -d 8
+    run ./sdbsc -f 7 8
+    [ "${lines[1]}" = "7      a-longer-first-name      and-a-longer-last-name           4.00" ]
+    [ "${lines[2]}" = "Student 8 was not found in database." ]
+
+    ./sdbsc -x
+    run ./sdbsc -c
+    [ "$output" = "Database contains 39 student record(s)." ]
+    run ./sdbsc -f 9
+    [ "${lines[1]}" = "9      first9                   last9                            0.63" ]
+
+    #emptied, the db drops its directory
+    ./sdbsc -z
+    [ ! -e student.db.off ]
+}
+
+@test "--snapshot scans a copy of the db and leaves nothing behind" {
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 3 jane doe 390
+    ./sdbsc -a 70000 jim beam 210
+    before="$(./sdbsc -p)"
+
+    run ./sdbsc --snapshot -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "$before" ]
+
+    run ./sdbsc --snapshot -c
+    [ "$output" = "Database contains 3 student record(s)." ]
+
+    for layout in packed hash; do
+        ./sdbsc --migrate=$layout
+        run ./sdbsc --snapshot -j 2 -p
+        [ "$output" = "$before" ]
+    done
+    ./sdbsc --migrate
+
+    #operations that change the db ignore --snapshot
+    ./sdbsc --snapshot -a 5 ann lee 310
+    run ./sdbsc -f 5
+    [ "${lines[1]}" = "5      ann                      lee                              3.10" ]
+
+    [ -z "$(ls -a | grep '^\.snap_')" ]
+    ./sdbsc -z
+}
+
+@test "-q prints the students a query matches" {
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 3 jane doe 390
+    ./sdbsc -a 5 jim beam 210
+    ./sdbsc -a 60000 jo doe 355
+
+    run ./sdbsc -q "gpa>=350 && lname=doe && id<50000"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "ID     FIRST NAME               LAST_NAME                        GPA" ]
+    [ "${lines[1]}" = "3      jane                     doe                              3.90" ]
+    [ "${#lines[@]}" -eq 2 ]
+
+    run ./sdbsc --format=csv -q "lname != beam && gpa < 3.9"
+    [ "$output" = "$(printf '1,john,doe,345\n60000,jo,doe,355')" ]
+
+    #quoted CSV names load back with -b
+    ./sdbsc -a 7 "van, der" 'o"hara' 300
+    ./sdbsc --format=csv -q "id=7" > student.db.csv
+    [ "$(cat student.db.csv)" = '7,"van, der","o""hara",300' ]
+    ./sdbsc -d 7
+    ./sdbsc -b student.db.csv
+    rm student.db.csv
+    run ./sdbsc --format=tsv -q "id=7"
+    [ "$output" = "$(printf '7\tvan, der\to"hara\t300')" ]
+    ./sdbsc -d 7
+
+    run ./sdbsc --format=json -q "fname='jim'"
+    [ "$output" = "$(printf '[\n{"id":5,"fname":"jim","lname":"beam","gpa":2.10}\n]')" ]
+
+    run ./sdbsc -q "id>5 && id<60000"
+    [ "$status" -eq 1 ]
+    [ "$output" = "No student matched the query." ]
+
+    run ./sdbsc -q "gpa>=350 &&"
+    [ "$status" -eq 2 ]
+    [ "$output" = "Cant parse the query at: end of query" ]
+
+    ./sdbsc --migrate=split
+    run ./sdbsc --format=tsv -q "gpa>300"
+    [ "$output" = "$(printf '1\tjohn\tdoe\t345\n3\tjane\tdoe\t390\n60000\tjo\tdoe\t355')" ]
+
+    ./sdbsc -z
+    [ ! -e student.db.hot ]
+}
+
+@test "-r prints an id range and --after --limit pages through the db" {
+    for id in 1 2 3 5 8 13; do
+        ./sdbsc -a $id first$id last$id 300 > /dev/null
+    done
+
+    run ./sdbsc -r 2 5
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2      first2                   last2                            3.00" ]
+    [ "${lines[3]}" = "5      first5                   last5                            3.00" ]
+    [ "${#lines[@]}" -eq 4 ]
+
+    run ./sdbsc -r 6 7
+    [ "$status" -eq 1 ]
+    [ "$output" = "No student with an id between 6 and 7 was found in database." ]
+
+    run ./sdbsc -r --after 2 --limit 2
+    [ "${lines[1]}" = "3      first3                   last3                            3.00" ]
+    [ "${lines[2]}" = "5      first5                   last5                            3.00" ]
+    [ "${lines[3]}" = "More students follow, continue with --after 5." ]
+
+    run ./sdbsc --format=csv -r --after 5 --limit 2
+    [ "$output" = "$(printf '8,first8,last8,300\n13,first13,last13,300')" ]
+
+    run ./sdbsc -r --after 13 --limit 2
+    [ "$status" -eq 1 ]
+    [ "$output" = "No student with an id past 13 was found in database." ]
+
+    run ./sdbsc -r --after 2147483647
+    [ "$status" -eq 1 ]
+    [ "$output" = "No student with an id past 2147483647 was found in database." ]
+
+    run ./sdbsc -r --after 2147483648
+    [ "$status" -eq 2 ]
+    run ./sdbsc -r 2 5x
+    [ "$status" -eq 2 ]
+
+    ./sdbsc --migrate=packed
+    run ./sdbsc --format=tsv -r 4 20
+    [ "$output" = "$(printf '5\tfirst5\tlast5\t300\n8\tfirst8\tlast8\t300\n13\tfirst13\tlast13\t300')" ]
+
+    ./sdbsc -z
+}
+
+@test "--scan and --no-seek-data print a sparse db like the default scan" {
+    #live records at every offset of the 4 record avx2 step, then holes
+    for id in $(seq 1 40) 4097 70000 99999; do
+        echo "$id,first$id,last$id,$((id % 400))"
+    done | ./sdbsc -b -
+    ./sdbsc -d 2 3 7 12 13 14 15 33 > /dev/null
+    expected="$(./sdbsc -p)"
+    [ "$(echo "$expected" | wc -l)" -eq 36 ]
+
+    for opts in --scan=avx2 --scan=sse2 --scan=scalar \
+            "--no-seek-data --scan=scalar" "--no-seek-data --scan=sse2" \
+            "--no-seek-data -j 3"; do
+        run ./sdbsc $opts -p
+        [ "$output" = "$expected" ] || {
+            echo "Failed Output of $opts:  $output"
+            return 1
+        }
+        run ./sdbsc $opts -c
+        [ "$output" = "Database contains 35 student record(s)." ]
+    done
+
+    ./sdbsc -z
+}
+
+@test "sdbsc --serve survives another process emptying the db" {
+    ./sdbsc -a 150 bob smith 300
+    ./sdbsc --serve > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./student.db.sock ] && break
+        sleep 0.1
+    done
+
+    ./sdbsc -z
+    run ./sdbsc --client -f 150
+    [ "$status" -eq 1 ]
+    [ "$output" = "Student 150 was not found in database." ]
+
+    run ./sdbsc --client -a 150 bob smith 300
+    [ "$status" -eq 0 ]
+
+    kill $server
+    wait $server
+    ./sdbsc -z
+}
+
+@test "A process that has the db open follows -x to the compressed file" {
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 2 jane doe 390
+    ./sdbsc -d 2
+
+    mkfifo student.db.fifo
+    ./sdbsc -i < student.db.fifo > student.db.out &
+    session=$!
+    exec 3> student.db.fifo
+    echo "f 1" >&3
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        grep -q john student.db.out && break
+        sleep 0.1
+    done
+
+    ./sdbsc -x
+    echo "a 5 jim beam 210" >&3
+    exec 3>&-
+    wait $session
+    rm student.db.fifo student.db.out
+
+    run ./sdbsc -f 5
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "5      jim                      beam                             2.10" ]
+
+    ./sdbsc -z
+}
+
+@test "-d of ids next to the superblock keeps it locked for concurrent adds" {
+    #deleting id 3 scans every slot up to 99000 for the new lowest id while
+    #the adds below wait for the superblock, a delete that let go of it
+    #early loses their count
+    ./sdbsc -a 99000 far away 300
+    for round in $(seq 1 20); do
+        ./sdbsc -a 1 amy lee 300
+        ./sdbsc -a 2 bo lee 300
+        ./sdbsc -a 3 cy lee 300
+        for p in 1 2 3 4 5 6 7 8; do
+            ./sdbsc -a $((99000 + round * 10 + p)) add er 300 > /dev/null &
+        done
+        ./sdbsc --no-seek-data -d 1 2 3
+        wait
+    done
+
+    run ./sdbsc -c
+    [ "$output" = "Database contains 161 student record(s)." ]
+    [ "$(./sdbsc -p | grep -c ' add ')" -eq 160 ]
+
+    ./sdbsc -z
+}
+
+@test "Concurrent adds and deletes keep the superblock count" {
+    #the first adds race to a db file that does not exist yet
+    rm -f student.db
+    for w in 1 2 3 4 5 6 7 8; do
+        (
+            for i in $(seq $w 8 200); do ./sdbsc -a $i w$w lee 300; done
+            for i in $(seq $w 16 200); do ./sdbsc -d $i; done
+        ) > /dev/null &
+    done
+    wait
+
+    [ "$(./sdbsc -p | grep -c ' lee ')" -eq 96 ]
+    run ./sdbsc -c
+    [ "$output" = "Database contains 96 student record(s)." ]
+
+    ./sdbsc -z
+}
@@ -1,6 +1,11 @@
 #! /bin/bash
-./sdbsc -a 1      john doe 3.45
-./sdbsc -a 3      jane  doe  3.90
-./sdbsc -a 63     jim   doe  2.85
-./sdbsc -a 64     janet doe  3.10
-./sdbsc -a 99999  big   dude 2.05
\ No newline at end of file
+#loads the sample students with one sdbsc process, one row per line in
+#the id first last gpa columns that -p prints.  -b stores a gpa with a
+#decimal point times 100 (3.45 as 345, the 3 digit form -a takes)
+./sdbsc -b - <<ROWS
+1      john  doe  3.45
+3      jane  doe  3.90
+63     jim   doe  2.85
+64     janet doe  3.10
+99999  big   dude 2.05
+ROWS